@@ -0,0 +1,170 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/******************************************************************************
+ *  File:         trace.h
+ *  Description:  Binary trace of the TTI processing. Each event is a record of
+ *                fixed size written to a lock-free ring of the calling thread,
+ *                a background thread drains the rings to a file and the
+ *                formatting is left to sonica_trace_decoder. The level of each
+ *                layer can be changed at any time.
+ *****************************************************************************/
+
+#ifndef SONICA_TRACE_H
+#define SONICA_TRACE_H
+
+#include "sonica/common/trace_events.h"
+#include "sonica/config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SONICA_TRACE_MAGIC "SNTR"
+#define SONICA_TRACE_VERSION 1
+#define SONICA_TRACE_NOF_ARGS 5
+#define SONICA_TRACE_MAX_THREADS 64
+#define SONICA_TRACE_DEFAULT_RING_SIZE 4096
+
+// TTI of the events not bound to one
+#define SONICA_TRACE_NO_TTI 0xFFFFFFFF
+
+typedef enum SONICA_API {
+  SONICA_TRACE_LAYER_PHY = 0,
+  SONICA_TRACE_LAYER_NPRACH,
+  SONICA_TRACE_LAYER_MAC,
+  SONICA_TRACE_LAYER_SCHED,
+  SONICA_TRACE_NOF_LAYERS
+} sonica_trace_layer_t;
+
+// Same order as the srslte log levels
+typedef enum SONICA_API {
+  SONICA_TRACE_LEVEL_NONE = 0,
+  SONICA_TRACE_LEVEL_ERROR,
+  SONICA_TRACE_LEVEL_WARNING,
+  SONICA_TRACE_LEVEL_INFO,
+  SONICA_TRACE_LEVEL_DEBUG,
+  SONICA_TRACE_NOF_LEVELS
+} sonica_trace_level_t;
+
+#define SONICA_TRACE_EVENT_ID_(name, layer, level, fmt) SONICA_TRACE_##name,
+typedef enum SONICA_API { SONICA_TRACE_EVENTS(SONICA_TRACE_EVENT_ID_) SONICA_TRACE_NOF_EVENTS } sonica_trace_event_t;
+#undef SONICA_TRACE_EVENT_ID_
+
+#define SONICA_TRACE_EVENT_LAYER_(name, layer, level, fmt) SONICA_TRACE_LAYER_OF_##name = SONICA_TRACE_LAYER_##layer,
+#define SONICA_TRACE_EVENT_LEVEL_(name, layer, level, fmt) SONICA_TRACE_LEVEL_OF_##name = SONICA_TRACE_LEVEL_##level,
+enum { SONICA_TRACE_EVENTS(SONICA_TRACE_EVENT_LAYER_) SONICA_TRACE_EVENTS(SONICA_TRACE_EVENT_LEVEL_) };
+#undef SONICA_TRACE_EVENT_LAYER_
+#undef SONICA_TRACE_EVENT_LEVEL_
+
+// 40 bytes, written to the file as they are in memory
+typedef struct SONICA_API {
+  uint64_t time_ns;     // monotonic clock
+  uint32_t tti;
+  uint16_t event;
+  uint16_t rnti;        // 0 for none
+  uint16_t thread;      // ring of the writer
+  uint16_t nof_dropped; // records the ring could not take before this one
+  int32_t  args[SONICA_TRACE_NOF_ARGS];
+} sonica_trace_record_t;
+
+// Start of the file. The layer names follow, then the layer, the level, the name and the format of each event, each
+// name and format as its uint16_t length and its characters. The records take the rest of the file
+typedef struct SONICA_API {
+  char     magic[4];
+  uint16_t version;
+  uint16_t record_size;
+  uint64_t start_ns;      // monotonic clock at the start of the trace
+  uint64_t start_real_ns; // wall clock at the same time
+  uint32_t nof_layers;
+  uint32_t nof_events;
+} sonica_trace_file_header_t;
+
+SONICA_API extern uint8_t sonica_trace_levels[SONICA_TRACE_NOF_LAYERS];
+
+static inline bool sonica_trace_enabled(uint32_t layer, uint32_t level)
+{
+  return __atomic_load_n(&sonica_trace_levels[layer], __ATOMIC_RELAXED) >= level;
+}
+
+// Bytes 4*i to 4*i+3 of data as a big endian word, zero past len, to trace the start of a buffer
+static inline int32_t sonica_trace_pack(const uint8_t* data, uint32_t len, uint32_t i)
+{
+  uint32_t w = 0;
+  for (uint32_t j = 4 * i; j < 4 * i + 4; j++) {
+    w = (w << 8) | (j < len ? data[j] : 0);
+  }
+  return (int32_t)w;
+}
+
+// Traces an event with 1 to 5 int arguments, they are evaluated only if the level of its layer enables it
+#define SONICA_TRACE(name, tti, rnti, ...)                                                                             \
+  do {                                                                                                                 \
+    if (sonica_trace_enabled(SONICA_TRACE_LAYER_OF_##name, SONICA_TRACE_LEVEL_OF_##name)) {                            \
+      SONICA_TRACE_WRITE_(SONICA_TRACE_##name, tti, rnti, __VA_ARGS__, 0, 0, 0, 0, 0);                                 \
+    }                                                                                                                  \
+  } while (0)
+
+#define SONICA_TRACE_WRITE_(...) SONICA_TRACE_WRITE5_(__VA_ARGS__)
+#define SONICA_TRACE_WRITE5_(ev, tti, rnti, a0, a1, a2, a3, a4, ...)                                                   \
+  sonica_trace_write(ev,                                                                                               \
+                     (uint32_t)(tti),                                                                                  \
+                     (uint16_t)(rnti),                                                                                 \
+                     (int32_t)(a0),                                                                                    \
+                     (int32_t)(a1),                                                                                    \
+                     (int32_t)(a2),                                                                                    \
+                     (int32_t)(a3),                                                                                    \
+                     (int32_t)(a4))
+
+/**
+ * Opens the file and starts the drain thread. Each thread writing events gets a ring of ring_size records, rounded up
+ * to a power of 2, the first time it does. The levels are left as they are
+ */
+SONICA_API int sonica_trace_init(const char* filename, uint32_t ring_size);
+
+// Writes what the rings hold and closes the file. The rings stay allocated for a later sonica_trace_init
+SONICA_API void sonica_trace_stop(void);
+
+SONICA_API void                 sonica_trace_set_level(sonica_trace_layer_t layer, sonica_trace_level_t level);
+SONICA_API sonica_trace_level_t sonica_trace_get_level(sonica_trace_layer_t layer);
+
+SONICA_API const char* sonica_trace_layer_name(sonica_trace_layer_t layer);
+SONICA_API const char* sonica_trace_level_name(sonica_trace_level_t level);
+
+// Records lost to full rings, or to threads beyond SONICA_TRACE_MAX_THREADS
+SONICA_API uint64_t sonica_trace_nof_dropped(void);
+
+SONICA_API void sonica_trace_write(uint32_t event,
+                                   uint32_t tti,
+                                   uint16_t rnti,
+                                   int32_t  a0,
+                                   int32_t  a1,
+                                   int32_t  a2,
+                                   int32_t  a3,
+                                   int32_t  a4);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SONICA_TRACE_H
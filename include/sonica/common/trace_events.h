@@ -0,0 +1,75 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/******************************************************************************
+ *  File:         trace_events.h
+ *  Description:  Events of the binary trace, as X(name, layer, level, format).
+ *                The format takes up to 5 int arguments through the conversions
+ *                d, i, u, x, X and c only, it is applied by the decoder. Events
+ *                are only appended and an unused one keeps its place, so the
+ *                ids stay stable. The file carries the table of its writer.
+ *****************************************************************************/
+
+#ifndef SONICA_TRACE_EVENTS_H
+#define SONICA_TRACE_EVENTS_H
+
+#define SONICA_TRACE_EVENTS(X)                                                                                         \
+  /* PHY */                                                                                                            \
+  X(PHY_DL_GRANT, PHY, DEBUG, "DL grant %d of %d with NPDCCH, tti_rx=%d, tti_tx_ul=%d")                                \
+  X(PHY_DL_DATA, PHY, DEBUG, "DL data of %d bytes: %08x %08x %08x %08x")                                               \
+  X(PHY_UL_GRANTS, PHY, DEBUG, "%d UL grants to transmit, tti_tx_ul=%d")                                               \
+  X(PHY_UL_GRANT_RECORD, PHY, INFO, "Recording UL grant starting at tti=%d, tti_tx_ul=%d")                             \
+  X(PHY_UL_GRANTS_RX, PHY, DEBUG, "%d UL grants to receive")                                                           \
+  X(PHY_NPUSCH_START, PHY, INFO, "Activating NPUSCH of %d bits")                                                       \
+  X(PHY_NPUSCH_RX_ERROR, PHY, WARNING, "Receiving NPUSCH failed with %d")                                              \
+  X(PHY_NPUSCH_DECODED, PHY, INFO, "NPUSCH decoding result %d, %d bytes")                                              \
+  X(PHY_UL_DATA, PHY, DEBUG, "UL data of %d bytes: %08x %08x %08x %08x")                                               \
+  X(PHY_UL_UNHANDLED, PHY, WARNING, "Unhandled UL grant of %d bytes") /* unused */                                     \
+  X(PHY_UL_DCI, PHY, INFO, "Sending DCI N0, NPDCCH ends at tti=%d")                                                    \
+  X(PHY_NPDSCH_TX, PHY, INFO, "Transmitting NPDSCH subframe %d of %d")                                                 \
+  /* NPRACH */                                                                                                         \
+  X(NPRACH_SKIP, NPRACH, WARNING, "Skipping the occasion of CE level %d, no free RX buffers")                          \
+  X(NPRACH_DETECT, NPRACH, DEBUG, "Detecting %d samples of CE level %d")                                               \
+  X(NPRACH_INCOMPLETE, NPRACH, WARNING, "Occasion of CE level %d is incomplete")                                       \
+  X(NPRACH_PREAMBLE, NPRACH, INFO, "CE level %d, preamble=%d, offset=%d ns, p2avg_x10=%d, ta=%d")                      \
+  X(NPRACH_SUBCARRIER, NPRACH, DEBUG, "Detected subcarrier %d, p2avg_x10=%d, toa=%d ns")                               \
+  /* MAC */                                                                                                            \
+  X(MAC_UL_PDU, MAC, DEBUG, "UL PDU of %d bytes: %08x")                                                                \
+  X(MAC_UL_SDU, MAC, INFO, "UL SDU of lcid=%d, %d bytes")                                                              \
+  X(MAC_UL_NO_RLC, MAC, WARNING, "UL SDU of lcid=%d dropped, no RLC")                                                  \
+  X(MAC_DPR, MAC, INFO, "DPR=0x%02x, lcid with most data=%d")                                                          \
+  X(MAC_DL_SDU, MAC, DEBUG, "DL SDU of lcid=%d, %d bytes in %d bytes of space")                                        \
+  /* SCHED */                                                                                                          \
+  X(SCHED_RAR_PARTIAL, SCHED, WARNING, "%d of %d RAR grants allocated, the rest waits for the next TTI")               \
+  X(SCHED_MSG3, SCHED, DEBUG, "Queueing Msg3 at tti=%d")                                                               \
+  X(SCHED_MSG3_UL, SCHED, DEBUG, "UL TTIs %d-%d reserved for Msg3")                                                    \
+  X(SCHED_UL_EXPECTED, SCHED, DEBUG, "DL newtx, %d UL bytes expected on lcid=%d after %d TTIs")                        \
+  X(SCHED_UL_WAIT, SCHED, DEBUG, "UL wait timer not expired, %d TTIs left")                                            \
+  X(SCHED_UL_NEWTX, SCHED, DEBUG, "UL TTIs %d-%d reserved for a newtx, mcs=%d, i_ru=%d, i_rep=%d")                     \
+  X(SCHED_DL_REQ, SCHED, DEBUG, "Requested DL bytes min=%d, max=%d")                                                   \
+  X(SCHED_DL_BUFFER, SCHED, DEBUG, "DL buffer state of lcid=%d, tx=%d, retx=%d")                                       \
+  X(SCHED_DL_PENDING, SCHED, DEBUG, "DL bytes pending on lcid=%d, tx=%d, retx=%d")                                     \
+  X(SCHED_UL_BSR, SCHED, DEBUG, "BSR of lcid=%d, bsr={%d,%d,%d,%d}")                                                   \
+  X(SCHED_UL_WAIT_TIMER, SCHED, DEBUG, "UL wait timer set to %d")                                                      \
+  X(SCHED_DL_NO_MCS, SCHED, WARNING, "No MCS fits %d bytes with i_sf=%d, MCS 12 is taken")                             \
+  X(SCHED_DL_NEWTX, SCHED, DEBUG, "DL newtx mcs=%d, i_sf=%d, tbs=%d bytes")
+
+#endif // SONICA_TRACE_EVENTS_H
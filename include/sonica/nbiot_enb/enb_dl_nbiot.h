@@ -27,7 +27,7 @@
 
 #include "srslte/phy/ch_estimation/chest_dl_nbiot.h"
 #include "srslte/phy/common/phy_common.h"
-#include "srslte/phy/dft/ofdm.h"
+#include "sonica/nbiot_enb/ofdm_nbiot.h"
 #include "srslte/phy/phch/npbch.h"
 #include "srslte/phy/phch/npdcch.h"
 #include "srslte/phy/phch/npdsch.h"
@@ -36,12 +36,27 @@
 
 #include "srslte/phy/utils/vector.h"
 
+/* One template per subframe index (NRS, NPSS in subframe 5) and one per NSSS sequence */
+#define SONICA_ENB_DL_NBIOT_NOF_TMPL (SRSLTE_NOF_SF_X_FRAME + SRSLTE_NSSS_NUM_SEQ)
+
+/*
+ * Base subframe with the signals known in advance. The time domain signal is kept once a subframe
+ * without NPDCCH/NPDSCH has been modulated from it, so the following ones are copied instead.
+ */
+typedef struct SONICA_API {
+  cf_t* grid[SRSLTE_MAX_PORTS];
+  cf_t* signal[SRSLTE_MAX_PORTS];
+  bool  has_signal;
+} sonica_enb_dl_nbiot_tmpl_t;
+
 typedef struct SONICA_API {
   srslte_nbiot_cell_t cell;
 
   cf_t* sf_symbols[SRSLTE_MAX_PORTS];
+  cf_t* out_buffer[SRSLTE_MAX_PORTS];
+  uint32_t sf_len; // samples per subframe at the configured rate
 
-  srslte_ofdm_t ifft[SRSLTE_MAX_PORTS];
+  sonica_ofdm_nbiot_t ifft[SRSLTE_MAX_PORTS];
 
   srslte_npbch_t           npbch;
   srslte_npdcch_t          npdcch;
@@ -55,10 +70,19 @@ typedef struct SONICA_API {
 
   uint8_t bch_payload[SRSLTE_MIB_NB_LEN];
   srslte_mib_nb_t          mib_nb;
+
+  sonica_enb_dl_nbiot_tmpl_t  tmpl[SONICA_ENB_DL_NBIOT_NOF_TMPL];
+  sonica_enb_dl_nbiot_tmpl_t* cur_tmpl; ///< template of the current subframe, NULL once other channels are mapped
+
+  // NPBCH subframes of a whole MIB-NB period, built when the period changes
+  cf_t*    npbch_grid[SRSLTE_NPBCH_NUM_FRAMES][SRSLTE_MAX_PORTS];
+  uint32_t npbch_period;
+  bool     npbch_valid;
 } sonica_enb_dl_nbiot_t;
 
 /* This function shall be called just after the initial synchronization */
-SONICA_API int sonica_enb_dl_nbiot_init(sonica_enb_dl_nbiot_t* q, cf_t* out_buffer[SRSLTE_MAX_PORTS]);
+SONICA_API int
+sonica_enb_dl_nbiot_init(sonica_enb_dl_nbiot_t* q, cf_t* out_buffer[SRSLTE_MAX_PORTS], uint32_t symbol_sz);
 
 SONICA_API void sonica_enb_dl_nbiot_free(sonica_enb_dl_nbiot_t* q);
 
@@ -68,10 +92,12 @@ SONICA_API void sonica_enb_dl_nbiot_put_base(sonica_enb_dl_nbiot_t* q, uint32_t
 
 SONICA_API int sonica_enb_dl_nbiot_put_npdcch_dl(sonica_enb_dl_nbiot_t*    q,
                                                  srslte_ra_nbiot_dl_dci_t* dci_dl,
+                                                 srslte_dci_location_t     location,
                                                  uint32_t                  sf_idx);
 SONICA_API int sonica_enb_dl_nbiot_put_npdcch_ul(sonica_enb_dl_nbiot_t*    q,
                                                  srslte_ra_nbiot_ul_dci_t* dci_ul,
                                                  uint16_t                  rnti,
+                                                 srslte_dci_location_t     location,
                                                  uint32_t                  sf_idx);
 
 SONICA_API int sonica_enb_dl_nbiot_put_npdsch(sonica_enb_dl_nbiot_t* q,
@@ -30,54 +30,155 @@
 
 #include "srslte/phy/common/phy_common.h"
 #include "srslte/phy/common/sequence.h"
-#include "srslte/phy/dft/ofdm.h"
+#include "sonica/nbiot_enb/ofdm_nbiot.h"
 
 #include "srslte/phy/phch/ra_nbiot.h"
+#include "srslte/phy/ue/ue_dl_nbiot.h"
 
 #include "srslte/phy/utils/debug.h"
 #include "srslte/phy/utils/vector.h"
 
+// Maximum number of concurrent NPUSCH grants, i.e. 12 single-tone allocations
+#define SONICA_ENB_UL_NBIOT_MAX_GRANTS 12
+
+// 3.75 kHz numerology, TS 36.211 Sec. 10.1.5. At 1.92 MHz a 2 ms slot holds 7 symbols of 512 + 16 samples
+// followed by a guard period of 144 samples. All of them scale with the 15 kHz symbol size.
+#define SONICA_ENB_UL_NBIOT_3K75_NOF_SC 48
+#define SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(symbol_sz) (4 * (symbol_sz))
+#define SONICA_ENB_UL_NBIOT_3K75_CP_LEN(symbol_sz) ((symbol_sz) / 8)
+#define SONICA_ENB_UL_NBIOT_3K75_SLOT_LEN(symbol_sz) (2 * SRSLTE_SF_LEN(symbol_sz))
+
+/*
+ * @brief Receive context of a single NPUSCH grant.
+ *
+ * Every subframe is demodulated on reception, the context accumulates the soft bits of all subframes and
+ * repetitions of the grant until it can be decoded.
+ */
+typedef struct SONICA_API {
+  bool                     active;
+  bool                     complete; // all subframes and repetitions have been received
+  sonica_npusch_cfg_t      npusch_cfg;
+  sonica_npusch_softbits_t softbits;
+  float                    noise_estimate; // average over the received subframes
+  float                    signal_power;   // average per RE over the received subframes, without the noise
+  uint32_t                 nof_meas;       // subframes, or 3.75 kHz slots, in the averages
+} sonica_enb_ul_nbiot_grant_t;
+
 /*
  * @brief Narrowband ENB uplink object.
  *
  * This module is a frontend to all the uplink data and control
- * channel processing modules.
+ * channel processing modules. The FFT runs once per subframe, then
+ * every active grant context is estimated on the DMRS of its own
+ * subcarriers, so grants on disjoint subcarriers are received side by
+ * side. Only the 15 kHz subcarrier spacing is received.
  */
 typedef struct SONICA_API {
   sonica_npusch_t         npusch;
-  srslte_ofdm_t           fft;
+  sonica_ofdm_nbiot_t     fft;
   // srslte_chest_ul_nbiot_t chest;
 
   srslte_softbuffer_rx_t softbuffer;
   srslte_nbiot_cell_t    cell;
 
+  uint32_t symbol_sz; // 15 kHz symbol size, sets the sample rate
+  uint32_t sf_len;
+
   int    nof_re;     // Number of RE per subframe
   cf_t*  sf_symbols; // this buffer holds the symbols of the current subframe
-  cf_t*  sf_buffer;  // this buffer holds multiple subframes
-  cf_t*  ce;
-  cf_t*  ce_buffer;
+  cf_t*  ce;         // each grant fills in the estimate of its own subcarriers
 
-  float noise_estimate;
+  float noise_estimate; // noise estimate of the current subframe on the free subcarriers
 
-  srslte_sequence_t ref12_seq;
+  // 3.75 kHz front end, the slot is demodulated once both of its subframes have been received
+  srslte_dft_plan_t fft_3k75;
+  cf_t*             slot_buffer_3k75;  // time domain samples of the current slot
+  cf_t*             slot_symbols_3k75; // 7 symbols of 48 subcarriers
+  cf_t*             shift_3k75;        // half subcarrier shift of a symbol
+  float             noise_estimate_3k75;
 
-  // UL configuration for "normal" transmissions
-  bool                has_ul_grant;
-  sonica_npusch_cfg_t npusch_cfg;
+  // UL grants for "normal" transmissions
+  uint32_t                    nof_grants;
+  sonica_enb_ul_nbiot_grant_t grants[SONICA_ENB_UL_NBIOT_MAX_GRANTS];
 } sonica_enb_ul_nbiot_t;
 
+/*
+ * in_buffer is only the FFT input of sonica_ofdm_nbiot_rx_sf(), the receive functions take the subframe to
+ * demodulate on every call.
+ */
 SONICA_API int sonica_enb_ul_nbiot_init(sonica_enb_ul_nbiot_t* q,
-                                        cf_t*                  in_buffer);
+                                        cf_t*                  in_buffer,
+                                        uint32_t               symbol_sz);
 
 SONICA_API void sonica_enb_ul_nbiot_free(sonica_enb_ul_nbiot_t* q);
 
 SONICA_API int sonica_enb_ul_nbiot_set_cell(sonica_enb_ul_nbiot_t* q, srslte_nbiot_cell_t cell);
 
+/*
+ * Sets the group hopping and the base sequences of the NPUSCH DMRS broadcast in SIB2-NB
+ */
+SONICA_API int sonica_enb_ul_nbiot_set_dmrs_cfg(sonica_enb_ul_nbiot_t* q, const sonica_npusch_dmrs_cfg_t* cfg);
+
+/*
+ * Assigns a receive context to the grant. Returns the index of the context, or SRSLTE_ERROR if no context is
+ * available or the subcarriers collide with an active grant. 3.75 kHz grants must start in an even subframe, i.e. at a
+ * slot boundary.
+ */
 SONICA_API int
 sonica_enb_ul_nbiot_cfg_grant(sonica_enb_ul_nbiot_t* q, srslte_ra_nbiot_ul_grant_t* grant, uint16_t rnti);
 
+SONICA_API void sonica_enb_ul_nbiot_release_grant(sonica_enb_ul_nbiot_t* q, uint32_t idx);
+
+/*
+ * Demodulates the subframe held by input and accumulates the soft bits of every active grant. Returns
+ * the number of grants whose last subframe was received, these are flagged as complete and remain allocated
+ * until decoded or released.
+ */
+SONICA_API int sonica_enb_ul_nbiot_receive_npusch(sonica_enb_ul_nbiot_t* q,
+                                                  const cf_t*            input,
+                                                  uint32_t               sf_idx);
+
+/*
+ * Receive context idx of src becomes the same context of q, positioned at subframe num_sf of the grant and without
+ * soft bits, so q demodulates that subframe alone. The context of src is flagged as complete if num_sf is its last
+ * subframe. The soft bits are added back with sonica_enb_ul_nbiot_merge_grant().
+ */
+SONICA_API int
+sonica_enb_ul_nbiot_copy_grant(sonica_enb_ul_nbiot_t* q, sonica_enb_ul_nbiot_t* src, uint32_t idx, uint32_t num_sf);
+
+/*
+ * Adds the soft bits and measurements of context idx of src, copied from q by sonica_enb_ul_nbiot_copy_grant(), to
+ * the context of q. Returns 1 if src received the last subframe of the grant and 0 if not, SRSLTE_ERROR if src failed
+ * to demodulate it or SRSLTE_ERROR_INVALID_INPUTS if q no longer holds the grant.
+ */
+SONICA_API int sonica_enb_ul_nbiot_merge_grant(sonica_enb_ul_nbiot_t* q, const sonica_enb_ul_nbiot_t* src, uint32_t idx);
+
+/*
+ * Takes the first subframe of the current 3.75 kHz slot, when it was received by another object
+ */
+SONICA_API int sonica_enb_ul_nbiot_set_slot_start(sonica_enb_ul_nbiot_t* q, const cf_t* input);
+
+/*
+ * SNR per RE in dB of a complete grant, averaged over its subframes. Only meaningful for NPUSCH Format 1, the
+ * channel estimate of multi-tone grants follows its DMRS.
+ */
+SONICA_API float sonica_enb_ul_nbiot_grant_snr(sonica_enb_ul_nbiot_t* q, uint32_t idx);
+
+/*
+ * Decodes a complete grant and releases its context
+ */
+SONICA_API int sonica_enb_ul_nbiot_decode_grant(sonica_enb_ul_nbiot_t* q, uint32_t idx, uint8_t* data);
+
+/*
+ * Detects the HARQ-ACK of a complete NPUSCH Format 2 grant and releases its context. Returns SRSLTE_ERROR on DTX.
+ */
+SONICA_API int sonica_enb_ul_nbiot_decode_ack(sonica_enb_ul_nbiot_t* q, uint32_t idx, bool* ack);
+
+/*
+ * Receives one subframe and decodes the first grant completed by it. Meant for a single grant at a time.
+ */
 SONICA_API int sonica_enb_ul_nbiot_decode_npusch(sonica_enb_ul_nbiot_t* q,
-                                                 cf_t*                  input,
+                                                 const cf_t*            input,
                                                  uint32_t               sf_idx,
                                                  uint8_t*               data);
 
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SONICA_OFDM_NBIOT_H
+#define SONICA_OFDM_NBIOT_H
+
+#include "sonica/config.h"
+
+#include "srslte/phy/common/phy_common.h"
+#include "srslte/phy/dft/dft.h"
+#include "srslte/phy/dft/ofdm.h"
+
+/* Size of the short transforms, the 12 subcarriers of the carrier fit in it without aliasing */
+#define SONICA_OFDM_NBIOT_DFT_SZ 16
+
+/* Range of 15 kHz symbol sizes: the 6 PRB LTE base (1.92 MHz) down to 240 kHz for a standalone carrier */
+#define SONICA_NBIOT_MAX_SYMBOL_SZ 128
+#define SONICA_NBIOT_MIN_SYMBOL_SZ SONICA_OFDM_NBIOT_DFT_SZ
+
+/*
+ * @brief Narrowband OFDM modulator/demodulator.
+ *
+ * Drop-in replacement of srslte_ofdm_t for a single PRB carrier. Only the 12 subcarriers of the
+ * PRB are non-zero, so the symbol_sz-point transform is pruned: the symbol is split in
+ * symbol_sz/16 interleaved phases, each one computed with a 16-point DFT, and the twiddles of the
+ * decimation carry the frequency shift. The shift is therefore not applied as a separate pass and
+ * the input buffer is left untouched when receiving.
+ *
+ * The configuration is the srslte_ofdm_cfg_t one (in/out buffers, CP, normalize, freq_shift_f and
+ * rx_window_offset keep their meaning), nof_prb must be 1. symbol_sz may be set below the LTE size
+ * down to 16 samples (240 kHz) for a standalone carrier. The CP lengths are then fractional: each
+ * symbol starts at the nearest sample and the remaining delay is applied as a phase per subcarrier.
+ * Normalization uses the LTE symbol size, so every rate produces the same waveform level.
+ */
+typedef struct SONICA_API {
+  srslte_ofdm_cfg_t cfg;
+  srslte_dft_plan_t plan;
+  uint32_t          nof_symbols; // per slot
+  uint32_t          nof_phases;  // symbol_sz / SONICA_OFDM_NBIOT_DFT_SZ
+  uint32_t          slot_sz;
+  uint32_t          window_offset_n;
+  uint32_t          cp_len[SRSLTE_CP_NORM_NSYMB];
+  bool              fractional_cp;
+  cf_t*             symbol_phase;    // nof_symbols x SRSLTE_NRE, timing error of each symbol start
+  uint32_t          bin[SRSLTE_NRE]; // bin of the short DFT holding each subcarrier
+  cf_t*             twiddle;         // nof_phases x SRSLTE_NRE
+  cf_t*             phase;           // per sample of the symbol, shift left after the decimation
+  cf_t              cp_phase;        // the CP is not a plain copy of the symbol tail when shifted
+  cf_t*             tmp_in;
+  cf_t*             tmp_out;
+} sonica_ofdm_nbiot_t;
+
+SONICA_API int sonica_ofdm_nbiot_tx_init(sonica_ofdm_nbiot_t* q, srslte_ofdm_cfg_t* cfg);
+
+SONICA_API int sonica_ofdm_nbiot_rx_init(sonica_ofdm_nbiot_t* q, srslte_ofdm_cfg_t* cfg);
+
+SONICA_API void sonica_ofdm_nbiot_free(sonica_ofdm_nbiot_t* q);
+
+SONICA_API void sonica_ofdm_nbiot_tx_sf(sonica_ofdm_nbiot_t* q);
+
+SONICA_API void sonica_ofdm_nbiot_rx_sf(sonica_ofdm_nbiot_t* q);
+
+/* Same as sonica_ofdm_nbiot_rx_sf() on the given buffers instead of the configured ones */
+SONICA_API void sonica_ofdm_nbiot_rx_sf_ng(sonica_ofdm_nbiot_t* q, const cf_t* input, cf_t* output);
+
+#endif // SONICA_OFDM_NBIOT_H
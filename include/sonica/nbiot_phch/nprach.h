@@ -32,40 +32,128 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+// NPRACH symbol size in samples at 1.92 MHz, it is 4 times the 15 kHz symbol size at any rate
 #define SONICA_NPRACH_SAMP_SIZE 512
+#define SONICA_NPRACH_SYMBOL_SZ(symbol_sz) (4 * (symbol_sz))
 #define SONICA_NPRACH_SYM_GROUP_SIZE 5
-#define SONICA_NPRACH_SUBCARRIERS 12
+#define SONICA_NPRACH_SYM_GROUPS 4 // per repetition
+#define SONICA_NPRACH_SUBCARRIERS 12 // hopping set of a preamble
 #define SONICA_NPRACH_SUBC_HALF (SONICA_NPRACH_SUBCARRIERS / 2)
+#define SONICA_NPRACH_MAX_SUBCARRIERS 48
+#define SONICA_NPRACH_MAX_REPS 128
+#define SONICA_NPRACH_SCS_HZ 3750.0f
 
+// The channelizer brings the band to 240 kHz, where the NPRACH symbol is 64 samples. Its FIR spans
+// 2*SONICA_NPRACH_CH_HALF_TAPS output samples and filters the input in blocks of SONICA_NPRACH_CH_BLOCK.
+#define SONICA_NPRACH_CH_SYMBOL_SZ 64
+#define SONICA_NPRACH_CH_HALF_TAPS 7
+#define SONICA_NPRACH_CH_BLOCK 1920
+
+// Every 64 repetitions a 40 ms gap is inserted, 36.211 10.1.6.1
+#define SONICA_NPRACH_GAP_REPS 64
+#define SONICA_NPRACH_GAP_MS 40
+
+// Detection threshold on the preamble power normalized to the noise (1 without preamble), in standard deviations
+// of the noise only power, which shrink with the number of symbol groups combined
+#define SONICA_NPRACH_DET_THRESHOLD 6.0f
+
+typedef enum SONICA_API { SONICA_NPRACH_FORMAT_0 = 0, SONICA_NPRACH_FORMAT_1 } sonica_nprach_format_t;
+
+// NPRACH resource of a CE level, from the SIB2 NPRACH-ConfigSIB-NB
+typedef struct SONICA_API {
+  sonica_nprach_format_t format;    // 0: 66.7 us CP, 1: 266.7 us CP
+  uint32_t               sc_offset; // nprach-SubcarrierOffset
+  uint32_t               nof_sc;    // nprach-NumSubcarriers
+  uint32_t               nof_reps;  // numRepetitionsPerPreambleAttempt
+} sonica_nprach_cfg_t;
+
+/*
+ * @brief NPRACH receiver.
+ *
+ * Samples of an occasion are pushed as they arrive. Every symbol group is reduced to its 48
+ * subcarriers, summing the 5 symbols coherently, and all the start subcarriers are tracked along
+ * their hopping pattern, so every preamble of the occasion is reported. The noise is measured from
+ * the spread of the symbols of a group around their mean, which holds with preambles on every
+ * subcarrier. The time of arrival is estimated from the phase rotation between symbol groups: the
+ * 1 subcarrier hops resolve up to 266.7 us and the 6 subcarrier hops refine the estimate.
+ *
+ * Above 240 kHz, a decimating FIR channelizer first brings the 180 kHz NPRACH band down to 240 kHz. Only
+ * the outputs kept by the decimation are computed, so each symbol is a 64 point DFT whatever the input rate.
+ * The filter is centered on the output sample, its delay is absorbed by looking ahead of the occasion.
+ */
 typedef struct SONICA_API {
   srslte_dft_plan_t fft;
-  srslte_dft_plan_t ifft;
 
   cf_t* fft_in;
   cf_t* fft_out;
   cf_t* freq_shift;
 
-  uint32_t cp_len;     // two formats
-  uint32_t base_subc;  // base subcarrier
+  uint32_t in_samp_size; // symbol size at the input rate
+  float    in_srate_hz;
+  bool     use_channelizer;
+  uint32_t decim;        // input samples per detector sample, 1 without channelizer
+  uint32_t samp_size;    // symbol size at the detector rate
+  float    srate_hz;
+
+  float*   ch_coeff;
+  uint32_t ch_len;       // taps, 0 without channelizer
+  cf_t*    ch_buf;       // input history and current block
+  uint32_t ch_buf_len;
+  uint32_t ch_pos;       // first input sample of the next output
+  cf_t*    dec_buf;
+
+  sonica_nprach_format_t format;
+  uint32_t cp_len;     // format 0 or 1
+  uint32_t nof_sc;     // subcarriers searched
+  uint32_t sc_offset;  // first subcarrier searched
+  uint32_t nof_reps;   // repetitions of the 4 symbol groups
+  float    det_threshold;
+
+  uint8_t hop[SONICA_NPRACH_MAX_REPS]; // f(t) of the cell, hop between repetitions
 
   uint32_t buf_samp;   // Buffered sample from previous sf
   uint32_t cur_symg;   // Current symbol group ID
   uint32_t nxt_sym;    // Next expected symbol in symbol group (0 means reading CP)
-  uint32_t total_samp; // Total number of sample read
+  uint32_t gap_samp;   // Samples left in the current NPRACH gap
+  uint32_t consumed;   // Input samples of the occasion read so far
+
+  // Current and previous symbol group, per subcarrier
+  cf_t  grp[SONICA_NPRACH_MAX_SUBCARRIERS];
+  float grp_energy[SONICA_NPRACH_MAX_SUBCARRIERS];
+  cf_t  prev_grp[SONICA_NPRACH_MAX_SUBCARRIERS];
 
-  cf_t det_buf[20][12];
+  // Per start subcarrier
+  uint32_t cur_sc[SONICA_NPRACH_MAX_SUBCARRIERS];
+  uint32_t prev_sc[SONICA_NPRACH_MAX_SUBCARRIERS];
+  float    power[SONICA_NPRACH_MAX_SUBCARRIERS];
+  cf_t     corr_1sc[SONICA_NPRACH_MAX_SUBCARRIERS];
+  cf_t     corr_6sc[SONICA_NPRACH_MAX_SUBCARRIERS];
+  float    noise;
 } sonica_nprach_t;
 
-SONICA_API int sonica_nprach_init(sonica_nprach_t *q);
-SONICA_API int sonica_nprach_set_cell(sonica_nprach_t *q);
+SONICA_API int sonica_nprach_init(sonica_nprach_t *q, uint32_t symbol_sz);
+SONICA_API int sonica_nprach_set_cell(sonica_nprach_t* q, srslte_nbiot_cell_t cell);
+SONICA_API int sonica_nprach_set_cfg(sonica_nprach_t* q, const sonica_nprach_cfg_t* cfg);
+SONICA_API int sonica_nprach_set_channelizer(sonica_nprach_t* q, bool enable);
 SONICA_API int sonica_nprach_free(sonica_nprach_t *q);
 
+/* Input samples needed by an occasion, with the gaps between repetitions and the channelizer look-ahead */
+SONICA_API uint32_t sonica_nprach_occasion_len(const sonica_nprach_t* q);
+
 SONICA_API int sonica_nprach_detect_reset(sonica_nprach_t *q);
+
+/*
+ * Consumes the samples of an occasion. Returns 1 once the occasion is complete, the detected
+ * preambles are then in indices (start subcarrier), t_offsets (seconds) and peak_to_avg (normalized
+ * power). Returns 0 while more samples are needed, need_samples tells how many.
+ */
 SONICA_API int sonica_nprach_detect(sonica_nprach_t* q,
-                                    cf_t*            signal,
+                                    const cf_t*      signal,
                                     uint32_t         sig_len,
                                     uint32_t*        need_samples,
                                     uint32_t*        indices,
+                                    float*           t_offsets,
+                                    float*           peak_to_avg,
                                     uint32_t*        ind_len);
 
 #endif // SONICA_NPRACH_H
\ No newline at end of file
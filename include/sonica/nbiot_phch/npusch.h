@@ -37,6 +37,51 @@
 
 #define SONICA_NPUSCH_MAX_NOF_RU 10
 
+// Maximum number of data REs of a NPUSCH, a RU always carries 12 SC-FDMA data symbols on 12 subcarriers
+#define SONICA_NPUSCH_MAX_RE (12 * SRSLTE_NRE * SONICA_NPUSCH_MAX_NOF_RU)
+
+// Maximum number of coded bits of a NPUSCH, at most QPSK
+#define SONICA_NPUSCH_MAX_BITS (2 * SONICA_NPUSCH_MAX_RE)
+
+// Repetitions alternate between two redundancy versions, TS 36.212 Sec. 6.3.2
+#define SONICA_NPUSCH_NOF_RV 2
+
+// Maximum number of repetitions, TS 36.213 Table 16.5.1.1-3
+#define SONICA_NPUSCH_MAX_NOF_REP 128
+
+// Maximum number of slots of a single-tone NPUSCH, 16 slots per RU
+#define SONICA_NPUSCH_MAX_NOF_SLOTS_ST (16 * SONICA_NPUSCH_MAX_NOF_RU * SONICA_NPUSCH_MAX_NOF_REP)
+
+// Format 2 carries the HARQ-ACK bit repeated over the 16 data symbols of its RU, TS 36.212 Sec. 6.3.3
+#define SONICA_NPUSCH_F2_NOF_BITS 16
+
+
+/*
+ * @brief DMRS configuration of the cell, broadcast in SIB2-NB
+ *
+ * Reference: 3GPP TS 36.211 version 13.2.0 Release 13 Sec. 10.1.4.1
+ */
+typedef struct SONICA_API {
+  bool     group_hopping_en;
+  uint32_t group_assign; // Delta_ss of the sequence-shift pattern
+  int      three_tone_base_seq; // -1 if not configured, u is then N_cell mod 12
+  uint32_t three_tone_cyclic_shift;
+  int      six_tone_base_seq; // -1 if not configured, u is then N_cell mod 14
+  uint32_t six_tone_cyclic_shift;
+  int      twelve_tone_base_seq; // -1 if not configured, u is then N_cell mod 30
+} sonica_npusch_dmrs_cfg_t;
+
+/*
+ * @brief Accumulated soft bits of a NPUSCH with repetitions
+ *
+ * Each subframe is demodulated and descrambled as it is received and its LLRs are added to the codeword of its
+ * redundancy version, so only the soft bits are kept until the last repetition.
+ */
+typedef struct SONICA_API {
+  int16_t* llr[SONICA_NPUSCH_NOF_RV];
+  uint32_t nof_comb[SONICA_NPUSCH_NOF_RV]; // Number of codeword repetitions combined in each buffer
+  uint32_t max_bits;
+} sonica_npusch_softbits_t;
 
 /* @brief Narrowband Physical Uplink shared channel (NPUSCH)
  *
@@ -58,9 +103,18 @@ typedef struct SONICA_API {
   srslte_modem_table_t mod_qpsk;
   srslte_sch_t nul_sch;
   srslte_sequence_t tmp_seq;
+  srslte_sequence_t dmrs_seq_st; // c(n) of the single-tone DMRS, one element per slot
+  srslte_sequence_t dmrs_oc_seq; // c(i) selecting the orthogonal cover of the Format 2 DMRS, c_init = N_cell
+  sonica_npusch_dmrs_cfg_t dmrs_cfg;
+  srslte_sequence_t        dmrs_gh_seq[4]; // group hopping of the 1-, 3-, 6- and 12-tone DMRS, c_init = N_cell / N_seq
   srslte_dft_precoding_t dft_precoding;
+  srslte_dft_plan_t      dft_plan_3; // transform precoding of 3-tone allocations
+  srslte_dft_plan_t      dft_plan_6; // transform precoding of 6-tone allocations
 
   sonica_nulsch_t nulsch;
+
+  // used by sonica_npusch_decode()
+  sonica_npusch_softbits_t softbits;
 } sonica_npusch_t;
 
 /*
@@ -73,9 +127,10 @@ typedef struct SONICA_API {
   srslte_ra_nbits_t          nbits;
 
   bool                       is_encoded;
-  uint32_t                   sf_idx;   // The current idx within the entire NPUSCH
+  uint32_t                   sf_idx;   // The current subframe within the codeword
   uint32_t                   rep_idx;  // The current repetion within this NPUSCH
   uint32_t                   num_sf;   // Total number of subframes tx'ed in this NPUSCH
+  uint32_t                   num_slots; // Total number of slots rx'ed in this NPUSCH, single-tone only
   uint16_t                   rnti;
 } sonica_npusch_cfg_t;
 
@@ -87,6 +142,8 @@ SONICA_API void sonica_npusch_free(sonica_npusch_t* q);
 
 SONICA_API int sonica_npusch_set_cell(sonica_npusch_t* q, srslte_nbiot_cell_t cell);
 
+SONICA_API int sonica_npusch_set_dmrs_cfg(sonica_npusch_t* q, const sonica_npusch_dmrs_cfg_t* cfg);
+
 SONICA_API int sonica_npusch_set_rnti(sonica_npusch_t* q, uint16_t rnti);
 
 SONICA_API int sonica_npusch_encode(sonica_npusch_t*        q,
@@ -103,6 +160,84 @@ SONICA_API int sonica_npusch_decode(sonica_npusch_t*        q,
                                     float                   noise_estimate,
                                     uint8_t*                data);
 
+SONICA_API int sonica_npusch_softbits_init(sonica_npusch_softbits_t* sb, uint32_t max_bits);
+
+SONICA_API void sonica_npusch_softbits_free(sonica_npusch_softbits_t* sb);
+
+SONICA_API void sonica_npusch_softbits_reset(sonica_npusch_softbits_t* sb);
+
+SONICA_API int
+sonica_npusch_softbits_copy(sonica_npusch_softbits_t* dst, const sonica_npusch_softbits_t* src, uint32_t nof_bits);
+
+/*
+ * Adds the soft bits of src to dst, e.g. the subframes of the same NPUSCH demodulated apart
+ */
+SONICA_API int
+sonica_npusch_softbits_add(sonica_npusch_softbits_t* dst, const sonica_npusch_softbits_t* src, uint32_t nof_bits);
+
+/*
+ * Equalizes, demodulates and descrambles the allocated REs of one received subframe, then adds the LLRs to the
+ * soft bits of the grant. Advances cfg to the next subframe, the NPUSCH is complete once
+ * sonica_npusch_nof_sf() subframes have been received.
+ */
+SONICA_API int sonica_npusch_demod_sf(sonica_npusch_t*          q,
+                                      sonica_npusch_cfg_t*      cfg,
+                                      cf_t*                     sf_symbols,
+                                      cf_t*                     ce,
+                                      float                     noise_estimate,
+                                      sonica_npusch_softbits_t* softbits);
+
+/*
+ * Single-tone receive path, used by sonica_npusch_demod_sf() for 15 kHz and called once per 2 ms slot for
+ * 3.75 kHz. Removes the phase rotation of TS 36.211 Sec. 10.1.5, estimates the channel on the DMRS of the slot and
+ * demodulates the pi/2-BPSK or pi/4-QPSK symbols, no DFT despreading is needed. Format 2 grants estimate the
+ * channel on the 3 DMRS symbols of the slot and accumulate the HARQ-ACK codeword.
+ *
+ * slot_symbols holds the 7 symbols of the slot, nof_sc subcarriers each, i.e. 12 at 15 kHz and 48 at 3.75 kHz.
+ */
+SONICA_API int sonica_npusch_demod_slot_st(sonica_npusch_t*          q,
+                                           sonica_npusch_cfg_t*      cfg,
+                                           cf_t*                     slot_symbols,
+                                           uint32_t                  nof_sc,
+                                           float                     noise_estimate,
+                                           sonica_npusch_softbits_t* softbits);
+
+/*
+ * DMRS of a 3-, 6- or 12-tone NPUSCH in slot ns of the frame, cyclic shift included. The base sequence follows the
+ * group hopping of the cell.
+ */
+SONICA_API void sonica_npusch_dmrs_multitone(sonica_npusch_t* q, uint32_t nof_sc, uint32_t ns, cf_t* r);
+
+/*
+ * Decodes the soft bits accumulated over all repetitions
+ */
+SONICA_API int sonica_npusch_decode_softbits(sonica_npusch_t*          q,
+                                             sonica_npusch_cfg_t*      cfg,
+                                             sonica_npusch_softbits_t* softbits,
+                                             uint8_t*                  data);
+
+/*
+ * Detects the HARQ-ACK bit of a complete NPUSCH Format 2 from its accumulated soft bits. The descrambled repetitions
+ * of the bit must agree in sign, otherwise the UE is assumed not to have transmitted (DTX).
+ *
+ * @return SRSLTE_SUCCESS with ack set, or SRSLTE_ERROR on DTX
+ */
+SONICA_API int sonica_npusch_decode_ack(sonica_npusch_t*          q,
+                                        sonica_npusch_cfg_t*      cfg,
+                                        sonica_npusch_softbits_t* softbits,
+                                        bool*                     ack);
+
+/*
+ * Number of subframes of the NPUSCH including all repetitions
+ */
+SONICA_API uint32_t sonica_npusch_nof_sf(sonica_npusch_cfg_t* cfg);
+
+/*
+ * Positions cfg at subframe num_sf of the NPUSCH, so the next demodulation takes that subframe. A 3.75 kHz slot is
+ * positioned at its first subframe.
+ */
+SONICA_API void sonica_npusch_cfg_seek(sonica_npusch_cfg_t* cfg, uint32_t num_sf);
+
 SONICA_API int sonica_npusch_cfg(sonica_npusch_cfg_t*        cfg,
                                  srslte_ra_nbiot_ul_grant_t* grant,
                                  uint16_t                    rnti);
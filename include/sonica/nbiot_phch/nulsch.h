@@ -43,9 +43,15 @@ typedef struct SONICA_API {
 SONICA_API int sonica_nulsch_init(sonica_nulsch_t *q);
 SONICA_API int sonica_nulsch_free(sonica_nulsch_t *q);
 
+/*
+ * Decodes a transport block received in nof_cw codewords, q_bits[i] holding the soft bits of the codeword sent
+ * with redundancy version rv_idx[i]. The codewords are combined in the circular buffer before turbo decoding.
+ */
 SONICA_API int sonica_nulsch_decode(sonica_nulsch_t*            q,
                                     srslte_ra_nbiot_ul_grant_t* grant,
-                                    int16_t*                    q_bits,
+                                    int16_t**                   q_bits,
+                                    uint32_t*                   rv_idx,
+                                    uint32_t                    nof_cw,
                                     int16_t*                    g_bits,
                                     uint8_t*                    data);
 
@@ -36,6 +36,7 @@ extern "C" {
 
 #include "sonica/nbiot_enb/enb_dl_nbiot.h"
 #include "sonica/nbiot_enb/enb_ul_nbiot.h"
+#include "sonica/nbiot_enb/ofdm_nbiot.h"
 
 #include "sonica/nbiot_phch/nprach.h"
 #include "sonica/nbiot_phch/npusch.h"
@@ -80,6 +80,8 @@ struct log_args_t {
   int         all_hex_limit;
   int         file_max_size;
   std::string filename;
+
+  threads_cfg_t thread;
 };
 
 struct general_args_t {
@@ -92,12 +94,35 @@ struct general_args_t {
   std::string eea_pref_list;
 };
 
+// Scheduling of each thread as "[policy:priority][@cores]", parsed into the thread args of each layer
+struct threads_args_t {
+  std::string txrx;
+  std::string sf_workers; // one spec for all the workers, or one per worker separated by ';'
+  std::string nprach;
+  std::string stack;
+  std::string decoder;
+  std::string logger;
+};
+
+// Binary trace of the PHY/MAC TTI processing, decoded by sonica_trace_decoder
+struct trace_args_t {
+  bool        enable;
+  std::string filename;
+  uint32_t    ring_size; // records per thread
+  std::string phy_level;
+  std::string nprach_level;
+  std::string mac_level;
+  std::string sched_level;
+};
+
 struct all_args_t {
   enb_args_t        enb;
   enb_files_t       enb_files;
   srslte::rf_args_t rf;
   log_args_t        log;
   general_args_t    general;
+  threads_args_t    threads;
+  trace_args_t      trace;
   phy_args_t        phy;
   stack_args_t      stack;
 };
@@ -119,6 +144,14 @@ public:
 
   void print_pool();
 
+  // Prints the TTI deadline counters and stage histograms of the PHY
+  void print_timing();
+  // Logs the periodic timing summary of the PHY once the workers have taken it
+  void log_timing();
+
+  // Moves the trace level of a layer to the next one, from none to debug and back to none
+  void cycle_trace_level(uint32_t layer);
+
   static void rf_msg(srslte_rf_error_t error);
 
   void handle_rf_msg(srslte_rf_error_t error);
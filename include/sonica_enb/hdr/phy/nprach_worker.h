@@ -23,76 +23,107 @@
 #ifndef SRSENB_NB_NPRACH_WORKER_H
 #define SRSENB_NB_NPRACH_WORKER_H
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "sonica/sonica.h"
 
 #include "phy_interfaces.h"
+#include "rx_sf_ring.h"
 #include "srslte/common/block_queue.h"
-#include "srslte/common/buffer_pool.h"
 #include "srslte/common/log.h"
-#include "srslte/common/threads.h"
+#include "srslte/common/thread_pool.h"
 #include "srslte/interfaces/enb_interfaces_nb.h"
 
 namespace sonica_enb {
 
-class nprach_worker : srslte::thread
+/**
+ * NPRACH reception. The occasions of every CE level are derived from the SIB2 NPRACH configuration, their
+ * subframes are handed over in chunks as they are received and each level runs its own detector on a small
+ * task pool. Chunks of a level are detected in order, so an occasion of any number of repetitions streams
+ * through a fixed amount of memory. Chunks are views of the RX subframe ring, the samples are not copied.
+ */
+class nprach_worker
 {
 public:
-  nprach_worker() : buffer_pool(8), thread("NPRACH_WORKER") { }
-
-  int  init(const srslte_nbiot_cell_t& cell_,
-            const phy_args_t&          args_,
-            // const srslte_prach_cfg_t& prach_cfg_,
-            stack_interface_phy_nb*    mac,
-            srslte::log*               log_h,
-            int                        priority);
-  int  new_tti(uint32_t tti, cf_t* buffer);
+  nprach_worker() = default;
+  ~nprach_worker();
+
+  int  init(const srslte_nbiot_cell_t&                cell_,
+            const phy_args_t&                         args_,
+            const asn1::rrc::nprach_cfg_sib_nb_r13_s& nprach_cfg,
+            uint32_t                                  symbol_sz,
+            stack_interface_phy_nb*                   mac,
+            srslte::log*                              log_h,
+            int                                       priority);
+  /**
+   * Sets the ring the subframes come from, views are only taken while more than nof_reserved slots are free
+   */
+  void set_rx_ring(const rx_sf_ring* ring, uint32_t nof_reserved);
+  int  new_tti(uint32_t tti, const rx_sf_ring::view& sf);
   void stop();
 
 private:
-  uint32_t nprach_nof_det     = 0;
-  uint32_t nprach_indices[12] = {};
-  float    prach_offsets[12]  = {};
-  float    prach_p2avg[12]    = {};
-
-  srslte_nbiot_cell_t cell    = {};
-
-  // srslte_nprach_cfg_t nprach_cfg = {};
-  sonica_nprach_t     nprach     = {};
-
-  const static int sf_buffer_sz = 8 * 1920;
-  class sf_buffer
-  {
-  public:
-    sf_buffer() = default;
-    void reset()
-    {
-      nof_samples = 0;
-      tti         = 0;
-    }
-    cf_t     samples[sf_buffer_sz] = {};
-    uint32_t nof_samples           = 0;
-    uint32_t tti                   = 0;
-#ifdef SRSLTE_BUFFER_POOL_LOG_ENABLED
-    char debug_name[SRSLTE_BUFFER_POOL_LOG_NAME_LEN];
-#endif /* SRSLTE_BUFFER_POOL_LOG_ENABLED */
+  // Largest chunk handed over to a detector
+  const static uint32_t max_chunk_sf = 8;
+  // Skipped or incomplete occasions of a level between two warnings of the same kind
+  const static uint32_t warn_period = 100;
+
+  // Part of an occasion, an empty view drops the occasion
+  struct chunk_t {
+    rx_sf_ring::view samples;
+    uint32_t         tti  = 0; // first subframe of the occasion
+    bool             last = false;
+  };
+
+  struct level_t {
+    uint32_t        ce_level = 0;
+    uint32_t        period   = 0; // ms
+    uint32_t        start    = 0; // ms within the period
+    uint32_t        nof_sf   = 0; // subframes of an occasion
+    sonica_nprach_t nprach   = {};
+
+    // Occasion being received, only accessed from new_tti()
+    bool             active      = false;
+    uint32_t         tti         = 0;
+    uint32_t         sf_cnt      = 0;
+    rx_sf_ring::view current     = {};
+    uint32_t         nof_skipped = 0;
+
+    // Detection side, the mutex keeps the chunks in order when two tasks of a level overlap
+    srslte::block_queue<chunk_t> chunks;
+    std::mutex                   mutex;
+    bool                         done           = false;
+    uint32_t                     nof_incomplete = 0;
+
+    uint32_t nof_det                                 = 0;
+    uint32_t indices[SONICA_NPRACH_MAX_SUBCARRIERS]  = {};
+    float    offsets[SONICA_NPRACH_MAX_SUBCARRIERS]  = {};
+    float    p2avg[SONICA_NPRACH_MAX_SUBCARRIERS]    = {};
   };
 
-  srslte::buffer_pool<sf_buffer>  buffer_pool;
-  srslte::block_queue<sf_buffer*> pending_buffers;
+  void push_chunk(level_t* level, bool last);
+  void skip_occasion(level_t* level);
+  void drop_occasion(level_t* level);
+  void run_level(level_t* level);
+  void run_chunk(level_t* level, const chunk_t& chunk);
+  void report(level_t* level, uint32_t tti);
+
+  srslte_nbiot_cell_t cell = {};
 
-  bool                    emulate_nprach      = false;
-  stack_interface_phy_nb* stack               = nullptr;
-  srslte::log*            log_h               = nullptr;
-  sf_buffer*              current_buffer      = nullptr;
-  bool                    initiated           = false;
-  bool                    running             = false;
-  uint32_t                nof_sf              = 0;
-  uint32_t                sf_cnt              = 0;
+  std::vector<std::unique_ptr<level_t>>     levels;
+  std::unique_ptr<srslte::task_thread_pool> detector_pool;
+  const rx_sf_ring*                         rx_ring      = nullptr;
+  uint32_t                                  nof_reserved = 0;
 
-  void run_thread() final;
-  int  run_tti(sf_buffer* b);
+  bool                    emulate_nprach = false;
+  stack_interface_phy_nb* stack          = nullptr;
+  srslte::log*            log_h          = nullptr;
+  bool                    initiated      = false;
+  uint32_t                sf_len         = 0;
 };
 
 } // namespace sonica_enb
 
-#endif // SRSENB_NB_NPRACH_WORKER_H
\ No newline at end of file
+#endif // SRSENB_NB_NPRACH_WORKER_H
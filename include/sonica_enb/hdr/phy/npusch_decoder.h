@@ -0,0 +1,122 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_NPUSCH_DECODER_H
+#define SRSENB_NB_NPUSCH_DECODER_H
+
+#include <memory>
+#include <vector>
+
+#include "sonica/sonica.h"
+
+#include "srslte/common/buffer_pool.h"
+#include "srslte/common/log.h"
+#include "srslte/common/thread_pool.h"
+#include "srslte/common/time_prof.h"
+#include "srslte/interfaces/enb_interfaces_nb.h"
+
+namespace sonica_enb {
+
+/**
+ * NPUSCH decoding stage. Workers hand over the soft bits accumulated over all the repetitions of a complete
+ * NPUSCH reception, the turbo decoding runs in a task pool and the result is reported to the stack with crc_info(),
+ * so the DL processing of the workers never waits for it.
+ */
+class npusch_decoder
+{
+public:
+  npusch_decoder();
+  ~npusch_decoder();
+
+  int  init(const srslte_nbiot_cell_t& cell,
+            stack_interface_phy_nb*    stack,
+            srslte::log*               log_h,
+            uint32_t                   nof_threads,
+            const threads_cfg_t&       thread_cfg,
+            int                        priority);
+  void stop();
+
+  /**
+   * Takes over a NPUSCH grant buffered by the receiver, which must have completed its reception
+   *
+   * @param grant receive context holding the accumulated soft bits
+   * @param tti TTI of the first subframe, used to report the CRC
+   * @param rnti RNTI of the grant
+   * @param data buffer where the decoded TB is written
+   * @return SRSLTE_SUCCESS if the decoding was enqueued
+   */
+  int push(const sonica_enb_ul_nbiot_grant_t* grant, uint32_t tti, uint16_t rnti, uint8_t* data);
+
+private:
+  const static uint32_t nof_jobs = 8;
+  const static uint32_t max_bits = SONICA_NPUSCH_MAX_BITS;
+
+  class decode_job
+  {
+  public:
+    decode_job()
+    {
+      for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+        softbits.llr[i] = llr[i];
+      }
+      softbits.max_bits = max_bits;
+    }
+    void reset()
+    {
+      tti  = 0;
+      rnti = 0;
+      data = nullptr;
+    }
+    sonica_npusch_cfg_t      npusch_cfg = {};
+    sonica_npusch_softbits_t softbits   = {};
+    uint32_t                 tti        = 0;
+    uint16_t                 rnti       = 0;
+    uint8_t*                 data       = nullptr;
+    int16_t                  llr[SONICA_NPUSCH_NOF_RV][max_bits] = {};
+#ifdef SRSLTE_BUFFER_POOL_LOG_ENABLED
+    char debug_name[SRSLTE_BUFFER_POOL_LOG_NAME_LEN];
+#endif /* SRSLTE_BUFFER_POOL_LOG_ENABLED */
+  };
+
+  // Decoding objects, one per pool thread
+  struct decoder_t {
+    sonica_npusch_t npusch = {};
+  };
+
+  void run_job(uint32_t worker_id, decode_job* job);
+  void report(decode_job* job, int ret);
+
+  srslte::buffer_pool<decode_job>           job_pool;
+  std::unique_ptr<srslte::task_thread_pool> decoder_pool;
+  std::vector<decoder_t>                    decoders;
+
+  stack_interface_phy_nb* stack     = nullptr;
+  srslte::log*            log_h     = nullptr;
+  bool                    initiated = false;
+
+  // Per-stage latency, from the hand over to the start of the decoding and of the decoding itself
+  srslte::mutexed_tprof<srslte::avg_time_stats> queue_tprof;
+  srslte::mutexed_tprof<srslte::avg_time_stats> decode_tprof;
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_NPUSCH_DECODER_H
@@ -66,9 +66,17 @@ public:
 
   // void get_metrics(phy_metrics_t metrics[ENB_METRICS_MAX_USERS]) override;
 
-  void radio_overflow() override{};
+  void radio_overflow() override { workers_common.timing.radio_overflow(); }
+  void radio_underflow() override { workers_common.timing.radio_underflow(); }
+  void radio_late() override { workers_common.timing.radio_late(); }
   void radio_failure() override{};
 
+  // TTI deadline counters and stage histograms
+  void get_timing_metrics(tti_timing::metrics_t& m) const { workers_common.timing.get_metrics(m); }
+  void print_timing() { workers_common.timing.print_summary(true); }
+  // Logs the summary taken every TIMING_PRINT_PERIOD TTIs, polled by the main thread
+  void log_timing() { workers_common.timing.print_periodic(); }
+
 private:
   // phy_rrc_cfg_t phy_rrc_config = {};
   uint32_t      nof_workers    = 0;
@@ -78,6 +86,10 @@ private:
   const static int PRACH_WORKER_THREAD_PRIO = 3;
   const static int SF_RECV_THREAD_PRIO      = 1;
   const static int WORKERS_THREAD_PRIO      = 2;
+  const static int DECODER_THREAD_PRIO      = 3;
+
+  // TTIs between two timing summaries in the PHY log
+  const static uint32_t TIMING_PRINT_PERIOD = 10240;
 
   srslte::radio_interface_phy* radio = nullptr;
   stack_interface_phy_nb*      stack = nullptr;
@@ -23,7 +23,10 @@
 #ifndef SRSENB_NB_PHY_COMMON_H
 #define SRSENB_NB_PHY_COMMON_H
 
+#include "npusch_decoder.h"
 #include "phy_interfaces.h"
+#include "rx_sf_ring.h"
+#include "tti_timing.h"
 #include "srslte/common/interfaces_common.h"
 #include "srslte/common/log.h"
 #include "srslte/common/thread_pool.h"
@@ -33,7 +36,11 @@
 #include "srslte/interfaces/radio_interfaces.h"
 // #include "srslte/phy/channel/channel.h"
 #include "srslte/radio/radio.h"
+#include "sonica/sonica.h"
+#include <atomic>
+#include <list>
 #include <map>
+#include <mutex>
 #include <srslte/common/tti_sempahore.h>
 #include <string.h>
 
@@ -43,9 +50,12 @@ class phy_common
 {
 public:
   explicit phy_common() = default;
+  ~phy_common();
 
-  bool init(const phy_cell_cfg_nb_t& cell_, srslte::radio_interface_phy* radio_handler,
-            stack_interface_phy_nb* stack);
+  bool init(const phy_cell_cfg_nb_t&                    cell_,
+            const asn1::rrc::npusch_cfg_common_nb_r13_s& npusch_cfg,
+            srslte::radio_interface_phy*                 radio_handler,
+            stack_interface_phy_nb*                      stack);
   void reset();
   void stop();
   /**
@@ -53,15 +63,38 @@ public:
    */
   srslte::tti_semaphore<void*> semaphore;
 
+  /**
+   * TTI state semaphore, used for ensuring that PHY workers access the state shared across TTIs (see tti_state) in
+   * start order. It is pushed together with the transmission semaphore.
+   */
+  srslte::tti_semaphore<void*> state_semaphore;
+
+  /**
+   * TTI uplink semaphore, used for ensuring that PHY workers add the NPUSCH subframe they demodulated to the receive
+   * contexts (see tti_state) in start order, so a grant is decoded once all its subframes are in. It is pushed together
+   * with the transmission semaphore.
+   */
+  srslte::tti_semaphore<void*> ul_semaphore;
+
+  /**
+   * Guards the NPUSCH receive contexts of tti_state, shared by the workers holding state_semaphore and ul_semaphore
+   */
+  std::mutex ul_mutex;
+
   /**
    * Performs common end worker transmission tasks such as transmission and stack TTI execution
    *
    * @param tx_sem_id Semaphore identifier, the worker thread pointer is used
+   * @param tti RX TTI of the worker, closes its timing record
    * @param buffer baseband IQ sample buffer
    * @param nof_samples number of samples to transmit
    * @param tx_time timestamp to transmit samples
    */
-  void worker_end(void* tx_sem_id, srslte::rf_buffer_t& buffer, uint32_t nof_samples, srslte_timestamp_t tx_time);
+  void worker_end(void*                tx_sem_id,
+                  uint32_t             tti,
+                  srslte::rf_buffer_t& buffer,
+                  uint32_t             nof_samples,
+                  srslte_timestamp_t   tx_time);
 
   // Common objects
   phy_args_t params = {};
@@ -70,6 +103,22 @@ public:
   {
     return cell.cell.base.nof_prb;
   }
+  /**
+   * Samples of a 15 kHz symbol. It is the LTE one unless a standalone carrier runs at a reduced rate, everything
+   * sampled in the PHY (radio, buffers, OFDM, NPRACH) derives from it.
+   */
+  inline uint32_t get_symbol_sz() const
+  {
+    return symbol_sz;
+  }
+  inline uint32_t get_sf_len() const
+  {
+    return SRSLTE_SF_LEN(symbol_sz);
+  }
+  inline double get_srate_hz() const
+  {
+    return 15000.0 * symbol_sz;
+  }
   inline uint32_t get_nof_ports() const
   {
     return cell.cell.nof_ports;
@@ -95,6 +144,11 @@ public:
     return cell.cell;
   }
 
+  inline const sonica_npusch_dmrs_cfg_t& get_npusch_dmrs_cfg() const
+  {
+    return npusch_dmrs_cfg;
+  }
+
   srslte::radio_interface_phy* radio      = nullptr;
   // TODO: stack interface
   stack_interface_phy_nb*      stack      = nullptr;
@@ -102,13 +156,99 @@ public:
   // TODO: UE Database
   // phy_ue_db ue_db;
 
-  // Getters and setters for ul grants which need to be shared between workers
-  const stack_interface_phy_nb::ul_sched_list_t& get_ul_grants(uint32_t tti);
-  void set_ul_grants(uint32_t tti, const stack_interface_phy_nb::ul_sched_list_t& ul_grants);
+  // NPUSCH decoding stage, runs apart from the workers
+  npusch_decoder ul_decoder;
+
+  // Per TTI stage timestamps and deadline slack
+  tti_timing timing;
+
+  /**
+   * UL grants shared between workers, one slot per TTI modulo TTIMOD_SZ. The worker of the TX TTI fills the slot in
+   * place with write_ul_grants() and publishes it with publish_ul_grants(). Workers of later TTIs get it without
+   * locking, get_ul_grants() returns nullptr until the slot holds the grants of the requested TTI.
+   *
+   * A slot is written again TTIMOD_SZ TTIs later, while workers run at most MAX_WORKERS TTIs apart, so a published
+   * slot is not overwritten while a worker reads it.
+   */
+  stack_interface_phy_nb::ul_sched_t&       write_ul_grants(uint32_t tti);
+  void                                      publish_ul_grants(uint32_t tti);
+  const stack_interface_phy_nb::ul_sched_t* get_ul_grants(uint32_t tti) const;
+
+  struct dl_grant_record_t {
+    srslte_ra_nbiot_dl_grant_t grant;
+    uint16_t                   rnti;
+    uint8_t*                   data;
+    bool                       needs_ack;
+  };
+
+  struct ul_grant_record_t {
+    srslte_ra_nbiot_ul_grant_t grant;
+    uint16_t                   rnti;
+    uint8_t*                   data;
+  };
+
+  /**
+   * DCI mapped to the valid DL subframes of its NPDCCH candidate, from the TTI it was scheduled in up to end_tti
+   */
+  struct npdcch_rep_t {
+    bool                     is_dl;
+    srslte_ra_nbiot_dl_dci_t dl_dci;
+    srslte_ra_nbiot_ul_dci_t ul_dci;
+    uint16_t                 rnti;
+    srslte_dci_location_t    location;
+    uint32_t                 end_tti;
+  };
+
+  /**
+   * NPDSCH transmission spanning multiple subframes. The encoded symbols are kept by the worker which encoded them,
+   * identified by gen, so any other worker must encode again before mapping its subframe.
+   */
+  struct npdsch_tx_t {
+    srslte_npdsch_cfg_t cfg;
+    bool                active;
+    uint16_t            rnti;
+    uint8_t*            data;
+    uint32_t            gen;
+    bool                needs_ack;
+  };
+
+  /**
+   * State carried from one TTI to the next. Only accessed by the worker currently holding state_semaphore, except for
+   * the NPUSCH receive contexts guarded by ul_mutex.
+   */
+  struct tti_state_t {
+    // TODO: Assign DCI with HARQ in MAC
+    bool     h_ndi_dl    = false;
+    bool     h_ndi_ul    = false;
+    uint32_t npdsch_gen  = 0;
+
+    npdsch_tx_t sib1   = {};
+    npdsch_tx_t npdsch = {};
+
+    std::list<dl_grant_record_t> dl_pending_grants;
+    std::list<ul_grant_record_t> ul_pending_grants;
+    std::list<npdcch_rep_t>      npdcch_reps;
+
+    // NPUSCH receive contexts, accumulate the soft bits of the subframes demodulated by all workers. Grants are
+    // indexed by receive context
+    ul_grant_record_t     npusch[SONICA_ENB_UL_NBIOT_MAX_GRANTS] = {};
+    sonica_enb_ul_nbiot_t enb_ul                                 = {};
+
+    // First subframe of the current 3.75 kHz slot, taken by the worker of the second one
+    rx_sf_ring::view rx_3k75;
+  } tti_state;
+
 private:
-  phy_cell_cfg_nb_t cell;
-  stack_interface_phy_nb::ul_sched_list_t ul_grants[TTIMOD_SZ] = {};
-  std::mutex                              grant_mutex          = {};
+  phy_cell_cfg_nb_t        cell;
+  uint32_t                 symbol_sz       = SONICA_NBIOT_MAX_SYMBOL_SZ;
+  sonica_npusch_dmrs_cfg_t npusch_dmrs_cfg = {};
+
+  // seq is the TTI plus one once published, 0 while empty or being written
+  struct ul_grant_slot_t {
+    std::atomic<uint32_t>              seq   = {0};
+    stack_interface_phy_nb::ul_sched_t sched = {};
+  };
+  ul_grant_slot_t ul_grants[TTIMOD_SZ];
 };
 
 } // namespace sonica_enb
@@ -27,6 +27,7 @@
 #include <inttypes.h>
 #include <srslte/asn1/rrc_asn1_nbiot.h>
 #include <srslte/common/interfaces_common.h>
+#include <srslte/common/threads.h>
 #include <srslte/phy/channel/channel.h>
 #include <vector>
 
@@ -49,12 +50,20 @@ struct phy_args_t {
   bool        pusch_8bit_decoder  = false;
   float       tx_amplitude        = 1.0f;
   int         nof_phy_threads     = 1;
+  int         nof_decoder_threads = 1;
   std::string equalizer_mode      = "mmse";
   float       estimator_fil_w     = 1.0f;
   bool        pusch_meas_epre     = true;
   bool        pusch_meas_evm      = false;
   bool        pusch_meas_ta       = true;
   bool        emulate_nprach      = false;
+  double      nb_srate_hz         = 0; // standalone carrier sample rate, 0 keeps the LTE base rate
+
+  // Scheduling policy and cores of the PHY threads, zeroed keeps the default priorities
+  threads_cfg_t              txrx_thread     = {};
+  std::vector<threads_cfg_t> worker_threads  = {}; // one per sf_worker
+  threads_cfg_t              nprach_thread   = {};
+  threads_cfg_t              decoder_threads = {};
 };
 
 struct phy_cfg_t {
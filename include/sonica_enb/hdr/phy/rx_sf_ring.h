@@ -0,0 +1,114 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_RX_SF_RING_H
+#define SRSENB_NB_RX_SF_RING_H
+
+#include <atomic>
+#include <memory>
+
+#include "srslte/srslte.h"
+
+namespace sonica_enb {
+
+/**
+ * Ring of received subframes, filled by the TXRX thread. Consumers (the sf_worker of the TTI, the NPRACH
+ * worker) hold reference counted views of the slots instead of copies, and a slot is received into again once
+ * the last view on it is released. The TXRX thread never waits for a consumer, slots still held are skipped.
+ * Consecutive slots are contiguous in memory, so a view may span several subframes up to the end of the ring.
+ */
+class rx_sf_ring
+{
+public:
+  class view
+  {
+  public:
+    view() = default;
+    view(const view& other) { copy(other); }
+    view(view&& other) noexcept;
+    view& operator=(const view& other);
+    view& operator=(view&& other) noexcept;
+    ~view() { release(); }
+
+    bool        empty() const { return ring == nullptr; }
+    uint32_t    get_tti() const { return tti; }
+    uint32_t    get_nof_sf() const { return nof_sf; }
+    uint32_t    get_nof_samples() const;
+    const cf_t* get(uint32_t port) const;
+
+    /**
+     * Extends the view with the subframes of next when they directly follow it in memory
+     *
+     * @return true if the view was extended
+     */
+    bool append(const view& next);
+    void release();
+
+  private:
+    friend class rx_sf_ring;
+    view(rx_sf_ring* ring_, uint32_t first_, uint32_t tti_) : ring(ring_), first(first_), nof_sf(1), tti(tti_) {}
+    void copy(const view& other);
+
+    rx_sf_ring* ring   = nullptr;
+    uint32_t    first  = 0;
+    uint32_t    nof_sf = 0;
+    uint32_t    tti    = 0; // of the first subframe
+  };
+
+  rx_sf_ring() = default;
+  ~rx_sf_ring();
+  rx_sf_ring(const rx_sf_ring&) = delete;
+  rx_sf_ring& operator=(const rx_sf_ring&) = delete;
+
+  bool init(uint32_t nof_slots, uint32_t sf_len, uint32_t nof_ports);
+
+  /**
+   * Takes the next free slot for reception, skipping the slots whose views are still held. Only the TXRX thread
+   * calls it.
+   *
+   * @return an empty view if every slot is held, the subframe is then received into a spare buffer and dropped
+   */
+  view acquire(uint32_t tti);
+
+  // Where the subframe of v is received, the spare buffer for an empty view
+  cf_t* get_write_ptr(const view& v, uint32_t port);
+
+  uint32_t get_nof_free() const;
+  uint32_t get_nof_slots() const { return nof_slots; }
+  uint32_t get_sf_len() const { return sf_len; }
+  uint32_t get_nof_overflows() const { return nof_overflows; }
+
+private:
+  void ref(uint32_t first, uint32_t nof_sf);
+  void unref(uint32_t first, uint32_t nof_sf);
+
+  cf_t*                                    buffer[SRSLTE_MAX_PORTS] = {}; // nof_slots slots and the spare one
+  std::unique_ptr<std::atomic<uint32_t>[]> refs;
+  uint32_t                                 nof_slots     = 0;
+  uint32_t                                 nof_ports     = 0;
+  uint32_t                                 sf_len        = 0;
+  uint32_t                                 wr_idx        = 0;
+  std::atomic<uint32_t>                    nof_overflows = {0};
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_RX_SF_RING_H
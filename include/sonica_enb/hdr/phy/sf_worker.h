@@ -24,11 +24,12 @@
 #define SRSENB_NB_PHY_WORKER_H
 
 
-#include <list>
 #include <mutex>
 #include <string.h>
+#include <vector>
 
 #include "phy_common.h"
+#include "rx_sf_ring.h"
 #include "srslte/srslte.h"
 #include "sonica/sonica.h"
 
@@ -42,7 +43,7 @@ public:
   void init(phy_common* phy, srslte::log* log_h);
   void reset();
 
-  cf_t* get_buffer_rx(uint32_t antenna_idx);
+  void  set_rx(const rx_sf_ring::view& rx);
   cf_t* get_buffer_tx(uint32_t antenna_idx);
   void  set_time(uint32_t hfn, uint32_t tti, uint32_t tx_worker_cnt, srslte_timestamp_t tx_time);
 
@@ -55,15 +56,16 @@ private:
   void worker_init(phy_common* phy, srslte::log* log_h);
   void work_imp() final;
 
-  void work_ul(stack_interface_phy_nb::ul_sched_list_t ul_grants);
-  void work_dl(stack_interface_phy_nb::dl_sched_t& dl_grants,
-               stack_interface_phy_nb::ul_sched_t& ul_grants_tx);
+  // Under state_semaphore, the receive contexts and DL transmissions take this TTI and the work is left in the worker
+  void sched_ul();
+  void sched_dl(stack_interface_phy_nb::dl_sched_t& dl_grants, stack_interface_phy_nb::ul_sched_t& ul_grants_tx);
+  void queue_npdsch(phy_common::npdsch_tx_t& tx);
 
-  struct dl_grant_record {
-    srslte_ra_nbiot_dl_grant_t grant;
-    uint16_t                   rnti;
-    uint8_t*                   data;
-  };
+  // Outside of it, the subframes are demodulated and encoded by the worker objects
+  void work_ul();
+  void merge_ul();
+  void work_dl();
+  int  put_npdsch(phy_common::npdsch_tx_t& tx);
 
   /* Common objects */
   srslte::log* log_h     = nullptr;
@@ -78,25 +80,29 @@ private:
   uint32_t           tx_worker_cnt = 0;
   srslte_timestamp_t tx_time       = {};
 
-  cf_t*    signal_buffer_rx[SRSLTE_MAX_PORTS] = {};
-  cf_t*    signal_buffer_tx[SRSLTE_MAX_PORTS] = {};
+  rx_sf_ring::view rx;  // received subframe, released once the UL is processed
+  cf_t*            signal_buffer_tx[SRSLTE_MAX_PORTS] = {};
 
   sonica_enb_dl_nbiot_t enb_dl = {};
   sonica_enb_ul_nbiot_t enb_ul = {};
 
-  srslte_npdsch_cfg_t   sib1_npdsch_cfg = {};
-  srslte_npdsch_cfg_t   npdsch_cfg = {};
-  bool                  npdsch_active = false;
-  uint16_t              npdsch_rnti;
-  uint8_t*              npdsch_data;
+  // Receive contexts of phy_common the subframe of this TTI belongs to, copied into enb_ul unless the grant misses it
+  struct ul_rx_t {
+    bool     copied;
+    bool     lost;
+    uint16_t rnti;
+    uint32_t tx_tti;
+  };
+  ul_rx_t          ul_rx[SONICA_ENB_UL_NBIOT_MAX_GRANTS] = {};
+  rx_sf_ring::view rx_3k75; // first subframe of the 3.75 kHz slot ending this TTI
 
-  uint32_t              npusch_start;
-  uint16_t              npusch_rnti;
-  uint8_t*              npusch_data;
-  srslte_ra_nbiot_ul_grant_t ugrant;
-  bool has_ugrant = false;
+  // DCIs and NPDSCH subframe to map this TTI
+  std::vector<phy_common::npdcch_rep_t> npdcch_tx;
+  phy_common::npdsch_tx_t               npdsch_tx     = {};
+  bool                                  has_npdsch_tx = false;
 
-  std::list<dl_grant_record> dl_pending_grants;
+  // Generation of the NPDSCH currently encoded in enb_dl, for data [0] and BCCH [1] symbols
+  uint32_t encoded_gen[2] = {};
 };
 
 } // namespace sonica_enb
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_TTI_TIMING_H
+#define SRSENB_NB_TTI_TIMING_H
+
+#include <atomic>
+#include <climits>
+
+#include "srslte/common/log.h"
+
+namespace sonica_enb {
+
+/**
+ * Deadline instrumentation of the TXRX/worker pipeline. Every stage of a TTI stamps the time it was reached in a
+ * ring indexed by TTI, with relaxed atomic stores so neither the TXRX thread nor the workers ever block on it. Once
+ * the subframe is handed to the radio, the worker holding the TX semaphore closes the TTI: the stage durations and
+ * the deadline slack go into histograms, and a TTI which missed its deadline is logged with its breakdown. Every
+ * print_period TTIs it also takes a snapshot of the counters, which another thread prints with print_periodic().
+ *
+ * The deadline is the TX time minus the RX time of the subframe, less the subframe itself, counted from the return
+ * of rx_now().
+ */
+class tti_timing
+{
+public:
+  enum stage_t {
+    RX_DONE = 0,    // rx_now() returned
+    WORKER_START,   // sf_worker started
+    STATE_ACQUIRED, // state semaphore acquired, the TTI ordered part starts
+    MAC_DL_DONE,    // get_dl_sched() returned
+    MAC_UL_DONE,    // get_ul_sched() returned
+    UL_DONE,        // work_ul() done
+    DL_DONE,        // DL signal generated
+    TX_ACQUIRED,    // TX semaphore acquired
+    TX_DONE,        // radio tx() returned
+    NOF_STAGES
+  };
+
+  // Intervals with their own histogram, plus the slack
+  enum interval_t {
+    QUEUE = 0,  // RX_DONE to WORKER_START
+    STATE_WAIT, // WORKER_START to STATE_ACQUIRED
+    MAC_DL,     // STATE_ACQUIRED to MAC_DL_DONE
+    MAC_UL,     // MAC_DL_DONE to MAC_UL_DONE
+    UL,         // MAC_UL_DONE to UL_DONE
+    DL,         // UL_DONE to DL_DONE
+    TX_WAIT,    // DL_DONE to TX_ACQUIRED
+    RADIO_TX,   // TX_ACQUIRED to TX_DONE
+    PROCESSING, // WORKER_START to DL_DONE
+    SLACK,      // deadline minus TX_ACQUIRED
+    NOF_INTERVALS
+  };
+
+  // Linear bins of 25 us from -1 ms, the first and last bins also count what falls beyond them
+  class histogram
+  {
+  public:
+    const static int32_t  BIN_US   = 25;
+    const static int32_t  MIN_US   = -1000;
+    const static uint32_t NOF_BINS = 200;
+
+    void     add(int32_t us);
+    void     reset();
+    uint32_t get_count() const { return count.load(std::memory_order_relaxed); }
+    int32_t  get_max() const { return max_us.load(std::memory_order_relaxed); }
+    float    get_mean() const;
+    // Upper edge of the bin holding the given fraction of the samples
+    int32_t percentile(float p) const;
+
+  private:
+    std::atomic<uint32_t> bins[NOF_BINS] = {};
+    std::atomic<uint32_t> count          = {0};
+    std::atomic<int64_t>  sum_us         = {0};
+    std::atomic<int32_t>  max_us         = {INT32_MIN};
+  };
+
+  struct metrics_t {
+    uint32_t nof_ttis;
+    uint32_t nof_late;
+    uint32_t nof_missed;     // stamps overwritten before the TTI was closed
+    uint32_t rf_underflows;
+    uint32_t rf_overflows;
+    uint32_t rf_late;
+    float    mean_us[NOF_INTERVALS];
+    int32_t  p99_us[NOF_INTERVALS];
+    int32_t  max_us[NOF_INTERVALS];
+    int32_t  min_slack_us;   // 1st percentile
+  };
+
+  static const char* interval_name(interval_t i);
+
+  void init(srslte::log* log_h_, uint32_t deadline_us_, uint32_t print_period_);
+
+  // Starts the stamps of a TTI, called by the TXRX thread when its subframe is received
+  void begin(uint32_t tti);
+  void stamp(uint32_t tti, stage_t stage);
+  // Closes the TTI, only called by the holder of the TX semaphore so TTIs are closed one at a time and in order
+  void end(uint32_t tti);
+  // Logs the latest snapshot of end() if it was not printed yet, called away from the TTI processing
+  void print_periodic();
+
+  // Radio events, from the radio thread
+  void radio_underflow() { rf_underflows.fetch_add(1, std::memory_order_relaxed); }
+  void radio_overflow() { rf_overflows.fetch_add(1, std::memory_order_relaxed); }
+  void radio_late() { rf_late.fetch_add(1, std::memory_order_relaxed); }
+
+  void get_metrics(metrics_t& m) const;
+  // Logs the counters and the histogram percentiles, to the console instead of the PHY log if asked
+  void print_summary(bool console = false);
+  void reset();
+
+private:
+  // Ring of TTI stamps, longer than the TTIs in flight between the TXRX thread and the last worker
+  const static uint32_t NOF_SLOTS = 32;
+
+  struct slot_t {
+    std::atomic<uint32_t> tti = {UINT32_MAX};
+    std::atomic<int64_t>  t_ns[NOF_STAGES] = {};
+  };
+
+  static int64_t now_ns();
+  void           print_late(uint32_t tti, const int64_t* t_ns, int32_t slack_us);
+  void           print_line(const char* str, bool console);
+  void           print_metrics(const metrics_t& m, bool console);
+
+  srslte::log* log_h        = nullptr;
+  int64_t      deadline_ns  = 0;
+  uint32_t     print_period = 0;
+
+  slot_t    slots[NOF_SLOTS];
+  histogram hist[NOF_INTERVALS];
+
+  std::atomic<uint32_t> nof_ttis      = {0};
+  std::atomic<uint32_t> nof_late      = {0};
+  std::atomic<uint32_t> nof_missed    = {0};
+  std::atomic<uint32_t> rf_underflows = {0};
+  std::atomic<uint32_t> rf_overflows  = {0};
+  std::atomic<uint32_t> rf_late       = {0};
+
+  // Written by end() while snapshot_ready is false, read by print_periodic() while it is true
+  metrics_t         snapshot       = {};
+  std::atomic<bool> snapshot_ready = {false};
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_TTI_TIMING_H
@@ -25,6 +25,7 @@
 
 #include "phy_common.h"
 #include "nprach_worker.h"
+#include "rx_sf_ring.h"
 #include "srslte/common/log.h"
 #include "srslte/common/thread_pool.h"
 #include "srslte/common/threads.h"
@@ -43,25 +44,31 @@ public:
             phy_common*                  worker_com,
             nprach_worker*               nprach_,
             srslte::log*                 log_h,
+            const threads_cfg_t&         thread_cfg,
             uint32_t                     prio);
   void stop();
 
 private:
   void run_thread() override;
 
+  // Subframes kept for the NPRACH worker on top of the one of each sf_worker
+  const static uint32_t nof_nprach_slots = 32;
+
   srslte::radio_interface_phy* radio_h      = nullptr;
   srslte::log*                 log_h        = nullptr;
   srslte::thread_pool*         workers_pool = nullptr;
   nprach_worker*               nprach       = nullptr;
   phy_common*                  worker_com   = nullptr;
+  rx_sf_ring                   rx_ring;
 
   // Main system HFN & TTI counter
   uint32_t hfn = 0;
   uint32_t tti = 0;
 
-  uint32_t tx_worker_cnt = 0;
-  uint32_t nof_workers   = 0;
-  bool     running       = false;
+  uint32_t tx_worker_cnt    = 0;
+  uint32_t nof_workers      = 0;
+  uint32_t nof_rx_overflows = 0;
+  bool     running          = false;
 };
 
 } // namespace sonica_enb
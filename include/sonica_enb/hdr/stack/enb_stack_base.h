@@ -23,6 +23,7 @@
 #ifndef SRSLTE_ENB_NB_STACK_BASE_H
 #define SRSLTE_ENB_NB_STACK_BASE_H
 
+#include "srslte/common/threads.h"
 #include "srslte/interfaces/enb_interfaces_nb.h"
 #include "srslte/interfaces/sched_interface_nb.h"
 #include <string>
@@ -65,6 +66,7 @@ typedef struct {
   pcap_args_t      s1ap_pcap;
   stack_log_args_t log;
   embms_args_t     embms;
+  threads_cfg_t    thread;
 } stack_args_t;
 
 struct stack_metrics_t;
@@ -62,13 +62,18 @@ public:
   std::string get_type() final;
 
   /* PHY-MAC interface */
-  void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv) final
+  void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv, uint32_t ce_level) final
   {
-     mac.rach_detected(tti, preamble_idx, time_adv);
+     mac.rach_detected(tti, preamble_idx, time_adv, ce_level);
   }
   int get_dl_sched(uint32_t hfn, uint32_t tti, dl_sched_list_t& dl_sched_res) final { return mac.get_dl_sched(hfn, tti, dl_sched_res); }
-  int get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sched_res) final { return mac.get_ul_sched(hfn, tti_tx_ul, ul_sched_res); }
+  int get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_t& ul_sched_res) final { return mac.get_ul_sched(hfn, tti_tx_ul, ul_sched_res); }
   int crc_info(uint32_t tti, uint16_t rnti, uint32_t nof_bytes, bool crc_res) final {return mac.crc_info(tti, rnti, nof_bytes, crc_res);}
+  int snr_info(uint32_t tti, uint16_t rnti, float snr_db, float noise_db) final
+  {
+    return mac.snr_info(tti, rnti, snr_db, noise_db);
+  }
+  int ack_info(uint32_t tti, uint16_t rnti, bool ack) final { return mac.ack_info(tti, rnti, ack); }
 
   // Radio-Link status
   // void rl_failure(uint16_t rnti) final { mac.rl_failure(rnti); }
@@ -82,15 +87,21 @@ public:
 //  void add_gtpu_m1u_socket_handler(int fd) override;
 
   /* Stack-MAC interface */
-  srslte::timer_handler::unique_timer    get_unique_timer() final;
-  srslte::task_multiqueue::queue_handler make_task_queue() final;
-  void                                   defer_callback(uint32_t duration_ms, std::function<void()> func) final;
-  void                                   enqueue_background_task(std::function<void(uint32_t)> task) final;
-  void                                   notify_background_task_result(srslte::move_task_t task) final;
-  void                                   defer_task(srslte::move_task_t task) final;
+  srslte::timer_handler::unique_timer         get_unique_timer() final;
+  srslte::mpsc_task_multiqueue::queue_handler make_task_queue() final;
+  void defer_callback(uint32_t duration_ms, std::function<void()> func) final;
+  void enqueue_background_task(std::function<void(uint32_t)> task) final;
+  void notify_background_task_result(srslte::move_task_t task) final;
+  void defer_task(srslte::move_task_t task) final;
 
 private:
   static const int STACK_MAIN_THREAD_PRIO = -1; // Use default high-priority below UHD
+
+  // Priorities of the task queues, the TTI clock first, then the tasks of the layers and last the network
+  static const int SYNC_QUEUE_PRIO  = 3;
+  static const int LAYER_QUEUE_PRIO = 2;
+  static const int STACK_QUEUE_PRIO = 1;
+  static const int NET_QUEUE_PRIO   = 0;
   // thread loop
   void run_thread() override;
   void stop_impl();
@@ -134,8 +145,8 @@ private:
   phy_interface_stack_nb* phy = nullptr;
 
   // state
-  bool                    started = false;
-  srslte::task_multiqueue pending_tasks;
+  bool                         started = false;
+  srslte::mpsc_task_multiqueue pending_tasks;
   int enb_queue_id = -1, sync_queue_id = -1, mme_queue_id = -1, gtpu_queue_id = -1, mac_queue_id = -1,
       stack_queue_id = -1;
   std::vector<srslte::move_task_t>     deferred_stack_tasks; ///< enqueues stack tasks from within. Avoids locking
@@ -23,6 +23,7 @@
 #ifndef SRSENB_NB_MAC_H
 #define SRSENB_NB_MAC_H
 
+#include "rnti_table.h"
 #include "scheduler.h"
 #include "srslte/common/log.h"
 #include "srslte/common/mac_pcap.h"
@@ -34,6 +35,8 @@
 #include "ta.h"
 #include "ue.h"
 #include <srslte/phy/phch/ra_nbiot.h>
+#include <atomic>
+#include <chrono>
 #include <vector>
 
 namespace sonica_enb {
@@ -56,18 +59,18 @@ public:
 
   /******** Interface from PHY (PHY -> MAC) ****************/
 //  int  sr_detected(uint32_t tti, uint16_t rnti) final;
-  void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv) final;
+  void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv, uint32_t ce_level) final;
 
 //  int ri_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t ri_value) override;
 //  int pmi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t pmi_value) override;
 //  int cqi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t cqi_value) override;
-//  int snr_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, float snr) override;
+  int snr_info(uint32_t tti, uint16_t rnti, float snr_db, float noise_db) override;
 //  int ta_info(uint32_t tti, uint16_t rnti, float ta_us) override;
-//  int ack_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t tb_idx, bool ack) override;
+  int ack_info(uint32_t tti, uint16_t rnti, bool ack) override;
   int crc_info(uint32_t tti, uint16_t rnti, uint32_t nof_bytes, bool crc_res) override;
 
   int  get_dl_sched(uint32_t hfn, uint32_t tti_tx_dl, dl_sched_list_t& dl_sched_res) override;
-  int  get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sched_res) override;
+  int  get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_t& ul_sched_res) override;
 //  int  get_mch_sched(uint32_t tti, bool is_mcch, dl_sched_list_t& dl_sched_res) override;
 //  void set_sched_dl_tti_mask(uint8_t* tti_mask, uint32_t nof_sfs) override
 //  {
@@ -101,18 +104,13 @@ public:
 //  write_mcch(asn1::rrc::sib_type2_s* sib2, asn1::rrc::sib_type13_r9_s* sib13, asn1::rrc::mcch_msg_s* mcch) override;
 //
 //  /* Allocate C-RNTI */
+  // Reserves the slot of the C-RNTI in the UE table, which rach_detected() fills
   uint16_t allocate_rnti() final;
   void srslte_nb_dci_rar_pack(srslte_nbiot_dci_rar_grant_t* rar, uint8_t* payload);
 
 private:
   static const uint32_t cfi                      = 3;
 
-  std::mutex rnti_mutex;
-
-  // We use a rwlock in MAC to allow multiple workers to access MAC simultaneously. No conflicts will happen since
-  // access for different TTIs
-  pthread_rwlock_t rwlock = {};
-
   // Interaction with PHY
   phy_interface_stack_nb* phy_h = nullptr;
   rlc_interface_mac*       rlc_h = nullptr;
@@ -125,7 +123,8 @@ private:
   mac_args_t  args  = {};
 
   // derived from args
-  srslte::task_multiqueue::queue_handler stack_task_queue;
+  srslte::mpsc_task_multiqueue::queue_handler stack_task_queue;
+  std::atomic<bool>                           pdus_pending{false}; ///< a process_pdus task is in stack_task_queue
 
   bool started = false;
 
@@ -135,9 +134,9 @@ private:
 
   sched_interface::dl_pdu_mch_t mch = {};
 
-  /* Map of active UEs */
-  std::map<uint16_t, std::unique_ptr<ue> > ue_db;
-  uint16_t                                 last_rnti = 0;
+  /* Table of active UEs, indexed by C-RNTI. The workers, the stack and the NPRACH worker look UEs up and add them
+   * concurrently without locking */
+  rnti_table<std::unique_ptr<ue> > ue_db;
 
   uint8_t* assemble_rar(sched_interface::dl_sched_rar_grant_t* grants,
                         uint32_t                               nof_grants,
@@ -173,6 +172,23 @@ private:
 
   // pointer to MAC PCAP object
   srslte::mac_pcap* pcap = nullptr;
+
+  /**
+   * Time spent in each stage of get_dl_sched() and get_ul_sched(), logged every SCHED_TIMING_PERIOD TTIs. The PHY
+   * workers call both in TTI order under their state semaphore, so the counters need no locking.
+   */
+  enum sched_stage_t { DL_SCHED = 0, DL_UE_PDU, DL_RAR, DL_BCCH, UL_SCHED, UL_GRANTS, NOF_SCHED_STAGES };
+  struct sched_stage_stats_t {
+    uint32_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+  };
+  const static uint32_t SCHED_TIMING_PERIOD            = 10240;
+  sched_stage_stats_t   sched_timing[NOF_SCHED_STAGES] = {};
+  uint32_t              sched_timing_ttis              = 0;
+
+  void sched_stage_done(sched_stage_t stage, std::chrono::steady_clock::time_point& t);
+  void print_sched_timing();
 };
 
 } // namespace sonica_enb
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_RNTI_TABLE_H
+#define SRSENB_NB_RNTI_TABLE_H
+
+#include <array>
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+
+namespace sonica_enb {
+
+/**
+ * Per-UE objects in a preallocated table of NOF_SLOTS slots indexed by the C-RNTI. The C-RNTIs are handed out in
+ * sequence from RNTI_START, so the slot of an RNTI is its offset modulo NOF_SLOTS and the quotient is the generation
+ * of the slot. Each slot keeps the RNTI it holds, so an RNTI which was removed, or whose slot was reused by a later
+ * generation, is simply not found.
+ *
+ * Lookups take a reference on the slot instead of a lock. add() publishes a slot nobody can see yet and remove()
+ * hides the slot and waits for the references to it to be dropped before resetting the object, so neither blocks
+ * the lookups of other UEs. A thread must not remove a UE while it holds a reference to it.
+ */
+template <typename T, uint32_t N = 256>
+class rnti_table
+{
+  // Slot state: RNTI in the upper half, busy flag while being added or removed, then the count of references
+  const static uint32_t BUSY     = 0x8000;
+  const static uint32_t REF_MASK = 0x7fff;
+
+public:
+  const static uint16_t RNTI_START = 4097;
+  const static uint16_t RNTI_END   = 60000;
+  const static uint32_t NOF_SLOTS  = N;
+  // A whole number of generations, so the slot of an RNTI does not change when the sequence wraps around
+  const static uint32_t NOF_RNTIS = ((RNTI_END - RNTI_START) / N) * N;
+
+  // Reference to the object of a slot, which stays valid while the reference is held
+  class ref
+  {
+  public:
+    ref() = default;
+    ref(ref&& other) noexcept : slot_state(other.slot_state), obj(other.obj) { other.slot_state = nullptr; }
+    ref(const ref&) = delete;
+    ref& operator=(const ref&) = delete;
+    ref& operator=(ref&& other) noexcept
+    {
+      std::swap(slot_state, other.slot_state);
+      std::swap(obj, other.obj);
+      return *this;
+    }
+    ~ref()
+    {
+      if (slot_state != nullptr) {
+        slot_state->fetch_sub(1, std::memory_order_release);
+      }
+    }
+
+    explicit operator bool() const { return slot_state != nullptr; }
+    T*       get() const { return obj; }
+    T*       operator->() const { return obj; }
+    T&       operator*() const { return *obj; }
+
+  private:
+    friend class rnti_table;
+    ref(std::atomic<uint32_t>* slot_state_, T* obj_) : slot_state(slot_state_), obj(obj_) {}
+
+    std::atomic<uint32_t>* slot_state = nullptr;
+    T*                     obj        = nullptr;
+  };
+
+  rnti_table()
+  {
+    for (auto& s : states) {
+      s.store(0, std::memory_order_relaxed);
+    }
+  }
+  rnti_table(const rnti_table&) = delete;
+  rnti_table& operator=(const rnti_table&) = delete;
+
+  static bool is_valid(uint16_t rnti) { return rnti >= RNTI_START and rnti < RNTI_START + NOF_RNTIS; }
+
+  /**
+   * Reserves the slot of the next free C-RNTI, to be filled with add(). Returns 0 if every slot is in use
+   */
+  uint16_t allocate_rnti()
+  {
+    for (uint32_t i = 0; i < NOF_SLOTS; i++) {
+      uint32_t seq  = next_seq.fetch_add(1, std::memory_order_relaxed) % NOF_RNTIS;
+      uint32_t free = 0;
+      if (states[seq % N].compare_exchange_strong(free, state_of(RNTI_START + seq) | BUSY)) {
+        return (uint16_t)(RNTI_START + seq);
+      }
+    }
+    return 0;
+  }
+
+  // Restarts the C-RNTI sequence from RNTI_START
+  void reset_rnti() { next_seq.store(0, std::memory_order_relaxed); }
+
+  /**
+   * Stores the object of a UE and makes it visible, in the slot reserved by allocate_rnti() or in a free slot.
+   * Fails if the slot of the RNTI holds another UE
+   */
+  bool add(uint16_t rnti, T&& obj)
+  {
+    if (not is_valid(rnti)) {
+      return false;
+    }
+    std::atomic<uint32_t>& state = states[slot_idx(rnti)];
+    uint32_t               s     = state.load(std::memory_order_relaxed);
+    do {
+      if (s != 0 and s != (state_of(rnti) | BUSY)) {
+        return false;
+      }
+    } while (not state.compare_exchange_weak(s, state_of(rnti) | BUSY, std::memory_order_acquire));
+
+    objs[slot_idx(rnti)] = std::move(obj);
+    nof_ues.fetch_add(1, std::memory_order_relaxed);
+    state.store(state_of(rnti), std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Hides the UE, waits for the references to it to be dropped and resets its object
+   */
+  bool remove(uint16_t rnti)
+  {
+    if (not is_valid(rnti)) {
+      return false;
+    }
+    std::atomic<uint32_t>& state = states[slot_idx(rnti)];
+    uint32_t               s     = state.load(std::memory_order_relaxed);
+    do {
+      if ((s & ~REF_MASK) != state_of(rnti)) {
+        return false;
+      }
+    } while (not state.compare_exchange_weak(s, s | BUSY, std::memory_order_relaxed));
+
+    release_slot(slot_idx(rnti));
+    return true;
+  }
+
+  // Removes every UE and releases the reserved slots
+  void clear()
+  {
+    for (uint32_t i = 0; i < N; i++) {
+      uint32_t s = states[i].fetch_or(BUSY, std::memory_order_relaxed);
+      if (s != 0) {
+        release_slot(i, (s & BUSY) == 0);
+      } else {
+        states[i].store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  ref find(uint16_t rnti)
+  {
+    if (not is_valid(rnti)) {
+      return {};
+    }
+    uint32_t idx = slot_idx(rnti);
+    if (not acquire(idx, state_of(rnti))) {
+      return {};
+    }
+    return ref(&states[idx], &objs[idx]);
+  }
+
+  bool contains(uint16_t rnti) { return (bool)find(rnti); }
+
+  uint32_t size() const { return nof_ues.load(std::memory_order_relaxed); }
+  bool     empty() const { return size() == 0; }
+
+  /**
+   * Calls f(T&) for every UE in slot order, starting from the first-th one and wrapping around. Each UE is
+   * referenced during its call
+   */
+  template <typename Func>
+  void for_each(uint32_t first, Func f)
+  {
+    // The UEs from the first-th one on, then the ones before it
+    for (uint32_t pass = 0; pass < 2; pass++) {
+      uint32_t count = 0;
+      for (uint32_t i = 0; i < N and (pass == 0 or count < first); i++) {
+        if (not acquire(i, 0)) {
+          continue;
+        }
+        if ((pass == 0) == (count >= first)) {
+          f(objs[i]);
+        }
+        count++;
+        states[i].fetch_sub(1, std::memory_order_release);
+      }
+    }
+  }
+
+  template <typename Func>
+  void for_each(Func f)
+  {
+    for_each(0, f);
+  }
+
+private:
+  static uint32_t state_of(uint32_t rnti) { return rnti << 16u; }
+  static uint32_t slot_idx(uint16_t rnti) { return (rnti - RNTI_START) % N; }
+
+  // Takes a reference if the slot is visible and holds the given state, any RNTI if 0
+  bool acquire(uint32_t idx, uint32_t rnti_state)
+  {
+    uint32_t s = states[idx].load(std::memory_order_relaxed);
+    do {
+      if (s == 0 or (s & BUSY) or (rnti_state != 0 and (s & ~REF_MASK) != rnti_state) or
+          (s & REF_MASK) == REF_MASK) {
+        return false;
+      }
+    } while (not states[idx].compare_exchange_weak(s, s + 1, std::memory_order_acquire, std::memory_order_relaxed));
+    return true;
+  }
+
+  // Resets the object of a slot hidden by the caller once its last reference is dropped
+  void release_slot(uint32_t idx, bool counted = true)
+  {
+    while ((states[idx].load(std::memory_order_acquire) & REF_MASK) != 0) {
+      std::this_thread::yield();
+    }
+    if (counted) {
+      objs[idx] = T{};
+      nof_ues.fetch_sub(1, std::memory_order_relaxed);
+    }
+    states[idx].store(0, std::memory_order_release);
+  }
+
+  std::array<std::atomic<uint32_t>, N> states;
+  std::array<T, N>                     objs = {};
+  std::atomic<uint32_t>                next_seq{0};
+  std::atomic<uint32_t>                nof_ues{0};
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_RNTI_TABLE_H
@@ -70,19 +70,29 @@ public:
   class metric_dl
   {
   public:
-//    virtual ~metric_dl() = default;
-//    /* Virtual methods for user metric calculation */
+    virtual ~metric_dl() = default;
+    /* Virtual methods for user metric calculation */
 //    virtual void set_params(const sched_cell_params_t& cell_params_)                          = 0;
-//    virtual void sched_users(std::map<uint16_t, sched_ue>& ue_db, dl_sf_sched_itf* tti_sched) = 0;
+    virtual void sched_users(sched_ue_db_t& ue_db, dl_sf_sched_itf* tti_sched) = 0;
+    /* UE added or reconfigured, and removed */
+    virtual void ue_cfg(uint16_t rnti, const sched_ue& user) {}
+    virtual void ue_rem(uint16_t rnti) {}
+    /* UE got data to schedule */
+    virtual void ue_backlogged(uint16_t rnti) {}
   };
 
   class metric_ul
   {
   public:
-//    virtual ~metric_ul() = default;
-//    /* Virtual methods for user metric calculation */
+    virtual ~metric_ul() = default;
+    /* Virtual methods for user metric calculation */
 //    virtual void set_params(const sched_cell_params_t& cell_params_)                          = 0;
-//    virtual void sched_users(std::map<uint16_t, sched_ue>& ue_db, ul_sf_sched_itf* tti_sched) = 0;
+    virtual void sched_users(sched_ue_db_t& ue_db, ul_sf_sched_itf* tti_sched) = 0;
+    /* UE added or reconfigured, and removed */
+    virtual void ue_cfg(uint16_t rnti, const sched_ue& user) {}
+    virtual void ue_rem(uint16_t rnti) {}
+    /* UE got data to schedule */
+    virtual void ue_backlogged(uint16_t rnti) {}
   };
 
   /*************************************************************
@@ -115,12 +125,13 @@ public:
   int dl_rlc_buffer_state(uint16_t rnti, uint32_t lc_id, uint32_t tx_queue, uint32_t retx_queue) final;
   int dl_mac_buffer_state(uint16_t rnti, uint32_t ce_code, uint32_t nof_cmds = 1) final;
 
-//  int dl_ack_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t tb_idx, bool ack) final;
+  int dl_ack_info(uint32_t tti, uint16_t rnti, bool ack) final;
   int dl_rach_info(dl_sched_rar_info_t rar_info) final;
 //  int dl_ri_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t ri_value) final;
 //  int dl_pmi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t pmi_value) final;
 //  int dl_cqi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t cqi_value) final;
-//  int ul_crc_info(uint32_t tti, uint16_t rnti, bool crc) final;
+  int ul_crc_info(uint32_t tti, uint16_t rnti, bool crc) final;
+  int ul_snr_info(uint32_t tti, uint16_t rnti, float snr_db) final;
 //  int ul_sr_info(uint32_t tti, uint16_t rnti) override;
   int ul_bsr(uint16_t rnti, uint32_t lcid, uint32_t bsr, bool set_value = true) final;
   int ul_wait_timer(uint16_t rnti, uint32_t wait_time, bool set_value = true) final;
@@ -144,14 +155,17 @@ protected:
   // Helper methods
   template <typename Func>
   int ue_db_access(uint16_t rnti, Func, const char* func_name = nullptr);
+  // Tell the metrics the UE has data to schedule, called with the lock held
+  void dl_backlogged(uint16_t rnti);
+  void ul_backlogged(uint16_t rnti);
 
   // args
   srslte::log_ref                  log_h;
 //  rrc_interface_mac*               rrc       = nullptr;
-//  sched_args_t                     sched_cfg = {};
+  sched_args_t                     sched_cfg = {};
 //  std::vector<sched_cell_params_t> sched_cell_params;
 
-  std::map<uint16_t, sched_ue> ue_db;
+  sched_ue_db_t ue_db;
 
   // independent schedulers for each carrier
   std::vector<std::unique_ptr<carrier_sched> > carrier_schedulers;
@@ -33,11 +33,15 @@ class ra_sched;
 class sched::carrier_sched
 {
 public:
-  explicit carrier_sched(std::map<uint16_t, sched_ue>* ue_db_);
+  explicit carrier_sched(sched_ue_db_t* ue_db_);
   ~carrier_sched();
   void                   reset();
 //  void                   carrier_cfg(const sched_cell_params_t& sched_params_);
-  void                   carrier_cfg();
+  void                   carrier_cfg(const sched_interface::sched_args_t& sched_args);
+  void                   ue_cfg(uint16_t rnti, const sched_ue& user);
+  void                   ue_rem(uint16_t rnti);
+  void                   dl_backlogged(uint16_t rnti);
+  void                   ul_backlogged(uint16_t rnti);
 //  void                   set_dl_tti_mask(uint8_t* tti_mask, uint32_t nof_sfs);
   const sf_sched_result& generate_tti_result(uint32_t hfn, uint32_t tti_rx, bool dl_flag);
   int                    dl_rach_info(dl_sched_rar_info_t rar_info);
@@ -52,23 +56,19 @@ public:
 private:
   //! Compute DL scheduler result for given TTI
   void alloc_dl_users(sf_sched* tti_result);
-  void sched_users_dl(sf_sched* tti_sched);
-  dl_harq_proc* allocate_user(sched_ue* user, dl_sf_sched_itf* tti_sched);
 
   //! Compute UL scheduler result for given TTI
   int alloc_ul_users(sf_sched* tti_sched);
-  void sched_users_ul(sf_sched* tti_sched);
-  ul_harq_proc* allocate_user_newtx_prbs(sched_ue* user, ul_sf_sched_itf* tti_sched);
   //! Get sf_sched for a given TTI
-  sf_sched*        get_sf_sched(uint32_t tti_rx, bool* dl_sched_table, bool* l_sched_table);
+  sf_sched*        get_sf_sched(uint32_t tti_rx);
   sf_sched_result* get_next_sf_result(uint32_t tti_rx);
   // args
 //  const sched_cell_params_t*    cc_cfg = nullptr;
   srslte::log_ref               log_h;
 //  rrc_interface_mac*            rrc   = nullptr;
-  std::map<uint16_t, sched_ue>* ue_db = nullptr;
-//  std::unique_ptr<metric_dl>    dl_metric;
-//  std::unique_ptr<metric_ul>    ul_metric;
+  sched_ue_db_t*                ue_db = nullptr;
+  std::unique_ptr<metric_dl>    dl_metric;
+  std::unique_ptr<metric_ul>    ul_metric;
 //  const uint32_t                enb_cc_idx;
 //
 //  // derived from args
@@ -79,8 +79,11 @@ private:
   std::array<sf_sched, TTIMOD_SZ * 2>            sf_scheds;  // For NB-IoT, set the sd_scheds larger
   std::array<sf_sched_result, TTIMOD_SZ * 4> sf_sched_results;
 
-  bool dl_sched_table[10240];
-  bool ul_sched_table[10240];
+  // Subframes taken over the hyperframe, shared by every allocation of the carrier
+  sched_timeline dl_timeline;
+  sched_timeline ul_timeline;
+  // NCCEs taken in the DL subframes and the NPDCCH search spaces
+  sched_npdcch npdcch;
 
   std::vector<uint8_t> sf_dl_mask; ///< Some TTIs may be forbidden for DL sched due to MBMS
 
@@ -105,6 +108,9 @@ private:
 //    uint32_t n_tx         = 0;
 //  };
 
+  // Largest N_sf of an NPDSCH, TS 36.213 Table 16.4.1.3-1
+  const static uint32_t SIB_MAX_NSF = 10;
+
   srslte_mib_nb_t          mib_nb;
   uint32_t                 sib1_sf_idx;
   uint32_t                 sib1_num_sf;
@@ -138,7 +144,7 @@ public:
   using dl_sched_rar_t       = sched_interface::dl_sched_rar_t;
   using dl_sched_rar_grant_t = sched_interface::dl_sched_rar_grant_t;
 
-  explicit ra_sched(std::map<uint16_t, sched_ue>& ue_db_);
+  explicit ra_sched(sched_ue_db_t& ue_db_);
   alloc_outcome_t dl_sched(sf_sched* tti_sched);
   void ul_sched(sf_sched* sf_dl_sched, sf_sched* sf_msg3_sched);
   int  dl_rach_info(dl_sched_rar_info_t rar_info);
@@ -148,10 +154,9 @@ private:
   // args
   srslte::log_ref               log_h;
 //  const sched_cell_params_t*    cc_cfg = nullptr;
-  std::map<uint16_t, sched_ue>* ue_db  = nullptr;
+  sched_ue_db_t*                ue_db  = nullptr;
 
   std::deque<sf_sched::pending_rar_t> pending_rars;
-  uint32_t                            rar_aggr_level = 2;
 };
 
 } // namespace sonica_enb
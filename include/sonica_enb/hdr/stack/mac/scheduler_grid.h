@@ -24,6 +24,8 @@
 #define SRSLTE_NB_SCHEDULER_GRID_H
 
 #include "srslte/interfaces/sched_interface_nb.h"
+#include "scheduler_npdcch.h"
+#include "scheduler_timeline.h"
 #include "scheduler_ue.h"
 #include "srslte/common/bounded_bitset.h"
 #include "srslte/common/log.h"
@@ -62,11 +64,12 @@ class dl_sf_sched_itf
 {
 public:
 //  virtual alloc_outcome_t  alloc_dl_user(sched_ue* user, const rbgmask_t& user_mask, uint32_t pid) = 0;
-  virtual alloc_outcome_t  alloc_dl_user(sched_ue* user, uint32_t max_data) = 0;
+  virtual alloc_outcome_t  alloc_dl_user(sched_ue* user, uint32_t max_data, uint32_t pid) = 0;
 //  virtual const rbgmask_t& get_dl_mask() const                                                     = 0;
   virtual uint32_t         get_tti_tx_dl() const                                                   = 0;
 //  virtual uint32_t         get_nof_ctrl_symbols() const                                            = 0;
   virtual bool             is_dl_alloc(sched_ue* user) const                                       = 0;
+  virtual bool             is_npdcch_free() const                                                  = 0;
 };
 
 //! generic interface used by UL scheduler algorithm
@@ -77,6 +80,7 @@ public:
 //  virtual const prbmask_t& get_ul_mask() const                                           = 0;
   virtual uint32_t         get_tti_tx_ul() const                                         = 0;
   virtual bool             is_ul_alloc(sched_ue* user) const                             = 0;
+  virtual bool             is_npdcch_free() const                                        = 0;
 };
 
 /** Description: Stores the RAR, broadcast, paging, DL data, UL data allocations for the given subframe
@@ -96,7 +100,16 @@ public:
   struct rar_alloc_t {
     sf_sched::ctrl_alloc_t          alloc_data;
     sched_interface::dl_sched_rar_t rar_grant;
-    rar_alloc_t(const sf_sched::ctrl_alloc_t& c, const sched_interface::dl_sched_rar_t& r) : alloc_data(c), rar_grant(r)
+    sched_npdcch::alloc_t           npdcch;
+    uint32_t                        npdsch_tti; ///< subframe of the RAR, Msg3 is allocated from its UL result
+    rar_alloc_t(const sf_sched::ctrl_alloc_t&          c,
+                const sched_interface::dl_sched_rar_t& r,
+                const sched_npdcch::alloc_t&           n,
+                uint32_t                               npdsch_tti_) :
+      alloc_data(c),
+      rar_grant(r),
+      npdcch(n),
+      npdsch_tti(npdsch_tti_)
     {
     }
   };
@@ -116,6 +129,10 @@ public:
 //    rbgmask_t user_mask;
     uint32_t i_sf   = 0;
     uint32_t  pid;
+    uint32_t  harq_ack = 0; ///< HARQ-ACK resource field of the DCI
+    uint32_t  tti_ack  = 0; ///< first subframe of the NPUSCH Format 2
+    uint32_t  i_delay  = 0; ///< scheduling delay field of the DCI
+    sched_npdcch::alloc_t npdcch;
   };
   struct ul_alloc_t {
     enum type_t { NEWTX, NOADAPT_RETX, ADAPT_RETX, MSG3 };
@@ -123,7 +140,12 @@ public:
     type_t                   type;
     sched_ue*                user_ptr;
     ul_harq_proc::ul_alloc_t alloc;
-    uint32_t                 mcs = 0;
+    uint32_t                 mcs        = 0;
+    uint32_t                 i_ru       = 3; ///< number of RUs field of the DCI
+    uint32_t                 i_rep      = 0; ///< repetition number field of the DCI
+    uint32_t                 i_delay    = 0; ///< scheduling delay field of the DCI
+    uint32_t                 npusch_tti = 0; ///< first subframe of the NPUSCH
+    sched_npdcch::alloc_t    npdcch;
     bool                     is_retx() const { return type == NOADAPT_RETX or type == ADAPT_RETX; }
     bool                     is_msg3() const { return type == MSG3; }
     bool                     needs_npdcch() const { return type == NEWTX or type == ADAPT_RETX; }
@@ -150,7 +172,8 @@ public:
 //  // DL alloc methods
 //  alloc_outcome_t                      alloc_bc(uint32_t aggr_lvl, uint32_t sib_idx, uint32_t sib_ntx);
 //  alloc_outcome_t                      alloc_paging(uint32_t aggr_lvl, uint32_t paging_payload);
-  std::pair<alloc_outcome_t, uint32_t> alloc_rar(uint32_t aggr_lvl, const pending_rar_t& rar_grant);
+  std::pair<alloc_outcome_t, uint32_t>
+  alloc_rar(const sched_npdcch::alloc_t& npdcch_alloc, uint32_t npdsch_tti, const pending_rar_t& rar_grant);
 //  bool reserve_dl_rbgs(uint32_t rbg_start, uint32_t rbg_end) { return tti_alloc.reserve_dl_rbgs(rbg_start, rbg_end); }
   const std::vector<rar_alloc_t>& get_allocated_rars() const { return rar_allocs; }
 
@@ -162,11 +185,12 @@ public:
 //  bool alloc_phich(sched_ue* user, sched_interface::ul_sched_res_t* ul_sf_result);
 
   // compute DCIs and generate dl_sched_result/ul_sched_result for a given TTI
-  void generate_sched_results(sf_sched_result* sf_result);
+  void generate_sched_results(sf_sched_result* sf_result, bool dl_flag);
 
   // dl_tti_sched itf
 //  alloc_outcome_t  alloc_dl_user(sched_ue* user, const rbgmask_t& user_mask, uint32_t pid) final;
-  alloc_outcome_t  alloc_dl_user(sched_ue* user, uint32_t max_data) final;
+  alloc_outcome_t  alloc_dl_user(sched_ue* user, uint32_t max_data, uint32_t pid) final;
+  const std::vector<dl_alloc_t>& get_allocated_data() const { return data_allocs; }
   uint32_t         get_tti_tx_dl() const final { return tti_params.tti_tx_dl; }
 //  uint32_t         get_nof_ctrl_symbols() const final;
 //  const rbgmask_t& get_dl_mask() const final { return tti_alloc.get_dl_mask(); }
@@ -174,13 +198,16 @@ public:
   alloc_outcome_t  alloc_ul_user(sched_ue* user, ul_harq_proc::ul_alloc_t alloc) final;
 //  const prbmask_t& get_ul_mask() const final { return tti_alloc.get_ul_mask(); }
   uint32_t         get_tti_tx_ul() const final { return tti_params.tti_tx_ul; }
+  // A DCI of the UE-specific search space can still start at the TTI
+  bool             is_npdcch_free() const final { return npdcch->is_free(sched_npdcch::UE_SS, get_tti_tx_dl()); }
 
   // getters
   uint32_t            get_tti_rx() const { return tti_params.tti_rx; }
   const tti_params_t& get_tti_params() const { return tti_params; }
 
-  bool *dl_sched_table = nullptr;
-  bool *ul_sched_table = nullptr;
+  sched_timeline*         dl_timeline = nullptr;
+  sched_timeline*         ul_timeline = nullptr;
+  sched_npdcch*           npdcch      = nullptr;
   std::vector<bc_alloc_t>  bc_allocs;
 
 private:
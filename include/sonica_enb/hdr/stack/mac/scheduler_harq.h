@@ -28,64 +28,70 @@
 #include "srslte/common/tti_point.h"
 #include "srslte/interfaces/sched_interface_nb.h"
 #include <map>
+#include <vector>
 
 namespace sonica_enb {
 
 class harq_proc
 {
 public:
-//  void     init(uint32_t id);
-//  void     set_cfg(uint32_t max_retx);
-//  void     reset(uint32_t tb_idx);
-//  uint32_t get_id() const;
-//  bool     is_empty() const;
-//  bool     is_empty(uint32_t tb_idx) const;
-//
-//  uint32_t          nof_tx(uint32_t tb_idx) const;
-//  uint32_t          nof_retx(uint32_t tb_idx) const;
-//  srslte::tti_point get_tti() const;
-//  bool              get_ndi(uint32_t tb_idx) const;
-//  uint32_t          max_nof_retx() const;
+  void     init(uint32_t id);
+  void     set_cfg(uint32_t max_retx);
+  void     reset();
+  uint32_t get_id() const { return id; }
+  bool     is_empty() const { return not active; }
+
+  uint32_t          nof_tx() const { return tx_cnt; }
+  uint32_t          nof_retx() const { return n_rtx; }
+  srslte::tti_point get_tti() const { return tti; }
+  bool              get_ndi() const { return ndi; }
+  uint32_t          max_nof_retx() const { return max_retx; }
 
 protected:
-//  void new_tx_common(uint32_t tb_idx, srslte::tti_point tti, int mcs, int tbs);
-//  void new_retx_common(uint32_t tb_idx, srslte::tti_point tti, int* mcs, int* tbs);
-//  bool has_pending_retx_common(uint32_t tb_idx) const;
-//  int  set_ack_common(uint32_t tb_idx, bool ack);
-//  void reset_pending_data_common();
-//
-//  enum ack_t { NULL_ACK, NACK, ACK };
-//
-//  ack_t                           ack_state[SRSLTE_MAX_TB];
-//  bool                            active[SRSLTE_MAX_TB];
-//  std::array<bool, SRSLTE_MAX_TB> ndi = {};
-//  uint32_t                        id;
-//  uint32_t                        max_retx = 5;
-//  uint32_t                        n_rtx[SRSLTE_MAX_TB];
-//  uint32_t                        tx_cnt[SRSLTE_MAX_TB];
-//  srslte::tti_point               tti;
-//  int                             last_mcs[SRSLTE_MAX_TB];
-//  int                             last_tbs[SRSLTE_MAX_TB];
+  void new_tx_common(srslte::tti_point tti, int mcs, int tbs);
+  void new_retx_common(srslte::tti_point tti, int* mcs, int* tbs);
+  int  set_ack_common(bool ack);
+
+  enum ack_t { NULL_ACK, NACK, ACK };
+
+  ack_t             ack_state = NULL_ACK;
+  bool              active    = false;
+  bool              ndi       = false;
+  uint32_t          id        = 0;
+  uint32_t          max_retx  = 5;
+  uint32_t          n_rtx     = 0;
+  uint32_t          tx_cnt    = 0;
+  srslte::tti_point tti;
+  int               last_mcs = -1;
+  int               last_tbs = -1;
 
   srslte::log_ref log_h;
 };
 
+/**
+ * DL HARQ process of a NPDSCH. The HARQ-ACK is received on NPUSCH Format 2 starting at tti_ack, a missing report
+ * (DTX) is handled as a NACK once max_ack_delay subframes have passed.
+ */
 class dl_harq_proc : public harq_proc
 {
 public:
-//  dl_harq_proc();
-//  void      new_tx(const rbgmask_t& new_mask, uint32_t tb_idx, uint32_t tti, int mcs, int tbs, uint32_t n_cce_);
-//  void      new_retx(const rbgmask_t& new_mask, uint32_t tb_idx, uint32_t tti_, int* mcs, int* tbs, uint32_t n_cce_);
-//  int       set_ack(uint32_t tb_idx, bool ack);
-//  rbgmask_t get_rbgmask() const;
-//  bool      has_pending_retx(uint32_t tb_idx, uint32_t tti) const;
-//  int       get_tbs(uint32_t tb_idx) const;
-//  uint32_t  get_n_cce() const;
-//  void      reset_pending_data();
+  // Format 2 with a single repetition, its decoding and the scheduling advance of the DL
+  const static uint32_t max_ack_delay = 2 + FDD_HARQ_DELAY_UL_MS + 2;
+
+  void new_tx(srslte::tti_point tti, int mcs, int tbs, uint32_t i_sf, srslte::tti_point tti_ack);
+  void new_retx(srslte::tti_point tti, srslte::tti_point tti_ack, int* mcs, int* tbs);
+  int  set_ack(bool ack);
+  void check_ack_timeout(srslte::tti_point tti_tx_dl);
+  bool has_pending_retx() const;
+  bool is_waiting_ack() const { return active and ack_state == NULL_ACK; }
+
+  int               get_tbs() const { return last_tbs; }
+  uint32_t          get_i_sf() const { return i_sf; }
+  srslte::tti_point get_tti_ack() const { return tti_ack; }
 
 private:
-//  rbgmask_t rbgmask;
-//  uint32_t  n_cce;
+  uint32_t          i_sf = 0;
+  srslte::tti_point tti_ack;
 };
 
 class ul_harq_proc : public harq_proc
@@ -127,37 +133,36 @@ class harq_entity
 public:
   static const bool is_async = ASYNC_DL_SCHED;
 
-//  harq_entity(size_t nof_dl_harqs, size_t nof_ul_harqs);
-//  void reset();
-//  void set_cfg(uint32_t max_retx);
-//
-//  size_t                           nof_dl_harqs() const { return dl_harqs.size(); }
+  explicit harq_entity(size_t nof_dl_harqs);
+  void reset();
+  void set_cfg(uint32_t max_retx);
+
+  size_t                           nof_dl_harqs() const { return dl_harqs.size(); }
 //  size_t                           nof_ul_harqs() const { return ul_harqs.size(); }
-//  std::vector<dl_harq_proc>&       dl_harq_procs() { return dl_harqs; }
-//  const std::vector<dl_harq_proc>& dl_harq_procs() const { return dl_harqs; }
+  std::vector<dl_harq_proc>&       dl_harq_procs() { return dl_harqs; }
+  const std::vector<dl_harq_proc>& dl_harq_procs() const { return dl_harqs; }
 //  std::vector<ul_harq_proc>&       ul_harq_procs() { return ul_harqs; }
 
   /**
-   * Get the DL harq proc based on tti_tx_dl
+   * Get the DL harq proc waiting for a retransmission, either NACKed or without ACK after the timeout
    * @param tti_tx_dl assumed to always be equal or ahead in time in comparison to current harqs
    * @return pointer to found dl_harq
    */
-//  dl_harq_proc* get_pending_dl_harq(uint32_t tti_tx_dl);
+  dl_harq_proc* get_pending_dl_harq(uint32_t tti_tx_dl);
   /**
    * Get empty DL Harq
    * @param tti_tx_dl only used in case of sync dl sched
    * @return pointer to found dl_harq
    */
-//  dl_harq_proc* get_empty_dl_harq(uint32_t tti_tx_dl);
+  dl_harq_proc* get_empty_dl_harq(uint32_t tti_tx_dl);
 
   /**
    * Set ACK state for DL Harq Proc
-   * @param tti_rx tti the DL ACK was received
-   * @param tb_idx TB index for the given ACK
+   * @param tti_rx tti the NPUSCH Format 2 carrying the ACK started
    * @param ack true for ACK and false for NACK
    * @return pair with pid and size of TB of the DL harq that was ACKed
    */
-//  std::pair<uint32_t, int> set_ack_info(uint32_t tti_rx, uint32_t tb_idx, bool ack);
+  std::pair<uint32_t, int> set_ack_info(uint32_t tti_rx, bool ack);
 
   //! Get UL Harq for a given tti_tx_ul
 //  ul_harq_proc* get_ul_harq(uint32_t tti_tx_ul);
@@ -167,15 +172,12 @@ public:
    */
 //  std::pair<bool, uint32_t> set_ul_crc(srslte::tti_point tti_tx_ul, uint32_t tb_idx, bool ack_);
 
-  //! Resets pending harq ACKs and cleans UL Harqs with maxretx == 0
-//  void reset_pending_data(uint32_t tti_rx);
-
 private:
-//  dl_harq_proc* get_oldest_dl_harq(uint32_t tti_tx_dl);
-//
-//  srslte::log_ref log_h;
-//
-//  std::vector<dl_harq_proc> dl_harqs;
+  dl_harq_proc* get_oldest_dl_harq(uint32_t tti_tx_dl);
+
+  srslte::log_ref log_h;
+
+  std::vector<dl_harq_proc> dl_harqs;
 //  std::vector<ul_harq_proc> ul_harqs;
 };
 
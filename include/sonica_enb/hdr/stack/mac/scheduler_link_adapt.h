@@ -0,0 +1,81 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_SCHEDULER_LINK_ADAPT_H
+#define SRSENB_NB_SCHEDULER_LINK_ADAPT_H
+
+#include "srslte/interfaces/sched_interface_nb.h"
+#include <stdint.h>
+
+namespace sonica_enb {
+
+/**
+ * UL outer loop link adaptation of a UE. The SNR the PHY measures on its NPUSCH is averaged and corrected by an offset
+ * which the CRC outcomes move, down by step on an error and up by step * bler / (1 - bler) on a success, so the BLER
+ * settles at the target. The NPUSCH format is then the shortest combination of MCS, RUs and repetitions whose SNR
+ * requirement the corrected SNR meets.
+ */
+class ul_link_adapt
+{
+public:
+  // NPUSCH Format 1 over 12 subcarriers, as the fields of DCI N0
+  struct ul_format_t {
+    uint32_t mcs    = 0;
+    uint32_t i_ru   = 3;
+    uint32_t i_rep  = 0;
+    uint32_t tbs    = 0; ///< in bits
+    uint32_t nof_sf = 4;
+  };
+
+  void set_cfg(const sched_interface::sched_args_t& args);
+  void reset();
+
+  void snr_info(float snr_db);
+  void crc_info(bool crc);
+
+  bool  has_snr() const { return snr_valid; }
+  float get_snr() const { return snr_avg + offset; }
+
+  /**
+   * Format to send req_bytes in at most max_nof_sf subframes. Until the first SNR report, or with a fixed MCS
+   * configured, it is the fixed format of 4 RUs without repetitions
+   */
+  ul_format_t select(uint32_t req_bytes, uint32_t max_nof_sf) const;
+
+private:
+  const static float SNR_AVG_COEFF;
+  const static float MAX_OFFSET_DB;
+
+  // SNR per repetition for a TB of tbs bits over nof_ru RUs at the target BLER
+  static float required_snr(uint32_t tbs, uint32_t nof_ru);
+
+  float target_bler = 0.1;
+  float step_db     = 1.0;
+  int   fixed_mcs   = -1;
+
+  bool  snr_valid = false;
+  float snr_avg   = 0;
+  float offset    = 0;
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_SCHEDULER_LINK_ADAPT_H
@@ -24,41 +24,167 @@
 #define SRSENB_NB_SCHEDULER_METRIC_H
 
 #include "scheduler.h"
+#include "srslte/common/logmap.h"
+#include <set>
+#include <unordered_map>
 
 namespace sonica_enb {
 
 class dl_metric_rr : public sched::metric_dl
 {
-  const static int MAX_RBG = 25;
-
 public:
 //  void set_params(const sched_cell_params_t& cell_params_) final;
-//  void sched_users(std::map<uint16_t, sched_ue>& ue_db, dl_sf_sched_itf* tti_sched) final;
+  void sched_users(sched_ue_db_t& ue_db, dl_sf_sched_itf* tti_sched) override;
 
-private:
+protected:
 //  bool          find_allocation(uint32_t min_nof_rbg, uint32_t max_nof_rbg, rbgmask_t* rbgmask);
-//  dl_harq_proc* allocate_user(sched_ue* user);
+  dl_harq_proc* allocate_user(sched_ue* user, dl_sf_sched_itf* tti_sched);
 
 //  const sched_cell_params_t* cc_cfg = nullptr;
-//  srslte::log_ref            log_h;
-//  dl_sf_sched_itf*           tti_alloc = nullptr;
+  srslte::log_ref log_h = srslte::logmap::get("MAC ");
 };
 
 class ul_metric_rr : public sched::metric_ul
 {
 public:
 //  void set_params(const sched_cell_params_t& cell_params_) final;
-//  void sched_users(std::map<uint16_t, sched_ue>& ue_db, ul_sf_sched_itf* tti_sched) final;
+  void sched_users(sched_ue_db_t& ue_db, ul_sf_sched_itf* tti_sched) override;
 
-private:
+protected:
 //  bool          find_allocation(uint32_t L, ul_harq_proc::ul_alloc_t* alloc);
-//  ul_harq_proc* allocate_user_newtx_prbs(sched_ue* user);
+  alloc_outcome_t allocate_user_newtx_prbs(sched_ue* user, ul_sf_sched_itf* tti_sched);
 //  ul_harq_proc* allocate_user_retx_prbs(sched_ue* user);
 
 //  const sched_cell_params_t* cc_cfg = nullptr;
-//  srslte::log_ref            log_h;
-//  ul_sf_sched_itf*           tti_alloc   = nullptr;
-//  uint32_t                   current_tti = 0;
+  srslte::log_ref log_h = srslte::logmap::get("MAC ");
+};
+
+/**
+ * Order of the UEs for the proportional fair metrics. The priority of a UE is its rate over the average of the bytes
+ * it was served per TTI. The rate is the same for every UE but for the repetitions of its CE level, the Rmax of the
+ * Type-2 common search space the NPRACH configuration gives the level, so over time each UE gets the same share of
+ * subframes however deep its coverage is.
+ *
+ * The averages are not aged one by one. All of them decay by the same factor every TTI, which does not change their
+ * order, so only the growing scale of the bytes served is tracked and a UE moves in the order only when it is served.
+ *
+ * Only the UEs with data to schedule are kept in the order. A UE enters it when it gets data and leaves it once a pass
+ * finds it drained, so a pass never walks the idle UEs.
+ */
+class sched_pf_order
+{
+public:
+  // Averaging window of about 1000 TTIs
+  explicit sched_pf_order(const std::vector<uint32_t>& ce_level_rep_, double alpha_ = 0.001) :
+    ce_level_rep(ce_level_rep_),
+    alpha(alpha_)
+  {
+  }
+
+  void ue_cfg(uint16_t rnti, uint32_t ce_level);
+  void ue_rem(uint16_t rnti);
+  void ue_backlogged(uint16_t rnti);
+  void new_tti();
+
+  /**
+   * Calls f(sched_ue&) once for each UE of the order from the highest priority on, as long as has_room() holds. f
+   * returns the bytes the UE was served, if any. A UE for which backlogged(sched_ue&) no longer holds leaves the order.
+   * Returns the number of UEs served
+   */
+  template <typename Func, typename Backlog, typename Pred>
+  uint32_t serve(sched_ue_db_t& ue_db, Func f, Backlog backlogged, Pred has_room);
+
+private:
+  // Average of the bytes served per TTI that a new UE starts with
+  const static double MIN_AVG;
+
+  struct ue_ctxt {
+    double weight;
+    double avg;    // in units of the current scale
+    bool   queued; // in the order
+  };
+  struct pf_key {
+    double   prio;
+    uint16_t rnti;
+    bool     operator<(const pf_key& other) const
+    {
+      return prio > other.prio or (prio == other.prio and rnti < other.rnti);
+    }
+  };
+
+  uint32_t nof_rep(uint32_t ce_level) const;
+  pf_key          key_of(uint16_t rnti, const ue_ctxt& ue) const { return {ue.weight / ue.avg, rnti}; }
+  void            served(uint16_t rnti, uint32_t bytes);
+
+  std::vector<uint32_t>                 ce_level_rep;
+  double                                alpha;
+  double                                scale = 1.0; // (1 - alpha)^-t
+  std::set<pf_key>                      order;
+  std::unordered_map<uint16_t, ue_ctxt> ues;
+
+  std::vector<std::pair<uint16_t, uint32_t> > served_ues; // of the current pass
+};
+
+template <typename Func, typename Backlog, typename Pred>
+uint32_t sched_pf_order::serve(sched_ue_db_t& ue_db, Func f, Backlog backlogged, Pred has_room)
+{
+  served_ues.clear();
+  for (auto it = order.begin(); it != order.end() and has_room();) {
+    uint16_t rnti = it->rnti;
+    auto     user = ue_db.find(rnti);
+    if (not user) {
+      // The UE was removed without ue_rem, e.g. by a reset of the scheduler
+      ues.erase(rnti);
+      it = order.erase(it);
+      continue;
+    }
+    uint32_t bytes = f(*user);
+    if (bytes > 0) {
+      served_ues.emplace_back(rnti, bytes);
+    }
+    if (not backlogged(*user)) {
+      ues[rnti].queued = false;
+      it               = order.erase(it);
+      continue;
+    }
+    ++it;
+  }
+
+  // The averages are updated once the pass is over, which reorders the UEs
+  for (const auto& s : served_ues) {
+    served(s.first, s.second);
+  }
+  return served_ues.size();
+}
+
+/**
+ * Proportional fair metrics. The UEs are tried in the order of their priority while a DCI still fits in the NPDCCH
+ * candidates starting at the TTI, two of one NCCE at most
+ */
+class dl_metric_pf : public dl_metric_rr
+{
+public:
+  explicit dl_metric_pf(const std::vector<uint32_t>& ce_level_rep) : order(ce_level_rep) {}
+  void sched_users(sched_ue_db_t& ue_db, dl_sf_sched_itf* tti_sched) final;
+  void ue_cfg(uint16_t rnti, const sched_ue& user) final { order.ue_cfg(rnti, user.get_ce_level()); }
+  void ue_rem(uint16_t rnti) final { order.ue_rem(rnti); }
+  void ue_backlogged(uint16_t rnti) final { order.ue_backlogged(rnti); }
+
+private:
+  sched_pf_order order;
+};
+
+class ul_metric_pf : public ul_metric_rr
+{
+public:
+  explicit ul_metric_pf(const std::vector<uint32_t>& ce_level_rep) : order(ce_level_rep) {}
+  void sched_users(sched_ue_db_t& ue_db, ul_sf_sched_itf* tti_sched) final;
+  void ue_cfg(uint16_t rnti, const sched_ue& user) final { order.ue_cfg(rnti, user.get_ce_level()); }
+  void ue_rem(uint16_t rnti) final { order.ue_rem(rnti); }
+  void ue_backlogged(uint16_t rnti) final { order.ue_backlogged(rnti); }
+
+private:
+  sched_pf_order order;
 };
 
 } // namespace sonica_enb
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_SCHEDULER_NPDCCH_H
+#define SRSENB_NB_SCHEDULER_NPDCCH_H
+
+#include "scheduler_timeline.h"
+#include "srslte/interfaces/sched_interface_nb.h"
+#include <array>
+
+namespace sonica_enb {
+
+/**
+ * NPDCCH allocator. It finds the candidates of the Type-1 and Type-2 common search spaces and of the UE-specific
+ * search space from Rmax, G and alpha_offset, TS 36.213 16.6, and keeps the NCCEs taken in each subframe, so two DCIs
+ * of one NCCE, e.g. a DL and a UL DCI, share a subframe. A candidate of R repetitions takes R valid DL subframes,
+ * which are reserved in the DL timeline for the other DL channels.
+ */
+class sched_npdcch
+{
+public:
+  enum ss_type_t { TYPE1_CSS = 0, TYPE2_CSS, UE_SS, NOF_SS };
+
+  struct alloc_t {
+    uint32_t                        tti     = 0; ///< first subframe of the NPDCCH
+    uint32_t                        rep_idx = 0; ///< DCI subframe repetition number field
+    sched_interface::npdcch_alloc_t npdcch  = {};
+  };
+
+  void init(sched_timeline* dl_timeline_, const sched_interface::sched_args_t& args);
+  void reset() { ncce_mask.fill(0); }
+
+  /**
+   * Finds the first candidate of the search space which starts at tti, repeats at least min_rep times and has its
+   * NCCEs free in all its subframes. A DCI of one NCCE (L=1) takes a candidate of one NCCE if the search space has
+   * them, both NCCEs otherwise. The Type-1 candidates start at the paging occasion, given in tti
+   */
+  bool find(ss_type_t ss, uint32_t tti, uint32_t L, uint32_t min_rep, alloc_t* alloc) const;
+  void reserve(const alloc_t& alloc);
+  // A DCI of one NCCE still fits at tti
+  bool is_free(ss_type_t ss, uint32_t tti) const { return find(ss, tti, 1, 1, nullptr); }
+  // Forgets the NCCEs of a past subframe
+  void release(uint32_t tti) { ncce_mask[tti % sched_timeline::NOF_TTIS] = 0; }
+
+  const sched_interface::npdcch_ss_cfg_t& get_ss_cfg(ss_type_t ss) const { return ss_cfg[ss]; }
+
+private:
+  const static uint32_t MAX_NOF_REP = 8;
+
+  // Repetitions of the candidates of a search space, TS 36.213 Tables 16.6-1 to 16.6-3
+  static uint32_t get_rep_list(ss_type_t ss, uint32_t r_max, uint32_t* rep);
+  // Index b of tti among the valid subframes of its search space period, -1 if tti is not a valid subframe
+  int get_ss_index(ss_type_t ss, uint32_t tti) const;
+  // The NCCEs in mask are free in the R valid subframes from tti on, the last of which goes into end_tti
+  bool is_span_free(uint32_t tti, uint32_t R, uint8_t mask, uint32_t* end_tti) const;
+
+  sched_timeline*                                      dl_timeline = nullptr;
+  std::array<sched_interface::npdcch_ss_cfg_t, NOF_SS> ss_cfg      = {};
+  std::array<uint8_t, sched_timeline::NOF_TTIS>        ncce_mask   = {};
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_SCHEDULER_NPDCCH_H
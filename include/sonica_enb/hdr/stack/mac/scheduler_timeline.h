@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef SRSENB_NB_SCHEDULER_TIMELINE_H
+#define SRSENB_NB_SCHEDULER_TIMELINE_H
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+namespace sonica_enb {
+
+/**
+ * Occupancy of the subframes of a hyperframe in one direction, one bit per TTI in 64-bit words. A second bitset marks
+ * the subframes an allocation may use, e.g. the NB-IoT DL subframes without NPBCH, NPSS, NSSS or SIB1, which NPDCCH and
+ * NPDSCH skip. Ranges wrap around the end of the hyperframe and every search is done a word at a time.
+ */
+class sched_timeline
+{
+public:
+  const static uint32_t NOF_TTIS  = 10240;
+  const static uint32_t NOF_WORDS = NOF_TTIS / 64;
+
+  sched_timeline();
+
+  // Marks the subframes set in valid, all of them by default
+  void set_valid(const std::vector<bool>& valid);
+  void reset();
+
+  bool is_valid(uint32_t tti) const { return get(valid_bits, tti); }
+  bool is_busy(uint32_t tti) const { return get(busy_bits, tti); }
+  // Valid and not taken
+  bool is_free(uint32_t tti) const { return is_valid(tti) and not is_busy(tti); }
+  // None of the len subframes from tti on, valid or not, is taken
+  bool is_range_free(uint32_t tti, uint32_t len) const;
+
+  // Valid subframes among the len subframes from tti on
+  uint32_t count_valid(uint32_t tti, uint32_t len) const;
+  // First valid subframe from tti on
+  uint32_t next_valid(uint32_t tti) const;
+  /**
+   * The k valid subframes from tti on, as an allocation which skips the invalid subframes sees them. Fails if any of
+   * them is taken
+   */
+  bool get_valid_span(uint32_t tti, uint32_t k, uint32_t* ttis) const;
+
+  void reserve(uint32_t tti) { busy_bits[word(tti)] |= bit(tti); }
+  void reserve(uint32_t tti, uint32_t len);
+  void reserve(const uint32_t* ttis, uint32_t n);
+  void release(uint32_t tti) { busy_bits[word(tti)] &= ~bit(tti); }
+
+private:
+  using bitset_t = std::array<uint64_t, NOF_WORDS>;
+
+  static uint32_t word(uint32_t tti) { return (tti % NOF_TTIS) / 64; }
+  static uint64_t bit(uint32_t tti) { return 1ULL << (tti % 64); }
+  static bool     get(const bitset_t& b, uint32_t tti) { return (b[word(tti)] & bit(tti)) != 0; }
+  static uint64_t first_mask(uint32_t tti, uint32_t i);
+
+  // Calls f(word index, mask) for the words covering the len subframes from tti on
+  template <typename Func>
+  static void for_each_word(uint32_t tti, uint32_t len, Func f);
+
+  bitset_t valid_bits;
+  bitset_t busy_bits;
+};
+
+} // namespace sonica_enb
+
+#endif // SRSENB_NB_SCHEDULER_TIMELINE_H
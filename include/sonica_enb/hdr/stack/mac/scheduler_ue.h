@@ -23,6 +23,7 @@
 #ifndef SRSENB_NB_SCHEDULER_UE_H
 #define SRSENB_NB_SCHEDULER_UE_H
 
+#include "rnti_table.h"
 #include "scheduler_common.h"
 #include "srslte/common/log.h"
 #include "srslte/mac/pdu.h"
@@ -30,6 +31,7 @@
 #include <vector>
 
 #include "scheduler_harq.h"
+#include "scheduler_link_adapt.h"
 #include <deque>
 
 namespace sonica_enb {
@@ -97,7 +99,7 @@ public:
   sched_ue();
   void reset();
   void phy_config_enabled(uint32_t tti, bool enabled);
-  void init(uint16_t rnti);
+  void init(uint16_t rnti, const sched_interface::sched_args_t& sched_args);
   void set_cfg(const sched_interface::ue_cfg_t& cfg);
 
 //  void set_bearer_cfg(uint32_t lc_id, srsenb::sched_interface::ue_bearer_cfg_t* cfg);
@@ -105,6 +107,7 @@ public:
 
   void dl_buffer_state(uint8_t lc_id, uint32_t tx_queue, uint32_t retx_queue);
   void ul_buffer_state(uint8_t lc_id, uint32_t bsr, bool set_value = true);
+  void ul_buffer_sub(uint32_t bytes);
   void ul_wait_timer(uint32_t wait_time, bool set_value = true);
 //  void ul_phr(int phr);
   void mac_buffer_state(uint32_t ce_code, uint32_t nof_cmds);
@@ -114,7 +117,9 @@ public:
 //  void set_dl_ri(uint32_t tti, uint32_t enb_cc_idx, uint32_t ri);
 //  void set_dl_pmi(uint32_t tti, uint32_t enb_cc_idx, uint32_t ri);
 //  void set_dl_cqi(uint32_t tti, uint32_t enb_cc_idx, uint32_t cqi);
-//  int  set_ack_info(uint32_t tti, uint32_t enb_cc_idx, uint32_t tb_idx, bool ack);
+  int  set_ack_info(uint32_t tti, bool ack);
+  void set_ul_crc(uint32_t tti, bool crc_res);
+  void set_ul_snr(uint32_t tti, float snr_db);
 //  void set_ul_crc(srslte::tti_point tti_rx, uint32_t enb_cc_idx, bool crc_res);
 
   /*******************************************************
@@ -124,8 +129,9 @@ public:
 //  void tpc_inc();
 //  void tpc_dec();
 //
-//  const dl_harq_proc&              get_dl_harq(uint32_t idx, uint32_t cc_idx) const;
+  const dl_harq_proc&              get_dl_harq(uint32_t idx) const;
   uint16_t                         get_rnti() const { return rnti; }
+  uint32_t                         get_ce_level() const { return cfg.ce_level; }
 //  std::pair<bool, uint32_t>        get_cell_index(uint32_t enb_cc_idx) const;
 //  const sched_interface::ue_cfg_t& get_ue_cfg() const { return cfg; }
 //  uint32_t                         get_aggr_level(uint32_t ue_cc_idx, uint32_t nof_bits);
@@ -141,10 +147,15 @@ public:
   uint32_t                      get_pending_dl_new_data();
   uint32_t                      get_pending_ul_new_data(uint32_t tti);
   uint32_t                      get_pending_ul_old_data(uint32_t cc_idx);
+  ul_link_adapt::ul_format_t    get_ul_format(uint32_t req_bytes, uint32_t max_nof_sf) const;
+  // Subcarrier spacing granted by the RAR, every later NPUSCH of the UE keeps it
+  void                          set_ul_sc_spacing(srslte_npusch_sc_spacing_t sc_spacing);
 //  uint32_t                      get_pending_dl_new_data_total();
 //
-//  dl_harq_proc* get_pending_dl_harq(uint32_t tti_tx_dl, uint32_t cc_idx);
-//  dl_harq_proc* get_empty_dl_harq(uint32_t tti_tx_dl, uint32_t cc_idx);
+  dl_harq_proc* get_pending_dl_harq(uint32_t tti_tx_dl);
+  dl_harq_proc* get_empty_dl_harq(uint32_t tti_tx_dl);
+  // Some DL HARQ process waits for its HARQ-ACK or a retx
+  bool          has_active_dl_harq() const;
 //  ul_harq_proc* get_ul_harq(uint32_t tti, uint32_t ue_cc_idx);
 
   /*******************************************************
@@ -172,15 +183,16 @@ public:
 //                       ul_harq_proc::ul_alloc_t          alloc,
                        bool                              needs_pdcch,
 //                       srslte_dci_location_t             cce_range,
-                       int                               explicit_mcs = -1);
+                       int                               explicit_mcs = -1,
+                       uint32_t                          i_ru         = 3,
+                       uint32_t                          i_rep        = 0);
 
-  int generate_formatN1(sched_interface::dl_sched_data_t* data,
+  int generate_formatN1(uint32_t                          pid,
+                        sched_interface::dl_sched_data_t* data,
                         uint32_t                          tti,
-                        //                       uint32_t                          cc_idx,
-                        //                       ul_harq_proc::ul_alloc_t          alloc,
-                        bool needs_pdcch,
-                        //                       srslte_dci_location_t             cce_range,
-                        uint32_t i_sf);
+                        uint32_t                          i_sf,
+                        uint32_t                          harq_ack,
+                        uint32_t                          tti_ack);
 
 //  srslte_dci_format_t get_dci_format();
 //  sched_dci_cce_t*    get_locations(uint32_t enb_cc_idx, uint32_t current_cfi, uint32_t sf_idx);
@@ -282,10 +294,21 @@ private:
 
   std::vector<sched_ue_carrier> carriers; ///< map of UE CellIndex to carrier configuration
 
+  // Rel-13 NB-IoT UEs have a single DL HARQ process (TS 36.321 Sec. 5.3.2)
+  harq_entity harq_ent;
+
+  ul_link_adapt ul_la;
+
+  srslte_npusch_sc_spacing_t ul_sc_spacing = SRSLTE_NPUSCH_SC_SPACING_15000;
+
   // Control Element Command queue
   using ce_cmd = srslte::dl_sch_lcid;
   std::deque<ce_cmd> pending_ces;
 };
+
+// Scheduler UEs indexed by C-RNTI, in the same slots as the UEs of the MAC
+using sched_ue_db_t = rnti_table<sched_ue>;
+
 } // namespace sonica_enb
 
 #endif // SRSENB_NB_SCHEDULER_UE_H
@@ -69,6 +69,7 @@ public:
                         sched_interface::dl_sched_pdu_t pdu[sched_interface::MAX_RLC_PDU_LIST],
                         uint32_t                        nof_pdu_elems,
                         uint32_t                        grant_size);
+  uint8_t* get_tx_pdu(uint32_t ue_cc_idx, uint32_t harq_pid, uint32_t tb_idx);
 //  uint8_t*
 //  generate_mch_pdu(uint32_t harq_pid, sched_interface::dl_pdu_mch_t sched, uint32_t nof_pdu_elems, uint32_t grant_size);
 //
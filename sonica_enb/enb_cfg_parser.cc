@@ -26,6 +26,8 @@
 #include "srslte/phy/common/phy_common.h"
 #include "srslte/srslte.h"
 // #include <boost/algorithm/string.hpp>
+#include <sstream>
+#include <sys/sysinfo.h>
 
 
 #define HANDLEPARSERCODE(cond)                                                                                         \
@@ -349,6 +351,30 @@ static void fill_sib_from_cell_cfg(rrc_cfg_t* rrc_cfg_)
   sib2->freq_info_r13.ul_carrier_freq_r13.carrier_freq_offset_r13 = rrc_cfg_->cell_spec.ul_carrier_offset;
 }
 
+// The MAC allocates the NPDCCH from the search spaces the UEs are configured with
+static void fill_npdcch_ss_cfg(const rrc_cfg_t* rrc_cfg_, sched_interface::sched_args_t* sched_args)
+{
+  const npdcch_cfg_ded_nb_r13_s& uss = rrc_cfg_->npdcch_cfg;
+  sched_args->npdcch_uss = {uss.npdcch_num_repeats_r13.to_number(),
+                            uss.npdcch_start_sf_uss_r13.to_number(),
+                            uss.npdcch_offset_uss_r13.to_number()};
+
+  // Only the CE level 0 is scheduled so far
+  const rr_cfg_common_sib_nb_r13_s& rr_cfg = rrc_cfg_->sib2.rr_cfg_common_r13;
+  if (rr_cfg.nprach_cfg_r13.nprach_params_list_r13.size() > 0) {
+    const nprach_params_nb_r13_s& ra = rr_cfg.nprach_cfg_r13.nprach_params_list_r13[0];
+    sched_args->npdcch_ra_css        = {ra.npdcch_num_repeats_ra_r13.to_number(),
+                                 ra.npdcch_start_sf_css_ra_r13.to_number(),
+                                 ra.npdcch_offset_ra_r13.to_number()};
+  }
+  // The repetitions of each CE level weigh its UEs in the proportional fair order
+  sched_args->ce_level_rep.clear();
+  for (const nprach_params_nb_r13_s& ra : rr_cfg.nprach_cfg_r13.nprach_params_list_r13) {
+    sched_args->ce_level_rep.push_back(ra.npdcch_num_repeats_ra_r13.to_number());
+  }
+  sched_args->npdcch_paging.r_max = rr_cfg.pcch_cfg_r13.npdcch_num_repeat_paging_r13.to_number();
+}
+
 int set_derived_args(all_args_t* args_, rrc_cfg_t* rrc_cfg_, phy_cfg_t* phy_cfg_)
 {
   // TODO: Check for a forced  DL EARFCN or frequency
@@ -366,6 +392,8 @@ int set_derived_args(all_args_t* args_, rrc_cfg_t* rrc_cfg_, phy_cfg_t* phy_cfg_
   // Fill certain SIB configurations from cell config
   fill_sib_from_cell_cfg(rrc_cfg_);
 
+  fill_npdcch_ss_cfg(rrc_cfg_, &args_->stack.mac.sched);
+
   // Patch certain args that are not exposed yet
   args_->rf.nof_carriers = 1;
   args_->rf.nof_antennas = args_->enb.nof_ports;
@@ -376,6 +404,151 @@ int set_derived_args(all_args_t* args_, rrc_cfg_t* rrc_cfg_, phy_cfg_t* phy_cfg_
   return SRSLTE_SUCCESS;
 }
 
+static std::string trim(const std::string& str)
+{
+  size_t first = str.find_first_not_of(" \t");
+  if (first == std::string::npos) {
+    return "";
+  }
+  return str.substr(first, str.find_last_not_of(" \t") - first + 1);
+}
+
+static bool parse_int(const std::string& str, int* value)
+{
+  char* end = nullptr;
+  long  v   = strtol(str.c_str(), &end, 10);
+  if (str.empty() || *end != '\0') {
+    return false;
+  }
+  *value = (int)v;
+  return true;
+}
+
+// Parses "2-3,5" into a core set
+static int parse_cores(const std::string& name, const std::string& str, cpu_set_t* cpus)
+{
+  int nof_cpus = get_nprocs_conf();
+
+  CPU_ZERO(cpus);
+  std::stringstream ss(str);
+  std::string       item;
+  while (std::getline(ss, item, ',')) {
+    item       = trim(item);
+    size_t sep = item.find('-');
+    int    first, last;
+    if (sep == std::string::npos) {
+      if (not parse_int(item, &first)) {
+        fprintf(stderr, "Invalid core '%s' for the %s thread\n", item.c_str(), name.c_str());
+        return SRSLTE_ERROR;
+      }
+      last = first;
+    } else if (not parse_int(trim(item.substr(0, sep)), &first) or
+               not parse_int(trim(item.substr(sep + 1)), &last)) {
+      fprintf(stderr, "Invalid core range '%s' for the %s thread\n", item.c_str(), name.c_str());
+      return SRSLTE_ERROR;
+    }
+    if (first < 0 or last < first or last >= CPU_SETSIZE) {
+      fprintf(stderr, "Invalid core range '%s' for the %s thread\n", item.c_str(), name.c_str());
+      return SRSLTE_ERROR;
+    }
+    COND_PARSER_WARN(last >= nof_cpus,
+                     "Warning: core %d for the %s thread is beyond the %d cores of this host\n",
+                     last,
+                     name.c_str(),
+                     nof_cpus);
+    for (int i = first; i <= last; i++) {
+      CPU_SET(i, cpus);
+    }
+  }
+  if (CPU_COUNT(cpus) == 0) {
+    fprintf(stderr, "Empty core set for the %s thread\n", name.c_str());
+    return SRSLTE_ERROR;
+  }
+  return SRSLTE_SUCCESS;
+}
+
+// Parses "[policy:priority][@cores]", with policy one of fifo, rr or other. An empty spec keeps the defaults
+static int parse_thread_spec(const std::string& name, const std::string& spec, threads_cfg_t* cfg)
+{
+  *cfg = {};
+
+  std::string str   = trim(spec);
+  size_t      at    = str.find('@');
+  std::string sched = trim(str.substr(0, at));
+
+  if (not sched.empty()) {
+    size_t      sep    = sched.find(':');
+    std::string policy = trim(sched.substr(0, sep));
+    std::string prio   = sep == std::string::npos ? "" : trim(sched.substr(sep + 1));
+
+    cfg->set_policy = true;
+    if (policy == "fifo") {
+      cfg->policy = SCHED_FIFO;
+    } else if (policy == "rr") {
+      cfg->policy = SCHED_RR;
+    } else if (policy == "other") {
+      cfg->policy = SCHED_OTHER;
+    } else {
+      fprintf(stderr, "Invalid scheduling policy '%s' for the %s thread\n", policy.c_str(), name.c_str());
+      return SRSLTE_ERROR;
+    }
+
+    if (cfg->policy == SCHED_OTHER) {
+      if (not prio.empty() and (not parse_int(prio, &cfg->priority) or cfg->priority != 0)) {
+        fprintf(stderr, "The %s thread takes no priority with the other policy\n", name.c_str());
+        return SRSLTE_ERROR;
+      }
+      cfg->priority = 0;
+    } else if (not parse_int(prio, &cfg->priority) or cfg->priority < sched_get_priority_min(cfg->policy) or
+               cfg->priority > sched_get_priority_max(cfg->policy)) {
+      fprintf(stderr,
+              "The %s thread needs a priority between %d and %d, got '%s'\n",
+              name.c_str(),
+              sched_get_priority_min(cfg->policy),
+              sched_get_priority_max(cfg->policy),
+              prio.c_str());
+      return SRSLTE_ERROR;
+    }
+  }
+
+  if (at != std::string::npos) {
+    return parse_cores(name, str.substr(at + 1), &cfg->cpus);
+  }
+  return SRSLTE_SUCCESS;
+}
+
+int parse_threads(all_args_t* args_)
+{
+  threads_args_t* t = &args_->threads;
+
+  HANDLEPARSERCODE(parse_thread_spec("txrx", t->txrx, &args_->phy.txrx_thread));
+  HANDLEPARSERCODE(parse_thread_spec("nprach", t->nprach, &args_->phy.nprach_thread));
+  HANDLEPARSERCODE(parse_thread_spec("decoder", t->decoder, &args_->phy.decoder_threads));
+  HANDLEPARSERCODE(parse_thread_spec("stack", t->stack, &args_->stack.thread));
+  HANDLEPARSERCODE(parse_thread_spec("logger", t->logger, &args_->log.thread));
+
+  // Either one spec shared by all the workers or one spec per worker
+  std::vector<std::string> specs;
+  std::stringstream        ss(t->sf_workers);
+  std::string              item;
+  while (std::getline(ss, item, ';')) {
+    specs.push_back(item);
+  }
+  uint32_t nof_workers = (uint32_t)SRSLTE_MAX(args_->phy.nof_phy_threads, 1);
+  if (specs.size() > 1 and specs.size() != nof_workers) {
+    fprintf(stderr, "sf_workers holds %zu specs for %d PHY threads\n", specs.size(), nof_workers);
+    return SRSLTE_ERROR;
+  }
+
+  args_->phy.worker_threads.resize(nof_workers);
+  for (uint32_t i = 0; i < nof_workers; i++) {
+    std::string spec = specs.empty() ? "" : specs[specs.size() > 1 ? i : 0];
+    HANDLEPARSERCODE(parse_thread_spec("sf_worker" + std::to_string(i), spec, &args_->phy.worker_threads[i]));
+  }
+
+  return SRSLTE_SUCCESS;
+}
+
 } // namespace enb_conf_sections
 
 namespace sib_sections {
@@ -45,6 +45,8 @@ namespace enb_conf_sections {
 
 int parse_cfg_files(all_args_t* args_, rrc_cfg_t* rrc_cfg_, phy_cfg_t* phy_cfg_);
 int set_derived_args(all_args_t* args_, rrc_cfg_t* rrc_cfg_, phy_cfg_t* phy_cfg_);
+// Fills the thread args of the PHY, the stack and the logger from the [threads] section
+int parse_threads(all_args_t* args_);
 
 }  // namespace enb_conf_sections
 
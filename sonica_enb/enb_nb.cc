@@ -24,6 +24,7 @@
 #include "sonica_enb/hdr/stack/enb_stack_nb.h"
 #include "enb_cfg_parser.h"
 #include "sonica/build_info.h"
+#include "sonica/common/trace.h"
 #include <iostream>
 
 namespace sonica_enb {
@@ -62,6 +63,18 @@ int enb_nb::init(const all_args_t& args_, srslte::logger* logger_)
   pool_log.set_level(srslte::LOG_LEVEL_ERROR);
   pool->set_log(&pool_log);
 
+  // The trace levels follow the order of the log levels
+  if (args.trace.enable) {
+    if (sonica_trace_init(args.trace.filename.c_str(), args.trace.ring_size)) {
+      log.console("Error starting the trace.\n");
+      return SRSLTE_ERROR;
+    }
+    sonica_trace_set_level(SONICA_TRACE_LAYER_PHY, (sonica_trace_level_t)level(args.trace.phy_level));
+    sonica_trace_set_level(SONICA_TRACE_LAYER_NPRACH, (sonica_trace_level_t)level(args.trace.nprach_level));
+    sonica_trace_set_level(SONICA_TRACE_LAYER_MAC, (sonica_trace_level_t)level(args.trace.mac_level));
+    sonica_trace_set_level(SONICA_TRACE_LAYER_SCHED, (sonica_trace_level_t)level(args.trace.sched_level));
+  }
+
   std::unique_ptr<enb_stack_nb> nb_stack(new enb_stack_nb(logger));
   if (!nb_stack) {
     log.console("Error creating eNB stack.\n");
@@ -81,13 +94,14 @@ int enb_nb::init(const all_args_t& args_, srslte::logger* logger_)
   }
 
   // Init layers
-  if (lte_radio->init(args.rf, nullptr)) {
+  // The PHY counts the radio underflows, overflows and late transmissions
+  if (lte_radio->init(args.rf, nb_phy.get())) {
     log.console("Error initializing radio.\n");
     ret = SRSLTE_ERROR;
   }
 
   if (nb_phy->init(args.phy, phy_cfg, lte_radio.get(), nb_stack.get())) {
-    log.console("Error initializing stack.\n");
+    log.console("Error initializing PHY.\n");
     ret = SRSLTE_ERROR;
   }
 
@@ -102,7 +116,10 @@ int enb_nb::init(const all_args_t& args_, srslte::logger* logger_)
   radio = std::move(lte_radio);
 
   log.console("\n==== eNodeB started ===\n");
-  log.console("Type <t> to view trace\n");
+  log.console("Type <t> to view TTI timing\n");
+  if (args.trace.enable) {
+    log.console("Type <1>-<4> to change the trace level of PHY, NPRACH, MAC and SCHED\n");
+  }
 
   started = (ret == SRSLTE_SUCCESS);
 
@@ -127,6 +144,15 @@ void enb_nb::stop()
 
     started = false;
   }
+
+  // A failed init may have started the trace as well
+  if (args.trace.enable) {
+    sonica_trace_stop();
+    uint64_t nof_dropped = sonica_trace_nof_dropped();
+    if (nof_dropped > 0) {
+      log.console("Trace: %ld events dropped\n", (long)nof_dropped);
+    }
+  }
 }
 
 int enb_nb::parse_args(const all_args_t& args_)
@@ -139,7 +165,38 @@ int enb_nb::parse_args(const all_args_t& args_)
 
 void enb_nb::print_pool()
 {
-  srslte::byte_buffer_pool::get_instance()->print_all_buffers();
+  srslte::buffer_pool_metrics_t m = {};
+  pool->get_metrics(m);
+  printf("Buffer pool: %d/%d used, %d cached, %ld failed allocations\n",
+         m.nof_used,
+         m.capacity,
+         m.nof_cached,
+         (long)m.nof_alloc_fail);
+}
+
+void enb_nb::print_timing()
+{
+  if (phy_h) {
+    phy_h->print_timing();
+  }
+}
+
+void enb_nb::log_timing()
+{
+  if (phy_h) {
+    phy_h->log_timing();
+  }
+}
+
+void enb_nb::cycle_trace_level(uint32_t layer)
+{
+  if (not args.trace.enable or layer >= SONICA_TRACE_NOF_LAYERS) {
+    return;
+  }
+  sonica_trace_layer_t l    = (sonica_trace_layer_t)layer;
+  uint32_t             next = (sonica_trace_get_level(l) + 1) % SONICA_TRACE_NOF_LEVELS;
+  sonica_trace_set_level(l, (sonica_trace_level_t)next);
+  printf("Trace level of %s: %s\n", sonica_trace_layer_name(l), sonica_trace_level_name((sonica_trace_level_t)next));
 }
 
 // bool enb_nb::get_metrics(srsenb::enb_metrics_t* m)
@@ -36,6 +36,7 @@
 #include <memory>
 #include <string>
 
+#include "enb_cfg_parser.h"
 #include "sonica_enb/hdr/enb_nb.h"
 
 using namespace std;
@@ -127,8 +128,35 @@ int parse_args(all_args_t* args, int argc, char* argv[])
   pcap->add_option("--s1ap_enable", args->stack.s1ap_pcap.enable, "Enable S1AP packet captures for wireshark")->default_val(false);
   pcap->add_option("--s1ap_filename", args->stack.s1ap_pcap.filename, "S1AP layer capture filename")->default_val("enb_s1ap.pcap");
 
+  CLI::App *scheduler = app.add_subcommand("scheduler")->configurable();
+  scheduler->add_option("--policy", args->stack.mac.sched.sched_policy, "Order of the UEs, rr (round robin) or pf (proportional fair)")->default_val("pf");
+  scheduler->add_option("--pusch_mcs", args->stack.mac.sched.pusch_mcs, "Fixed MCS of the NPUSCH, -1 for the UL link adaptation")->default_val(-1);
+  scheduler->add_option("--ul_target_bler", args->stack.mac.sched.ul_target_bler, "Target BLER of the UL link adaptation")->default_val(0.1);
+  scheduler->add_option("--ul_olla_step", args->stack.mac.sched.ul_olla_step_db, "Step in dB of the UL outer loop on a CRC error")->default_val(1.0);
+
   CLI::App *expert = app.add_subcommand("expert")->configurable();
+  expert->add_option("--nof_phy_threads", args->phy.nof_phy_threads, "Number of PHY threads")->default_val(1);
+  expert->add_option("--nof_decoder_threads", args->phy.nof_decoder_threads, "Number of NPUSCH decoder threads")->default_val(1);
   expert->add_option("--emulate_nprach", args->phy.emulate_nprach, "Enable emulated nprach")->default_val(false);
+  expert->add_option("--print_buffer_state", args->general.print_buffer_state, "Print the usage of the buffer pool every 10 s")->default_val(false);
+  expert->add_option("--nb_srate", args->phy.nb_srate_hz, "Sample rate of a standalone carrier in Hz (0 for the LTE base rate)")->default_val(0);
+
+  CLI::App *trace = app.add_subcommand("trace")->configurable();
+  trace->add_option("--enable", args->trace.enable, "Enable the binary trace of the TTI processing")->default_val(false);
+  trace->add_option("--filename", args->trace.filename, "Trace filename, read by sonica_trace_decoder")->default_val("/tmp/enb_nb.trace");
+  trace->add_option("--ring_size", args->trace.ring_size, "Events buffered per thread")->default_val(4096);
+  trace->add_option("--phy_level", args->trace.phy_level, "PHY trace level")->default_val("info");
+  trace->add_option("--nprach_level", args->trace.nprach_level, "NPRACH trace level")->default_val("info");
+  trace->add_option("--mac_level", args->trace.mac_level, "MAC trace level")->default_val("info");
+  trace->add_option("--sched_level", args->trace.sched_level, "Scheduler trace level")->default_val("info");
+
+  CLI::App *threads = app.add_subcommand("threads")->configurable();
+  threads->add_option("--txrx", args->threads.txrx, "Scheduling of the TXRX thread, as [policy:priority][@cores]");
+  threads->add_option("--sf_workers", args->threads.sf_workers, "Scheduling of the sf_workers, one or one per worker separated by ';'");
+  threads->add_option("--nprach", args->threads.nprach, "Scheduling of the NPRACH worker");
+  threads->add_option("--decoder", args->threads.decoder, "Scheduling of the NPUSCH decoder threads");
+  threads->add_option("--stack", args->threads.stack, "Scheduling of the stack thread");
+  threads->add_option("--logger", args->threads.logger, "Scheduling of the logger thread");
 
   app.add_option("config_file", config_file, "eNodeB configuration file");
 
@@ -258,13 +286,20 @@ int parse_args(all_args_t* args, int argc, char* argv[])
     exit(1);
   }
 
+  // The logger thread is started before the eNB, so the thread section is parsed here
+  if (enb_conf_sections::parse_threads(args) != SRSLTE_SUCCESS) {
+    cout << "Failed to parse the thread configuration - exiting" << endl;
+    exit(1);
+  }
+
   return 1;
 }
 
 void* input_loop(void* m)
 {
   // metrics_stdout* metrics = (metrics_stdout*)m;
-  char            key;
+  sonica_enb::enb_nb* enb = (sonica_enb::enb_nb*)m;
+  char                key;
   while (running) {
     cin >> key;
     if (cin.eof() || cin.bad()) {
@@ -272,6 +307,7 @@ void* input_loop(void* m)
       break;
     } else {
       if ('t' == key) {
+        enb->print_timing();
         // do_metrics = !do_metrics;
         // if (do_metrics) {
         //   cout << "Enter t to stop trace." << endl;
@@ -279,6 +315,8 @@ void* input_loop(void* m)
         //   cout << "Enter t to restart trace." << endl;
         // }
         // metrics->toggle_print(do_metrics);
+      } else if (key >= '1' and key <= '4') {
+        enb->cycle_trace_level(key - '1');
       } else if ('q' == key) {
         raise(SIGTERM);
       }
@@ -308,6 +346,7 @@ int main(int argc, char* argv[])
   if (args.log.filename == "stdout") {
     logger = &logger_stdout;
   } else {
+    logger_file.set_thread_cfg(args.log.thread);
     logger_file.init(args.log.filename, args.log.file_max_size);
     logger = &logger_file;
   }
@@ -334,7 +373,7 @@ int main(int argc, char* argv[])
 
   // create input thread
   pthread_t input;
-  pthread_create(&input, nullptr, &input_loop, NULL /* &metrics_screen */);
+  pthread_create(&input, nullptr, &input_loop, enb.get() /* &metrics_screen */);
 
   bool signals_pregenerated = false;
   // if (running) {
@@ -344,11 +383,12 @@ int main(int argc, char* argv[])
   // }
   int cnt = 0;
   while (running) {
+    enb->log_timing();
     if (args.general.print_buffer_state) {
       cnt++;
       if (cnt == 1000) {
         cnt = 0;
-        // enb->print_pool();
+        enb->print_pool();
       }
     }
     usleep(10000);
@@ -21,133 +21,260 @@
  */
 
 #include "sonica_enb/hdr/phy/nprach_worker.h"
+#include "sonica/common/trace.h"
 #include "srslte/srslte.h"
 
 namespace sonica_enb {
 
-int nprach_worker::init(const srslte_nbiot_cell_t&      cell_,
-                        const phy_args_t&               args_,
-                        // const srslte_prach_cfg_t&       prach_cfg_,
-                        stack_interface_phy_nb*         stack_,
-                        srslte::log*                    log_h_,
-                        int                             priority)
+nprach_worker::~nprach_worker()
 {
-  log_h      = log_h_;
-  stack      = stack_;
-  // nprach_cfg = prach_cfg_;
-  cell       = cell_;
+  stop();
+}
+
+int nprach_worker::init(const srslte_nbiot_cell_t&                cell_,
+                        const phy_args_t&                         args_,
+                        const asn1::rrc::nprach_cfg_sib_nb_r13_s& nprach_cfg,
+                        uint32_t                                  symbol_sz,
+                        stack_interface_phy_nb*                   stack_,
+                        srslte::log*                              log_h_,
+                        int                                       priority)
+{
+  log_h          = log_h_;
+  stack          = stack_;
+  cell           = cell_;
   emulate_nprach = args_.emulate_nprach;
+  sf_len         = SRSLTE_SF_LEN(symbol_sz);
+
+  bool cp_66us = nprach_cfg.nprach_cp_len_r13.value == asn1::rrc::nprach_cfg_sib_nb_r13_s::nprach_cp_len_r13_opts::us66dot7;
+
+  // One detector per CE level
+  for (uint32_t i = 0; i < nprach_cfg.nprach_params_list_r13.size(); i++) {
+    const asn1::rrc::nprach_params_nb_r13_s& params = nprach_cfg.nprach_params_list_r13[i];
+
+    std::unique_ptr<level_t> level(new level_t);
+    level->ce_level = i;
+    level->period   = params.nprach_periodicity_r13.to_number();
+    level->start    = params.nprach_start_time_r13.to_number();
+
+    sonica_nprach_cfg_t cfg = {};
+    cfg.format              = cp_66us ? SONICA_NPRACH_FORMAT_0 : SONICA_NPRACH_FORMAT_1;
+    cfg.sc_offset           = params.nprach_subcarrier_offset_r13.to_number();
+    cfg.nof_sc              = params.nprach_num_subcarriers_r13.to_number();
+    cfg.nof_reps            = params.num_repeats_per_preamb_attempt_r13.to_number();
 
-  if (sonica_nprach_init(&nprach)) {
-    return -1;
+    if (sonica_nprach_init(&level->nprach, symbol_sz) || sonica_nprach_set_cell(&level->nprach, cell) ||
+        sonica_nprach_set_cfg(&level->nprach, &cfg)) {
+      log_h->error("NPRACH: error configuring CE level %d\n", i);
+      return -1;
+    }
+    level->nof_sf = (sonica_nprach_occasion_len(&level->nprach) + sf_len - 1) / sf_len;
+    if (level->start + level->nof_sf > level->period) {
+      log_h->error("NPRACH: CE level %d occasion of %d ms does not fit in its %d ms period\n",
+                   i,
+                   level->nof_sf,
+                   level->period);
+      return -1;
+    }
+
+    log_h->info("NPRACH: CE level %d, period=%d ms, start=%d ms, subcarriers=%d+%d, reps=%d, cp=%s, %d ms\n",
+                i,
+                level->period,
+                level->start,
+                cfg.sc_offset,
+                cfg.nof_sc,
+                cfg.nof_reps,
+                cp_66us ? "66.7us" : "266.7us",
+                level->nof_sf);
+    levels.push_back(std::move(level));
+  }
+  if (levels.empty()) {
+    log_h->warning("NPRACH: no CE level configured\n");
   }
 
-  // if (sonica_nprach_set_cell(&nprach)) {
-  //   return -1;
-  // }
+  detector_pool.reset(new srslte::task_thread_pool(SRSLTE_MAX(levels.size(), 1)));
+  detector_pool->start(args_.nprach_thread, priority);
 
-  start(priority);
   initiated = true;
-
-  sf_cnt = 0;
   return 0;
 }
 
 void nprach_worker::stop()
 {
-  running = false;
-  sonica_nprach_free(&nprach);
+  if (detector_pool) {
+    detector_pool->stop();
+    detector_pool.reset();
+  }
+
+  for (auto& level : levels) {
+    level->chunks.clear();
+    level->current.release();
+    sonica_nprach_free(&level->nprach);
+  }
+  levels.clear();
 
-  pending_buffers.push(nullptr);
-  wait_thread_finish();
+  initiated = false;
 }
 
-int nprach_worker::new_tti(uint32_t tti_rx, cf_t* buffer_rx)
+void nprach_worker::set_rx_ring(const rx_sf_ring* ring, uint32_t nof_reserved_)
 {
-  // TODO: Compute timing of RA according to config, push actual buffer
-  // for computation
-  if (tti_rx % 160 == 64 || sf_cnt) {
-    if (sf_cnt == 0) {
-      current_buffer = buffer_pool.allocate();
-      if (!current_buffer) {
-        log_h->warning("PRACH skipping tti=%d due to lack of available buffers\n", tti_rx);
-        return 0;
+  rx_ring      = ring;
+  nof_reserved = nof_reserved_;
+}
+
+int nprach_worker::new_tti(uint32_t tti_rx, const rx_sf_ring::view& sf)
+{
+  if (!initiated) {
+    return 0;
+  }
+
+  // The ring was full and the subframe is lost, so are the occasions it belongs to
+  if (sf.empty()) {
+    for (auto& l : levels) {
+      if (l->active) {
+        skip_occasion(l.get());
       }
     }
-    if (!current_buffer) {
-      log_h->error("PRACH: Expected available current_buffer\n");
-      return -1;
-    }
-    if (current_buffer->nof_samples + SRSLTE_SF_LEN_PRB(1) < sf_buffer_sz) {
-      memcpy(&current_buffer->samples[sf_cnt * SRSLTE_SF_LEN_PRB(1)],
-             buffer_rx,
-             sizeof(cf_t) * SRSLTE_SF_LEN_PRB(1));
-      current_buffer->nof_samples += SRSLTE_SF_LEN_PRB(1);
-      if (sf_cnt == 0) {
-        current_buffer->tti = tti_rx;
+    return 0;
+  }
+
+  for (auto& l : levels) {
+    level_t* level = l.get();
+    if (!level->active) {
+      if (tti_rx % level->period != level->start) {
+        continue;
       }
-    } else {
-      log_h->error("PRACH: Not enough space in current_buffer\n");
-      return -1;
+      level->active = true;
+      level->tti    = tti_rx;
+      level->sf_cnt = 0;
     }
-    sf_cnt++;
-    if (sf_cnt == 7) {
-      sf_cnt = 0;
-      pending_buffers.push(current_buffer);
+
+    // Leave the ring to the sf_workers if the detection falls behind
+    if (rx_ring && rx_ring->get_nof_free() <= nof_reserved) {
+      skip_occasion(level);
+      continue;
     }
-  }
 
+    // Subframes are appended while contiguous, the ring wrapping around starts a new chunk
+    if (!level->current.append(sf)) {
+      push_chunk(level, false);
+      level->current = sf;
+    }
+    level->sf_cnt++;
+
+    bool last = level->sf_cnt == level->nof_sf;
+    if (last || level->current.get_nof_sf() == max_chunk_sf) {
+      push_chunk(level, last);
+    }
+    if (last) {
+      level->active = false;
+    }
+  }
 
   return 0;
 }
 
-int nprach_worker::run_tti(sf_buffer* b)
+void nprach_worker::push_chunk(level_t* level, bool last)
 {
-  // MOCK: invoke 
-  /*
-  if (tti_rx == 384) {
-    
+  chunk_t chunk;
+  chunk.samples = std::move(level->current);
+  chunk.tti     = level->tti;
+  chunk.last    = last;
+  level->chunks.push(std::move(chunk));
+  detector_pool->push_task([this, level](uint32_t worker_id) { run_level(level); });
+}
+
+void nprach_worker::skip_occasion(level_t* level)
+{
+  SONICA_TRACE(NPRACH_SKIP, level->tti, 0, level->ce_level);
+  if (level->nof_skipped++ % warn_period == 0) {
+    log_h->warning("NPRACH: skipping the occasion of CE level %d at tti=%d, no free RX buffers (%d skipped)\n",
+                   level->ce_level,
+                   level->tti,
+                   level->nof_skipped);
   }
-  */
-  uint32_t index;
+  drop_occasion(level);
+}
+
+void nprach_worker::drop_occasion(level_t* level)
+{
+  level->current.release();
+  push_chunk(level, true);
+  level->active = false;
+}
 
-  printf("Detecting %d samples at TTI %d\n", b->nof_samples, b->tti);
-  int ret = sonica_nprach_detect(&nprach, b->samples, b->nof_samples, NULL, &index, NULL);
-  sonica_nprach_detect_reset(&nprach);
+void nprach_worker::run_level(level_t* level)
+{
+  std::lock_guard<std::mutex> lock(level->mutex);
 
-  if (!emulate_nprach) {
-    if (ret) {
-      stack->rach_detected(b->tti, index, 5);
-    }
-  } else {
-    if (b->tti == 384) {
-      stack->rach_detected(b->tti, 41, 5);
+  chunk_t chunk;
+  while (level->chunks.try_pop(&chunk)) {
+    run_chunk(level, chunk);
+  }
+}
+
+void nprach_worker::run_chunk(level_t* level, const chunk_t& chunk)
+{
+  if (!chunk.samples.empty() && !level->done) {
+    SONICA_TRACE(NPRACH_DETECT, chunk.tti, 0, chunk.samples.get_nof_samples(), level->ce_level);
+    int ret = sonica_nprach_detect(&level->nprach,
+                                   chunk.samples.get(0),
+                                   chunk.samples.get_nof_samples(),
+                                   NULL,
+                                   level->indices,
+                                   level->offsets,
+                                   level->p2avg,
+                                   &level->nof_det);
+    if (ret < 0) {
+      log_h->error("NPRACH: error detecting preambles at tti=%d\n", chunk.tti);
+    } else if (ret == 1) {
+      report(level, chunk.tti);
+      level->done = true;
+    } else if (chunk.last) {
+      SONICA_TRACE(NPRACH_INCOMPLETE, chunk.tti, 0, level->ce_level);
+      if (level->nof_incomplete++ % warn_period == 0) {
+        log_h->warning("NPRACH: occasion of CE level %d at tti=%d is incomplete (%d incomplete)\n",
+                       level->ce_level,
+                       chunk.tti,
+                       level->nof_incomplete);
+      }
     }
   }
-  //printf("MOCK: detected RACH at 38.4\n");
-  // if (b->tti != 64 && b->tti != 5184) {
-  //   stack->rach_detected(b->tti, b->tti + 7, 42, 0);
-  // }
 
-  return 0;
+  if (chunk.last) {
+    sonica_nprach_detect_reset(&level->nprach);
+    level->done = false;
+  }
 }
 
-void nprach_worker::run_thread()
+void nprach_worker::report(level_t* level, uint32_t tti)
 {
-  running = true;
-  while (running) {
-    sf_buffer* b = pending_buffers.wait_pop();
-    if (running && b) {
-      int ret = run_tti(b);
-      b->reset();
-      buffer_pool.deallocate(b);
-      if (ret) {
-        running = false;
-      }
-    } else {
-      running = false;
+  if (emulate_nprach) {
+    if (level->ce_level == 0 && tti == 384) {
+      stack->rach_detected(tti, 41, 5, level->ce_level);
     }
+    return;
+  }
+
+  for (uint32_t i = 0; i < level->nof_det; i++) {
+    // TA command in units of 16 Ts (0.52 us)
+    uint32_t ta = (uint32_t)(level->offsets[i] * 1e6 / 0.52);
+    SONICA_TRACE(NPRACH_PREAMBLE,
+                 tti,
+                 0,
+                 level->ce_level,
+                 level->indices[i],
+                 level->offsets[i] * 1e9,
+                 level->p2avg[i] * 10,
+                 ta);
+    log_h->info("NPRACH: tti=%d, CE level %d, preamble=%d, offset=%.1f us, p2avg=%.1f, ta=%d\n",
+                tti,
+                level->ce_level,
+                level->indices[i],
+                level->offsets[i] * 1e6,
+                level->p2avg[i],
+                ta);
+    stack->rach_detected(tti, level->indices[i], ta, level->ce_level);
   }
 }
 
-}
\ No newline at end of file
+} // namespace sonica_enb
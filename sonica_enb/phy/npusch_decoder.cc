@@ -0,0 +1,175 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica/common/trace.h"
+#include "sonica_enb/hdr/phy/npusch_decoder.h"
+#include "srslte/srslte.h"
+
+#define Error(fmt, ...)                                                                                                \
+  if (SRSLTE_DEBUG_ENABLED)                                                                                            \
+  log_h->error(fmt, ##__VA_ARGS__)
+#define Warning(fmt, ...)                                                                                              \
+  if (SRSLTE_DEBUG_ENABLED)                                                                                            \
+  log_h->warning(fmt, ##__VA_ARGS__)
+#define Info(fmt, ...)                                                                                                 \
+  if (SRSLTE_DEBUG_ENABLED)                                                                                            \
+  log_h->info(fmt, ##__VA_ARGS__)
+#define Debug(fmt, ...)                                                                                                \
+  if (SRSLTE_DEBUG_ENABLED)                                                                                            \
+  log_h->debug(fmt, ##__VA_ARGS__)
+
+namespace sonica_enb {
+
+npusch_decoder::npusch_decoder() :
+  job_pool(nof_jobs),
+  queue_tprof("npusch_queue_tprof", "PHY", 100),
+  decode_tprof("npusch_decode_tprof", "PHY", 100)
+{
+}
+
+npusch_decoder::~npusch_decoder()
+{
+  stop();
+}
+
+int npusch_decoder::init(const srslte_nbiot_cell_t& cell,
+                         stack_interface_phy_nb*    stack_,
+                         srslte::log*               log_h_,
+                         uint32_t                   nof_threads,
+                         const threads_cfg_t&       thread_cfg,
+                         int                        priority)
+{
+  stack = stack_;
+  log_h = log_h_;
+
+  decoders.resize(SRSLTE_MAX(nof_threads, 1));
+  for (decoder_t& d : decoders) {
+    if (sonica_npusch_init_enb(&d.npusch)) {
+      Error("Error creating NPUSCH object\n");
+      return SRSLTE_ERROR;
+    }
+    if (sonica_npusch_set_cell(&d.npusch, cell)) {
+      Error("Error setting NPUSCH cell\n");
+      return SRSLTE_ERROR;
+    }
+  }
+
+  decoder_pool.reset(new srslte::task_thread_pool(decoders.size()));
+  decoder_pool->start(thread_cfg, priority);
+
+  initiated = true;
+  return SRSLTE_SUCCESS;
+}
+
+void npusch_decoder::stop()
+{
+  if (decoder_pool) {
+    decoder_pool->stop();
+    decoder_pool.reset();
+  }
+
+  for (decoder_t& d : decoders) {
+    sonica_npusch_free(&d.npusch);
+  }
+  decoders.clear();
+
+  initiated = false;
+}
+
+int npusch_decoder::push(const sonica_enb_ul_nbiot_grant_t* grant, uint32_t tti, uint16_t rnti, uint8_t* data)
+{
+  if (!initiated) {
+    return SRSLTE_ERROR;
+  }
+
+  uint32_t nof_bits = grant->npusch_cfg.nbits.nof_bits;
+  if (nof_bits > max_bits) {
+    Error("NPUSCH decoder: %d bits exceed the %d bits of a job\n", nof_bits, max_bits);
+    return SRSLTE_ERROR;
+  }
+
+  decode_job* job = job_pool.allocate("npusch_decoder");
+  if (!job) {
+    Warning("NPUSCH decoder skipping tti=%d due to lack of available buffers\n", tti);
+    return SRSLTE_ERROR;
+  }
+
+  job->npusch_cfg = grant->npusch_cfg;
+  job->tti        = tti;
+  job->rnti       = rnti;
+  job->data       = data;
+  sonica_npusch_softbits_copy(&job->softbits, &grant->softbits, nof_bits);
+
+  auto queue_meas = queue_tprof.start();
+  decoder_pool->push_task([this, job, queue_meas](uint32_t worker_id) mutable {
+    queue_meas.stop();
+    run_job(worker_id, job);
+  });
+
+  return SRSLTE_SUCCESS;
+}
+
+void npusch_decoder::run_job(uint32_t worker_id, decode_job* job)
+{
+  decoder_t& d = decoders[worker_id];
+
+  auto decode_meas = decode_tprof.start();
+
+  Debug("Decoding NPUSCH with %d RU(s) x %d repetitions for RNTI %x, tti=%d\n",
+        job->npusch_cfg.grant.nof_ru,
+        job->npusch_cfg.grant.nof_rep,
+        job->rnti,
+        job->tti);
+  int ret = sonica_npusch_decode_softbits(&d.npusch, &job->npusch_cfg, &job->softbits, job->data);
+  ret     = (ret == SRSLTE_SUCCESS) ? SRSLTE_SUCCESS : SRSLTE_ERROR;
+
+  decode_meas.stop();
+
+  report(job, ret);
+
+  job->reset();
+  job_pool.deallocate(job);
+}
+
+void npusch_decoder::report(decode_job* job, int ret)
+{
+  uint32_t tti  = job->tti;
+  uint16_t rnti = job->rnti;
+  uint8_t* data = job->data;
+  int      len  = job->npusch_cfg.grant.mcs.tbs / 8;
+
+  SONICA_TRACE(PHY_NPUSCH_DECODED, tti, rnti, ret, len);
+  if (ret == SRSLTE_SUCCESS) {
+    SONICA_TRACE(PHY_UL_DATA,
+                 tti,
+                 rnti,
+                 len,
+                 sonica_trace_pack(data, len, 0),
+                 sonica_trace_pack(data, len, 1),
+                 sonica_trace_pack(data, len, 2),
+                 sonica_trace_pack(data, len, 3));
+    stack->crc_info(tti, rnti, len, true);
+  } else {
+    stack->crc_info(tti, rnti, len, false);
+  }
+}
+
+} // namespace sonica_enb
@@ -94,26 +94,53 @@ int phy::init(const phy_args_t&            args,
 
   radio       = radio_;
   stack       = stack_;
-  nof_workers = 1;//args.nof_phy_threads;
+  nof_workers = SRSLTE_MIN(SRSLTE_MAX(args.nof_phy_threads, 1), MAX_WORKERS);
 
   workers_common.params = args;
 
-  workers_common.init(cfg.phy_cell_cfg, radio, stack_);
+  if (!workers_common.init(cfg.phy_cell_cfg, cfg.npusch_cnfg, radio, stack_)) {
+    log_h->error("Error initiating the PHY common state\n");
+    return SRSLTE_ERROR;
+  }
+
+  // A subframe received at t is transmitted at t + FDD_HARQ_DELAY_UL_MS, rx_now() returns a subframe after t
+  workers_common.timing.init(log_h, (FDD_HARQ_DELAY_UL_MS - 1) * 1000, TIMING_PRINT_PERIOD);
 
   // TODO
   // parse_common_config(cfg);
 
+  if (workers_common.ul_decoder.init(cfg.phy_cell_cfg.cell,
+                                     stack_,
+                                     log_vec.at(0).get(),
+                                     args.nof_decoder_threads,
+                                     args.decoder_threads,
+                                     DECODER_THREAD_PRIO)) {
+    log_h->error("Error initiating NPUSCH decoder\n");
+    return SRSLTE_ERROR;
+  }
+
   // Add workers to workers pool and start threads
   for (uint32_t i = 0; i < nof_workers; i++) {
     printf("INIT W%d\n", i);
     workers[i].init(&workers_common, log_vec.at(i).get());
-    workers_pool.init_worker(i, &workers[i], WORKERS_THREAD_PRIO);
+    threads_cfg_t thread_cfg = i < args.worker_threads.size() ? args.worker_threads[i] : threads_cfg_t{};
+    workers_pool.init_worker(i, &workers[i], thread_cfg, WORKERS_THREAD_PRIO);
   }
 
-  nprach.init(cfg.phy_cell_cfg.cell, args, stack_, log_vec.at(0).get(), PRACH_WORKER_THREAD_PRIO);
+  if (nprach.init(cfg.phy_cell_cfg.cell,
+                  args,
+                  cfg.nprach_cnfg,
+                  workers_common.get_symbol_sz(),
+                  stack_,
+                  log_vec.at(0).get(),
+                  PRACH_WORKER_THREAD_PRIO)) {
+    log_h->error("Error initiating NPRACH worker\n");
+    return SRSLTE_ERROR;
+  }
 
   // Warning this must be initialized after all workers have been added to the pool
-  tx_rx.init(radio, &workers_pool, &workers_common, &nprach, log_vec.at(0).get(), SF_RECV_THREAD_PRIO);
+  tx_rx.init(
+      radio, &workers_pool, &workers_common, &nprach, log_vec.at(0).get(), args.txrx_thread, SF_RECV_THREAD_PRIO);
 
   initialized = true;
 
@@ -127,6 +154,7 @@ void phy::stop()
     tx_rx.stop();
     workers_common.stop();
     workers_pool.stop();
+    workers_common.ul_decoder.stop();
     nprach.stop();
 
     initialized = false;
@@ -46,19 +46,58 @@ using namespace asn1::rrc;
 
 namespace sonica_enb {
 
+phy_common::~phy_common()
+{
+  sonica_enb_ul_nbiot_free(&tti_state.enb_ul);
+}
 
 void phy_common::reset()
 {
-  for (auto& q : ul_grants) {
-    for (auto& g : q) {
-      g = {};
-    }
+  for (auto& slot : ul_grants) {
+    slot.seq.store(0, std::memory_order_relaxed);
+    slot.sched.nof_grants = 0;
+    slot.sched.nof_phich  = 0;
+  }
+
+  tti_state.h_ndi_dl    = false;
+  tti_state.h_ndi_ul    = false;
+  tti_state.sib1        = {};
+  tti_state.npdsch      = {};
+  tti_state.dl_pending_grants.clear();
+  tti_state.ul_pending_grants.clear();
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_release_grant(&tti_state.enb_ul, i);
+    tti_state.npusch[i] = {};
   }
+  tti_state.rx_3k75.release();
 }
 
-bool phy_common::init(const phy_cell_cfg_nb_t&     cell_,
-                      srslte::radio_interface_phy* radio_h_,
-                      stack_interface_phy_nb*      stack_)
+// NPUSCH DMRS of SIB2-NB, base sequences outside 0..N_seq-1 are not configured and follow the cell ID
+static sonica_npusch_dmrs_cfg_t make_dmrs_cfg(const asn1::rrc::npusch_cfg_common_nb_r13_s& npusch_cfg)
+{
+  const auto& dmrs = npusch_cfg.dmrs_cfg_r13;
+  bool        has  = npusch_cfg.dmrs_cfg_r13_present;
+
+  sonica_npusch_dmrs_cfg_t cfg = {};
+  cfg.group_hopping_en         = npusch_cfg.ul_ref_sigs_npusch_r13.group_hop_enabled_r13;
+  cfg.group_assign             = npusch_cfg.ul_ref_sigs_npusch_r13.group_assign_npusch_r13;
+  cfg.three_tone_base_seq =
+      (has && dmrs.three_tone_base_seq_r13_present && dmrs.three_tone_base_seq_r13 < 12) ? dmrs.three_tone_base_seq_r13
+                                                                                          : -1;
+  cfg.three_tone_cyclic_shift = has ? dmrs.three_tone_cyclic_shift_r13 : 0;
+  cfg.six_tone_base_seq =
+      (has && dmrs.six_tone_base_seq_r13_present && dmrs.six_tone_base_seq_r13 < 14) ? dmrs.six_tone_base_seq_r13 : -1;
+  cfg.six_tone_cyclic_shift = has ? dmrs.six_tone_cyclic_shift_r13 : 0;
+  cfg.twelve_tone_base_seq  = (has && dmrs.twelve_tone_base_seq_r13_present && dmrs.twelve_tone_base_seq_r13 < 30)
+                                 ? dmrs.twelve_tone_base_seq_r13
+                                 : -1;
+  return cfg;
+}
+
+bool phy_common::init(const phy_cell_cfg_nb_t&                    cell_,
+                      const asn1::rrc::npusch_cfg_common_nb_r13_s& npusch_cfg,
+                      srslte::radio_interface_phy*                 radio_h_,
+                      stack_interface_phy_nb*                      stack_)
 {
   radio = radio_h_;
   cell  = cell_;
@@ -67,9 +106,37 @@ bool phy_common::init(const phy_cell_cfg_nb_t&     cell_,
   // TODO: Set UE PHY data-base stack and configuration
   // ue_db.init(stack, params, cell_list);
 
-  // Create grants
-  for (auto& q : ul_grants) {
-    q.resize(1);
+  // A standalone carrier does not need the LTE base rate, only enough samples for the 12 subcarriers
+  symbol_sz = srslte_symbol_sz(get_nof_prb());
+  if (params.nb_srate_hz > 0) {
+    uint32_t nb_symbol_sz = (uint32_t)round(params.nb_srate_hz / 15000.0);
+    if (cell.cell.mode != SRSLTE_NBIOT_MODE_STANDALONE) {
+      ERROR("Reduced sample rate requires a standalone cell\n");
+      return false;
+    }
+    if (nb_symbol_sz * 15000.0 != params.nb_srate_hz || nb_symbol_sz % SONICA_OFDM_NBIOT_DFT_SZ ||
+        nb_symbol_sz < SONICA_NBIOT_MIN_SYMBOL_SZ || nb_symbol_sz > symbol_sz) {
+      ERROR("Invalid sample rate %.0f Hz, it must be a multiple of 240 kHz up to %.2f MHz\n",
+            params.nb_srate_hz,
+            get_srate_hz() / 1e6);
+      return false;
+    }
+    symbol_sz = nb_symbol_sz;
+  }
+
+  // Create the NPUSCH receive contexts, workers demodulate the subframe they received into copies of them
+  if (sonica_enb_ul_nbiot_init(&tti_state.enb_ul, NULL, symbol_sz)) {
+    ERROR("Error initiating ENB UL\n");
+    return false;
+  }
+  if (sonica_enb_ul_nbiot_set_cell(&tti_state.enb_ul, cell.cell)) {
+    ERROR("Error initiating ENB UL\n");
+    return false;
+  }
+  npusch_dmrs_cfg = make_dmrs_cfg(npusch_cfg);
+  if (sonica_enb_ul_nbiot_set_dmrs_cfg(&tti_state.enb_ul, &npusch_dmrs_cfg)) {
+    ERROR("Invalid NPUSCH DMRS configuration\n");
+    return false;
   }
 
   reset();
@@ -78,19 +145,33 @@ bool phy_common::init(const phy_cell_cfg_nb_t&     cell_,
 
 void phy_common::stop()
 {
+  state_semaphore.wait_all();
+  ul_semaphore.wait_all();
   semaphore.wait_all();
+  tti_state.rx_3k75.release();
 }
 
-const stack_interface_phy_nb::ul_sched_list_t& phy_common::get_ul_grants(uint32_t tti)
+stack_interface_phy_nb::ul_sched_t& phy_common::write_ul_grants(uint32_t tti)
 {
-  std::lock_guard<std::mutex> lock(grant_mutex);
-  return ul_grants[tti % TTIMOD_SZ];
+  ul_grant_slot_t& slot = ul_grants[TTIMOD(tti)];
+  slot.seq.store(0, std::memory_order_relaxed);
+  slot.sched.nof_grants = 0;
+  slot.sched.nof_phich  = 0;
+  return slot.sched;
 }
 
-void phy_common::set_ul_grants(uint32_t tti, const stack_interface_phy_nb::ul_sched_list_t& ul_grant_list)
+void phy_common::publish_ul_grants(uint32_t tti)
 {
-  std::lock_guard<std::mutex> lock(grant_mutex);
-  ul_grants[tti % TTIMOD_SZ] = ul_grant_list;
+  ul_grants[TTIMOD(tti)].seq.store(tti + 1, std::memory_order_release);
+}
+
+const stack_interface_phy_nb::ul_sched_t* phy_common::get_ul_grants(uint32_t tti) const
+{
+  const ul_grant_slot_t& slot = ul_grants[TTIMOD(tti)];
+  if (slot.seq.load(std::memory_order_acquire) != tti + 1) {
+    return nullptr;
+  }
+  return &slot.sched;
 }
 
 /* The transmission of UL subframes must be in sequence. The correct sequence is guaranteed by a chain of N semaphores,
@@ -101,15 +182,21 @@ void phy_common::set_ul_grants(uint32_t tti, const stack_interface_phy_nb::ul_sc
  * there is no transmission at all (tx_enable). In that case, the end of burst message will be sent to the radio
  */
 void phy_common::worker_end(void*                tx_sem_id,
+                            uint32_t             tti,
                             srslte::rf_buffer_t& buffer,
                             uint32_t             nof_samples,
                             srslte_timestamp_t   tx_time)
 {
   // Wait for the green light to transmit in the current TTI
   semaphore.wait(tx_sem_id);
+  timing.stamp(tti, tti_timing::TX_ACQUIRED);
 
   // Always transmit on single radio
   radio->tx(buffer, nof_samples, tx_time);
+  timing.stamp(tti, tti_timing::TX_DONE);
+
+  // TTIs are closed in TX order, while holding the semaphore
+  timing.end(tti);
 
   // Trigger MAC clock
    stack->tti_clock();
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/phy/rx_sf_ring.h"
+
+namespace sonica_enb {
+
+rx_sf_ring::view::view(view&& other) noexcept :
+  ring(other.ring),
+  first(other.first),
+  nof_sf(other.nof_sf),
+  tti(other.tti)
+{
+  other.ring   = nullptr;
+  other.nof_sf = 0;
+}
+
+rx_sf_ring::view& rx_sf_ring::view::operator=(const view& other)
+{
+  if (this != &other) {
+    release();
+    copy(other);
+  }
+  return *this;
+}
+
+rx_sf_ring::view& rx_sf_ring::view::operator=(view&& other) noexcept
+{
+  if (this != &other) {
+    release();
+    ring         = other.ring;
+    first        = other.first;
+    nof_sf       = other.nof_sf;
+    tti          = other.tti;
+    other.ring   = nullptr;
+    other.nof_sf = 0;
+  }
+  return *this;
+}
+
+void rx_sf_ring::view::copy(const view& other)
+{
+  ring   = other.ring;
+  first  = other.first;
+  nof_sf = other.nof_sf;
+  tti    = other.tti;
+  if (ring) {
+    ring->ref(first, nof_sf);
+  }
+}
+
+uint32_t rx_sf_ring::view::get_nof_samples() const
+{
+  return ring ? nof_sf * ring->sf_len : 0;
+}
+
+const cf_t* rx_sf_ring::view::get(uint32_t port) const
+{
+  if (!ring || port >= ring->nof_ports) {
+    return nullptr;
+  }
+  return &ring->buffer[port][first * ring->sf_len];
+}
+
+bool rx_sf_ring::view::append(const view& next)
+{
+  if (next.empty()) {
+    return false;
+  }
+  if (empty()) {
+    *this = next;
+    return true;
+  }
+  if (next.ring != ring || next.first != first + nof_sf) {
+    return false;
+  }
+  ring->ref(next.first, next.nof_sf);
+  nof_sf += next.nof_sf;
+  return true;
+}
+
+void rx_sf_ring::view::release()
+{
+  if (ring) {
+    ring->unref(first, nof_sf);
+  }
+  ring   = nullptr;
+  nof_sf = 0;
+}
+
+rx_sf_ring::~rx_sf_ring()
+{
+  for (uint32_t p = 0; p < SRSLTE_MAX_PORTS; p++) {
+    if (buffer[p]) {
+      free(buffer[p]);
+    }
+  }
+}
+
+bool rx_sf_ring::init(uint32_t nof_slots_, uint32_t sf_len_, uint32_t nof_ports_)
+{
+  if (nof_slots_ == 0 || nof_ports_ == 0 || nof_ports_ > SRSLTE_MAX_PORTS) {
+    return false;
+  }
+
+  nof_slots = nof_slots_;
+  nof_ports = nof_ports_;
+  sf_len    = sf_len_;
+  wr_idx    = 0;
+
+  for (uint32_t p = 0; p < nof_ports; p++) {
+    buffer[p] = srslte_vec_cf_malloc((nof_slots + 1) * sf_len);
+    if (!buffer[p]) {
+      ERROR("Error allocating memory\n");
+      return false;
+    }
+    srslte_vec_cf_zero(buffer[p], (nof_slots + 1) * sf_len);
+  }
+
+  refs.reset(new std::atomic<uint32_t>[nof_slots]);
+  for (uint32_t i = 0; i < nof_slots; i++) {
+    refs[i] = 0;
+  }
+
+  return true;
+}
+
+rx_sf_ring::view rx_sf_ring::acquire(uint32_t tti)
+{
+  // A slot still referenced belongs to a late consumer, the radio moves on to the next free one. Only this thread
+  // takes a free slot, so it stays free once seen
+  for (uint32_t n = 0; n < nof_slots; n++) {
+    uint32_t idx = (wr_idx + n) % nof_slots;
+    if (refs[idx].load(std::memory_order_acquire) == 0) {
+      refs[idx].store(1, std::memory_order_relaxed);
+      wr_idx = (idx + 1) % nof_slots;
+      return view(this, idx, tti);
+    }
+  }
+
+  nof_overflows++;
+  return view();
+}
+
+cf_t* rx_sf_ring::get_write_ptr(const view& v, uint32_t port)
+{
+  if (port >= nof_ports) {
+    return nullptr;
+  }
+  if (v.empty()) {
+    return &buffer[port][nof_slots * sf_len];
+  }
+  if (v.ring != this) {
+    return nullptr;
+  }
+  return &buffer[port][v.first * sf_len];
+}
+
+uint32_t rx_sf_ring::get_nof_free() const
+{
+  uint32_t nof_free = 0;
+  for (uint32_t i = 0; i < nof_slots; i++) {
+    nof_free += refs[i].load(std::memory_order_relaxed) == 0;
+  }
+  return nof_free;
+}
+
+void rx_sf_ring::ref(uint32_t first, uint32_t nof_sf)
+{
+  for (uint32_t i = first; i < first + nof_sf; i++) {
+    refs[i].fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void rx_sf_ring::unref(uint32_t first, uint32_t nof_sf)
+{
+  for (uint32_t i = first; i < first + nof_sf; i++) {
+    refs[i].fetch_sub(1, std::memory_order_release);
+  }
+}
+
+} // namespace sonica_enb
@@ -19,11 +19,14 @@
  *
  */
 
+#include "sonica/common/trace.h"
 #include "srslte/common/log.h"
 #include "srslte/common/threads.h"
+#include "srslte/common/time_prof.h"
 #include "srslte/srslte.h"
 
 #include "sonica_enb/hdr/phy/sf_worker.h"
+#include <cmath>
 
 #define Error(fmt, ...)                                                                                                \
   if (SRSLTE_DEBUG_ENABLED)                                                                                            \
@@ -54,34 +57,12 @@ using namespace asn1::rrc;
 
 namespace sonica_enb {
 
-static uint8_t dummy_data[11] = {0x00, 0x39, 0x2A, 0x53, 0x40, 0x14, 0x7B, 0x1C, 0x40, 0x00, 0x00};
-
-static uint8_t dummy_data2[125] = {
-  0x3d, 0x23, 0x53, 0x1f, 0x00, 0xa0, 0x00, 0x10, 0x00, 0x26, 0x83, 0xa0, 0xb9, 0x04, 0x4c, 0x88,
-  0x03, 0x80, 0x00, 0x20, 0x38, 0x02, 0x03, 0xf8, 0x38, 0x00, 0x00, 0x00, 0x42, 0x00, 0x00, 0x15,
-  0x01, 0x00, 0xe8, 0x08, 0xe8, 0x93, 0x91, 0xc0, 0x40, 0x10, 0x88, 0x00, 0x80, 0x00, 0x08, 0x40,
-  0x83, 0x00, 0x00, 0x00, 0x00, 0x41, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0x80, 0x00, 0x05,
-  0x00, 0x00, 0x02, 0x80, 0x00, 0x08, 0x00, 0x00, 0x08, 0x80, 0x18, 0x81, 0xf2, 0xf0, 0x1a, 0x48,
-  0x08, 0x81, 0xab, 0xac, 0x53, 0x7a, 0xe0, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-
-static uint8_t dummy_data_bsr[11] = {0x3B, 0x3D, 0x03, 0x10, 0x5F, 0x09, 0x88, 0x01, 0x30, 0x0B, 0x00};
-
-static uint8_t dummy_data_bsr2[15] = {0x3B, 0x3D, 0x23, 0x02, 0x03, 0x10, 0x5F, 0x09, 0x00, 0x04,0x88, 0x01, 0x30, 0x0B, 0x00};
-
-static uint32_t msg_counter = 0;
-
 sf_worker::~sf_worker()
 {
   sonica_enb_dl_nbiot_free(&enb_dl);
   sonica_enb_ul_nbiot_free(&enb_ul);
 
   for (int p = 0; p < SRSLTE_MAX_PORTS; p++) {
-    if (signal_buffer_rx[p]) {
-      free(signal_buffer_rx[p]);
-    }
     if (signal_buffer_tx[p]) {
       free(signal_buffer_tx[p]);
     }
@@ -103,16 +84,9 @@ void sf_worker::worker_init(phy_common* phy_, srslte::log* log_h_)
   reset();
 
   srslte_nbiot_cell_t cell = phy->get_cell();
-  uint32_t nof_prb = phy->get_nof_prb();
-  uint32_t sf_len  = SRSLTE_SF_LEN_PRB(nof_prb);
+  uint32_t sf_len  = phy->get_sf_len();
 
   for (uint32_t p = 0; p < phy->get_nof_ports(); p++) {
-    signal_buffer_rx[p] = srslte_vec_cf_malloc(2 * sf_len);
-    if (!signal_buffer_rx[p]) {
-      ERROR("Error allocating memory\n");
-      return;
-    }
-    srslte_vec_cf_zero(signal_buffer_rx[p], 2 * sf_len);
     signal_buffer_tx[p] = srslte_vec_cf_malloc(2 * sf_len);
     if (!signal_buffer_tx[p]) {
       ERROR("Error allocating memory\n");
@@ -120,22 +94,26 @@ void sf_worker::worker_init(phy_common* phy_, srslte::log* log_h_)
     }
     srslte_vec_cf_zero(signal_buffer_tx[p], 2 * sf_len);
   }
-  if (sonica_enb_dl_nbiot_init(&enb_dl, signal_buffer_tx)) {
+  if (sonica_enb_dl_nbiot_init(&enb_dl, signal_buffer_tx, phy->get_symbol_sz())) {
     ERROR("Error initiating ENB DL\n");
     return;
   }
-  if (sonica_enb_ul_nbiot_init(&enb_ul, signal_buffer_rx[0])) {
-    ERROR("Error initiating ENB UL\n");
-    return;
-  }
   if (sonica_enb_dl_nbiot_set_cell(&enb_dl, cell)) {
     ERROR("Error initiating ENB DL\n");
     return;
   }
+  if (sonica_enb_ul_nbiot_init(&enb_ul, NULL, phy->get_symbol_sz())) {
+    ERROR("Error initiating ENB UL\n");
+    return;
+  }
   if (sonica_enb_ul_nbiot_set_cell(&enb_ul, cell)) {
     ERROR("Error initiating ENB UL\n");
     return;
   }
+  if (sonica_enb_ul_nbiot_set_dmrs_cfg(&enb_ul, &phy->get_npusch_dmrs_cfg())) {
+    ERROR("Error initiating ENB UL\n");
+    return;
+  }
 }
 
 void sf_worker::reset()
@@ -145,9 +123,9 @@ void sf_worker::reset()
 }
 
 
-cf_t* sf_worker::get_buffer_rx(uint32_t antenna_idx)
+void sf_worker::set_rx(const rx_sf_ring::view& rx_)
 {
-  return signal_buffer_rx[antenna_idx];
+  rx = rx_;
 }
 
 cf_t* sf_worker::get_buffer_tx(uint32_t antenna_idx)
@@ -170,10 +148,56 @@ void sf_worker::set_time(uint32_t hfn_, uint32_t tti_, uint32_t tx_worker_cnt_,
   srslte_timestamp_copy(&tx_time, &tx_time_);
 }
 
+//! Keeps the pending NPUSCH grants sorted by their first subframe, Format 2 grants are not recorded in that order
+static void push_ul_grant(std::list<phy_common::ul_grant_record_t>& grants, const phy_common::ul_grant_record_t& record)
+{
+  auto it = grants.begin();
+  while (it != grants.end() && TTI_SUB(record.grant.tx_tti, it->grant.tx_tti) < 10240 / 2) {
+    ++it;
+  }
+  grants.insert(it, record);
+}
+
+//! Keeps the pending NPDSCH grants sorted by their first subframe
+static void push_dl_grant(std::list<phy_common::dl_grant_record_t>& grants, const phy_common::dl_grant_record_t& record)
+{
+  uint32_t start = record.grant.start_sfn * 10 + record.grant.start_sfidx;
+  auto     it    = grants.begin();
+  while (it != grants.end() && TTI_SUB(start, it->grant.start_sfn * 10 + it->grant.start_sfidx) < 10240 / 2) {
+    ++it;
+  }
+  grants.insert(it, record);
+}
+
+//! Traces the length and the first 16 bytes of a DL transport block, its TBS is only computed if the trace is on
+static void trace_dl_data(uint32_t tti, const srslte_ra_nbiot_dl_dci_t& dci, const uint8_t* data)
+{
+  if (data == nullptr || !sonica_trace_enabled(SONICA_TRACE_LAYER_OF_PHY_DL_DATA, SONICA_TRACE_LEVEL_OF_PHY_DL_DATA)) {
+    return;
+  }
+  int      tbs = srslte_ra_nbiot_get_npdsch_tbs(dci.mcs_idx, dci.alloc.i_sf);
+  uint32_t len = tbs > 0 ? tbs / 8 : 0;
+  SONICA_TRACE(PHY_DL_DATA,
+               tti,
+               dci.alloc.rnti,
+               len,
+               sonica_trace_pack(data, len, 0),
+               sonica_trace_pack(data, len, 1),
+               sonica_trace_pack(data, len, 2),
+               sonica_trace_pack(data, len, 3));
+}
+
 void sf_worker::work_imp()
 {
+  static srslte::mutexed_tprof<srslte::avg_time_stats> work_tprof("work_tprof", "PHY", 1000);
+  static srslte::mutexed_tprof<srslte::avg_time_stats> ul_tprof("ul_tprof", "PHY", 1000);
+  static srslte::mutexed_tprof<srslte::avg_time_stats> dl_tprof("dl_tprof", "PHY", 1000);
+
   std::lock_guard<std::mutex> lock(work_mutex);
 
+  auto work_meas = work_tprof.start();
+  phy->timing.stamp(tti_rx, tti_timing::WORKER_START);
+
   log_h->step(tti_rx);
 
   srslte::rf_buffer_t tx_buffer = {};
@@ -182,10 +206,22 @@ void sf_worker::work_imp()
   }
 
   if (!running) {
-    phy->worker_end(this, tx_buffer, 0, tx_time);
+    phy->state_semaphore.wait(this);
+    phy->state_semaphore.release();
+    phy->ul_semaphore.wait(this);
+    phy->ul_semaphore.release();
+    phy->worker_end(this, tti_rx, tx_buffer, 0, tx_time);
     return;
   }
 
+  // First, put NPSS/NSSS/Ref/NPBCH in, this does not depend on other TTIs
+  sonica_enb_dl_nbiot_put_base(&enb_dl, hfn, tti_tx_dl);
+
+  // From here on, the scheduling and the NPDSCH/NPUSCH state must be processed in TTI order. Only the bookkeeping is
+  // done in order, the signal processing runs on the objects of this worker once the state is released.
+  phy->state_semaphore.wait(this);
+  phy->timing.stamp(tti_rx, tti_timing::STATE_ACQUIRED);
+
   stack_interface_phy_nb* stack = phy->stack;
 
   // Downlink grants to transmit this TTI
@@ -193,159 +229,342 @@ void sf_worker::work_imp()
 
   if (stack->get_dl_sched(hfn, tti_tx_dl, dl_grants) < 0) {
     Error("Getting DL scheduling from MAC\n");
-    phy->worker_end(this, tx_buffer, 0, tx_time);
+    phy->state_semaphore.release();
+    phy->ul_semaphore.wait(this);
+    phy->ul_semaphore.release();
+    phy->worker_end(this, tti_rx, tx_buffer, 0, tx_time);
     return;
   }
+  phy->timing.stamp(tti_rx, tti_timing::MAC_DL_DONE);
 
-  // Uplink grants to receive this TTI
-  stack_interface_phy_nb::ul_sched_list_t ul_grants = phy->get_ul_grants(t_rx);
-  // Uplink grants to transmit this tti and receive in the future
-  stack_interface_phy_nb::ul_sched_list_t ul_grants_tx = phy->get_ul_grants(t_tx_ul);
+  // Uplink grants to receive this TTI, published by the worker which granted them
+  const stack_interface_phy_nb::ul_sched_t* ul_grants = phy->get_ul_grants(tti_rx);
+  // Uplink grants to transmit this tti and receive in the future, the MAC fills the slot in place
+  stack_interface_phy_nb::ul_sched_t& ul_grants_tx = phy->write_ul_grants(tti_tx_ul);
 
   // Get UL scheduling for the TX TTI from MAC
   if (stack->get_ul_sched(hfn, tti_tx_ul, ul_grants_tx) < 0) {
     Error("Getting UL scheduling from MAC\n");
-    printf("Getting UL scheduling from MAC Error\n");
-    phy->worker_end(this, tx_buffer, 0, tx_time);
+    phy->state_semaphore.release();
+    phy->ul_semaphore.wait(this);
+    phy->ul_semaphore.release();
+    phy->worker_end(this, tti_rx, tx_buffer, 0, tx_time);
     return;
   }
+  phy->timing.stamp(tti_rx, tti_timing::MAC_UL_DONE);
 
-  if(dl_grants[0].nof_grants > 0 && dl_grants[0].npdsch.has_npdcch){
-    printf("TTI %d: DL grant available. has_npdcch. nof_grants=%d\n", tti_tx_dl, dl_grants[0].nof_grants);
-    printf("TTI %d: DL tti_rx=%d, tti_tx_ul=%d \n", tti_tx_dl, tti_rx, tti_tx_ul);
-    uint8_t* dl_data = dl_grants[0].npdsch.data[0];
-
-    uint32_t test_print_len = 50;
-    printf("PHY: sf_worker------------DL DATA Start: length=%d\n", test_print_len);
-    for(uint32_t i =0; i<test_print_len; i++){
-      printf("0x%02x ", dl_data[i]);
+  for (uint32_t n = 0; n < dl_grants[0].nof_grants; n++) {
+    if (!dl_grants[0].npdsch[n].has_npdcch) {
+      continue;
     }
-    printf("\nPHY: sf_worker------------DL DATA End\n");
-
+    stack_interface_phy_nb::dl_sched_grant_t& npdsch = dl_grants[0].npdsch[n];
+    SONICA_TRACE(PHY_DL_GRANT, tti_tx_dl, npdsch.dci.alloc.rnti, n, dl_grants[0].nof_grants, tti_rx, tti_tx_ul);
+    trace_dl_data(tti_tx_dl, npdsch.dci, npdsch.data[0]);
   }
 
-  if(ul_grants_tx[0].nof_grants > 0){
-    printf("TTI %d: UL grant available. nof_grants=%d\n", tti_rx, ul_grants_tx[0].nof_grants);
-    printf("TTI %d: t_rx=%d, t_tx_ul=%d \n", tti_rx, t_rx, t_tx_ul);
+  if(ul_grants_tx.nof_grants > 0){
+    SONICA_TRACE(PHY_UL_GRANTS, tti_rx, 0, ul_grants_tx.nof_grants, tti_tx_ul);
 
-    if (srslte_ra_nbiot_ul_dci_to_grant(&ul_grants_tx[0].npusch[0].dci.ra_dci, &ugrant,
-                                        tti_tx_dl,
-                                        SRSLTE_NPUSCH_SC_SPACING_15000)) {
-      Error("Failed to generate Grant from DCI");
-    } else {
-      npusch_rnti = ul_grants_tx[0].npusch[0].dci.rnti;
-      npusch_start = ugrant.tx_tti;
-      npusch_data  = ul_grants_tx[0].npusch[0].data;
-      //sonica_enb_ul_nbiot_cfg_grant(&enb_ul, &ugrant, npusch_rnti);
-      printf("  Recording grants for R%x, G%d=%d\n", npusch_rnti, ugrant.tx_tti, tti_tx_ul);
-      has_ugrant = true;
+    for (uint32_t i = 0; i < ul_grants_tx.nof_grants; i++) {
+      stack_interface_phy_nb::ul_sched_grant_t& npusch = ul_grants_tx.npusch[i];
+
+      // The scheduling delay counts from the last subframe of the NPDCCH. The subcarrier spacing is the one the RAR
+      // granted to the UE, the DCI only carries the subcarriers
+      phy_common::ul_grant_record_t record = {};
+      if (srslte_ra_nbiot_ul_dci_to_grant(&npusch.dci.ra_dci, &record.grant,
+                                          npusch.needs_npdcch ? npusch.npdcch.end_tti : tti_tx_dl,
+                                          npusch.dci.ra_dci.sc_spacing)) {
+        Error("Failed to generate Grant from DCI");
+      } else {
+        record.rnti = npusch.dci.rnti;
+        record.data = npusch.data;
+        SONICA_TRACE(PHY_UL_GRANT_RECORD, tti_rx, record.rnti, record.grant.tx_tti, tti_tx_ul);
+        push_ul_grant(phy->tti_state.ul_pending_grants, record);
+      }
     }
   }
 
-  // For test: should receive UL data if ul grants > 0
-  if (ul_grants[0].nof_grants > 0) {
-    printf("UL TTI %d: ul_grants = %d \n", tti_rx, ul_grants[0].nof_grants);
+  if (ul_grants && ul_grants->nof_grants > 0) {
+    SONICA_TRACE(PHY_UL_GRANTS_RX, tti_rx, 0, ul_grants->nof_grants);
   }
 
-  work_ul(ul_grants);
+  sched_ul();
+  sched_dl(dl_grants[0], ul_grants_tx);
+
+  // The NPDCCH bookkeeping sets the NDI, the slot is complete from here on
+  phy->publish_ul_grants(tti_tx_ul);
+
+  // Allow next TTI to access the shared state
+  phy->state_semaphore.release();
+
+  auto ul_meas = ul_tprof.start();
+  work_ul();
+  rx.release();
 
-  // Save grants
-  phy->set_ul_grants(t_tx_ul, ul_grants_tx);
-  phy->set_ul_grants(t_rx, ul_grants);
+  // The soft bits are added to the receive contexts in TTI order, the last subframe of a grant completes it
+  phy->ul_semaphore.wait(this);
+  merge_ul();
+  phy->ul_semaphore.release();
+  ul_meas.stop();
+  phy->timing.stamp(tti_rx, tti_timing::UL_DONE);
 
-  work_dl(dl_grants[0], ul_grants_tx[0]);
+  auto dl_meas = dl_tprof.start();
+  work_dl();
+  dl_meas.stop();
+  phy->timing.stamp(tti_rx, tti_timing::DL_DONE);
+
+  // Processing time up to the TX hand over, the remainder of the TTI budget is the DL deadline slack
+  work_meas.stop();
 
   // TODO
-  phy->worker_end(this, tx_buffer, SRSLTE_SF_LEN_PRB(phy->get_nof_prb()), tx_time);
+  phy->worker_end(this, tti_rx, tx_buffer, phy->get_sf_len(), tx_time);
 }
 
-
-static void log_data(uint8_t *data, uint32_t len)
+void sf_worker::sched_ul()
 {
-  printf("Data len = %u\n", len);
-  for (uint32_t i = 0; i < len && i < 256; ) {
-    for (uint32_t j = 0; j < 16 && i < len; j++, i++) {
-      printf(" %02x", data[i]);
+  phy_common::tti_state_t&    state  = phy->tti_state;
+  sonica_enb_ul_nbiot_t*      ctx    = &state.enb_ul;
+  bool                        is_odd = (tti_rx % 2) == 1;
+  std::lock_guard<std::mutex> lock(phy->ul_mutex);
+
+  // Drop grants whose start has already passed, then activate the ones starting now
+  while (!state.ul_pending_grants.empty()) {
+    phy_common::ul_grant_record_t& head_grant = state.ul_pending_grants.front();
+    if (TTI_SUB(tti_rx, head_grant.grant.tx_tti) >= 10240 / 2) {
+      break;
+    }
+    if (head_grant.grant.tx_tti == tti_rx) {
+      SONICA_TRACE(PHY_NPUSCH_START, tti_rx, head_grant.rnti, head_grant.grant.mcs.tbs);
+      int idx = sonica_enb_ul_nbiot_cfg_grant(ctx, &head_grant.grant, head_grant.rnti);
+      if (idx < 0) {
+        Warning("No NPUSCH receive context for RNTI %x\n", head_grant.rnti);
+        // A missing HARQ-ACK is handled as DTX by the MAC
+        if (head_grant.grant.format != SRSLTE_NPUSCH_FORMAT2) {
+          phy->stack->crc_info(head_grant.grant.tx_tti, head_grant.rnti, head_grant.grant.mcs.tbs / 8, false);
+        }
+      } else {
+        state.npusch[idx] = head_grant;
+      }
+    } else {
+      Warning("Dropping NPUSCH grant for RNTI %x starting at %d\n", head_grant.rnti, head_grant.grant.tx_tti);
+      // Reported like a failed decode, which releases the PDU buffer the MAC holds for it
+      if (head_grant.grant.format != SRSLTE_NPUSCH_FORMAT2) {
+        phy->stack->crc_info(head_grant.grant.tx_tti, head_grant.rnti, head_grant.grant.mcs.tbs / 8, false);
+      }
+    }
+    state.ul_pending_grants.pop_front();
+  }
+
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_release_grant(&enb_ul, i);
+    ul_rx[i] = {};
+  }
+
+  // The worker of the second subframe of a 3.75 kHz slot takes the first one over
+  rx_3k75.release();
+  bool has_slot_start = false;
+  if (is_odd) {
+    rx_3k75        = std::move(state.rx_3k75);
+    has_slot_start = !rx_3k75.empty() && rx_3k75.get_tti() == TTI_SUB(tti_rx, 1);
+  }
+  state.rx_3k75.release();
+
+  if (ctx->nof_grants == 0) {
+    rx_3k75.release();
+    return;
+  }
+
+  bool keep_slot_start = false;
+  bool uses_slot_start = false;
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_grant_t* grant = &ctx->grants[i];
+    if (!grant->active || grant->complete) {
+      continue;
+    }
+    bool     is_3k75 = grant->npusch_cfg.grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750;
+    uint32_t num_sf  = TTI_SUB(tti_rx, grant->npusch_cfg.grant.tx_tti);
+    ul_rx[i].rnti    = state.npusch[i].rnti;
+    ul_rx[i].tx_tti  = state.npusch[i].grant.tx_tti;
+
+    // The ring was full and the subframe is lost, the grant misses it and cannot be decoded. It is failed once the
+    // subframes before it are in, nothing is taken from it meanwhile.
+    if (rx.empty() || (is_3k75 && is_odd && !has_slot_start) ||
+        sonica_enb_ul_nbiot_copy_grant(&enb_ul, ctx, i, num_sf) != SRSLTE_SUCCESS) {
+      grant->complete = true;
+      ul_rx[i].lost   = true;
+      continue;
     }
-    printf("\n");
+    ul_rx[i].copied = true;
+    keep_slot_start |= is_3k75 && !is_odd;
+    uses_slot_start |= is_3k75 && is_odd;
+  }
+
+  if (keep_slot_start) {
+    state.rx_3k75 = rx;
+  }
+  if (!uses_slot_start) {
+    rx_3k75.release();
   }
-  printf("\n");
 }
 
-void sf_worker::work_ul(stack_interface_phy_nb::ul_sched_list_t ul_grants)
+void sf_worker::work_ul()
 {
-  uint32_t sfn = tti_rx / 10;
-  uint32_t sf_idx = tti_rx % 10;
+  if (enb_ul.nof_grants == 0) {
+    return;
+  }
 
-  if (has_ugrant && tti_rx == npusch_start) {
-    printf("RX %d.%d Activivating NPUSCH for RNTI %x\n", sfn, sf_idx, npusch_rnti);
-    sonica_enb_ul_nbiot_cfg_grant(&enb_ul, &ugrant, npusch_rnti);
+  if (!rx_3k75.empty()) {
+    sonica_enb_ul_nbiot_set_slot_start(&enb_ul, rx_3k75.get(0));
+    rx_3k75.release();
   }
 
-  if (enb_ul.has_ul_grant) {
-    int ret = sonica_enb_ul_nbiot_decode_npusch(&enb_ul, signal_buffer_rx[0], sf_idx, npusch_data);
-    printf("RX %d.%d decoding result %d\n", sfn, sf_idx, ret);
-    int len = enb_ul.npusch_cfg.grant.mcs.tbs / 8;
-    if (ret == SRSLTE_SUCCESS) {
-      log_data(npusch_data, len);
-      phy->stack->crc_info(npusch_start, npusch_rnti, len, true);
+  // Only the soft bits are kept across TTIs, the subframe is demodulated straight from the ring
+  int ret = sonica_enb_ul_nbiot_receive_npusch(&enb_ul, rx.get(0), tti_rx % 10);
+  if (ret < 0) {
+    SONICA_TRACE(PHY_NPUSCH_RX_ERROR, tti_rx, 0, ret);
+    // None of the grants got the subframe
+    for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+      sonica_enb_ul_nbiot_release_grant(&enb_ul, i);
     }
-    if (ret == -1) {
-      if (len == 11) {
-        memcpy(npusch_data, dummy_data, 11);
-        phy->stack->crc_info(npusch_start, npusch_rnti, 11, true);
-      } else if (len == 125) {
-        memcpy(npusch_data, dummy_data2, 125);
-        phy->stack->crc_info(npusch_start, npusch_rnti, 125, true);
-      } else {
-        if (msg_counter == 0) {
-          memcpy(npusch_data, dummy_data_bsr2, 15);
-          phy->stack->crc_info(npusch_start, npusch_rnti, 15, true);
-          msg_counter++;
-        } else {
-          printf("PHY: receive unhandle ul grant length=%d\n", len);
-          phy->stack->crc_info(npusch_start, npusch_rnti, len, false);
-        }
+  }
+}
+
+void sf_worker::merge_ul()
+{
+  phy_common::tti_state_t&    state = phy->tti_state;
+  sonica_enb_ul_nbiot_t*      ctx   = &state.enb_ul;
+  std::lock_guard<std::mutex> lock(phy->ul_mutex);
+
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    phy_common::ul_grant_record_t& npusch = state.npusch[i];
+    if (!ul_rx[i].copied && !ul_rx[i].lost) {
+      continue;
+    }
+    // An earlier TTI already failed the grant
+    if (!ctx->grants[i].active || npusch.rnti != ul_rx[i].rnti || npusch.grant.tx_tti != ul_rx[i].tx_tti) {
+      continue;
+    }
+
+    int ret = ul_rx[i].lost ? SRSLTE_ERROR : sonica_enb_ul_nbiot_merge_grant(ctx, &enb_ul, i);
+    if (ret == 0 || ret == SRSLTE_ERROR_INVALID_INPUTS) {
+      continue;
+    }
+    if (ret < 0) {
+      Warning("Dropping NPUSCH for RNTI %x started at %d, subframe %s\n",
+              npusch.rnti,
+              npusch.grant.tx_tti,
+              ul_rx[i].lost ? "lost" : "not demodulated");
+      if (npusch.grant.format != SRSLTE_NPUSCH_FORMAT2) {
+        phy->stack->crc_info(npusch.grant.tx_tti, npusch.rnti, npusch.grant.mcs.tbs / 8, false);
       }
+      sonica_enb_ul_nbiot_release_grant(ctx, i);
+      npusch = {};
+      continue;
     }
-    if (ret == SRSLTE_SUCCESS || ret == -1) {
-      has_ugrant = false;
+
+    sonica_enb_ul_nbiot_grant_t* grant = &ctx->grants[i];
+    if (npusch.grant.format == SRSLTE_NPUSCH_FORMAT2) {
+      // The HARQ-ACK is a single bit, detected right away
+      bool ack = false;
+      if (sonica_enb_ul_nbiot_decode_ack(ctx, i, &ack) == SRSLTE_SUCCESS) {
+        phy->stack->ack_info(npusch.grant.tx_tti, npusch.rnti, ack);
+      }
+      npusch = {};
+      continue;
     }
+
+    // The SNR of the received NPUSCH feeds the UL link adaptation of the scheduler
+    float snr_db = sonica_enb_ul_nbiot_grant_snr(ctx, i);
+    if (!std::isnan(snr_db)) {
+      phy->stack->snr_info(
+          npusch.grant.tx_tti, npusch.rnti, snr_db, srslte_convert_power_to_dB(grant->noise_estimate));
+    }
+
+    // Hand the buffered NPUSCH over, the decoder reports the CRC to the stack once done
+    if (phy->ul_decoder.push(grant, npusch.grant.tx_tti, npusch.rnti, npusch.data)) {
+      phy->stack->crc_info(npusch.grant.tx_tti, npusch.rnti, npusch.grant.mcs.tbs / 8, false);
+    }
+    sonica_enb_ul_nbiot_release_grant(ctx, i);
+    npusch = {};
   }
 }
 
-// TODO: Assign DCI with HARQ in MAC
-static bool h_ndi_dl = false;
-static bool h_ndi_ul = false;
+int sf_worker::put_npdsch(phy_common::npdsch_tx_t& tx)
+{
+  // The encoded symbols are only valid if this worker was the last one encoding this NPDSCH
+  uint32_t& gen     = encoded_gen[tx.cfg.has_bcch ? 1 : 0];
+  tx.cfg.is_encoded = (gen == tx.gen);
+  gen               = tx.gen;
+
+  return sonica_enb_dl_nbiot_put_npdsch(&enb_dl, &tx.cfg, tx.data, tx.rnti);
+}
+
+void sf_worker::queue_npdsch(phy_common::npdsch_tx_t& tx)
+{
+  // The subframe is mapped from a copy, the state moves on to the next one right away
+  npdsch_tx     = tx;
+  has_npdsch_tx = true;
+  srslte_npdsch_cfg_next_sf(&tx.cfg);
+}
 
-void sf_worker::work_dl(stack_interface_phy_nb::dl_sched_t& dl_grants,
-                        stack_interface_phy_nb::ul_sched_t& ul_grants_tx)
+void sf_worker::work_dl()
 {
+  uint32_t sf_idx = tti_tx_dl % 10;
+
+  for (phy_common::npdcch_rep_t& rep : npdcch_tx) {
+    if (rep.is_dl) {
+      sonica_enb_dl_nbiot_put_npdcch_dl(&enb_dl, &rep.dl_dci, rep.location, sf_idx);
+    } else {
+      sonica_enb_dl_nbiot_put_npdcch_ul(&enb_dl, &rep.ul_dci, rep.rnti, rep.location, sf_idx);
+    }
+  }
+
+  if (has_npdsch_tx && put_npdsch(npdsch_tx)) {
+    ERROR("Error encoding NPDSCH for RNTI %x\n", npdsch_tx.rnti);
+  }
+
+  sonica_enb_dl_nbiot_gen_signal(&enb_dl);
+}
+
+void sf_worker::sched_dl(stack_interface_phy_nb::dl_sched_t& dl_grants,
+                         stack_interface_phy_nb::ul_sched_t& ul_grants_tx)
+{
+  phy_common::tti_state_t& state = phy->tti_state;
   srslte_nbiot_cell_t cell = phy->get_cell();
   uint32_t sfn = tti_tx_dl / 10;
   uint32_t sf_idx = tti_tx_dl % 10;
   bool has_sib1_cfg = false;
 
-  // First, put NPSS/NSSS/Ref/NPBCH in
-  sonica_enb_dl_nbiot_put_base(&enb_dl, hfn, tti_tx_dl);
-
+  npdcch_tx.clear();
+  has_npdsch_tx = false;
 
-  if (ul_grants_tx.nof_grants > 0 && ul_grants_tx.npusch[0].needs_npdcch) {
-    srslte_nbiot_dci_ul_t *udci = &ul_grants_tx.npusch[0].dci;
-    udci->ra_dci.ndi = h_ndi_ul;
-    h_ndi_ul = !h_ndi_ul;
-    sonica_enb_dl_nbiot_put_npdcch_ul(&enb_dl, &udci->ra_dci, udci->rnti, sf_idx);
-    printf("PHY UL: TTI %d, sending UL DCI to RNTI %d\n", tti_tx_dl, udci->rnti);
+  for (uint32_t i = 0; i < ul_grants_tx.nof_grants; i++) {
+    if (!ul_grants_tx.npusch[i].needs_npdcch) {
+      continue;
+    }
+    srslte_nbiot_dci_ul_t *udci = &ul_grants_tx.npusch[i].dci;
+    udci->ra_dci.ndi = state.h_ndi_ul;
+    state.h_ndi_ul = !state.h_ndi_ul;
+
+    phy_common::npdcch_rep_t rep = {};
+    rep.is_dl    = false;
+    rep.ul_dci   = udci->ra_dci;
+    rep.rnti     = udci->rnti;
+    rep.location = ul_grants_tx.npusch[i].npdcch.location;
+    rep.end_tti  = ul_grants_tx.npusch[i].npdcch.end_tti;
+    state.npdcch_reps.push_back(rep);
+    SONICA_TRACE(PHY_UL_DCI, tti_tx_dl, udci->rnti, rep.end_tti);
   }
 
-  if (dl_grants.nof_grants > 0) {
-    srslte_ra_nbiot_dl_dci_t *dci = &dl_grants.npdsch.dci;
+  for (uint32_t i = 0; i < dl_grants.nof_grants; i++) {
+    stack_interface_phy_nb::dl_sched_grant_t& npdsch = dl_grants.npdsch[i];
+    srslte_ra_nbiot_dl_dci_t *dci = &npdsch.dci;
 
     // First case: SIB 1 needs to be sent out immediately at highest priority
     if (dci->alloc.has_sib1) {
       // SIB1 hasn't been configured, expecting a new config from MAC
-      if (dl_grants.npdsch.is_new_sib) {
-        if (sib1_npdsch_cfg.sf_idx > 0) {
+      if (npdsch.is_new_sib) {
+        if (state.sib1.cfg.sf_idx > 0) {
           Warning("Original SIB1 config has not finished transmission\n");
         }
 
@@ -353,14 +572,15 @@ void sf_worker::work_dl(stack_interface_phy_nb::dl_sched_t& dl_grants,
 
         srslte_ra_nbiot_dl_dci_to_grant(dci, &sib1_grant, sfn, sf_idx,
                                         DUMMY_R_MAX, true, cell.mode);
-        if (srslte_npdsch_cfg(&sib1_npdsch_cfg, cell, &sib1_grant, sf_idx)) {
+        if (srslte_npdsch_cfg(&state.sib1.cfg, cell, &sib1_grant, sf_idx)) {
           Error("Error configuring NPDSCH for SIB1\n");
           return;
         }
+        state.sib1.gen = ++state.npdsch_gen;
 
         has_sib1_cfg = true;
       } else {
-        if (sib1_npdsch_cfg.sf_idx > 0) {
+        if (state.sib1.cfg.sf_idx > 0) {
           has_sib1_cfg = true;
         } else {
           Warning("New SIB1 configuration missing\n");
@@ -369,85 +589,113 @@ void sf_worker::work_dl(stack_interface_phy_nb::dl_sched_t& dl_grants,
 
       // Only send out SIB1 when we actually have that config
       if (has_sib1_cfg) {
-        if (sonica_enb_dl_nbiot_put_npdsch(&enb_dl, &sib1_npdsch_cfg,
-                                           dl_grants.npdsch.data[0],
-                                           dci->alloc.rnti)) {
-          ERROR("Error encoding NPDSCH for SIB1\n");
-        }
+        state.sib1.rnti = dci->alloc.rnti;
+        state.sib1.data = npdsch.data[0];
+        queue_npdsch(state.sib1);
 
-        // Warning("SIB1 %d @ %d\n", sib1_npdsch_cfg.sf_idx, tti_tx_dl);
+        // Warning("SIB1 %d @ %d\n", state.sib1.cfg.sf_idx, tti_tx_dl);
 
-        if (sib1_npdsch_cfg.sf_idx == sib1_npdsch_cfg.grant.nof_sf * sib1_npdsch_cfg.grant.nof_rep) {
-          bzero(&sib1_npdsch_cfg, sizeof(srslte_npdsch_cfg_t));
+        if (state.sib1.cfg.sf_idx == state.sib1.cfg.grant.nof_sf * state.sib1.cfg.grant.nof_rep) {
+          bzero(&state.sib1.cfg, sizeof(srslte_npdsch_cfg_t));
         }
       }
     } else {
-      if (!dl_grants.npdsch.has_npdcch) {
+      if (!npdsch.has_npdcch) {
         // No NPDCCH but not SIB1, this should be other SIBs, should be immediately sent
         // TODO: check for collisions
         srslte_ra_nbiot_dl_grant_t sib2_grant;
 
         srslte_ra_nbiot_dl_dci_to_grant(dci, &sib2_grant, sfn, sf_idx,
                                         DUMMY_R_MAX, true, cell.mode);
-        if (srslte_npdsch_cfg(&npdsch_cfg, cell, &sib2_grant, sf_idx)) {
+        if (srslte_npdsch_cfg(&state.npdsch.cfg, cell, &sib2_grant, sf_idx)) {
           Error("Error configuring NPDSCH for SIB1\n");
         } else {
-          npdsch_cfg.has_bcch = true;
+          state.npdsch.cfg.has_bcch = true;
 
-          npdsch_active = true;
-          npdsch_rnti = dci->alloc.rnti;
-          npdsch_data = dl_grants.npdsch.data[0];
+          state.npdsch.active = true;
+          state.npdsch.rnti = dci->alloc.rnti;
+          state.npdsch.data = npdsch.data[0];
+          state.npdsch.gen = ++state.npdsch_gen;
+          state.npdsch.needs_ack = false;
         }
       } else {
-        // This is normal user data. In this case, transmit DCI immediately and
-        // queue the data
+        // This is normal user data. In this case, transmit DCI over its NPDCCH candidate and
+        // queue the data, which starts from the last subframe of the candidate on
 
         srslte_ra_nbiot_dl_grant_t grant;
+        uint32_t                   end_tti = npdsch.npdcch.end_tti;
 
-        srslte_ra_nbiot_dl_dci_to_grant(dci, &grant, sfn, sf_idx,
-                                        DUMMY_R_MAX, false, cell.mode);
-        dl_pending_grants.push_back({ grant, dci->alloc.rnti, dl_grants.npdsch.data[0] });
+        srslte_ra_nbiot_dl_dci_to_grant(dci, &grant, end_tti / 10, end_tti % 10,
+                                        npdsch.npdcch.r_max, false, cell.mode);
+        push_dl_grant(state.dl_pending_grants, { grant, dci->alloc.rnti, npdsch.data[0], npdsch.needs_ack });
 
-        dci->ndi = h_ndi_dl;
-        h_ndi_dl = !h_ndi_dl;
+        // Acknowledged NPDSCH carry the NDI of their MAC HARQ process, so a retransmission keeps it
+        if (!npdsch.needs_ack) {
+          dci->ndi = state.h_ndi_dl;
+          state.h_ndi_dl = !state.h_ndi_dl;
+        }
 
-        sonica_enb_dl_nbiot_put_npdcch_dl(&enb_dl, dci, sf_idx);
+        phy_common::npdcch_rep_t rep = {};
+        rep.is_dl    = true;
+        rep.dl_dci   = *dci;
+        rep.rnti     = dci->alloc.rnti;
+        rep.location = npdsch.npdcch.location;
+        rep.end_tti  = end_tti;
+        state.npdcch_reps.push_back(rep);
       }
     }
   }
 
-  if (!npdsch_active && !dl_pending_grants.empty()) {
-    dl_grant_record& head_grant = dl_pending_grants.front();
+  // Each DCI is repeated in the valid DL subframes of its candidate, the last one drops it
+  bool is_npdcch_sf = !has_sib1_cfg && srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl);
+  for (auto it = state.npdcch_reps.begin(); it != state.npdcch_reps.end();) {
+    if (is_npdcch_sf) {
+      npdcch_tx.push_back(*it);
+    }
+    if (TTI_SUB(tti_tx_dl, it->end_tti) < 10240 / 2) {
+      it = state.npdcch_reps.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  if (!state.npdsch.active && !state.dl_pending_grants.empty()) {
+    phy_common::dl_grant_record_t& head_grant = state.dl_pending_grants.front();
     if (head_grant.grant.start_sfn == sfn &&
         head_grant.grant.start_sfidx == sf_idx) {
-      if (srslte_npdsch_cfg(&npdsch_cfg, cell, &head_grant.grant, sf_idx)) {
+      if (srslte_npdsch_cfg(&state.npdsch.cfg, cell, &head_grant.grant, sf_idx)) {
         Error("Error configuring NPDSCH for Data\n");
       } else {
-        npdsch_active = true;
-        npdsch_rnti = head_grant.rnti;
-        npdsch_data = head_grant.data;
+        state.npdsch.active = true;
+        state.npdsch.rnti = head_grant.rnti;
+        state.npdsch.data = head_grant.data;
+        state.npdsch.gen = ++state.npdsch_gen;
+        state.npdsch.needs_ack = head_grant.needs_ack;
       }
-      dl_pending_grants.pop_front();
+      state.dl_pending_grants.pop_front();
     }
   }
 
-  if (!has_sib1_cfg && npdsch_active && srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl)) {
-    if (sonica_enb_dl_nbiot_put_npdsch(&enb_dl, &npdsch_cfg,
-                                       npdsch_data, npdsch_rnti)) {
-      ERROR("Error encoding NPDSCH\n");
-    }
-    printf("S %d.%d => %d\n", sfn, sf_idx, npdsch_rnti);
-    if (npdsch_rnti != SRSLTE_SIRNTI) {
-      log_data(npdsch_data, 7);
-    }
-
-    if (npdsch_cfg.num_sf == npdsch_cfg.grant.nof_sf * npdsch_cfg.grant.nof_rep) {
-      bzero(&npdsch_cfg, sizeof(srslte_npdsch_cfg_t));
-      npdsch_active = false;
+  if (!has_sib1_cfg && state.npdsch.active && srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl)) {
+    queue_npdsch(state.npdsch);
+    SONICA_TRACE(PHY_NPDSCH_TX,
+                 tti_tx_dl,
+                 state.npdsch.rnti,
+                 state.npdsch.cfg.num_sf,
+                 state.npdsch.cfg.grant.nof_sf * state.npdsch.cfg.grant.nof_rep);
+
+    if (state.npdsch.cfg.num_sf == state.npdsch.cfg.grant.nof_sf * state.npdsch.cfg.grant.nof_rep) {
+      // The UE answers on NPUSCH Format 2 k0 subframes after the last NPDSCH subframe
+      if (state.npdsch.needs_ack) {
+        phy_common::ul_grant_record_t record = {};
+        srslte_ra_nbiot_ul_get_uci_grant(&record.grant, state.npdsch.cfg.grant.ack_nack_resource, tti_tx_dl);
+        record.rnti = state.npdsch.rnti;
+        push_ul_grant(state.ul_pending_grants, record);
+      }
+      bzero(&state.npdsch.cfg, sizeof(srslte_npdsch_cfg_t));
+      state.npdsch.active = false;
     }
   }
-
-  sonica_enb_dl_nbiot_gen_signal(&enb_dl);
 }
 
-} // namespace sonica_enb
\ No newline at end of file
+} // namespace sonica_enb
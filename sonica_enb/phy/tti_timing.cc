@@ -0,0 +1,270 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "sonica_enb/hdr/phy/tti_timing.h"
+
+namespace sonica_enb {
+
+// Start and end stage of each interval, the slack is computed apart
+static const tti_timing::stage_t interval_stages[tti_timing::NOF_INTERVALS][2] = {
+    {tti_timing::RX_DONE, tti_timing::WORKER_START},
+    {tti_timing::WORKER_START, tti_timing::STATE_ACQUIRED},
+    {tti_timing::STATE_ACQUIRED, tti_timing::MAC_DL_DONE},
+    {tti_timing::MAC_DL_DONE, tti_timing::MAC_UL_DONE},
+    {tti_timing::MAC_UL_DONE, tti_timing::UL_DONE},
+    {tti_timing::UL_DONE, tti_timing::DL_DONE},
+    {tti_timing::DL_DONE, tti_timing::TX_ACQUIRED},
+    {tti_timing::TX_ACQUIRED, tti_timing::TX_DONE},
+    {tti_timing::WORKER_START, tti_timing::DL_DONE},
+    {tti_timing::RX_DONE, tti_timing::TX_ACQUIRED},
+};
+
+const char* tti_timing::interval_name(interval_t i)
+{
+  static const char* names[NOF_INTERVALS] = {
+      "queue", "state_wait", "mac_dl", "mac_ul", "ul", "dl", "tx_wait", "radio_tx", "processing", "slack"};
+  return i < NOF_INTERVALS ? names[i] : "invalid";
+}
+
+void tti_timing::histogram::add(int32_t us)
+{
+  int32_t bin = (us - MIN_US) / BIN_US;
+  bin         = std::min(std::max(bin, 0), (int32_t)NOF_BINS - 1);
+  bins[bin].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  sum_us.fetch_add(us, std::memory_order_relaxed);
+
+  // Only the TTI being closed adds samples, a plain compare is enough
+  if (us > max_us.load(std::memory_order_relaxed)) {
+    max_us.store(us, std::memory_order_relaxed);
+  }
+}
+
+void tti_timing::histogram::reset()
+{
+  for (auto& b : bins) {
+    b.store(0, std::memory_order_relaxed);
+  }
+  count.store(0, std::memory_order_relaxed);
+  sum_us.store(0, std::memory_order_relaxed);
+  max_us.store(INT32_MIN, std::memory_order_relaxed);
+}
+
+float tti_timing::histogram::get_mean() const
+{
+  uint32_t n = get_count();
+  return n ? (float)sum_us.load(std::memory_order_relaxed) / n : 0.0f;
+}
+
+int32_t tti_timing::histogram::percentile(float p) const
+{
+  uint32_t target = std::max(1u, (uint32_t)ceilf(p * get_count()));
+  uint32_t acc    = 0;
+  for (uint32_t i = 0; i < NOF_BINS; i++) {
+    acc += bins[i].load(std::memory_order_relaxed);
+    if (acc >= target) {
+      return MIN_US + (int32_t)(i + 1) * BIN_US;
+    }
+  }
+  return MIN_US + (int32_t)NOF_BINS * BIN_US;
+}
+
+void tti_timing::init(srslte::log* log_h_, uint32_t deadline_us_, uint32_t print_period_)
+{
+  log_h        = log_h_;
+  deadline_ns  = (int64_t)deadline_us_ * 1000;
+  print_period = print_period_;
+  reset();
+}
+
+void tti_timing::reset()
+{
+  for (auto& s : slots) {
+    s.tti.store(UINT32_MAX, std::memory_order_relaxed);
+  }
+  for (auto& h : hist) {
+    h.reset();
+  }
+  nof_ttis.store(0, std::memory_order_relaxed);
+  nof_late.store(0, std::memory_order_relaxed);
+  nof_missed.store(0, std::memory_order_relaxed);
+  rf_underflows.store(0, std::memory_order_relaxed);
+  rf_overflows.store(0, std::memory_order_relaxed);
+  rf_late.store(0, std::memory_order_relaxed);
+  snapshot_ready.store(false, std::memory_order_relaxed);
+}
+
+int64_t tti_timing::now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void tti_timing::begin(uint32_t tti)
+{
+  slot_t& s = slots[tti % NOF_SLOTS];
+  for (auto& t : s.t_ns) {
+    t.store(0, std::memory_order_relaxed);
+  }
+  s.t_ns[RX_DONE].store(now_ns(), std::memory_order_relaxed);
+  s.tti.store(tti, std::memory_order_release);
+}
+
+void tti_timing::stamp(uint32_t tti, stage_t stage)
+{
+  slot_t& s = slots[tti % NOF_SLOTS];
+  if (s.tti.load(std::memory_order_acquire) == tti) {
+    s.t_ns[stage].store(now_ns(), std::memory_order_relaxed);
+  }
+}
+
+void tti_timing::end(uint32_t tti)
+{
+  slot_t& s = slots[tti % NOF_SLOTS];
+  if (s.tti.load(std::memory_order_acquire) != tti) {
+    nof_missed.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  int64_t t_ns[NOF_STAGES];
+  for (uint32_t i = 0; i < NOF_STAGES; i++) {
+    t_ns[i] = s.t_ns[i].load(std::memory_order_relaxed);
+  }
+
+  // Stages skipped by an early return leave their interval out
+  for (uint32_t i = 0; i < SLACK; i++) {
+    int64_t t1 = t_ns[interval_stages[i][0]];
+    int64_t t2 = t_ns[interval_stages[i][1]];
+    if (t1 && t2) {
+      hist[i].add((int32_t)((t2 - t1) / 1000));
+    }
+  }
+
+  if (t_ns[TX_ACQUIRED]) {
+    int32_t slack_us = (int32_t)((deadline_ns - (t_ns[TX_ACQUIRED] - t_ns[RX_DONE])) / 1000);
+    hist[SLACK].add(slack_us);
+    if (slack_us < 0) {
+      nof_late.fetch_add(1, std::memory_order_relaxed);
+      print_late(tti, t_ns, slack_us);
+    }
+  }
+
+  // The summary is printed by another thread, a snapshot not printed yet is kept
+  uint32_t n = nof_ttis.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (print_period && n % print_period == 0 && !snapshot_ready.load(std::memory_order_acquire)) {
+    get_metrics(snapshot);
+    snapshot_ready.store(true, std::memory_order_release);
+  }
+}
+
+void tti_timing::print_periodic()
+{
+  if (snapshot_ready.load(std::memory_order_acquire)) {
+    print_metrics(snapshot, false);
+    snapshot_ready.store(false, std::memory_order_release);
+  }
+}
+
+void tti_timing::print_late(uint32_t tti, const int64_t* t_ns, int32_t slack_us)
+{
+  if (!log_h) {
+    return;
+  }
+
+  char     str[256];
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < SLACK && len < sizeof(str); i++) {
+    int64_t t1 = t_ns[interval_stages[i][0]];
+    int64_t t2 = t_ns[interval_stages[i][1]];
+    if (t1 && t2 && i != PROCESSING) {
+      len += snprintf(&str[len], sizeof(str) - len, " %s=%ld", interval_name((interval_t)i), (long)(t2 - t1) / 1000);
+    }
+  }
+  log_h->warning("Late TTI=%d by %d us:%s\n", tti, -slack_us, len ? str : "");
+}
+
+void tti_timing::print_line(const char* str, bool console)
+{
+  if (console) {
+    log_h->console("%s", str);
+  } else {
+    log_h->info("%s", str);
+  }
+}
+
+void tti_timing::print_summary(bool console)
+{
+  metrics_t m = {};
+  get_metrics(m);
+  print_metrics(m, console);
+}
+
+void tti_timing::print_metrics(const metrics_t& m, bool console)
+{
+  if (!log_h) {
+    return;
+  }
+
+  char str[256];
+  snprintf(str,
+           sizeof(str),
+           "TTI timing: %d TTIs, late=%d, missed=%d, rf underflow=%d overflow=%d late=%d, slack p1=%d us\n",
+           m.nof_ttis,
+           m.nof_late,
+           m.nof_missed,
+           m.rf_underflows,
+           m.rf_overflows,
+           m.rf_late,
+           m.min_slack_us);
+  print_line(str, console);
+  for (uint32_t i = 0; i < NOF_INTERVALS; i++) {
+    snprintf(str,
+             sizeof(str),
+             "  %-10s mean=%.1f p99=%d max=%d us\n",
+             interval_name((interval_t)i),
+             m.mean_us[i],
+             m.p99_us[i],
+             m.max_us[i]);
+    print_line(str, console);
+  }
+}
+
+void tti_timing::get_metrics(metrics_t& m) const
+{
+  m.nof_ttis      = nof_ttis.load(std::memory_order_relaxed);
+  m.nof_late      = nof_late.load(std::memory_order_relaxed);
+  m.nof_missed    = nof_missed.load(std::memory_order_relaxed);
+  m.rf_underflows = rf_underflows.load(std::memory_order_relaxed);
+  m.rf_overflows  = rf_overflows.load(std::memory_order_relaxed);
+  m.rf_late       = rf_late.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < NOF_INTERVALS; i++) {
+    m.mean_us[i] = hist[i].get_mean();
+    m.p99_us[i]  = hist[i].percentile(0.99f);
+    m.max_us[i]  = hist[i].get_count() ? hist[i].get_max() : 0;
+  }
+  m.min_slack_us = hist[SLACK].percentile(0.01f);
+}
+
+} // namespace sonica_enb
@@ -57,6 +57,7 @@ bool txrx::init(srslte::radio_interface_phy* radio_h_,
                 phy_common*                  worker_com_,
                 nprach_worker*               nprach_,
                 srslte::log*                 log_h_,
+                const threads_cfg_t&         thread_cfg,
                 uint32_t                     prio_)
 {
   radio_h       = radio_h_;
@@ -69,7 +70,15 @@ bool txrx::init(srslte::radio_interface_phy* radio_h_,
 
   nof_workers = workers_pool->get_nof_workers();
 
-  start(prio_);
+  // Every worker may hold the subframe of its TTI and one more is kept for the 3.75 kHz NPUSCH slot, the NPRACH
+  // worker stops taking subframes beyond that
+  if (!rx_ring.init(nof_workers + 2 + nof_nprach_slots, worker_com->get_sf_len(), worker_com->get_nof_ports())) {
+    log_h->error("Error initiating RX subframe ring\n");
+    return false;
+  }
+  nprach->set_rx_ring(&rx_ring, nof_workers + 2);
+
+  start_cfg(thread_cfg, prio_);
   return true;
 }
 
@@ -87,9 +96,9 @@ void txrx::run_thread()
   srslte::rf_buffer_t buffer  = {};
   srslte_timestamp_t  rx_time = {};
   srslte_timestamp_t  tx_time = {};
-  uint32_t            sf_len  = SRSLTE_SF_LEN_PRB(worker_com->get_nof_prb());
+  uint32_t            sf_len  = worker_com->get_sf_len();
 
-  float samp_rate = srslte_sampling_freq_hz(worker_com->get_nof_prb());
+  float samp_rate = worker_com->get_srate_hz();
 
   // Configure radio
   radio_h->set_rx_srate(samp_rate);
@@ -103,7 +112,10 @@ void txrx::run_thread()
   radio_h->set_tx_freq(0, tx_freq_hz);
   radio_h->set_rx_freq(0, rx_freq_hz);
 
-  log_h->info("Starting RX/TX thread nof_prb=%d, sf_len=%d\n", worker_com->get_nof_prb(), sf_len);
+  log_h->info("Starting RX/TX thread nof_prb=%d, srate=%.2f MHz, sf_len=%d\n",
+              worker_com->get_nof_prb(),
+              samp_rate / 1e6,
+              sf_len);
 
   // Set TTI so that first TX is at tti=0
   tti = TTI_SUB(0, FDD_HARQ_DELAY_UL_MS + 1);
@@ -125,14 +137,20 @@ void txrx::run_thread()
     worker = (sf_worker*)workers_pool->wait_worker(tti);
 
     if (worker) {
-      // Multiple cell buffer mapping
+      rx_sf_ring::view rx = rx_ring.acquire(tti);
+      if (rx_ring.get_nof_overflows() != nof_rx_overflows) {
+        nof_rx_overflows = rx_ring.get_nof_overflows();
+        log_h->warning("RX ring full at tti=%d, the subframe is dropped\n", tti);
+      }
 
+      // Multiple cell buffer mapping
       for (uint32_t p = 0; p < worker_com->get_nof_ports(); p++) {
         // WARNING: The number of ports for all cells must be the same
-        buffer.set(0, p, worker_com->get_nof_ports(), worker->get_buffer_rx(p));
+        buffer.set(0, p, worker_com->get_nof_ports(), rx_ring.get_write_ptr(rx, p));
       }
 
       radio_h->rx_now(buffer, sf_len, &rx_time);
+      worker_com->timing.begin(tti);
 
       /* Compute TX time: Any transmission happens in TTI+4 thus advance 4 ms the reception time */
       srslte_timestamp_copy(&tx_time, &rx_time);
@@ -146,14 +164,17 @@ void txrx::run_thread()
             worker->get_id());
 
       worker->set_time(tx_hfn, tti, tx_worker_cnt, tx_time);
+      worker->set_rx(rx);
       tx_worker_cnt = (tx_worker_cnt + 1) % nof_workers;
 
       // Trigger phy worker execution
+      worker_com->state_semaphore.push(worker);
+      worker_com->ul_semaphore.push(worker);
       worker_com->semaphore.push(worker);
       workers_pool->start_worker(worker);
 
-      // Trigger prach worker execution
-      nprach->new_tti(tti, buffer.get(0, 0, worker_com->get_nof_ports()));
+      // Trigger prach worker execution, it keeps a view of the subframe if it belongs to an occasion
+      nprach->new_tti(tti, rx);
     } else {
       // wait_worker() only returns NULL if it's being closed. Quit now to avoid unnecessary loops here
       running = false;
@@ -33,12 +33,12 @@ namespace sonica_enb {
 enb_stack_nb::enb_stack_nb(srslte::logger* logger_) :
   timers(128), logger(logger_), pdcp(this, "PDCP"), thread("STACK")
 {
-  enb_queue_id   = pending_tasks.add_queue();
-  sync_queue_id  = pending_tasks.add_queue();
-  mme_queue_id   = pending_tasks.add_queue();
-  gtpu_queue_id  = pending_tasks.add_queue();
-  mac_queue_id   = pending_tasks.add_queue();
-  stack_queue_id = pending_tasks.add_queue();
+  enb_queue_id   = pending_tasks.add_queue(STACK_QUEUE_PRIO);
+  sync_queue_id  = pending_tasks.add_queue(SYNC_QUEUE_PRIO);
+  mme_queue_id   = pending_tasks.add_queue(NET_QUEUE_PRIO);
+  gtpu_queue_id  = pending_tasks.add_queue(NET_QUEUE_PRIO);
+  mac_queue_id   = pending_tasks.add_queue(LAYER_QUEUE_PRIO);
+  stack_queue_id = pending_tasks.add_queue(STACK_QUEUE_PRIO);
 
   pool = byte_buffer_pool::get_instance();
 }
@@ -125,7 +125,7 @@ int enb_stack_nb::init(const stack_args_t& args_, const rrc_cfg_t& rrc_cfg_)
   // }
 
   started = true;
-  start(STACK_MAIN_THREAD_PRIO);
+  start_cfg(args.thread, STACK_MAIN_THREAD_PRIO);
 
   return SRSLTE_SUCCESS;
 }
@@ -240,9 +240,9 @@ srslte::timer_handler::unique_timer enb_stack_nb::get_unique_timer()
   return timers.get_unique_timer();
 }
 
-srslte::task_multiqueue::queue_handler enb_stack_nb::make_task_queue()
+srslte::mpsc_task_multiqueue::queue_handler enb_stack_nb::make_task_queue()
 {
-  return pending_tasks.get_queue_handler();
+  return pending_tasks.get_queue_handler(LAYER_QUEUE_PRIO);
 }
 
 void enb_stack_nb::defer_callback(uint32_t duration_ms, std::function<void()> func)
@@ -29,7 +29,6 @@
 #include "sonica_enb/hdr/stack/mac/mac.h"
 #include "srslte/common/log.h"
 #include "srslte/common/log_helper.h"
-#include "srslte/common/rwlock_guard.h"
 #include "srslte/common/time_prof.h"
 
 //#define WRITE_SIB_PCAP
@@ -38,23 +37,19 @@ using namespace asn1::rrc;
 namespace sonica_enb {
 
 //:
-//last_rnti(0),
 //rar_pdu_msg(sched_interface::MAX_RAR_LIST),
 //    rar_payload(),
 //    common_buffers(SRSLTE_MAX_CARRIERS)
 mac::mac() :
-  last_rnti(0),
   rar_pdu_msg(sched_interface::MAX_RAR_LIST),
   rar_payload(),
   common_buffers(SRSLTE_MAX_CARRIERS)
 {
-  pthread_rwlock_init(&rwlock, nullptr);
 }
 
 mac::~mac()
 {
 //  stop();
-  pthread_rwlock_destroy(&rwlock);
 }
 
 bool mac::init(const mac_args_t &args_,
@@ -79,10 +74,10 @@ bool mac::init(const mac_args_t &args_,
 
     stack_task_queue = stack->make_task_queue();
 
-    scheduler.init();
-
     // Set default scheduler configuration
-//    scheduler.set_sched_cfg(&args.sched);
+    scheduler.set_sched_cfg(&args.sched);
+
+    scheduler.init();
 
     // Init softbuffer for SI messages
 //    common_buffers.resize(cells.size());
@@ -109,7 +104,6 @@ bool mac::init(const mac_args_t &args_,
 
 void mac::stop()
 {
-  srslte::rwlock_write_guard lock(rwlock);
   if (started) {
     ue_db.clear();
     for (auto& cc : common_buffers) {
@@ -128,7 +122,7 @@ void mac::reset()
 {
   Info("Resetting MAC\n");
 
-  last_rnti = 4097;
+  ue_db.reset_rnti();
 
   /* Setup scheduler */
   scheduler.reset();
@@ -136,15 +130,8 @@ void mac::reset()
 
 uint16_t mac::allocate_rnti()
 {
-  std::lock_guard<std::mutex> lock(rnti_mutex);
-
   // Assign a c-rnti
-  uint16_t rnti = last_rnti++;
-  if (last_rnti >= 60000) {
-    last_rnti = 4097;
-  }
-
-  return rnti;
+  return ue_db.allocate_rnti();
 }
 
 /********************************************************
@@ -155,9 +142,8 @@ uint16_t mac::allocate_rnti()
 
 int mac::rlc_buffer_state(uint16_t rnti, uint32_t lc_id, uint32_t tx_queue, uint32_t retx_queue)
 {
-  srslte::rwlock_read_guard lock(rwlock);
-  int                       ret = -1;
-  if (ue_db.count(rnti)) {
+  int ret = -1;
+  if (ue_db.contains(rnti)) {
     if (rnti != SRSLTE_MRNTI) {
       ret = scheduler.dl_rlc_buffer_state(rnti, lc_id, tx_queue, retx_queue);
     } else {
@@ -177,15 +163,12 @@ int mac::rlc_buffer_state(uint16_t rnti, uint32_t lc_id, uint32_t tx_queue, uint
 // Update UE configuration
 int mac::ue_cfg(uint16_t rnti, sched_interface::ue_cfg_t* cfg)
 {
-  srslte::rwlock_read_guard lock(rwlock);
-
-  auto it     = ue_db.find(rnti);
-  ue*  ue_ptr = nullptr;
-  if (it == ue_db.end()) {
+  auto u = ue_db.find(rnti);
+  if (not u) {
     Error("User rnti=0x%x not found\n", rnti);
     return SRSLTE_ERROR;
   }
-  ue_ptr = it->second.get();
+  ue* ue_ptr = u->get();
 
   // Start TA FSM in UE entity
   //  ue_ptr->start_ta();
@@ -214,23 +197,15 @@ int mac::ue_cfg(uint16_t rnti, sched_interface::ue_cfg_t* cfg)
 // Removes UE from DB
 int mac::ue_rem(uint16_t rnti)
 {
-  int ret = -1;
-  {
-    srslte::rwlock_read_guard lock(rwlock);
-    if (ue_db.count(rnti)) {
-      // phy_h->rem_rnti(rnti);
-      scheduler.ue_rem(rnti);
-      ret = 0;
-    } else {
-      Error("User rnti=0x%x not found\n", rnti);
-    }
-  }
-  if (ret) {
-    return ret;
+  if (not ue_db.contains(rnti)) {
+    Error("User rnti=0x%x not found\n", rnti);
+    return -1;
   }
-  srslte::rwlock_write_guard lock(rwlock);
-  if (ue_db.count(rnti)) {
-    ue_db.erase(rnti);
+  // phy_h->rem_rnti(rnti);
+  scheduler.ue_rem(rnti);
+
+  // Waits for the workers still using the UE
+  if (ue_db.remove(rnti)) {
     Info("User rnti=0x%x removed from MAC/PHY\n", rnti);
   } else {
     Error("User rnti=0x%x already removed\n", rnti);
@@ -245,7 +220,6 @@ int mac::ue_set_crnti(uint16_t temp_crnti, uint16_t crnti, sched_interface::ue_c
   if (ret != SRSLTE_SUCCESS) {
     return ret;
   }
-  srslte::rwlock_read_guard lock(rwlock);
   if (temp_crnti == crnti) {
     // if RNTI is maintained, Msg3 contained a RRC Setup Request
     scheduler.dl_mac_buffer_state(crnti, (uint32_t)srslte::dl_sch_lcid::CON_RES_ID);
@@ -263,15 +237,31 @@ int mac::ue_set_crnti(uint16_t temp_crnti, uint16_t crnti, sched_interface::ue_c
  *
  *******************************************************/
 
+int mac::ack_info(uint32_t tti_rx, uint16_t rnti, bool ack)
+{
+  log_h->step(tti_rx);
+
+  if (not ue_db.contains(rnti)) {
+    Error("User rnti=0x%x not found\n", rnti);
+    return SRSLTE_ERROR;
+  }
+
+  int nof_bytes = scheduler.dl_ack_info(tti_rx, rnti, ack);
+  Info("HARQ-ACK rnti=0x%x, tti_rx=%d, ack=%d, nof_bytes=%d\n", rnti, tti_rx, ack, nof_bytes);
+
+  return SRSLTE_SUCCESS;
+}
+
 int mac::crc_info(uint32_t tti_rx, uint16_t rnti, uint32_t nof_bytes, bool crc)
 {
   int ret = SRSLTE_ERROR;
   log_h->step(tti_rx);
-  srslte::rwlock_read_guard lock(rwlock);
 
-  if (ue_db.count(rnti)) {
-    ue_db[rnti]->set_tti(tti_rx);
-    ue_db[rnti]->metrics_rx(crc, nof_bytes);
+  auto u = ue_db.find(rnti);
+  if (u) {
+    ue* ue_ptr = u->get();
+    ue_ptr->set_tti(tti_rx);
+    ue_ptr->metrics_rx(crc, nof_bytes);
 
     //    std::array<int, SRSLTE_MAX_CARRIERS> enb_ue_cc_map = scheduler.get_enb_ue_cc_map(rnti);
     //    if (enb_ue_cc_map[enb_cc_idx] < 0) {
@@ -284,14 +274,20 @@ int mac::crc_info(uint32_t tti_rx, uint16_t rnti, uint32_t nof_bytes, bool crc)
     // push the pdu through the queue if received correctly
     if (crc) {
       Info("Pushing PDU rnti=0x%x, tti_rx=%d, nof_bytes=%d\n", rnti, tti_rx, nof_bytes);
-      ue_db[rnti]->push_pdu(tti_rx, nof_bytes);
-      stack_task_queue.push([this]() { process_pdus(); });
+      ue_ptr->push_pdu(tti_rx, nof_bytes);
+      // A single task processes the PDUs of every UE, so one is pushed until it runs
+      if (not pdus_pending.exchange(true)) {
+        stack_task_queue.push([this]() {
+          pdus_pending = false;
+          process_pdus();
+        });
+      }
     } else {
-      ue_db[rnti]->deallocate_pdu(tti_rx);
+      ue_ptr->deallocate_pdu(tti_rx);
     }
 
-    // Scheduler uses eNB's CC mapping. Update harq info
-    //    ret = scheduler.ul_crc_info(tti_rx, rnti, enb_cc_idx, crc);
+    // The CRC moves the outer loop of the UL link adaptation
+    ret = scheduler.ul_crc_info(tti_rx, rnti, crc);
 
   } else {
     Error("User rnti=0x%x not found\n", rnti);
@@ -300,23 +296,37 @@ int mac::crc_info(uint32_t tti_rx, uint16_t rnti, uint32_t nof_bytes, bool crc)
   return ret;
 }
 
-bool mac::process_pdus()
+int mac::snr_info(uint32_t tti_rx, uint16_t rnti, float snr_db, float noise_db)
 {
-  srslte::rwlock_read_guard lock(rwlock);
-  bool                      ret = false;
-  for (auto& u : ue_db) {
-    ret |= u.second->process_pdus();
+  log_h->step(tti_rx);
+
+  if (not ue_db.contains(rnti)) {
+    Error("User rnti=0x%x not found\n", rnti);
+    return SRSLTE_ERROR;
   }
+  Info("UL SNR rnti=0x%x, tti_rx=%d, snr=%.1f dB, noise=%.1f dB\n", rnti, tti_rx, snr_db, noise_db);
+
+  return scheduler.ul_snr_info(tti_rx, rnti, snr_db);
+}
+
+bool mac::process_pdus()
+{
+  bool ret = false;
+  ue_db.for_each([&ret](std::unique_ptr<ue>& u) { ret |= u->process_pdus(); });
   return ret;
 }
 
-void mac::rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv)
+void mac::rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv, uint32_t ce_level)
 {
   static srslte::mutexed_tprof<srslte::avg_time_stats> rach_tprof("rach_tprof", "MAC", 1);
   log_h->step(tti);
   auto rach_tprof_meas = rach_tprof.start();
 
   uint16_t rnti = allocate_rnti();
+  if (rnti == SRSLTE_INVALID_RNTI) {
+    Error("No free C-RNTI for the RACH at tti=%d, every UE slot is in use\n", tti);
+    return;
+  }
 
   // Create new UE
   std::unique_ptr<ue> ue_ptr{new ue(rnti, &scheduler, rlc_h, log_h)};
@@ -326,12 +336,10 @@ void mac::rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv)
 //    ue_ptr->start_pcap(pcap);
 //  }
 
-  {
-    srslte::rwlock_write_guard lock(rwlock);
-    ue_db[rnti] = std::move(ue_ptr);
-  }
+  // The slot was reserved by allocate_rnti(), the UE becomes visible to the workers once stored
+  ue_db.add(rnti, std::move(ue_ptr));
 
-  stack_task_queue.push([this, rnti, tti, preamble_idx, time_adv, rach_tprof_meas]() mutable {
+  stack_task_queue.push([this, rnti, tti, preamble_idx, time_adv, ce_level, rach_tprof_meas]() mutable {
 //    rach_tprof_meas.defer_stop();
     // Generate RAR data
     sched_interface::dl_sched_rar_info_t rar_info = {};
@@ -347,6 +355,7 @@ void mac::rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv)
     // Future: NB UE parameters init here
     ue_cfg.ue_bearers[0].direction             = sonica_enb::sched_interface::ue_bearer_cfg_t::BOTH;
     ue_cfg.dl_cfg.tm                           = SRSLTE_TM1;
+    ue_cfg.ce_level                            = ce_level;
 
     if (scheduler.ue_cfg(rnti, ue_cfg) != SRSLTE_SUCCESS) {
       Error("Registering new user rnti=0x%x to SCHED\n", rnti);
@@ -365,8 +374,18 @@ void mac::rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv)
     // Trigger scheduler RACH
     scheduler.dl_rach_info(rar_info);
 
-    log_h->info("RACH:  tti=%d, preamble=%d, offset=%d, temp_crnti=0x%x\n", tti, preamble_idx, time_adv, rnti);
-    log_h->console("RACH:  tti=%d, preamble=%d, offset=%d, temp_crnti=0x%x\n", tti, preamble_idx, time_adv, rnti);
+    log_h->info("RACH:  tti=%d, CE level=%d, preamble=%d, offset=%d, temp_crnti=0x%x\n",
+                tti,
+                ce_level,
+                preamble_idx,
+                time_adv,
+                rnti);
+    log_h->console("RACH:  tti=%d, CE level=%d, preamble=%d, offset=%d, temp_crnti=0x%x\n",
+                   tti,
+                   ce_level,
+                   preamble_idx,
+                   time_adv,
+                   rnti);
   });
 }
 
@@ -377,6 +396,7 @@ int mac::get_dl_sched(uint32_t hfn, uint32_t tti_tx_dl, dl_sched_list_t &dl_sche
   }
 
   log_h->step(TTI_SUB(tti_tx_dl, FDD_HARQ_DELAY_UL_MS));
+  auto t = std::chrono::steady_clock::now();
 
   // Run scheduler with current info
   sched_interface::dl_sched_res_t sched_result = {};
@@ -384,48 +404,62 @@ int mac::get_dl_sched(uint32_t hfn, uint32_t tti_tx_dl, dl_sched_list_t &dl_sche
     Error("Running scheduler\n");
     return SRSLTE_ERROR;
   }
+  sched_stage_done(DL_SCHED, t);
 
-  int n = 0;
+  uint32_t n = 0;
   dl_sched_t *dl_sched_res = &dl_sched_res_list[0];
+  uint32_t nof_elems = sched_result.nof_data_elems + sched_result.nof_rar_elems + sched_result.nof_bc_elems;
+
+  if (nof_elems > MAX_DL_GRANTS) {
+    Error("DL_SCHED: %d items generated, only %d fit in a subframe\n", nof_elems, MAX_DL_GRANTS);
+  }
 
   // Copy User data
   {
-    srslte::rwlock_read_guard lock(rwlock);
-
     // Copy data grants
-    for (uint32_t i = 0; i < sched_result.nof_data_elems; i++) {
+    for (uint32_t i = 0; i < sched_result.nof_data_elems and n < MAX_DL_GRANTS; i++) {
 
       // Get UE
       uint16_t rnti = sched_result.data[i].dci.alloc.rnti;
 
-      if (ue_db.count(rnti)) {
+      auto u = ue_db.find(rnti);
+      if (u) {
+        ue*               ue_ptr = u->get();
+        dl_sched_grant_t* grant  = &dl_sched_res->npdsch[n];
+
         // Copy dci info
-        dl_sched_res->npdsch.dci = sched_result.data[i].dci;
-        dl_sched_res->npdsch.has_npdcch = true;
+        grant->dci        = sched_result.data[i].dci;
+        grant->npdcch     = sched_result.data[i].npdcch;
+        grant->has_npdcch = true;
+        grant->needs_ack  = true;
+        grant->is_new_sib = false;
 
         for (uint32_t tb = 0; tb < SRSLTE_MAX_TB; tb++) {
-//          dl_sched_res->npdsch.softbuffer_tx[tb] =
+//          grant->softbuffer_tx[tb] =
 //              ue_db[rnti]->get_tx_softbuffer(sched_result.data[i].dci.ue_cc_idx, sched_result.data[i].dci.pid, tb);
 
           if (sched_result.data[i].nof_pdu_elems[tb] > 0) {
             /* Get PDU if it's a new transmission */
-            dl_sched_res->npdsch.data[tb] = ue_db[rnti]->generate_pdu(0, // tmp CC_index
-                                                                        0, // tmp pid
-                                                                        tb,
-                                                                        sched_result.data[i].pdu[tb],
-                                                                        sched_result.data[i].nof_pdu_elems[tb],
-                                                                        sched_result.data[i].tbs[tb]);
-
-            if (!dl_sched_res->npdsch.data[tb]) {
+            grant->data[tb] = ue_ptr->generate_pdu(0, // tmp CC_index
+                                                   sched_result.data[i].pid,
+                                                   tb,
+                                                   sched_result.data[i].pdu[tb],
+                                                   sched_result.data[i].nof_pdu_elems[tb],
+                                                   sched_result.data[i].tbs[tb]);
+
+            if (!grant->data[tb]) {
               Error("Error! PDU was not generated (rnti=0x%04x, tb=%d)\n", rnti, tb);
             }
 
 //            if (pcap) {
-//              pcap->write_dl_crnti(dl_sched_res->npdsch.data[tb], sched_result.data[i].tbs[tb], rnti, true, tti_tx_dl, enb_cc_idx);
+//              pcap->write_dl_crnti(grant->data[tb], sched_result.data[i].tbs[tb], rnti, true, tti_tx_dl, enb_cc_idx);
 //            }
+          } else if (sched_result.data[i].tbs[tb] > 0) {
+            /* Retransmission, the PDU of the HARQ process is sent again */
+            grant->data[tb] = ue_ptr->get_tx_pdu(0, sched_result.data[i].pid, tb);
           } else {
             /* TB not enabled OR no data to send: set pointers to NULL  */
-            dl_sched_res->npdsch.data[tb] = nullptr;
+            grant->data[tb] = nullptr;
           }
         }
         n++;
@@ -436,32 +470,42 @@ int mac::get_dl_sched(uint32_t hfn, uint32_t tti_tx_dl, dl_sched_list_t &dl_sche
 
     // No more uses of shared ue_db beyond here
   }
+  sched_stage_done(DL_UE_PDU, t);
 
   // Copy RAR grants
-  for (uint32_t i = 0; i < sched_result.nof_rar_elems; i++) {
+  for (uint32_t i = 0; i < sched_result.nof_rar_elems and n < MAX_DL_GRANTS; i++) {
+    dl_sched_grant_t* grant = &dl_sched_res->npdsch[n];
+
     // Copy dci info
-    dl_sched_res->npdsch.dci = sched_result.rar[i].dci;
-    dl_sched_res->npdsch.has_npdcch = true;
+    grant->dci        = sched_result.rar[i].dci;
+    grant->npdcch     = sched_result.rar[i].npdcch;
+    grant->has_npdcch = true;
+    grant->needs_ack  = false;
+    grant->is_new_sib = false;
 
     // Set softbuffer (there are no retx in RAR but a softbuffer is required)
     //    dl_sched_res->pdsch.softbuffer_tx[0] = &common_buffers[0].rar_softbuffer_tx;
 
     // Assemble PDU
-    dl_sched_res->npdsch.data[0] = assemble_rar(
+    grant->data[0] = assemble_rar(
             sched_result.rar[i].msg3_grant, sched_result.rar[i].nof_grants, i, sched_result.rar[i].tbs, tti_tx_dl);
 
     n++;
   }
+  sched_stage_done(DL_RAR, t);
 
   // Copy SIB grants
-  for (uint32_t i = 0; i < sched_result.nof_bc_elems; i++) {
+  for (uint32_t i = 0; i < sched_result.nof_bc_elems and n < MAX_DL_GRANTS; i++) {
+    dl_sched_grant_t* grant = &dl_sched_res->npdsch[n];
+
     // Copy dci info
-    dl_sched_res->npdsch.dci = sched_result.bc[i].dci;
-    dl_sched_res->npdsch.has_npdcch = false;
-    dl_sched_res->npdsch.is_new_sib = sched_result.bc[i].is_new_sib;
+    grant->dci        = sched_result.bc[i].dci;
+    grant->has_npdcch = false;
+    grant->needs_ack  = false;
+    grant->is_new_sib = sched_result.bc[i].is_new_sib;
 
     // Assemble PDU
-    if (dl_sched_res->npdsch.dci.alloc.has_sib1) {
+    if (grant->dci.alloc.has_sib1) {
       uint8_t *sib1_content = rrc_h->read_pdu_bcch_dlsch(0);
 
       // HACK: Patch HFN field in SIB1, we don't go over RRC to do this
@@ -472,20 +516,17 @@ int mac::get_dl_sched(uint32_t hfn, uint32_t tti_tx_dl, dl_sched_list_t &dl_sche
       s2 |= ((hfn >> 2) & 0x0F) << 4;
       sib1_content[2] = s2;
 
-      dl_sched_res->npdsch.data[0] = sib1_content;
+      grant->data[0] = sib1_content;
     } else {
-      dl_sched_res->npdsch.data[0] = rrc_h->read_pdu_bcch_dlsch(1);
+      grant->data[0] = rrc_h->read_pdu_bcch_dlsch(1);
     }
 
     n++;
   }
+  sched_stage_done(DL_BCCH, t);
 
   dl_sched_res->nof_grants = n;
 
-  if (n > 1) {
-    Error("DL_SCHED: scheduling conflict, %d item generated\n", n);
-  }
-
   // Number of CCH symbols
   //  dl_sched_res->cfi = sched_result.cfi;
 
@@ -531,7 +572,7 @@ void mac::srslte_nb_dci_rar_pack(srslte_nbiot_dci_rar_grant_t *rar, uint8_t payl
   srslte_bit_unpack(rar->i_mcs, &ptr, 3);
 }
 
-int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sched_res_list)
+int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_t& ul_sched_res)
 {
   if (!started) {
     return SRSLTE_SUCCESS;
@@ -547,7 +588,8 @@ int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sche
   //    }
   //  }
 
-  ul_sched_t* phy_ul_sched_res = &ul_sched_res_list[0];
+  ul_sched_t* phy_ul_sched_res = &ul_sched_res;
+  auto        t                = std::chrono::steady_clock::now();
 
   // Run scheduler with current info
   sched_interface::ul_sched_res_t sched_result = {};
@@ -555,10 +597,9 @@ int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sche
     Error("Running scheduler\n");
     return SRSLTE_ERROR;
   }
+  sched_stage_done(UL_SCHED, t);
 
   {
-    srslte::rwlock_read_guard lock(rwlock);
-
     // Copy DCI grants
     phy_ul_sched_res->nof_grants = 0;
     int n                        = 0;
@@ -567,11 +608,13 @@ int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sche
         // Get UE
         uint16_t rnti = sched_result.npusch[i].dci.rnti;
 
-        if (ue_db.count(rnti)) {
+        auto u = ue_db.find(rnti);
+        if (u) {
           // Copy grant info
           phy_ul_sched_res->npusch[n].current_tx_nb = sched_result.npusch[i].current_tx_nb;
           phy_ul_sched_res->npusch[n].needs_npdcch  = sched_result.npusch[i].needs_npdcch;
           phy_ul_sched_res->npusch[n].dci           = sched_result.npusch[i].dci;
+          phy_ul_sched_res->npusch[n].npdcch        = sched_result.npusch[i].npdcch;
 
           /// FUTURE: HARQ Related
           //          phy_ul_sched_res->pusch[n].softbuffer_rx =
@@ -582,7 +625,7 @@ int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sche
           //            sched_result.npusch[i].tbs * 8);
           //          }
 
-          phy_ul_sched_res->npusch[n].data = ue_db[rnti]->request_buffer(tti_tx_ul, sched_result.npusch[i].tbs);
+          phy_ul_sched_res->npusch[n].data = (*u)->request_buffer(sched_result.npusch[i].tti_tx, sched_result.npusch[i].tbs);
           phy_ul_sched_res->nof_grants++;
           n++;
 
@@ -598,8 +641,42 @@ int mac::get_ul_sched(uint32_t hfn, uint32_t tti_tx_ul, ul_sched_list_t& ul_sche
 
     // No more uses of ue_db beyond here
   }
+  sched_stage_done(UL_GRANTS, t);
+
+  // get_ul_sched() closes the TTI
+  if (++sched_timing_ttis == SCHED_TIMING_PERIOD) {
+    print_sched_timing();
+  }
 
   return SRSLTE_SUCCESS;
 }
 
+void mac::sched_stage_done(sched_stage_t stage, std::chrono::steady_clock::time_point& t)
+{
+  auto     now = std::chrono::steady_clock::now();
+  uint64_t ns  = std::chrono::duration_cast<std::chrono::nanoseconds>(now - t).count();
+  t            = now;
+
+  sched_stage_stats_t& s = sched_timing[stage];
+  s.count++;
+  s.sum_ns += ns;
+  s.max_ns = SRSLTE_MAX(s.max_ns, ns);
+}
+
+void mac::print_sched_timing()
+{
+  static const char* names[NOF_SCHED_STAGES] = {"dl_sched", "dl_ue_pdu", "dl_rar", "dl_bcch", "ul_sched", "ul_grants"};
+
+  log_h->info("Scheduling time over %d TTIs:\n", sched_timing_ttis);
+  for (uint32_t i = 0; i < NOF_SCHED_STAGES; i++) {
+    sched_stage_stats_t& s = sched_timing[i];
+    log_h->info("  %-9s mean=%.1f max=%.1f us\n",
+                names[i],
+                s.count ? s.sum_ns / 1e3 / s.count : 0.0,
+                s.max_ns / 1e3);
+    s = {};
+  }
+  sched_timing_ttis = 0;
+}
+
 } // namespace sonica_enb
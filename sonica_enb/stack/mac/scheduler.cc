@@ -89,9 +89,16 @@ int sched::dl_rach_info(dl_sched_rar_info_t rar_info)
   return carrier_schedulers[0]->dl_rach_info(rar_info);
 }
 
+void sched::set_sched_cfg(sched_interface::sched_args_t* sched_cfg_)
+{
+  if (sched_cfg_ != nullptr) {
+    sched_cfg = *sched_cfg_;
+  }
+}
+
 int sched::cell_cfg()
 {
-  carrier_schedulers[0]->carrier_cfg();
+  carrier_schedulers[0]->carrier_cfg(sched_cfg);
 
   return 0;
 }
@@ -106,13 +113,21 @@ int sched::ue_cfg(uint16_t rnti, const sched_interface::ue_cfg_t& ue_cfg)
 {
   std::lock_guard<std::mutex> lock(sched_mutex);
   // Add or config user
-  auto it = ue_db.find(rnti);
-  if (it == ue_db.end()) {
+  auto user = ue_db.find(rnti);
+  if (not user) {
     // create new user
-    ue_db[rnti].init(rnti);
-    it = ue_db.find(rnti);
+    sched_ue new_user;
+    new_user.init(rnti, sched_cfg);
+    if (not ue_db.add(rnti, std::move(new_user))) {
+      Error("No UE slot for rnti=0x%x\n", rnti);
+      return SRSLTE_ERROR;
+    }
+    user = ue_db.find(rnti);
+  }
+  user->set_cfg(ue_cfg);
+  for (auto& c : carrier_schedulers) {
+    c->ue_cfg(rnti, *user);
   }
-  it->second.set_cfg(ue_cfg);
 
   return SRSLTE_SUCCESS;
 }
@@ -120,12 +135,13 @@ int sched::ue_cfg(uint16_t rnti, const sched_interface::ue_cfg_t& ue_cfg)
 int sched::ue_rem(uint16_t rnti)
 {
   std::lock_guard<std::mutex> lock(sched_mutex);
-  if (ue_db.count(rnti) > 0) {
-    ue_db.erase(rnti);
-  } else {
+  if (not ue_db.remove(rnti)) {
     Error("User rnti=0x%x not found\n", rnti);
     return SRSLTE_ERROR;
   }
+  for (auto& c : carrier_schedulers) {
+    c->ue_rem(rnti);
+  }
   return SRSLTE_SUCCESS;
 }
 
@@ -136,17 +152,47 @@ bool sched::ue_exists(uint16_t rnti)
 
 int sched::dl_rlc_buffer_state(uint16_t rnti, uint32_t lc_id, uint32_t tx_queue, uint32_t retx_queue)
 {
-  return ue_db_access(rnti, [&](sched_ue& ue) { ue.dl_buffer_state(lc_id, tx_queue, retx_queue); });
+  return ue_db_access(rnti, [&](sched_ue& ue) {
+    ue.dl_buffer_state(lc_id, tx_queue, retx_queue);
+    if (tx_queue + retx_queue > 0) {
+      dl_backlogged(rnti);
+    }
+  });
 }
 
 int sched::dl_mac_buffer_state(uint16_t rnti, uint32_t ce_code, uint32_t nof_cmds)
 {
-  return ue_db_access(rnti, [ce_code, nof_cmds](sched_ue& ue) { ue.mac_buffer_state(ce_code, nof_cmds); });
+  return ue_db_access(rnti, [this, rnti, ce_code, nof_cmds](sched_ue& ue) {
+    ue.mac_buffer_state(ce_code, nof_cmds);
+    dl_backlogged(rnti);
+  });
+}
+
+int sched::dl_ack_info(uint32_t tti, uint16_t rnti, bool ack)
+{
+  int ret = -1;
+  ue_db_access(rnti, [&](sched_ue& ue) { ret = ue.set_ack_info(tti, ack); }, __PRETTY_FUNCTION__);
+  return ret;
+}
+
+int sched::ul_crc_info(uint32_t tti, uint16_t rnti, bool crc)
+{
+  return ue_db_access(rnti, [tti, crc](sched_ue& ue) { ue.set_ul_crc(tti, crc); }, __PRETTY_FUNCTION__);
+}
+
+int sched::ul_snr_info(uint32_t tti, uint16_t rnti, float snr_db)
+{
+  return ue_db_access(rnti, [tti, snr_db](sched_ue& ue) { ue.set_ul_snr(tti, snr_db); }, __PRETTY_FUNCTION__);
 }
 
 int sched::ul_bsr(uint16_t rnti, uint32_t lcid, uint32_t bsr, bool set_value)
 {
-  return ue_db_access(rnti, [lcid, bsr, set_value](sched_ue& ue) { ue.ul_buffer_state(lcid, bsr, set_value); });
+  return ue_db_access(rnti, [this, rnti, lcid, bsr, set_value](sched_ue& ue) {
+    ue.ul_buffer_state(lcid, bsr, set_value);
+    if (bsr > 0) {
+      ul_backlogged(rnti);
+    }
+  });
 }
 
 int sched::ul_wait_timer(uint16_t rnti, uint32_t wait_time, bool set_value)
@@ -207,9 +253,9 @@ template <typename Func>
 int sched::ue_db_access(uint16_t rnti, Func f, const char* func_name)
 {
   std::lock_guard<std::mutex> lock(sched_mutex);
-  auto                        it = ue_db.find(rnti);
-  if (it != ue_db.end()) {
-    f(it->second);
+  auto                        user = ue_db.find(rnti);
+  if (user) {
+    f(*user);
   } else {
     if (func_name != nullptr) {
       Error("User rnti=0x%x not found. Failed to call %s.\n", rnti, func_name);
@@ -222,6 +268,20 @@ int sched::ue_db_access(uint16_t rnti, Func f, const char* func_name)
 }
 
 
+void sched::dl_backlogged(uint16_t rnti)
+{
+  for (auto& c : carrier_schedulers) {
+    c->dl_backlogged(rnti);
+  }
+}
+
+void sched::ul_backlogged(uint16_t rnti)
+{
+  for (auto& c : carrier_schedulers) {
+    c->ul_backlogged(rnti);
+  }
+}
+
 /*******************************************************
  *
  * Helper functions and common data types
@@ -21,6 +21,8 @@
  */
 
 #include "sonica_enb/hdr/stack/mac/scheduler_carrier.h"
+#include "sonica/common/trace.h"
+#include "sonica_enb/hdr/stack/mac/scheduler_metric.h"
 #include "srslte/common/log_helper.h"
 #include "srslte/common/logmap.h"
 
@@ -109,7 +111,7 @@ void bc_sched::alloc_sibs(uint32_t hfn, sf_sched* tti_sched)
   if (is_sib1_sf(sfn, sf_idx)) {
 
     // Check the sched table
-    if (tti_sched->dl_sched_table[current_tti]) {
+    if (tti_sched->dl_timeline->is_busy(current_tti)) {
       log_h->error("BC SCHED Error: SIB1 TTI %d has been allocated!\n", current_tti);
       //printf("BC SCHED Error: SIB1 TTI %d has been allocated!\n", current_tti);
       return;
@@ -126,8 +128,7 @@ void bc_sched::alloc_sibs(uint32_t hfn, sf_sched* tti_sched)
     }
 
     // Update the sched table
-    tti_sched->dl_sched_table[current_tti] = true;
-    //printf("DL_sched_table %d: allocate to sib1\n", current_tti);
+    tti_sched->dl_timeline->reserve(current_tti);
 
     // Increase the sf_idx
     sib1_sf_idx++;
@@ -143,8 +144,9 @@ void bc_sched::alloc_sibs(uint32_t hfn, sf_sched* tti_sched)
     // Check SIB2 TTI
     if (sf_idx == 1 && sfn % 512 < 16 && sfn % 4 == 0) {
 
-      // Check the sched table
-      if (tti_sched->dl_sched_table[current_tti]) {
+      // Check the sched table, SIB2 spans the next valid subframes as the PHY sends it
+      uint32_t sib2_ttis[SIB_MAX_NSF] = {};
+      if (sib2_num_sf > SIB_MAX_NSF or not tti_sched->dl_timeline->get_valid_span(current_tti, sib2_num_sf, sib2_ttis)) {
         log_h->error("BC SCHED Error: SIB2 TTI has been allocated!\n");
         //printf("BC SCHED Error: SIB2 TTI %d has been allocated!\n", current_tti);
         return;
@@ -153,15 +155,7 @@ void bc_sched::alloc_sibs(uint32_t hfn, sf_sched* tti_sched)
       //log_h->console("MAC SIB2 %d/%d.%d\n", hfn, sfn, sf_idx);
 
       // Update dl_sched table
-      uint32_t alloc_i = 0, rem_sib = sib2_num_sf;
-      while (rem_sib > 0) {
-        if (srslte_ra_nbiot_is_valid_dl_sf((current_tti + alloc_i) % 10240)) {
-          //printf("DL_sched_table %d: allocate to sib2\n", (current_tti + alloc_i) % 10240);
-          tti_sched->dl_sched_table[(current_tti + alloc_i) % 10240] = true;
-          rem_sib--;
-        }
-        alloc_i++;
-      }
+      tti_sched->dl_timeline->reserve(sib2_ttis, sib2_num_sf);
 
       sf_sched::bc_alloc_t bc_alloc{};
       bc_alloc.dci = ra_dl_sib2;
@@ -175,7 +169,7 @@ void bc_sched::alloc_sibs(uint32_t hfn, sf_sched* tti_sched)
  *                 RAR scheduling
  *******************************************************/
 
-ra_sched::ra_sched(std::map<uint16_t, sched_ue>& ue_db_) :
+ra_sched::ra_sched(sched_ue_db_t& ue_db_) :
         log_h(srslte::logmap::get("MAC")),
         ue_db(&ue_db_)
 {}
@@ -186,64 +180,44 @@ ra_sched::ra_sched(std::map<uint16_t, sched_ue>& ue_db_) :
 alloc_outcome_t ra_sched::dl_sched(sf_sched *tti_sched)
 {
   uint32_t tti_tx_dl = tti_sched->get_tti_tx_dl();
-  uint32_t current_sf_idx = tti_sched->get_tti_params().sf_idx_tx_dl;
-  uint32_t current_sfn = tti_sched->get_tti_params().sfn_tx_dl;
-  rar_aggr_level = 2;
 
   while (not pending_rars.empty()) {
-    // Check if conflict with PBCH & NRS
-    //    if (current_sf_idx == 0 || current_sf_idx == 5 || (current_sf_idx == 9 && current_sfn % 2 == 0)) {
-    //      printf("RAR SCHED: Current TTI %d conflicts with PBCH & NRS!\n", tti_tx_dl);
-    //      return alloc_outcome_t::RB_COLLISION;
-    //    }
-    if (!srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl)) {
-      log_h->warning("MAC RAR ra_sched::dl_sched TTI %d conflicts with PBCH & NRS!\n", tti_tx_dl);
-      printf("MAC RAR ra_sched::dl_sched TTI %d conflicts with PBCH & NRS!\n", tti_tx_dl);
-      return alloc_outcome_t::RB_COLLISION;
-    }
-
-    if (tti_sched->dl_sched_table[tti_tx_dl]) {
-      log_h->warning("MAC RAR ra_sched::dl_sched TTI %d is already scheduled.\n", tti_tx_dl);
-      printf("MAC RAR ra_sched::dl_sched TTI %d is already scheduled.\n", tti_tx_dl);
-      return alloc_outcome_t::RB_COLLISION;
+    // The RAR DCI takes a candidate of the Type-2 common search space starting at this TTI
+    sched_npdcch::alloc_t npdcch_alloc;
+    if (not tti_sched->npdcch->find(sched_npdcch::TYPE2_CSS, tti_tx_dl, 2, 1, &npdcch_alloc)) {
+      log_h->debug("SCHED: No Type-2 NPDCCH candidate for the RAR at TTI %d\n", tti_tx_dl);
+      return alloc_outcome_t::DCI_COLLISION;
     }
 
-    // Check the UE search space
-    if (tti_tx_dl % 16 >= 8){
-      log_h->warning("MAC RAR ra_sched::dl_sched TTI %d is not in the UE search space.\n", tti_tx_dl);
-      printf("MAC RAR ra_sched::dl_sched TTI %d is not in the UE search space.\n", tti_tx_dl);
+    // The RAR takes the first valid subframe 5 subframes after the end of its NPDCCH
+    uint32_t npdsch_tti = tti_sched->dl_timeline->next_valid(npdcch_alloc.npdcch.end_tti + 5);
+    if (tti_sched->dl_timeline->is_busy(npdsch_tti)) {
+      log_h->warning("MAC RAR ra_sched::dl_sched NPDSCH TTI %d is already scheduled.\n", npdsch_tti);
       return alloc_outcome_t::RB_COLLISION;
     }
 
     sf_sched::pending_rar_t &rar = pending_rars.front();
-    uint32_t prach_tti = rar.nprach_tti;
 
     // Try to schedule DCI + RBGs for RAR Grant
-    std::pair<alloc_outcome_t, uint32_t> ret = tti_sched->alloc_rar(rar_aggr_level, rar);
+    std::pair<alloc_outcome_t, uint32_t> ret = tti_sched->alloc_rar(npdcch_alloc, npdsch_tti, rar);
 
     if (ret.first != alloc_outcome_t::SUCCESS) {
       // try to scheduler next RAR with different RA-RNTI
       continue;
     }
 
+    //Update the sched table
+    tti_sched->npdcch->reserve(npdcch_alloc);
+    tti_sched->dl_timeline->reserve(npdsch_tti);
+
     uint32_t nof_rar_allocs = ret.second;
     if (nof_rar_allocs == rar.nof_grants) {
       // all RAR grants were allocated. Remove pending RAR
       pending_rars.pop_front();
-
-      //Update the sched table
-      tti_sched->dl_sched_table[tti_tx_dl] = true; // Set the current TTI occupied
-      //printf("DL_sched_table %d: allocate to rar dci\n", tti_tx_dl);
-      uint32_t rar_tx_tti = (tti_tx_dl + 5) % 10240;
-      while (!srslte_ra_nbiot_is_valid_dl_sf(rar_tx_tti)) {
-        rar_tx_tti = (rar_tx_tti + 1) % 10240;
-      }
-      tti_sched->dl_sched_table[rar_tx_tti] = true;
-      //printf("DL_sched_table %d: allocate to rar data\n", rar_tx_tti);
       return alloc_outcome_t::SUCCESS;
     } else {
       // keep the RAR grants that were not scheduled, so we can schedule in next TTI
-      printf("RAR SCHED: nof_rar_allocs != rar.nof_grants, keep the RAR grants that were not scheduled\n");
+      SONICA_TRACE(SCHED_RAR_PARTIAL, tti_tx_dl, rar.ra_rnti, nof_rar_allocs, rar.nof_grants);
       std::copy(&rar.msg3_grant[nof_rar_allocs], &rar.msg3_grant[rar.nof_grants], &rar.msg3_grant[0]);
       rar.nof_grants -= nof_rar_allocs;
       return alloc_outcome_t::DCI_COLLISION;
@@ -298,10 +272,9 @@ void ra_sched::ul_sched(sf_sched* sf_dl_sched, sf_sched* sf_msg3_sched)
       const auto& msg3grant = rar.rar_grant.msg3_grant[j];
 
       uint16_t crnti   = msg3grant.data.temp_crnti;
-      auto     user_it = ue_db->find(crnti);
-      if (user_it != ue_db->end() and sf_msg3_sched->alloc_msg3(&user_it->second, msg3grant)) {
-        log_h->debug("SCHED: Queueing Msg3 for rnti=0x%x at tti=%d\n", crnti, sf_msg3_sched->get_tti_tx_ul());
-        printf("SCHED: Queueing Msg3 for rnti=0x%x at tti=%d\n", crnti, sf_msg3_sched->get_tti_tx_ul());
+      auto     user    = ue_db->find(crnti);
+      if (user and sf_msg3_sched->alloc_msg3(user.get(), msg3grant)) {
+        SONICA_TRACE(SCHED_MSG3, sf_dl_sched->get_tti_tx_dl(), crnti, sf_msg3_sched->get_tti_tx_ul());
       } else {
         log_h->error("SCHED: Failed to allocate Msg3 for rnti=0x%x at tti=%d\n", crnti, sf_msg3_sched->get_tti_tx_ul());
       }
@@ -318,11 +291,9 @@ void ra_sched::reset()
 *                 Carrier scheduling
 *******************************************************/
 
-sched::carrier_sched::carrier_sched(std::map<uint16_t, sched_ue>* ue_db_) :
+sched::carrier_sched::carrier_sched(sched_ue_db_t* ue_db_) :
         ue_db(ue_db_),
-        log_h(srslte::logmap::get("MAC ")),
-        dl_sched_table(),
-        ul_sched_table()
+        log_h(srslte::logmap::get("MAC "))
 {
   sf_dl_mask.resize(1, 0);
 }
@@ -336,10 +307,68 @@ void sched::carrier_sched::reset()
   bc_sched_ptr.reset();
 }
 
-void sched::carrier_sched::carrier_cfg()
+void sched::carrier_sched::carrier_cfg(const sched_interface::sched_args_t& sched_args)
 {
   bc_sched_ptr.reset(new bc_sched{});
   ra_sched_ptr.reset(new ra_sched{*ue_db});
+
+  // Setup the scheduling metrics
+  if (sched_args.sched_policy == "rr") {
+    dl_metric.reset(new dl_metric_rr{});
+    ul_metric.reset(new ul_metric_rr{});
+  } else {
+    if (sched_args.sched_policy != "pf") {
+      log_h->error("Unknown scheduler policy \"%s\", using \"pf\"\n", sched_args.sched_policy.c_str());
+    }
+    dl_metric.reset(new dl_metric_pf{sched_args.ce_level_rep});
+    ul_metric.reset(new ul_metric_pf{sched_args.ce_level_rep});
+  }
+  // The new metrics start with every UE in their order, a pass drops the drained ones
+  ue_db->for_each([this](sched_ue& user) {
+    ue_cfg(user.get_rnti(), user);
+    dl_backlogged(user.get_rnti());
+    ul_backlogged(user.get_rnti());
+  });
+
+  // NPDCCH and NPDSCH skip the NPBCH, NPSS and NSSS subframes and the SIB1 ones
+  std::vector<bool> dl_valid(sched_timeline::NOF_TTIS);
+  for (uint32_t tti = 0; tti < sched_timeline::NOF_TTIS; tti++) {
+    dl_valid[tti] = srslte_ra_nbiot_is_valid_dl_sf(tti) and not bc_sched_ptr->is_sib1_sf(tti / 10, tti % 10);
+  }
+  dl_timeline.set_valid(dl_valid);
+  dl_timeline.reset();
+  ul_timeline.reset();
+  npdcch.init(&dl_timeline, sched_args);
+}
+
+void sched::carrier_sched::ue_cfg(uint16_t rnti, const sched_ue& user)
+{
+  if (dl_metric != nullptr) {
+    dl_metric->ue_cfg(rnti, user);
+    ul_metric->ue_cfg(rnti, user);
+  }
+}
+
+void sched::carrier_sched::ue_rem(uint16_t rnti)
+{
+  if (dl_metric != nullptr) {
+    dl_metric->ue_rem(rnti);
+    ul_metric->ue_rem(rnti);
+  }
+}
+
+void sched::carrier_sched::dl_backlogged(uint16_t rnti)
+{
+  if (dl_metric != nullptr) {
+    dl_metric->ue_backlogged(rnti);
+  }
+}
+
+void sched::carrier_sched::ul_backlogged(uint16_t rnti)
+{
+  if (ul_metric != nullptr) {
+    ul_metric->ue_backlogged(rnti);
+  }
 }
 
 const sf_sched_result& sched::carrier_sched::generate_tti_result(uint32_t hfn, uint32_t tti_rx, bool dl_flag)
@@ -348,35 +377,40 @@ const sf_sched_result& sched::carrier_sched::generate_tti_result(uint32_t hfn, u
 
   // if it is the first time tti is run, reset vars
   if (tti_rx != sf_result->tti_params.tti_rx) {
-    sf_sched* tti_sched = get_sf_sched(tti_rx, dl_sched_table, ul_sched_table);
+    sf_sched* tti_sched = get_sf_sched(tti_rx);
     *sf_result          = {};
 
     if(dl_flag){
-      // Clear the sched table for the current TTI
-      dl_sched_table[tti_rx % 10240] = false;
+      // Release the current TTI, which is in the past for every later allocation
+      dl_timeline.release(tti_rx);
+      npdcch.release(tti_rx);
       /* Schedule DL control data */
       /* Schedule Broadcast data (SIB and paging) */
       bc_sched_ptr->dl_sched(hfn, tti_sched);
 
       /* Schedule RAR */
-      auto ret = ra_sched_ptr->dl_sched(tti_sched);
-
-      /* Schedule Msg3 */
-      if(ret==alloc_outcome_t::SUCCESS){
-        sf_sched *sf_msg3_sched = get_sf_sched(tti_rx+9, dl_sched_table, ul_sched_table); // NB-IoT MSG3_DELAY_MS = 9
-        ra_sched_ptr->ul_sched(tti_sched, sf_msg3_sched);
+      ra_sched_ptr->dl_sched(tti_sched);
+
+      /* Schedule Msg3 in the UL result of the RAR subframe, the UL grant of the RAR places it 13 subframes later */
+      if (not tti_sched->get_allocated_rars().empty()) {
+        uint32_t rar_tti = tti_sched->get_allocated_rars().back().npdsch_tti;
+        if (TTI_SUB(rar_tti, tti_rx) < sf_scheds.size()) {
+          ra_sched_ptr->ul_sched(tti_sched, get_sf_sched(rar_tti));
+        } else {
+          log_h->error("SCHED: RAR at tti=%d is too late to allocate its Msg3\n", rar_tti);
+        }
       }
 
       /* Schedule DL user data */
       alloc_dl_users(tti_sched);
     } else {
-      ul_sched_table[tti_rx % 10240] = false;
+      ul_timeline.release(tti_rx);
       /* Schedule UL user data */
       alloc_ul_users(tti_sched);
     }
 
     /* Select the winner DCI allocation combination, store all the scheduling results */
-    tti_sched->generate_sched_results(sf_result);
+    tti_sched->generate_sched_results(sf_result, dl_flag);
   }
 
   return *sf_result;
@@ -397,76 +431,14 @@ void sched::carrier_sched::alloc_dl_users(sf_sched* tti_result)
   //  }
 
   // call DL scheduler metric to fill RB grid
-  sched_users_dl(tti_result);
-}
-
-void sched::carrier_sched::sched_users_dl(sf_sched* tti_sched)
-{
-  if (ue_db->empty()) {
-    return;
-  }
-
-  // give priority in a time-domain RR basis.
-  uint32_t priority_idx = tti_sched->get_tti_tx_dl() % (uint32_t)ue_db->size();
-  auto     iter         = ue_db->begin();
-  std::advance(iter, priority_idx);
-  for (uint32_t ue_count = 0; ue_count < ue_db->size(); ++iter, ++ue_count) {
-    if (iter == ue_db->end()) {
-      iter = ue_db->begin(); // wrap around
-    }
-    sched_ue* user = &iter->second;
-    allocate_user(user, tti_sched);
-  }
-}
-
-// HACK: Remember last DL alloc and separate consecutive ones for some time
-// TODO: Use HARQ procedure to properly handle
-static int last_alloc = 0;
-static bool alloc_active = false;
-
-dl_harq_proc* sched::carrier_sched::allocate_user(sched_ue* user, dl_sf_sched_itf* tti_sched)
-{
-  // Do not allocate a user multiple times in the same tti
-  if (tti_sched->is_dl_alloc(user)) {
-    return nullptr;
-  }
-  // Do not allocate a user to an inactive carrier
-  //  auto p = user->get_cell_index(cc_cfg->enb_cc_idx);
-  //  if (not p.first) {
-  //    return nullptr;
-  //  }
-  //  uint32_t cell_idx = p.second;
-  uint32_t cell_idx = 0;
-
-  alloc_outcome_t code;
-  uint32_t        tti_dl = tti_sched->get_tti_tx_dl();
-  //  dl_harq_proc*   h      = user->get_pending_dl_harq(tti_dl, cell_idx);
+  dl_metric->sched_users(*ue_db, tti_result);
 
-  if (alloc_active) {
-    if ((tti_dl + 10240 - last_alloc) % 10240 > 25) {
-      alloc_active = false;
-    }
-    return nullptr;
+  // A DL newtx raises the UL buffer state of its UE for the reply it expects
+  for (const sf_sched::dl_alloc_t& alloc : tti_result->get_allocated_data()) {
+    ul_metric->ue_backlogged(alloc.user_ptr->get_rnti());
   }
-
-  std::pair<uint32_t, uint32_t> req_bytes = user->get_requested_dl_bytes(cell_idx);
-
-  if (req_bytes.first > 0 /* and req_bytes.second > 5 */) {
-    printf("MAC: NB-IoT ===============================Get req_bytes min data %d, max data %d\n", req_bytes.first, req_bytes.second);
-    //    code = tti_sched->alloc_dl_user(user, newtx_mask, h->get_id());
-    code = tti_sched->alloc_dl_user(user, req_bytes.second);
-    if (code == alloc_outcome_t::SUCCESS) {
-      last_alloc = tti_dl;
-      alloc_active = true;
-      return nullptr;
-    } else if (code == alloc_outcome_t::DCI_COLLISION) {
-      log_h->warning("SCHED: Couldn't find space in PDCCH for DL tx for rnti=0x%x\n", user->get_rnti());
-    }
-  }
-  return nullptr;
 }
 
-
 int sched::carrier_sched::alloc_ul_users(sf_sched* tti_sched)
 {
   uint32_t tti_tx_ul = tti_sched->get_tti_tx_ul();
@@ -481,80 +453,16 @@ int sched::carrier_sched::alloc_ul_users(sf_sched* tti_sched)
   //  tti_sched->reserve_ul_prbs(pucch_mask, cc_cfg->nof_prb() != 6);
 
   /* Call scheduler for UL data */
-  sched_users_ul(tti_sched);
+  ul_metric->sched_users(*ue_db, tti_sched);
 
   return SRSLTE_SUCCESS;
 }
-void sched::carrier_sched::sched_users_ul(sf_sched* tti_sched)
-{
-  if (ue_db->empty()) {
-    return;
-  }
-
-  // give priority in a time-domain RR basis
-  uint32_t priority_idx = tti_sched->get_tti_tx_ul() % (uint32_t)ue_db->size();
-
-  auto iter = ue_db->begin();
-  std::advance(iter, priority_idx);
-  //  // allocate reTxs first
-  //  for (uint32_t ue_count = 0; ue_count < ue_db->size(); ++iter, ++ue_count) {
-  //    if (iter == ue_db->end()) {
-  //      iter = ue_db->begin(); // wrap around
-  //    }
-  //    sched_ue* user = &iter->second;
-  //    allocate_user_retx_prbs(user);
-  //  }
-
-  // give priority in a time-domain RR basis
-  iter = ue_db->begin();
-  std::advance(iter, priority_idx);
-  for (uint32_t ue_count = 0; ue_count < ue_db->size(); ++iter, ++ue_count) {
-    if (iter == ue_db->end()) {
-      iter = ue_db->begin(); // wrap around
-    }
-    sched_ue* user = &iter->second;
-    allocate_user_newtx_prbs(user, tti_sched);
-  }
-}
-
-ul_harq_proc* sched::carrier_sched::allocate_user_newtx_prbs(sched_ue* user, ul_sf_sched_itf* tti_sched)
-{
-  if (tti_sched->is_ul_alloc(user)) {
-    return nullptr;
-  }
-  uint32_t current_tti = tti_sched->get_tti_tx_ul();
-//  auto p = user->get_cell_index(cc_cfg->enb_cc_idx);
-//  if (not p.first) {
-//    // this cc is not activated for this user
-//    return nullptr;
-//  }
-//  uint32_t cell_idx = p.second;
-  uint32_t cell_idx = 0;
-
-  uint32_t      pending_data = user->get_pending_ul_new_data(current_tti);
-//  ul_harq_proc* h            = user->get_ul_harq(current_tti, cell_idx);
-
-  // find an empty PID
-  if (pending_data > 0) {
-    ul_harq_proc::ul_alloc_t alloc{};
-
-    alloc_outcome_t ret = tti_sched->alloc_ul_user(user, alloc);
-    if (ret == alloc_outcome_t::SUCCESS) {
-      user->ul_buffer_state(0,0, true); // Reset the bsr value to 0
-      user->ul_buffer_state(3,0, true); // Reset the bsr value to 0
-      return nullptr;
-    }
-    if (ret == alloc_outcome_t::DCI_COLLISION) {
-      log_h->warning("SCHED: Couldn't find space in NPDCCH for UL tx of rnti=0x%x\n", user->get_rnti());
-    }
-  }
-  return nullptr;
-}
-sf_sched *sched::carrier_sched::get_sf_sched(uint32_t tti_rx, bool* dl_sched_table, bool* ul_sched_table)
+sf_sched *sched::carrier_sched::get_sf_sched(uint32_t tti_rx)
 {
   sf_sched *ret = &sf_scheds[tti_rx % sf_scheds.size()];
-  ret->dl_sched_table = dl_sched_table;
-  ret->ul_sched_table = ul_sched_table;
+  ret->dl_timeline = &dl_timeline;
+  ret->ul_timeline = &ul_timeline;
+  ret->npdcch      = &npdcch;
   if (ret->get_tti_rx() != tti_rx) {
     // start new TTI. Bind the struct where the result is going to be stored
     ret->new_tti(tti_rx);
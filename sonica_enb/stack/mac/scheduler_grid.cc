@@ -23,12 +23,19 @@
 #include "sonica_enb/hdr/stack/mac/scheduler_grid.h"
 #include "sonica_enb/hdr/stack/mac/scheduler_carrier.h"
 #include "sonica_enb/hdr/stack/mac/scheduler.h"
+#include "sonica/common/trace.h"
 #include "srslte/common/log_helper.h"
 #include "srslte/common/logmap.h"
 #include <srslte/interfaces/sched_interface.h>
 
 namespace sonica_enb {
 
+// Reply a DL newtx is expected to get before the UE sends a BSR: bytes added to the UL buffer state of the lcid, and
+// TTIs the UL grant waits for them
+const static uint32_t EXPECTED_UL_BYTES     = 70;
+const static uint32_t EXPECTED_UL_LCID      = 3;
+const static uint32_t EXPECTED_UL_WAIT_TTIS = 30;
+
 const char *alloc_outcome_t::to_string() const
 {
   switch (result) {
@@ -129,8 +136,10 @@ sf_sched::ctrl_code_t sf_sched::alloc_dl_ctrl(uint32_t aggr_lvl, uint32_t tbs_by
   return {alloc_outcome_t::SUCCESS, ctrl_alloc};
 }
 
-std::pair<alloc_outcome_t, uint32_t> sf_sched::alloc_rar(uint32_t aggr_lvl, const pending_rar_t &rar)
+std::pair<alloc_outcome_t, uint32_t>
+sf_sched::alloc_rar(const sched_npdcch::alloc_t& npdcch_alloc, uint32_t npdsch_tti, const pending_rar_t& rar)
 {
+  uint32_t aggr_lvl = npdcch_alloc.npdcch.location.L;
   const uint32_t msg3_grant_size = 3;
   std::pair<alloc_outcome_t, uint32_t> ret = {alloc_outcome_t::ERROR, 0};
 
@@ -165,13 +174,13 @@ std::pair<alloc_outcome_t, uint32_t> sf_sched::alloc_rar(uint32_t aggr_lvl, cons
 
     rar_grant.msg3_grant[0].data = rar.msg3_grant[0];
     rar_grant.msg3_grant[0].grant.sc_spacing = 1;
-    rar_grant.msg3_grant[0].grant.i_sc = 18;
+    rar_grant.msg3_grant[0].grant.i_sc = 18; // 12 subcarriers, the scheduler only plans 12-tone NPUSCH
     rar_grant.msg3_grant[0].grant.i_delay = 0;
     rar_grant.msg3_grant[0].grant.n_rep = 0;
     rar_grant.msg3_grant[0].grant.i_mcs = 0;
 
 //    last_msg3_prb += msg3_grant_size;
-    rar_allocs.emplace_back(ret2.second, rar_grant);
+    rar_allocs.emplace_back(ret2.second, rar_grant, npdcch_alloc, npdsch_tti);
 
     break;
   }
@@ -211,7 +220,9 @@ void sf_sched::set_rar_sched_result(sched_interface::dl_sched_res_t *dl_result)
     rar->dci.alloc.i_rep = 0; // i_rep_val
     rar->dci.alloc.harq_ack = 1;
     rar->dci.alloc.i_n_start = 0;
+    rar->dci.alloc.dci_sf_rep_num = rar_alloc.npdcch.rep_idx;
     rar->dci.alloc.rnti = rar_alloc.alloc_data.rnti;
+    rar->npdcch = rar_alloc.npdcch.npdcch;
 
     // Setup RAR process
     rar->tbs = rar_alloc.alloc_data.req_bytes;
@@ -240,13 +251,18 @@ void sf_sched::set_dl_data_sched_result(sched_interface::dl_sched_res_t*    dl_r
 
     // Generate DCI Format1/2/2A
     sched_ue*           user        = data_alloc.user_ptr;
-//    uint32_t            cell_index  = user->get_cell_index(cc_cfg->enb_cc_idx).second;
     uint32_t            data_before = user->get_pending_dl_new_data();
-//    const dl_harq_proc& dl_harq     = user->get_dl_harq(data_alloc.pid, cell_index);
-//    bool                is_newtx    = dl_harq.is_empty();
-    bool                is_newtx    = true;
+    const dl_harq_proc& dl_harq     = user->get_dl_harq(data_alloc.pid);
+    bool                is_newtx    = dl_harq.is_empty();
+
+    int tbs = user->generate_formatN1(
+        data_alloc.pid, data, get_tti_tx_dl(), data_alloc.i_sf, data_alloc.harq_ack, data_alloc.tti_ack);
 
-    int tbs = user->generate_formatN1(data, get_tti_tx_dl(), false,data_alloc.i_sf);
+    if (tbs > 0) {
+      data->dci.alloc.i_delay        = data_alloc.i_delay;
+      data->dci.alloc.dci_sf_rep_num = data_alloc.npdcch.rep_idx;
+      data->npdcch                   = data_alloc.npdcch.npdcch;
+    }
 
     if (tbs <= 0) {
       log_h->warning("SCHED: DL %s failed rnti=0x%x, pid=%d, i_sf=%d, tbs=%d, buffer=%d\n",
@@ -287,7 +303,7 @@ void sf_sched::set_ul_sched_result(sched_interface::ul_sched_res_t*    ul_result
 
     /* Generate DCI FormatN0 */
     //    uint32_t pending_data_before = user->get_pending_ul_new_data(get_tti_tx_ul());
-    int tbs = user->generate_formatN0(npusch, ul_alloc.needs_npdcch(), fixed_mcs);
+    int tbs = user->generate_formatN0(npusch, ul_alloc.needs_npdcch(), fixed_mcs, ul_alloc.i_ru, ul_alloc.i_rep);
 
     //    ul_harq_proc* h = user->get_ul_harq(get_tti_tx_ul(), cell_index);
 
@@ -301,6 +317,18 @@ void sf_sched::set_ul_sched_result(sched_interface::ul_sched_res_t*    ul_result
       continue;
     }
 
+    npusch->tti_tx = ul_alloc.npusch_tti;
+    if (ul_alloc.needs_npdcch()) {
+      npusch->dci.ra_dci.i_delay        = ul_alloc.i_delay;
+      npusch->dci.ra_dci.dci_sf_rep_num = ul_alloc.npdcch.rep_idx;
+      npusch->npdcch                    = ul_alloc.npdcch.npdcch;
+    }
+
+    // The granted bytes are no longer pending
+    if (ul_alloc.type == ul_alloc_t::NEWTX) {
+      user->ul_buffer_sub(tbs / 8);
+    }
+
     // Print Resulting UL Allocation
     log_h->info("SCHED: %s %s rnti=0x%x,tbs=%d\n",
                 ul_alloc.is_msg3() ? "Msg3" : "UL",
@@ -320,97 +348,100 @@ void sf_sched::set_ul_sched_result(sched_interface::ul_sched_res_t*    ul_result
 /// I_sf to N_sf from Table 16.4.1.3-1 in TS 36.213 R15
 const int i_sf_to_n_sf_npdsch[8] = {1, 2, 3, 4, 5, 6, 8, 10};
 
-alloc_outcome_t sf_sched::alloc_dl_user(sched_ue* user, uint32_t max_data)
+/// Longest NPUSCH a UL grant takes, bounds the RUs times repetitions the link adaptation may choose
+const uint32_t MAX_NPUSCH_NOF_SF = 256;
+
+alloc_outcome_t sf_sched::alloc_dl_user(sched_ue* user, uint32_t max_data, uint32_t pid)
 {
   if (is_dl_alloc(user)) {
     log_h->warning("SCHED: Attempt to assign multiple harq pids to the same user rnti=0x%x\n", user->get_rnti());
     return alloc_outcome_t::ERROR;
   }
 
-  // Check if allocation would cause segmentation
-  //  uint32_t            ue_cc_idx = user->get_cell_index(cc_cfg->enb_cc_idx).second;
-  //  const dl_harq_proc& h         = user->get_dl_harq(pid, ue_cc_idx);
-  //  if (h.is_empty()) {
-  //    // It is newTx
-  //    rbg_range_t r = user->get_required_dl_rbgs(ue_cc_idx);
-  //    if (r.rbg_min > user_mask.count()) {
-  //      log_h->warning("The number of RBGs allocated to rnti=0x%x will force segmentation\n", user->get_rnti());
-  //      return alloc_outcome_t::NOF_RB_INVALID;
-  //    }
-  //  }
-
+  const dl_harq_proc& h       = user->get_dl_harq(pid);
+  bool                is_newtx = h.is_empty();
 
   // Try to allocate RBGs and DCI
   uint32_t tti_tx_dl = get_tti_tx_dl();
 
-  if (!srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl)) {
-    log_h->warning("SCHED: TTI %d is not valid for DL data.\n", tti_tx_dl);
-    printf("SCHED: TTI %d is not valid for DL data.\n", tti_tx_dl);
-    return alloc_outcome_t::RB_COLLISION;
+  // The DCI takes a candidate of the UE-specific search space starting at this TTI
+  sched_npdcch::alloc_t npdcch_alloc;
+  if (!npdcch->find(sched_npdcch::UE_SS, tti_tx_dl, 1, 1, &npdcch_alloc)) {
+    log_h->debug("SCHED: No NPDCCH candidate for DL rnti=0x%x at TTI %d\n", user->get_rnti(), tti_tx_dl);
+    return alloc_outcome_t::DCI_COLLISION;
   }
 
-  if (dl_sched_table[tti_tx_dl]){
-    log_h->warning("SCHED: TTI %d is already scheduled.\n", tti_tx_dl);
-    printf("SCHED: TTI %d is already scheduled.\n", tti_tx_dl);
-    return alloc_outcome_t::RB_COLLISION;
+  // Currently Allocate 1 sf once to a user, a retransmission keeps the size of the TB. Future: Change the allocation
+  // scheme
+  uint32_t i_sf = 0;
+  if (!is_newtx) {
+    i_sf = h.get_i_sf();
+  } else if (max_data > 20) {
+    // TODO: NB-IoT: if max_data > 20 bytes, allocate 3 TTI slots
+    i_sf = 2;
   }
 
-  // Check the UE search space
-  // TODO: Change the search space for different stages
-  if (tti_tx_dl % 8 >= 2){
-    log_h->warning("MAC DL Data sf_sched::alloc_dl_user TTI %d is not in the UE search space.\n", tti_tx_dl);
-    printf("MAC DL data sf_sched::alloc_dl_user TTI %d is not in the UE search space.\n", tti_tx_dl);
-    return alloc_outcome_t::RB_COLLISION;
+  // The NPDSCH starts in the first valid subframe from 5 + k0 subframes after the end of the NPDCCH (TS 36.213
+  // 16.4.1) and occupies the next valid subframes that are not SIB1. Any of them being taken by another allocation
+  // would shift the NPDSCH as seen by the UE, so the next scheduling delay is tried instead
+  const uint32_t             ack_fields[]    = {0, 4, 8, 12};
+  uint32_t                   npdsch_ttis[10] = {};
+  uint32_t                   alloc_sf_num    = i_sf_to_n_sf_npdsch[i_sf];
+  srslte_ra_nbiot_dl_dci_t   delay_dci       = {};
+  srslte_ra_nbiot_ul_grant_t ack_grant       = {};
+  uint32_t                   ack_field       = 0;
+  bool                       found           = false;
+  for (uint32_t i_delay = 0; i_delay < 8 and not found; i_delay++) {
+    delay_dci.alloc.i_delay = i_delay;
+    uint32_t k0             = srslte_ra_k0_from_dci(&delay_dci, npdcch_alloc.npdcch.r_max);
+    if (!dl_timeline->get_valid_span(npdcch_alloc.npdcch.end_tti + 5 + k0, alloc_sf_num, npdsch_ttis)) {
+      continue;
+    }
+    uint32_t last_data_tti = npdsch_ttis[alloc_sf_num - 1];
+
+    // Pick the first HARQ-ACK resource whose NPUSCH Format 2 subframes are free (TS 36.213 Table 16.4.2-1)
+    for (uint32_t field : ack_fields) {
+      srslte_ra_nbiot_ul_get_uci_grant(&ack_grant, field, last_data_tti);
+      if (ul_timeline->is_range_free(ack_grant.tx_tti, 2)) {
+        ack_field = field;
+        found     = true;
+        break;
+      }
+    }
   }
-
-
-  // Checking if it is a SIB1 TTI
-  bc_sched bc_sched_test;
-  if (bc_sched_test.is_sib1_sf(tti_tx_dl / 10, tti_tx_dl % 10)) {
-    log_h->warning("MAC DL Data sf_sched::alloc_dl_user TTI %d is occupied by SIB1.\n", tti_tx_dl);
-    printf("MAC DL Data sf_sched::alloc_dl_user TTI %d is occupied by SIB1.\n", tti_tx_dl);
+  if (!found) {
+    log_h->warning("SCHED: No NPDSCH or HARQ-ACK resource available for rnti=0x%x at TTI %d\n",
+                   user->get_rnti(),
+                   tti_tx_dl);
     return alloc_outcome_t::RB_COLLISION;
   }
 
-  // Update dl_sched table. Currently Allocate 1 sf once to a user. Future: Change the allocation scheme
-  uint32_t alloc_i = 0, i_sf = 0;
-
-  // TODO: NB-IoT: if max_data > 20 bytes, allocate 3 TTI slots
-  if(max_data > 20){
-    i_sf = 2;
-  }
-
-  uint32_t alloc_sf_num = i_sf_to_n_sf_npdsch[i_sf];
-
-  // Set the DCI TTI in the sched_table
-  dl_sched_table[tti_tx_dl] = true;
-  printf("SCHED: TTI %d sf_sched::alloc_dl_user DCI.\n", tti_tx_dl);
-  uint32_t data_tx_tti = (tti_tx_dl + 5) % 10240;
-
-  while (alloc_sf_num > 0) {
-    uint32_t alloc_tti = (data_tx_tti + alloc_i) % 10240;
-    if (srslte_ra_nbiot_is_valid_dl_sf(alloc_tti) && !dl_sched_table[alloc_tti] &&
-        !bc_sched_test.is_sib1_sf(alloc_tti / 10, alloc_tti % 10)) {
-      printf("DL_sched_table %d: allocate to user 0x%x npdsch\n", alloc_tti, user->get_rnti());
-      dl_sched_table[alloc_tti] = true;
-      alloc_sf_num--;
-    } else {
-      printf("DL_sched_table Jump %d: user 0x%x npdsch collision with existing alloc\n", alloc_tti, user->get_rnti());
-    }
-    alloc_i++;
-  }
+  // Commit the NPDCCH, NPDSCH and NPUSCH Format 2 subframes
+  npdcch->reserve(npdcch_alloc);
+  dl_timeline->reserve(npdsch_ttis, alloc_sf_num);
+  ul_timeline->reserve(ack_grant.tx_tti, 2);
 
   // Allocation Successful
   dl_alloc_t alloc;
   alloc.user_ptr = user;
   alloc.i_sf     = i_sf;
-  //  alloc.pid       = pid;
+  alloc.pid      = pid;
+  alloc.harq_ack = ack_field;
+  alloc.tti_ack  = ack_grant.tx_tti;
+  alloc.i_delay  = delay_dci.alloc.i_delay;
+  alloc.npdcch   = npdcch_alloc;
   data_allocs.push_back(alloc);
 
-  Debug("MAC:NB-IoT: ----------------=================---------------Allocate an UL grant here!\n");
-  printf("MAC:NB-IoT: -------------===============------------------Allocate an UL grant here!\n");
-  user->ul_buffer_state(3, 70, false);
-  user->ul_wait_timer(30);
+  if (is_newtx) {
+    SONICA_TRACE(SCHED_UL_EXPECTED,
+                 tti_tx_dl,
+                 user->get_rnti(),
+                 EXPECTED_UL_BYTES,
+                 EXPECTED_UL_LCID,
+                 EXPECTED_UL_WAIT_TTIS);
+    user->ul_buffer_state(EXPECTED_UL_LCID, EXPECTED_UL_BYTES, false);
+    user->ul_wait_timer(EXPECTED_UL_WAIT_TTIS);
+  }
 
   return alloc_outcome_t::SUCCESS;
 }
@@ -427,85 +458,67 @@ alloc_outcome_t sf_sched::alloc_ul(sched_ue*                    user,
   }
 
   // Allocate RBGs and DCI space
-  bool            needs_npdcch = alloc_type == ul_alloc_t::ADAPT_RETX or alloc_type == ul_alloc_t::NEWTX;
-  uint32_t tti_tx_dl = get_tti_tx_dl();
+  bool                  needs_npdcch = alloc_type == ul_alloc_t::ADAPT_RETX or alloc_type == ul_alloc_t::NEWTX;
+  uint32_t              tti_tx_dl    = get_tti_tx_dl();
+  uint32_t              npusch_tti   = get_tti_tx_ul();
+  uint32_t              i_delay      = 0;
+  uint32_t              i_ru         = 3;
+  uint32_t              i_rep        = 0;
+  sched_npdcch::alloc_t npdcch_alloc;
 
   if(alloc_type == ul_alloc_t::MSG3){
-    uint32_t rar_dci_tx_tti = (tti_tx_dl + 10240 - 9) % 10240; // NB-IoT MSG3_DELAY_MS = 9
-    uint32_t rar_tx_tti = (rar_dci_tx_tti + 5) % 10240;
-    while (!srslte_ra_nbiot_is_valid_dl_sf(rar_tx_tti)) {
-      rar_tx_tti = (rar_tx_tti + 1) % 10240;
-    }
-
-    uint32_t msg3_rx_tti = rar_tx_tti + 13;
-
+    // Msg3 is allocated in the UL result of the RAR subframe, the RAR grant places it 13 subframes later
     // Check MSG3 TTIs (4 continuous sub frames)
-    for(uint32_t i=0; i<alloc.len; i++){
-      if(ul_sched_table[(msg3_rx_tti + i) % 10240]){
-        return alloc_outcome_t::RB_COLLISION;
-      }
+    if (!ul_timeline->is_range_free(npusch_tti, alloc.len)) {
+      return alloc_outcome_t::RB_COLLISION;
     }
     // Set the MSG3 TTIs as occupied
-    for(uint32_t i=0; i<alloc.len; i++) {
-      printf("MAC sf_sched::alloc_ul: Set ul_sched_table %d true for MSG3\n", msg3_rx_tti+i);
-      ul_sched_table[(msg3_rx_tti + i) % 10240] = true;
-    }
+    SONICA_TRACE(SCHED_MSG3_UL, tti_tx_dl, user->get_rnti(), npusch_tti, npusch_tti + alloc.len - 1);
+    ul_timeline->reserve(npusch_tti, alloc.len);
   }
 
   // Generate PDCCH except for RAR and non-adaptive retx
   if (needs_npdcch) {
-    // UL Data allocation. Currently use mcs=12
+    // UL Data allocation over 12 subcarriers, the link adaptation of the UE sets its MCS, RUs and repetitions
+    uint32_t                   pending_data = user->get_pending_ul_new_data(tti_tx_dl);
+    ul_link_adapt::ul_format_t fmt          = user->get_ul_format(pending_data, MAX_NPUSCH_NOF_SF);
     alloc.sc_num = 12;
-    alloc.len = 4;
-
-    // TODO: NB-IoT: Decide the MCS based on the estimated pending data now
-    uint32_t pending_data = user->get_pending_ul_new_data(tti_tx_dl);
-    if(pending_data >= 125){
-      mcs = 12;
-    } else {
-      mcs = 9;
-    }
-
-    uint32_t tti_tx_ul = get_tti_tx_ul();
+    alloc.len    = fmt.nof_sf;
+    mcs          = fmt.mcs;
+    i_ru         = fmt.i_ru;
+    i_rep        = fmt.i_rep;
 
-    printf("MAC UL Data sf_sched::alloc_ul tti_tx_ul=%d, tti_tx_dl=%d.\n", tti_tx_ul, tti_tx_dl);
     if (user->msg_wait_timer != 0){
-      log_h->warning("MAC UL Data sf_sched::alloc_ul: The wait timer is not finished at TTI %d.\n", tti_tx_dl);
-      printf("MAC UL Data sf_sched::alloc_ul: The wait timer is not finished at TTI %d.\n", tti_tx_dl);
+      SONICA_TRACE(SCHED_UL_WAIT, tti_tx_dl, user->get_rnti(), user->msg_wait_timer);
       user->msg_wait_timer--;
       return alloc_outcome_t::DCI_COLLISION;
     }
 
-    // Check if the DL grant is in the valid TTI
-    if(!srslte_ra_nbiot_is_valid_dl_sf(tti_tx_dl)){
-      log_h->warning("MAC UL Data sf_sched::alloc_ul: TTI %d is not the valid TTI for DL grant.\n", tti_tx_dl);
-      printf("MAC UL Data sf_sched::alloc_ul: TTI %d is not the valid TTI for DL grant.\n", tti_tx_dl);
-      return alloc_outcome_t::DCI_COLLISION;
-    } else if(dl_sched_table[tti_tx_dl]){
-      log_h->warning("MAC UL Data sf_sched::alloc_ul: TTI %d ahs been allocated. No space for DL grant.\n", tti_tx_dl);
-      printf("MAC UL Data sf_sched::alloc_ul: TTI %d ahs been allocated. No space for DL grant.\n", tti_tx_dl);
-      return alloc_outcome_t::DCI_COLLISION;
-    } else if (tti_tx_dl % 8 >= 2){
-      // TODO: Check if the DL grant is in the UE search space
-      log_h->warning("MAC UL Data sf_sched::alloc_ul: TTI %d is not in the UE search space.\n", tti_tx_dl);
-      printf("MAC UL Data sf_sched::alloc_ul: TTI %d is not in the UE search space.\n", tti_tx_dl);
+    // The DCI takes a candidate of the UE-specific search space starting at this TTI, which a DL DCI of one NCCE
+    // may share
+    if (!npdcch->find(sched_npdcch::UE_SS, tti_tx_dl, 1, 1, &npdcch_alloc)) {
+      log_h->debug("SCHED: No NPDCCH candidate for UL rnti=0x%x at TTI %d\n", user->get_rnti(), tti_tx_dl);
       return alloc_outcome_t::DCI_COLLISION;
     }
 
-    // Check UL DATA TTIs (4 continuous sub frames)
-    for(uint32_t i=0; i<alloc.len; i++){
-      if(ul_sched_table[tti_tx_ul % 10240]){
-        return alloc_outcome_t::RB_COLLISION;
+    // The NPUSCH starts k0 + 1 subframes after the end of the NPDCCH, TS 36.213 16.5.1. Take the first scheduling
+    // delay whose alloc.len UL DATA TTIs are free
+    const uint32_t k0_formatN0[] = {8, 16, 32, 64};
+    bool           found         = false;
+    for (i_delay = 0; i_delay < 4; i_delay++) {
+      npusch_tti = (npdcch_alloc.npdcch.end_tti + 1 + k0_formatN0[i_delay]) % 10240;
+      if (ul_timeline->is_range_free(npusch_tti, alloc.len)) {
+        found = true;
+        break;
       }
     }
-    // Set the MSG3 TTIs as occupied
-    for(uint32_t i=0; i<alloc.len; i++) {
-      printf("MAC sf_sched::alloc_ul: ------------------------ Set ul_sched_table %d true for UL NEWTX\n", tti_tx_ul+i);
-      ul_sched_table[tti_tx_ul % 10240] = true;
+    if (!found) {
+      return alloc_outcome_t::RB_COLLISION;
     }
-
-    // Also set the DL grant position in the dl_sched_table
-    ul_sched_table[tti_tx_dl] = true;
+    // Set the NPDCCH and the UL DATA TTIs as occupied
+    SONICA_TRACE(SCHED_UL_NEWTX, tti_tx_dl, user->get_rnti(), npusch_tti, npusch_tti + alloc.len - 1, mcs, i_ru, i_rep);
+    npdcch->reserve(npdcch_alloc);
+    ul_timeline->reserve(npusch_tti, alloc.len);
   }
 
   ul_alloc_t ul_alloc = {};
@@ -513,6 +526,11 @@ alloc_outcome_t sf_sched::alloc_ul(sched_ue*                    user,
   ul_alloc.user_ptr   = user;
   ul_alloc.alloc      = alloc;
   ul_alloc.mcs        = mcs;
+  ul_alloc.i_ru       = i_ru;
+  ul_alloc.i_rep      = i_rep;
+  ul_alloc.i_delay    = i_delay;
+  ul_alloc.npusch_tti = npusch_tti;
+  ul_alloc.npdcch     = npdcch_alloc;
   ul_data_allocs.push_back(ul_alloc);
 
   return alloc_outcome_t::SUCCESS;
@@ -522,6 +540,14 @@ alloc_outcome_t sf_sched::alloc_msg3(sched_ue* user, const sched_interface::dl_s
 {
   // Derive PRBs from allocated RAR grants
   ul_harq_proc::ul_alloc_t msg3_alloc = {};
+
+  // The RAR carries the subcarrier spacing of all NPUSCH of the UE, the scheduler only plans 12 tones at 15 kHz
+  if (rargrant.grant.sc_spacing != 1) {
+    log_h->warning("SCHED: Only 15 kHz Msg3 is supported for user rnti=0x%x\n", user->get_rnti());
+    return alloc_outcome_t::ERROR;
+  }
+  user->set_ul_sc_spacing(SRSLTE_NPUSCH_SC_SPACING_15000);
+
   if (rargrant.grant.i_mcs == 0){
     // currently only support mcs0
     msg3_alloc.sc_num = 12;
@@ -546,21 +572,23 @@ alloc_outcome_t sf_sched::alloc_ul_user(sched_ue* user, ul_harq_proc::ul_alloc_t
   return alloc_ul(user, alloc, alloc_type);
 }
 
-void sf_sched::generate_sched_results(sf_sched_result* sf_result)
+void sf_sched::generate_sched_results(sf_sched_result* sf_result, bool dl_flag)
 {
   /* Pick one of the possible DCI masks */
   //  pdcch_grid_t::alloc_result_t dci_result;
 
-  /* Generate DCI formats and fill sched_result structs */
-  set_bc_sched_result(&sf_result->dl_sched_result);
-
-  set_rar_sched_result(&sf_result->dl_sched_result);
-
-  set_dl_data_sched_result(&sf_result->dl_sched_result);
+  /* Generate DCI formats and fill sched_result structs, only for the direction being scheduled since the DL and UL
+   * results of a TTI are asked for separately */
+  if (dl_flag) {
+    set_bc_sched_result(&sf_result->dl_sched_result);
 
-  //  set_dl_data_sched_result(dci_result, &sf_result->dl_sched_result);
-  set_ul_sched_result(&sf_result->ul_sched_result);
+    set_rar_sched_result(&sf_result->dl_sched_result);
 
+    set_dl_data_sched_result(&sf_result->dl_sched_result);
+  } else {
+    //  set_dl_data_sched_result(dci_result, &sf_result->dl_sched_result);
+    set_ul_sched_result(&sf_result->ul_sched_result);
+  }
 }
 
 } // namespace sonica_enb
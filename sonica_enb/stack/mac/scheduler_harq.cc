@@ -0,0 +1,200 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/stack/mac/scheduler_harq.h"
+#include "srslte/common/log_helper.h"
+#include "srslte/common/logmap.h"
+#include <algorithm>
+
+namespace sonica_enb {
+
+/******************************************************
+ *                 HARQ Proc Common                   *
+ ******************************************************/
+
+void harq_proc::init(uint32_t id_)
+{
+  log_h = srslte::logmap::get("MAC ");
+  id    = id_;
+}
+
+void harq_proc::set_cfg(uint32_t max_retx_)
+{
+  max_retx = max_retx_;
+}
+
+void harq_proc::reset()
+{
+  ack_state = NULL_ACK;
+  active    = false;
+  n_rtx     = 0;
+  tti       = srslte::tti_point{0};
+  last_mcs  = -1;
+  last_tbs  = -1;
+  tx_cnt    = 0;
+}
+
+int harq_proc::set_ack_common(bool ack)
+{
+  if (not active) {
+    Warning("Received ACK for inactive harq\n");
+    return SRSLTE_ERROR;
+  }
+  if (ack_state != NULL_ACK) {
+    Warning("Received ACK for harq id=%d that is not waiting for it\n", id);
+    return SRSLTE_ERROR;
+  }
+  ack_state = ack ? ACK : NACK;
+  log_h->debug("ACK=%d received pid=%d, n_rtx=%d, max_retx=%d\n", ack, id, n_rtx, max_retx);
+  if (not ack and (n_rtx + 1 > max_retx)) {
+    Info("SCHED: discarding TB pid=%d, tti=%d, maximum number of retx exceeded (%d)\n", id, tti.to_uint(), max_retx);
+    active = false;
+  } else if (ack) {
+    active = false;
+  }
+  return SRSLTE_SUCCESS;
+}
+
+void harq_proc::new_tx_common(srslte::tti_point tti_, int mcs, int tbs)
+{
+  reset();
+  ndi       = !ndi;
+  tti       = tti_;
+  tx_cnt++;
+  last_mcs  = mcs;
+  last_tbs  = tbs;
+  active    = true;
+}
+
+void harq_proc::new_retx_common(srslte::tti_point tti_, int* mcs, int* tbs)
+{
+  ack_state = NULL_ACK;
+  tti       = tti_;
+  n_rtx++;
+  tx_cnt++;
+  if (mcs) {
+    *mcs = last_mcs;
+  }
+  if (tbs) {
+    *tbs = last_tbs;
+  }
+}
+
+/******************************************************
+ *                  DL HARQ                           *
+ ******************************************************/
+
+void dl_harq_proc::new_tx(srslte::tti_point tti_, int mcs, int tbs, uint32_t i_sf_, srslte::tti_point tti_ack_)
+{
+  new_tx_common(tti_, mcs, tbs);
+  i_sf    = i_sf_;
+  tti_ack = tti_ack_;
+}
+
+void dl_harq_proc::new_retx(srslte::tti_point tti_, srslte::tti_point tti_ack_, int* mcs, int* tbs)
+{
+  new_retx_common(tti_, mcs, tbs);
+  tti_ack = tti_ack_;
+}
+
+int dl_harq_proc::set_ack(bool ack)
+{
+  return set_ack_common(ack);
+}
+
+void dl_harq_proc::check_ack_timeout(srslte::tti_point tti_tx_dl)
+{
+  if (is_waiting_ack() and tti_tx_dl > tti_ack + max_ack_delay) {
+    Info("SCHED: No HARQ-ACK received for pid=%d at tti=%d, assuming NACK\n", id, tti_ack.to_uint());
+    set_ack_common(false);
+  }
+}
+
+bool dl_harq_proc::has_pending_retx() const
+{
+  return active and ack_state == NACK;
+}
+
+/********************************************************
+ *                   Harq Entity
+ *******************************************************/
+
+harq_entity::harq_entity(size_t nof_dl_harqs) : log_h(srslte::logmap::get("MAC ")), dl_harqs(nof_dl_harqs)
+{
+  for (uint32_t i = 0; i < dl_harqs.size(); ++i) {
+    dl_harqs[i].init(i);
+  }
+}
+
+void harq_entity::reset()
+{
+  for (auto& h : dl_harqs) {
+    h.reset();
+  }
+}
+
+void harq_entity::set_cfg(uint32_t max_retx)
+{
+  for (auto& h : dl_harqs) {
+    h.set_cfg(max_retx);
+  }
+}
+
+dl_harq_proc* harq_entity::get_pending_dl_harq(uint32_t tti_tx_dl)
+{
+  for (auto& h : dl_harqs) {
+    h.check_ack_timeout(srslte::tti_point{tti_tx_dl});
+  }
+  return get_oldest_dl_harq(tti_tx_dl);
+}
+
+dl_harq_proc* harq_entity::get_empty_dl_harq(uint32_t tti_tx_dl)
+{
+  auto it = std::find_if(dl_harqs.begin(), dl_harqs.end(), [](dl_harq_proc& h) { return h.is_empty(); });
+  return it != dl_harqs.end() ? &(*it) : nullptr;
+}
+
+std::pair<uint32_t, int> harq_entity::set_ack_info(uint32_t tti_rx, bool ack)
+{
+  for (auto& h : dl_harqs) {
+    if (h.is_waiting_ack() and h.get_tti_ack() == srslte::tti_point{tti_rx}) {
+      if (h.set_ack(ack) == SRSLTE_SUCCESS) {
+        return {h.get_id(), h.get_tbs()};
+      }
+      return {h.get_id(), -1};
+    }
+  }
+  return {dl_harqs.size(), -1};
+}
+
+//! Finds the oldest DL Harq waiting for a retransmission
+dl_harq_proc* harq_entity::get_oldest_dl_harq(uint32_t tti_tx_dl)
+{
+  dl_harq_proc* oldest = nullptr;
+  for (auto& h : dl_harqs) {
+    if (h.has_pending_retx() and (oldest == nullptr or h.get_tti() < oldest->get_tti())) {
+      oldest = &h;
+    }
+  }
+  return oldest;
+}
+
+} // namespace sonica_enb
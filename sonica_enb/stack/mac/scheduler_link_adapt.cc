@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/stack/mac/scheduler_link_adapt.h"
+#include "srslte/srslte.h"
+#include <algorithm>
+#include <cmath>
+
+namespace sonica_enb {
+
+const float ul_link_adapt::SNR_AVG_COEFF = 0.25;
+const float ul_link_adapt::MAX_OFFSET_DB = 20;
+
+// Number of RUs and of repetitions of NPUSCH Format 1, TS 36.213 Tables 16.5.1.1-2 and 16.5.1.1-3
+const static uint32_t nof_ru_npusch[8]  = {1, 2, 3, 4, 5, 6, 8, 10};
+const static uint32_t nof_rep_npusch[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+
+// QPSK bits of a RU of 12 subcarriers, one subframe without its two DMRS symbols
+const static uint32_t RU_BITS = 2 * SRSLTE_NRE * (SRSLTE_CP_NORM_SF_NSYMB - 2);
+
+// Spectral efficiency reached as a fraction of the Shannon bound, the outer loop absorbs the error of this model
+const static float SHANNON_ALPHA = 0.6;
+
+void ul_link_adapt::set_cfg(const sched_interface::sched_args_t& args)
+{
+  target_bler = std::min(std::max(args.ul_target_bler, 1e-3f), 0.5f);
+  step_db     = args.ul_olla_step_db;
+  fixed_mcs   = args.pusch_mcs;
+}
+
+void ul_link_adapt::reset()
+{
+  snr_valid = false;
+  snr_avg   = 0;
+  offset    = 0;
+}
+
+void ul_link_adapt::snr_info(float snr_db)
+{
+  if (std::isnan(snr_db)) {
+    return;
+  }
+  snr_avg   = snr_valid ? snr_avg + SNR_AVG_COEFF * (snr_db - snr_avg) : snr_db;
+  snr_valid = true;
+}
+
+void ul_link_adapt::crc_info(bool crc)
+{
+  offset += crc ? step_db * target_bler / (1 - target_bler) : -step_db;
+  offset = std::min(std::max(offset, -MAX_OFFSET_DB), MAX_OFFSET_DB);
+}
+
+float ul_link_adapt::required_snr(uint32_t tbs, uint32_t nof_ru)
+{
+  // Bits per RE of the TB with its CRC
+  float se = 2.0f * (tbs + 24) / (RU_BITS * nof_ru);
+  return srslte_convert_power_to_dB(std::pow(2.0f, se / SHANNON_ALPHA) - 1);
+}
+
+ul_link_adapt::ul_format_t ul_link_adapt::select(uint32_t req_bytes, uint32_t max_nof_sf) const
+{
+  ul_format_t best = {};
+  if (fixed_mcs >= 0 or not snr_valid) {
+    best.mcs = fixed_mcs >= 0 ? std::min(fixed_mcs, 12) : (req_bytes >= 125 ? 12 : 9);
+    best.tbs = srslte_ra_nbiot_get_npusch_tbs(best.mcs, best.i_ru);
+    return best;
+  }
+
+  float       snr         = get_snr();
+  bool        found       = false;
+  ul_format_t robust      = {};
+  float       best_margin = -INFINITY;
+  for (uint32_t i_rep = 0; i_rep < 8; i_rep++) {
+    for (uint32_t i_ru = 0; i_ru < 8; i_ru++) {
+      uint32_t nof_sf = nof_ru_npusch[i_ru] * nof_rep_npusch[i_rep];
+      if (nof_sf > max_nof_sf) {
+        continue;
+      }
+      float rep_gain = srslte_convert_power_to_dB(nof_rep_npusch[i_rep]);
+
+      // The smallest TB fitting req_bytes, the largest one otherwise, among those the SNR allows
+      ul_format_t fmt    = {};
+      bool        has_tb = false;
+      for (uint32_t mcs = 0; mcs <= 12; mcs++) {
+        int tbs = srslte_ra_nbiot_get_npusch_tbs(mcs, i_ru);
+        if (tbs <= 0) {
+          continue;
+        }
+        float margin = snr + rep_gain - required_snr(tbs, nof_ru_npusch[i_ru]);
+        if (margin > best_margin) {
+          best_margin = margin;
+          robust      = {mcs, i_ru, i_rep, (uint32_t)tbs, nof_sf};
+        }
+        if (margin < 0) {
+          break;
+        }
+        fmt    = {mcs, i_ru, i_rep, (uint32_t)tbs, nof_sf};
+        has_tb = true;
+        if (tbs / 8 >= (int)req_bytes) {
+          break;
+        }
+      }
+      if (not has_tb) {
+        continue;
+      }
+
+      // Take the format which fits req_bytes in the fewest subframes, or the highest rate if none fits them
+      bool fits      = fmt.tbs / 8 >= req_bytes;
+      bool best_fits = found and best.tbs / 8 >= req_bytes;
+      bool better    = false;
+      if (not found or fits != best_fits) {
+        better = not found or fits;
+      } else if (fits) {
+        better = fmt.nof_sf < best.nof_sf or (fmt.nof_sf == best.nof_sf and fmt.tbs < best.tbs);
+      } else {
+        better = fmt.tbs * best.nof_sf > best.tbs * fmt.nof_sf;
+      }
+      if (better) {
+        best  = fmt;
+        found = true;
+      }
+    }
+  }
+
+  // Below the SNR of every format, the one closest to it
+  return found ? best : robust;
+}
+
+} // namespace sonica_enb
@@ -0,0 +1,288 @@
+/*
+ * Copyright 2013-2020 Software Radio Systems Limited
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/stack/mac/scheduler_metric.h"
+#include "sonica/common/trace.h"
+#include <algorithm>
+
+namespace sonica_enb {
+
+// Largest NPDSCH and NPUSCH TBS in bytes, TS 36.213 Tables 16.4.1.5.1-1 and 16.5.1.2-2
+const static uint32_t MAX_TBS_BYTES_DL = 85;
+const static uint32_t MAX_TBS_BYTES_UL = 125;
+
+/*****************************************************************
+ *
+ * DL Metric
+ *
+ *****************************************************************/
+
+void dl_metric_rr::sched_users(sched_ue_db_t& ue_db, dl_sf_sched_itf* tti_sched)
+{
+  if (ue_db.empty()) {
+    return;
+  }
+
+  // give priority in a time-domain RR basis.
+  uint32_t priority_idx = tti_sched->get_tti_tx_dl() % ue_db.size();
+  ue_db.for_each(priority_idx, [this, tti_sched](sched_ue& user) { allocate_user(&user, tti_sched); });
+}
+
+dl_harq_proc* dl_metric_rr::allocate_user(sched_ue* user, dl_sf_sched_itf* tti_sched)
+{
+  // Do not allocate a user multiple times in the same tti
+  if (tti_sched->is_dl_alloc(user)) {
+    return nullptr;
+  }
+  // Do not allocate a user to an inactive carrier
+  //  auto p = user->get_cell_index(cc_cfg->enb_cc_idx);
+  //  if (not p.first) {
+  //    return nullptr;
+  //  }
+  //  uint32_t cell_idx = p.second;
+  uint32_t cell_idx = 0;
+
+  alloc_outcome_t code;
+  uint32_t        tti_dl = tti_sched->get_tti_tx_dl();
+  dl_harq_proc*   h      = user->get_pending_dl_harq(tti_dl);
+
+  // Schedule retx if we have space
+  if (h != nullptr) {
+    code = tti_sched->alloc_dl_user(user, 0, h->get_id());
+    if (code == alloc_outcome_t::SUCCESS) {
+      return h;
+    } else if (code == alloc_outcome_t::DCI_COLLISION) {
+      log_h->warning("SCHED: Couldn't find space in PDCCH for DL retx for rnti=0x%x\n", user->get_rnti());
+    }
+    return nullptr;
+  }
+
+  // There is space in the grid and no HARQ process waiting for its HARQ-ACK, schedule a newtx
+  h = user->get_empty_dl_harq(tti_dl);
+  if (h == nullptr) {
+    return nullptr;
+  }
+
+  std::pair<uint32_t, uint32_t> req_bytes = user->get_requested_dl_bytes(cell_idx);
+
+  if (req_bytes.first > 0 /* and req_bytes.second > 5 */) {
+    SONICA_TRACE(SCHED_DL_REQ, tti_dl, user->get_rnti(), req_bytes.first, req_bytes.second);
+    code = tti_sched->alloc_dl_user(user, req_bytes.second, h->get_id());
+    if (code == alloc_outcome_t::SUCCESS) {
+      return h;
+    } else if (code == alloc_outcome_t::DCI_COLLISION) {
+      log_h->warning("SCHED: Couldn't find space in PDCCH for DL tx for rnti=0x%x\n", user->get_rnti());
+    }
+  }
+  return nullptr;
+}
+
+void dl_metric_pf::sched_users(sched_ue_db_t& ue_db, dl_sf_sched_itf* tti_sched)
+{
+  order.new_tti();
+  if (ue_db.empty() or not tti_sched->is_npdcch_free()) {
+    return;
+  }
+
+  order.serve(
+      ue_db,
+      [this, tti_sched](sched_ue& user) -> uint32_t {
+        uint32_t      pending = user.get_pending_dl_new_data();
+        dl_harq_proc* h       = allocate_user(&user, tti_sched);
+        if (h == nullptr) {
+          return 0;
+        }
+        // A retx serves its TB again
+        uint32_t bytes = h->is_empty() ? std::min(pending, MAX_TBS_BYTES_DL) : (uint32_t)h->get_tbs();
+        return std::max(bytes, 1u);
+      },
+      // A TB waiting for its HARQ-ACK may still need a retx, which no buffer state announces
+      [](sched_ue& user) { return user.get_pending_dl_new_data() > 0 or user.has_active_dl_harq(); },
+      [tti_sched]() { return tti_sched->is_npdcch_free(); });
+}
+
+/*****************************************************************
+ *
+ * UL Metric
+ *
+ *****************************************************************/
+
+void ul_metric_rr::sched_users(sched_ue_db_t& ue_db, ul_sf_sched_itf* tti_sched)
+{
+  if (ue_db.empty()) {
+    return;
+  }
+
+  // give priority in a time-domain RR basis
+  uint32_t priority_idx = tti_sched->get_tti_tx_ul() % ue_db.size();
+
+  //  // allocate reTxs first
+  //  ue_db.for_each(priority_idx, [this](sched_ue& user) { allocate_user_retx_prbs(&user); });
+
+  // give priority in a time-domain RR basis
+  ue_db.for_each(priority_idx, [this, tti_sched](sched_ue& user) { allocate_user_newtx_prbs(&user, tti_sched); });
+}
+
+alloc_outcome_t ul_metric_rr::allocate_user_newtx_prbs(sched_ue* user, ul_sf_sched_itf* tti_sched)
+{
+  if (tti_sched->is_ul_alloc(user)) {
+    return alloc_outcome_t::ERROR;
+  }
+  uint32_t current_tti = tti_sched->get_tti_tx_ul();
+//  auto p = user->get_cell_index(cc_cfg->enb_cc_idx);
+//  if (not p.first) {
+//    // this cc is not activated for this user
+//    return nullptr;
+//  }
+//  uint32_t cell_idx = p.second;
+
+  uint32_t      pending_data = user->get_pending_ul_new_data(current_tti);
+//  ul_harq_proc* h            = user->get_ul_harq(current_tti, cell_idx);
+
+  // find an empty PID
+  if (pending_data == 0) {
+    return alloc_outcome_t::ERROR;
+  }
+  // The BSR is kept, the bytes of the grant are taken off it once its DCI is generated
+  ul_harq_proc::ul_alloc_t alloc{};
+  alloc_outcome_t          ret = tti_sched->alloc_ul_user(user, alloc);
+  if (ret == alloc_outcome_t::DCI_COLLISION) {
+    log_h->warning("SCHED: Couldn't find space in NPDCCH for UL tx of rnti=0x%x\n", user->get_rnti());
+  }
+  return ret;
+}
+
+void ul_metric_pf::sched_users(sched_ue_db_t& ue_db, ul_sf_sched_itf* tti_sched)
+{
+  order.new_tti();
+  if (ue_db.empty() or not tti_sched->is_npdcch_free()) {
+    return;
+  }
+
+  uint32_t tti_tx_ul = tti_sched->get_tti_tx_ul();
+  order.serve(
+      ue_db,
+      [this, tti_sched, tti_tx_ul](sched_ue& user) -> uint32_t {
+        uint32_t pending = user.get_pending_ul_new_data(tti_tx_ul);
+        if (pending == 0 or allocate_user_newtx_prbs(&user, tti_sched) != alloc_outcome_t::SUCCESS) {
+          return 0;
+        }
+        return std::min(pending, MAX_TBS_BYTES_UL);
+      },
+      [tti_tx_ul](sched_ue& user) { return user.get_pending_ul_new_data(tti_tx_ul) > 0; },
+      [tti_sched]() { return tti_sched->is_npdcch_free(); });
+}
+
+/*****************************************************************
+ *
+ * Proportional fair order
+ *
+ *****************************************************************/
+
+const double sched_pf_order::MIN_AVG = 1e-3;
+
+uint32_t sched_pf_order::nof_rep(uint32_t ce_level) const
+{
+  if (ce_level_rep.empty()) {
+    return 1;
+  }
+  // A CE level beyond the configured ones takes the deepest
+  uint32_t rep = ce_level_rep[std::min(ce_level, (uint32_t)ce_level_rep.size() - 1)];
+  return std::max(rep, 1u);
+}
+
+void sched_pf_order::ue_cfg(uint16_t rnti, uint32_t ce_level)
+{
+  ue_ctxt ue = {1.0 / nof_rep(ce_level), MIN_AVG * scale, false};
+
+  auto it = ues.find(rnti);
+  if (it == ues.end()) {
+    // Enters the order once it has data
+    ues.emplace(rnti, ue);
+    return;
+  }
+  // Reconfigured, keeps its average and its place in or out of the order
+  if (it->second.queued) {
+    order.erase(key_of(rnti, it->second));
+  }
+  ue.avg     = it->second.avg;
+  ue.queued  = it->second.queued;
+  it->second = ue;
+  if (ue.queued) {
+    order.insert(key_of(rnti, ue));
+  }
+}
+
+void sched_pf_order::ue_rem(uint16_t rnti)
+{
+  auto it = ues.find(rnti);
+  if (it != ues.end()) {
+    if (it->second.queued) {
+      order.erase(key_of(rnti, it->second));
+    }
+    ues.erase(it);
+  }
+}
+
+void sched_pf_order::ue_backlogged(uint16_t rnti)
+{
+  auto it = ues.find(rnti);
+  if (it != ues.end() and not it->second.queued) {
+    it->second.queued = true;
+    order.insert(key_of(rnti, it->second));
+  }
+}
+
+void sched_pf_order::new_tti()
+{
+  scale /= 1.0 - alpha;
+
+  // Bring the averages back to the current TTI before the scale overflows. Their order does not change
+  if (scale > 1e100) {
+    order.clear();
+    for (auto& ue : ues) {
+      ue.second.avg /= scale;
+      if (ue.second.queued) {
+        order.insert(key_of(ue.first, ue.second));
+      }
+    }
+    scale = 1.0;
+  }
+}
+
+void sched_pf_order::served(uint16_t rnti, uint32_t bytes)
+{
+  auto it = ues.find(rnti);
+  if (it == ues.end()) {
+    return;
+  }
+  // The pass may have found it drained, it only moves if it is still in the order
+  if (not it->second.queued) {
+    it->second.avg += alpha * bytes * scale;
+    return;
+  }
+  order.erase(key_of(rnti, it->second));
+  it->second.avg += alpha * bytes * scale;
+  order.insert(key_of(rnti, it->second));
+}
+
+} // namespace sonica_enb
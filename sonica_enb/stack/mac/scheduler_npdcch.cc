@@ -0,0 +1,167 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/stack/mac/scheduler_npdcch.h"
+
+namespace sonica_enb {
+
+void sched_npdcch::init(sched_timeline* dl_timeline_, const sched_interface::sched_args_t& args)
+{
+  dl_timeline       = dl_timeline_;
+  ss_cfg[TYPE1_CSS] = args.npdcch_paging;
+  ss_cfg[TYPE2_CSS] = args.npdcch_ra_css;
+  ss_cfg[UE_SS]     = args.npdcch_uss;
+  reset();
+}
+
+uint32_t sched_npdcch::get_rep_list(ss_type_t ss, uint32_t r_max, uint32_t* rep)
+{
+  // Table 16.6-2, Type-1 from Rmax = 256 on
+  const static uint32_t type1_rep[4][MAX_NOF_REP] = {{1, 4, 8, 16, 32, 64, 128, 256},
+                                                    {1, 4, 16, 32, 64, 128, 256, 512},
+                                                    {1, 8, 32, 64, 128, 256, 512, 1024},
+                                                    {1, 8, 64, 128, 256, 512, 1024, 2048}};
+  uint32_t n = 0;
+
+  if (ss == TYPE1_CSS and r_max >= 256) {
+    uint32_t row = r_max <= 256 ? 0 : (r_max <= 512 ? 1 : (r_max <= 1024 ? 2 : 3));
+    for (n = 0; n < MAX_NOF_REP; n++) {
+      rep[n] = type1_rep[row][n];
+    }
+  } else if (ss == TYPE1_CSS or r_max < 8) {
+    // Every power of two up to Rmax
+    for (uint32_t r = 1; r <= r_max and n < MAX_NOF_REP; r *= 2) {
+      rep[n++] = r;
+    }
+  } else {
+    // Tables 16.6-1 and 16.6-3
+    for (uint32_t r = r_max / 8; r <= r_max; r *= 2) {
+      rep[n++] = r;
+    }
+  }
+  return n;
+}
+
+int sched_npdcch::get_ss_index(ss_type_t ss, uint32_t tti) const
+{
+  tti %= sched_timeline::NOF_TTIS;
+  if (not dl_timeline->is_valid(tti)) {
+    return -1;
+  }
+  if (ss == TYPE1_CSS) {
+    return 0;
+  }
+
+  // The period starts at k0, where (10 nf + floor(ns / 2)) mod T = floor(alpha_offset T) with T = Rmax G
+  const sched_interface::npdcch_ss_cfg_t& cfg = ss_cfg[ss];
+
+  uint32_t T = (uint32_t)(cfg.r_max * cfg.g);
+  if (T == 0) {
+    return -1;
+  }
+  uint32_t offset = (uint32_t)(cfg.alpha_offset * T) % T;
+  uint32_t d      = (tti + T - offset) % T;
+  uint32_t k0     = (tti + sched_timeline::NOF_TTIS - d % sched_timeline::NOF_TTIS) % sched_timeline::NOF_TTIS;
+  return (int)dl_timeline->count_valid(k0, d);
+}
+
+bool sched_npdcch::is_span_free(uint32_t tti, uint32_t R, uint8_t mask, uint32_t* end_tti) const
+{
+  uint32_t t = tti % sched_timeline::NOF_TTIS;
+  for (uint32_t n = 0; n < R; n++) {
+    if (n > 0) {
+      t = dl_timeline->next_valid(t + 1);
+    }
+    // A subframe with NPDCCH only takes another DCI in its free NCCE, any other one must be free
+    uint8_t used = ncce_mask[t];
+    if (used != 0 ? (used & mask) != 0 : dl_timeline->is_busy(t)) {
+      return false;
+    }
+  }
+  *end_tti = t;
+  return true;
+}
+
+bool sched_npdcch::find(ss_type_t ss, uint32_t tti, uint32_t L, uint32_t min_rep, alloc_t* alloc) const
+{
+  int b = get_ss_index(ss, tti);
+  if (b < 0) {
+    return false;
+  }
+
+  const sched_interface::npdcch_ss_cfg_t& cfg = ss_cfg[ss];
+
+  uint32_t rep[MAX_NOF_REP];
+  uint32_t nof_rep = get_rep_list(ss, cfg.r_max, rep);
+
+  // Candidates of one NCCE, in the USS with Rmax up to 2 and without repetitions only, Table 16.6-1
+  bool has_ncce_candidates = ss == UE_SS and cfg.r_max <= 2;
+
+  for (uint32_t i = 0; i < nof_rep; i++) {
+    uint32_t R = rep[i];
+    // The candidates of R repetitions start every R valid subframes of the Rmax of the search space
+    if (R < min_rep or b % R != 0 or b + R > cfg.r_max) {
+      continue;
+    }
+
+    srslte_dci_location_t location = {2, 0};
+    uint32_t              end_tti  = 0;
+    bool                  found    = false;
+    if (L == 1 and has_ncce_candidates and R == 1) {
+      for (uint32_t ncce = 0; ncce < 2 and not found; ncce++) {
+        location = {1, ncce};
+        found    = is_span_free(tti, R, 1u << ncce, &end_tti);
+      }
+    }
+    if (not found) {
+      location = {2, 0};
+      found    = is_span_free(tti, R, 0x3, &end_tti);
+    }
+
+    if (found) {
+      if (alloc != nullptr) {
+        alloc->tti             = tti % sched_timeline::NOF_TTIS;
+        alloc->rep_idx         = i;
+        alloc->npdcch.location = location;
+        alloc->npdcch.r_max    = cfg.r_max;
+        alloc->npdcch.nof_rep  = R;
+        alloc->npdcch.end_tti  = end_tti;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void sched_npdcch::reserve(const alloc_t& alloc)
+{
+  uint8_t  mask = alloc.npdcch.location.L == 2 ? 0x3 : (uint8_t)(1u << alloc.npdcch.location.ncce);
+  uint32_t t    = alloc.tti;
+  for (uint32_t n = 0; n < alloc.npdcch.nof_rep; n++) {
+    if (n > 0) {
+      t = dl_timeline->next_valid(t + 1);
+    }
+    ncce_mask[t] |= mask;
+    dl_timeline->reserve(t);
+  }
+}
+
+} // namespace sonica_enb
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica_enb/hdr/stack/mac/scheduler_timeline.h"
+
+namespace sonica_enb {
+
+sched_timeline::sched_timeline()
+{
+  valid_bits.fill(~0ULL);
+  busy_bits.fill(0);
+}
+
+void sched_timeline::set_valid(const std::vector<bool>& valid)
+{
+  valid_bits.fill(0);
+  for (uint32_t tti = 0; tti < NOF_TTIS and tti < valid.size(); tti++) {
+    if (valid[tti]) {
+      valid_bits[word(tti)] |= bit(tti);
+    }
+  }
+}
+
+void sched_timeline::reset()
+{
+  busy_bits.fill(0);
+}
+
+template <typename Func>
+void sched_timeline::for_each_word(uint32_t tti, uint32_t len, Func f)
+{
+  tti %= NOF_TTIS;
+  while (len > 0) {
+    uint32_t pos = tti % 64;
+    uint32_t n   = len < 64 - pos ? len : 64 - pos;
+    uint64_t m   = (n == 64) ? ~0ULL : ((1ULL << n) - 1) << pos;
+    f(tti / 64, m);
+    len -= n;
+    tti = (tti + n) % NOF_TTIS;
+  }
+}
+
+bool sched_timeline::is_range_free(uint32_t tti, uint32_t len) const
+{
+  bool free = true;
+  for_each_word(tti, len, [this, &free](uint32_t w, uint64_t m) { free = free and (busy_bits[w] & m) == 0; });
+  return free;
+}
+
+void sched_timeline::reserve(uint32_t tti, uint32_t len)
+{
+  for_each_word(tti, len, [this](uint32_t w, uint64_t m) { busy_bits[w] |= m; });
+}
+
+void sched_timeline::reserve(const uint32_t* ttis, uint32_t n)
+{
+  for (uint32_t i = 0; i < n; i++) {
+    reserve(ttis[i]);
+  }
+}
+
+uint32_t sched_timeline::count_valid(uint32_t tti, uint32_t len) const
+{
+  uint32_t n = 0;
+  for_each_word(tti, len < NOF_TTIS ? len : NOF_TTIS, [this, &n](uint32_t w, uint64_t m) {
+    n += __builtin_popcountll(valid_bits[w] & m);
+  });
+  return n;
+}
+
+// Bits of the i-th word visited from tti on: from tti in the first word, below tti once the search wraps around to it
+uint64_t sched_timeline::first_mask(uint32_t tti, uint32_t i)
+{
+  uint64_t from = ~0ULL << (tti % 64);
+  if (i == 0) {
+    return from;
+  }
+  return i == NOF_WORDS ? ~from : ~0ULL;
+}
+
+uint32_t sched_timeline::next_valid(uint32_t tti) const
+{
+  for (uint32_t i = 0, w = word(tti); i <= NOF_WORDS; i++, w = (w + 1) % NOF_WORDS) {
+    uint64_t m = valid_bits[w] & first_mask(tti, i);
+    if (m != 0) {
+      return w * 64 + __builtin_ctzll(m);
+    }
+  }
+  return tti % NOF_TTIS;
+}
+
+bool sched_timeline::get_valid_span(uint32_t tti, uint32_t k, uint32_t* ttis) const
+{
+  uint32_t n = 0;
+  for (uint32_t i = 0, w = word(tti); n < k and i <= NOF_WORDS; i++, w = (w + 1) % NOF_WORDS) {
+    uint64_t m = valid_bits[w] & first_mask(tti, i);
+    // The valid subframes of the word the span takes, any of them being busy fails the whole span
+    while (m != 0 and n < k) {
+      uint64_t low = m & -m;
+      if (busy_bits[w] & low) {
+        return false;
+      }
+      ttis[n++] = w * 64 + __builtin_ctzll(m);
+      m ^= low;
+    }
+  }
+  return n == k;
+}
+
+} // namespace sonica_enb
@@ -20,10 +20,12 @@
  *
  */
 
+#include <algorithm>
 #include <string.h>
 
 #include "sonica_enb/hdr/stack/mac/scheduler.h"
 #include "sonica_enb/hdr/stack/mac/scheduler_ue.h"
+#include "sonica/common/trace.h"
 #include "srslte/common/log_helper.h"
 #include "srslte/common/logmap.h"
 #include "srslte/mac/pdu.h"
@@ -76,14 +78,15 @@ uint32_t get_mac_subheader_sdu_size(uint32_t sdu_bytes)
  *
  *******************************************************/
 
-sched_ue::sched_ue() : log_h(srslte::logmap::get("MAC "))
+sched_ue::sched_ue() : log_h(srslte::logmap::get("MAC ")), harq_ent(1)
 {
   reset();
 }
 
-void sched_ue::init(uint16_t rnti_)
+void sched_ue::init(uint16_t rnti_, const sched_interface::sched_args_t& sched_args)
 {
   rnti             = rnti_;
+  ul_la.set_cfg(sched_args);
   Info("SCHED: Added user rnti=0x%x\n", rnti);
 }
 
@@ -107,6 +110,8 @@ void sched_ue::set_cfg(const sched_interface::ue_cfg_t& cfg_)
 //  std::vector<sched::ue_cfg_t::cc_cfg_t> prev_supported_cc_list = std::move(cfg.supported_cc_list);
   cfg                                                           = cfg_;
 
+  harq_ent.set_cfg(cfg.maxharq_tx);
+
   // update bearer cfgs
   for (uint32_t i = 0; i < sched_interface::MAX_LC; ++i) {
     set_bearer_cfg_unlocked(i, cfg.ue_bearers[i]);
@@ -145,6 +150,8 @@ void sched_ue::reset()
   phy_config_dedicated_enabled = false;
   cqi_request_tti              = 0;
   carriers.clear();
+  harq_ent.reset();
+  ul_la.reset();
 
 //  // erase all bearers
 //  for (uint32_t i = 0; i < cfg.ue_bearers.size(); ++i) {
@@ -172,8 +179,7 @@ void sched_ue::dl_buffer_state(uint8_t lc_id, uint32_t tx_queue, uint32_t retx_q
   if (lc_id < sched_interface::MAX_LC) {
     lch[lc_id].buf_retx = retx_queue;
     lch[lc_id].buf_tx   = tx_queue;
-    Debug("SCHED: DL lcid=%d buffer_state=%d,%d\n", lc_id, tx_queue, retx_queue);
-    printf("MAC sched_ue::dl_buffer_state : DL lcid=%d buffer_state=%d,%d\n", lc_id, tx_queue, retx_queue);
+    SONICA_TRACE(SCHED_DL_BUFFER, SONICA_TRACE_NO_TTI, rnti, lc_id, tx_queue, retx_queue);
   }
 }
 
@@ -188,7 +194,29 @@ void sched_ue::mac_buffer_state(uint32_t ce_code, uint32_t nof_cmds)
     }
   }
   Info("SCHED: %s for rnti=0x%x needs to be scheduled\n", to_string(cmd), rnti);
-  printf("SCHED: %s for rnti=0x%x needs to be scheduled\n", to_string(cmd), rnti);
+}
+
+int sched_ue::set_ack_info(uint32_t tti, bool ack)
+{
+  std::pair<uint32_t, int> p2 = harq_ent.set_ack_info(tti, ack);
+  if (p2.second < 0) {
+    Warning("SCHED: Received ACK info for unknown TTI=%d\n", tti);
+    return -1;
+  }
+  Debug("SCHED: Set ACK=%d for rnti=0x%x, pid=%d, tti=%d\n", ack, rnti, p2.first, tti);
+  return p2.second;
+}
+
+void sched_ue::set_ul_crc(uint32_t tti, bool crc_res)
+{
+  ul_la.crc_info(crc_res);
+  Debug("SCHED: Set UL CRC=%d for rnti=0x%x, tti=%d, snr=%.1f dB\n", crc_res, rnti, tti, ul_la.get_snr());
+}
+
+void sched_ue::set_ul_snr(uint32_t tti, float snr_db)
+{
+  ul_la.snr_info(snr_db);
+  Debug("SCHED: Set UL SNR=%.1f dB for rnti=0x%x, tti=%d\n", snr_db, rnti, tti);
 }
 
 void sched_ue::ul_buffer_state(uint8_t lc_id, uint32_t bsr, bool set_value)
@@ -200,8 +228,20 @@ void sched_ue::ul_buffer_state(uint8_t lc_id, uint32_t bsr, bool set_value)
       lch[lc_id].bsr += bsr;
     }
   }
-  Debug("SCHED: bsr=%d, lcid=%d, bsr={%d,%d,%d,%d}\n", bsr, lc_id, lch[0].bsr, lch[1].bsr, lch[2].bsr, lch[3].bsr);
-  printf("MAC SCHED sched_ue::ul_buffer_state: bsr=%d, lcid=%d, bsr={%d,%d,%d,%d}\n", bsr, lc_id, lch[0].bsr, lch[1].bsr, lch[2].bsr, lch[3].bsr);
+  SONICA_TRACE(SCHED_UL_BSR, SONICA_TRACE_NO_TTI, rnti, lc_id, lch[0].bsr, lch[1].bsr, lch[2].bsr, lch[3].bsr);
+}
+
+// Takes the bytes of a new UL grant off the buffer states, which the next BSR of the UE overwrites
+void sched_ue::ul_buffer_sub(uint32_t bytes)
+{
+  for (int i = 0; i < sched_interface::MAX_LC and bytes > 0; i++) {
+    if (bearer_is_ul(&lch[i]) and lch[i].bsr > 0) {
+      uint32_t sub = std::min((uint32_t)lch[i].bsr, bytes);
+      lch[i].bsr -= sub;
+      bytes -= sub;
+    }
+  }
+  Debug("SCHED: bsr={%d,%d,%d,%d}\n", lch[0].bsr, lch[1].bsr, lch[2].bsr, lch[3].bsr);
 }
 
 void sched_ue::ul_wait_timer(uint32_t wait_time, bool set_value)
@@ -211,8 +251,7 @@ void sched_ue::ul_wait_timer(uint32_t wait_time, bool set_value)
   } else {
     msg_wait_timer += wait_time;
   }
-  Debug("MAC SCHED: ul_wait_timer=%d\n", msg_wait_timer);
-  printf("MAC SCHED: ul_wait_timer=%d\n", msg_wait_timer);
+  SONICA_TRACE(SCHED_UL_WAIT_TIMER, SONICA_TRACE_NO_TTI, rnti, msg_wait_timer);
 }
 /*******************************************************
  *
@@ -261,7 +300,9 @@ int sched_ue::generate_formatN0(sched_interface::ul_sched_data_t* data,
                                 //                               ul_harq_proc::ul_alloc_t          alloc,
                                 bool needs_npdcch,
                                 //                               srslte_dci_location_t             dci_pos,
-                                int explicit_mcs)
+                                int      explicit_mcs,
+                                uint32_t i_ru,
+                                uint32_t i_rep)
 {
   // Future: add the harq related functions later
   //  ul_harq_proc*    h   = get_ul_harq(tti, cc_idx);
@@ -276,8 +317,7 @@ int sched_ue::generate_formatN0(sched_interface::ul_sched_data_t* data,
 
   // uint32_t nof_retx;
   uint32_t i_tbs  = 0;
-  uint32_t nof_sc = 12; // Currently only support sc=12
-  uint32_t i_ru   = 3;  // Currently only support RU number=4 (MCS0)
+  uint32_t nof_sc = 12; // The scheduler only plans 12-tone NPUSCH at 15 kHz
 
   if (mcs >= 0) {
     if (nof_sc == 1) {
@@ -295,76 +335,84 @@ int sched_ue::generate_formatN0(sched_interface::ul_sched_data_t* data,
   data->tbs = tbs;
 
   if (tbs > 0) {
-    dci->rnti         = rnti;
-    dci->format       = SRSLTE_DCI_FORMATN0;
-    dci->ra_dci.i_mcs = mcs;
-    dci->ra_dci.i_ru  = i_ru;
-    dci->ra_dci.i_sc  = 18;
+    dci->rnti              = rnti;
+    dci->format            = SRSLTE_DCI_FORMATN0;
+    dci->ra_dci.i_mcs      = mcs;
+    dci->ra_dci.i_ru       = i_ru;
+    dci->ra_dci.i_rep      = i_rep;
+    dci->ra_dci.i_sc       = 18; // 12 subcarriers
+    dci->ra_dci.sc_spacing = ul_sc_spacing;
   }
 
   return tbs;
 }
 
-int sched_ue::generate_formatN1(sched_interface::dl_sched_data_t* data,
+int sched_ue::generate_formatN1(uint32_t                          pid,
+                                sched_interface::dl_sched_data_t* data,
                                 uint32_t                          tti,
-                                //                               uint32_t                          cc_idx,
-                                //                               ul_harq_proc::ul_alloc_t          alloc,
-                                bool needs_npdcch,
-                                //                               srslte_dci_location_t             dci_pos,
-                                uint32_t i_sf)
+                                uint32_t                          i_sf,
+                                uint32_t                          harq_ack,
+                                uint32_t                          tti_ack)
 {
-  // Future: add the harq related functions later
-  //  ul_harq_proc*    h   = get_ul_harq(tti, cc_idx);
-
+  dl_harq_proc*             h   = &harq_ent.dl_harq_procs()[pid];
   srslte_ra_nbiot_dl_dci_t* dci = &data->dci;
 
   uint32_t tbs_bytes = 0;
-  int final_mcs = -1;
+  int      final_mcs = -1;
 
-  uint32_t                      data_size = get_pending_dl_new_data();
-  std::pair<uint32_t, uint32_t> req_bytes = get_requested_dl_bytes(0);
+  if (h->is_empty()) {
+    std::pair<uint32_t, uint32_t> req_bytes = get_requested_dl_bytes(0);
 
-  // Currently only support sc=12
-  for (uint32_t mcs = 0; mcs <13; mcs++) {
-    tbs_bytes = tbs_table_nbiot[mcs][i_sf] / 8;
-    if (tbs_bytes > req_bytes.second) {
-      final_mcs = mcs;
-      break;
+    // Currently only support sc=12
+    for (uint32_t mcs = 0; mcs < 13; mcs++) {
+      tbs_bytes = tbs_table_nbiot[mcs][i_sf] / 8;
+      if (tbs_bytes > req_bytes.second) {
+        final_mcs = mcs;
+        break;
+      }
     }
-  }
-
-  if (final_mcs == -1) {
-    // TODO: Change the MCS/i_sf coordination in the future
-    printf("MAC sched_ue::generate_formatN1: cannot find suitable MCS to send all pending data\n");
-
-    printf("NB-IoT: MAC sched_ue::generate_formatN1: --------------------- tmp select MCS=12\n");
-    final_mcs = 12;
-    //    return 0;
-  }
 
-  printf("MAC sched_ue::generate_formatN1 allcoate mcs=%d i_sf=%d\n", final_mcs, i_sf);
+    if (final_mcs == -1) {
+      // TODO: Change the MCS/i_sf coordination in the future
+      SONICA_TRACE(SCHED_DL_NO_MCS, tti, rnti, req_bytes.second, i_sf);
+      final_mcs = 12;
+    }
 
-  data->tbs[0] = tbs_bytes;
-  data->tbs[1] = 0;
+    data->tbs[0] = tbs_bytes;
+    data->tbs[1] = 0;
 
-  uint32_t rem_tbs = tbs_bytes;
+    uint32_t rem_tbs = tbs_bytes;
 
-  rem_tbs -= allocate_mac_ces(data, rem_tbs, 0);
-  rem_tbs -= allocate_mac_sdus(data, rem_tbs, 0);
+    rem_tbs -= allocate_mac_ces(data, rem_tbs, 0);
+    rem_tbs -= allocate_mac_sdus(data, rem_tbs, 0);
 
-  /* Allocate DL UE Harq */
-  if (rem_tbs != tbs_bytes) {
-    //    h->new_tx(user_mask, tb, tti_tx_dl, mcs, tbs, data->dci.location.ncce);
-    Debug("SCHED: Alloc DCI format N1 new mcs=%d, tbs=%d\n", final_mcs, tbs_bytes);
-    printf("SCHED:sched_ue::generate_formatN1 Alloc DCI format N1 new mcs=%d, tbs=%d\n", final_mcs, tbs_bytes);
+    /* Allocate DL UE Harq */
+    if (rem_tbs == tbs_bytes) {
+      Warning("SCHED: Failed to allocate DL harq pid=%d\n", h->get_id());
+      return 0;
+    }
+    h->new_tx(srslte::tti_point{tti}, final_mcs, tbs_bytes, i_sf, srslte::tti_point{tti_ack});
+    SONICA_TRACE(SCHED_DL_NEWTX, tti, rnti, final_mcs, i_sf, tbs_bytes);
   } else {
-    //    Warning("SCHED: Failed to allocate DL harq pid=%d\n", h->get_id());
+    // The MAC PDU is kept by the ue object, only the DCI is generated again
+    int tbs = 0;
+    h->new_retx(srslte::tti_point{tti}, srslte::tti_point{tti_ack}, &final_mcs, &tbs);
+    tbs_bytes              = tbs;
+    data->tbs[0]           = tbs_bytes;
+    data->tbs[1]           = 0;
+    data->nof_pdu_elems[0] = 0;
+    Debug("SCHED: Alloc DCI format N1 retx pid=%d, mcs=%d, tbs=%d, n_rtx=%d\n",
+          h->get_id(),
+          final_mcs,
+          tbs_bytes,
+          h->nof_retx());
   }
 
   if (tbs_bytes > 0) {
+    data->pid            = h->get_id();
     dci->mcs_idx         = final_mcs;
-    dci->rv_idx         = 0;
-    dci->ndi             = true;
+    dci->rv_idx          = 0;
+    dci->ndi             = h->get_ndi();
     dci->format          = 1; // FormatN1 DCI
     dci->alloc.has_sib1  = false;
     dci->alloc.is_ra     = false;
@@ -372,7 +420,7 @@ int sched_ue::generate_formatN1(sched_interface::dl_sched_data_t* data,
     dci->alloc.i_delay   = 0;
     dci->alloc.i_sf      = i_sf; // i_sf_val
     dci->alloc.i_rep     = 0;    // i_rep_val
-    dci->alloc.harq_ack  = 1;
+    dci->alloc.harq_ack  = harq_ack;
     dci->alloc.i_n_start = 0;
   }
 
@@ -522,7 +570,7 @@ std::pair<uint32_t, uint32_t> sched_ue::get_requested_dl_bytes(uint32_t ue_cc_id
   //  bool     is_dci_format1 = get_dci_format() == SRSLTE_DCI_FORMAT1;
   bool is_dci_format1 = true;
   if (is_dci_format1 and (lch[0].buf_tx > 0 or lch[0].buf_retx > 0)) {
-     printf("MAC sched_ue::get_requested_dl_bytes buf_tx=%d, buf_retx=%d\n", lch[0].buf_tx, lch[0].buf_retx);
+    SONICA_TRACE(SCHED_DL_PENDING, SONICA_TRACE_NO_TTI, rnti, 0, lch[0].buf_tx, lch[0].buf_retx);
     srb0_data = compute_sdu_total_bytes(0, lch[0].buf_retx);
     srb0_data += compute_sdu_total_bytes(0, lch[0].buf_tx);
   }
@@ -537,7 +585,7 @@ std::pair<uint32_t, uint32_t> sched_ue::get_requested_dl_bytes(uint32_t ue_cc_id
   for (int i = 1; i < sched_interface::MAX_LC; i++) {
     if (bearer_is_dl(&lch[i])) {
       if (lch[i].buf_tx > 0 or lch[i].buf_retx > 0){
-        printf("MAC sched_ue::get_requested_dl_bytes lcid=%d, buf_tx=%d, buf_retx=%d\n", i, lch[i].buf_tx, lch[i].buf_retx);
+        SONICA_TRACE(SCHED_DL_PENDING, SONICA_TRACE_NO_TTI, rnti, i, lch[i].buf_tx, lch[i].buf_retx);
       }
       rb_data += compute_sdu_total_bytes(i, lch[i].buf_retx);
       rb_data += compute_sdu_total_bytes(i, lch[i].buf_tx);
@@ -569,6 +617,27 @@ std::pair<uint32_t, uint32_t> sched_ue::get_requested_dl_bytes(uint32_t ue_cc_id
  * Get pending DL data in RLC buffers + CEs
  * @return
  */
+const dl_harq_proc& sched_ue::get_dl_harq(uint32_t idx) const
+{
+  return harq_ent.dl_harq_procs()[idx];
+}
+
+dl_harq_proc* sched_ue::get_pending_dl_harq(uint32_t tti_tx_dl)
+{
+  return harq_ent.get_pending_dl_harq(tti_tx_dl);
+}
+
+dl_harq_proc* sched_ue::get_empty_dl_harq(uint32_t tti_tx_dl)
+{
+  return harq_ent.get_empty_dl_harq(tti_tx_dl);
+}
+
+bool sched_ue::has_active_dl_harq() const
+{
+  const std::vector<dl_harq_proc>& procs = harq_ent.dl_harq_procs();
+  return std::any_of(procs.begin(), procs.end(), [](const dl_harq_proc& h) { return not h.is_empty(); });
+}
+
 uint32_t sched_ue::get_pending_dl_new_data()
 {
   //  if (std::count_if(carriers.begin(), carriers.end(), [](const sched_ue_carrier& cc) { return cc.is_active(); }) ==
@@ -598,6 +667,16 @@ uint32_t sched_ue::get_pending_ul_old_data(uint32_t cc_idx)
   return get_pending_ul_old_data_unlocked(cc_idx);
 }
 
+void sched_ue::set_ul_sc_spacing(srslte_npusch_sc_spacing_t sc_spacing)
+{
+  ul_sc_spacing = sc_spacing;
+}
+
+ul_link_adapt::ul_format_t sched_ue::get_ul_format(uint32_t req_bytes, uint32_t max_nof_sf) const
+{
+  return ul_la.select(req_bytes, max_nof_sf);
+}
+
 // Private lock-free implementation
 uint32_t sched_ue::get_pending_ul_new_data_unlocked(uint32_t tti)
 {
@@ -651,11 +730,9 @@ void sched_ue::set_bearer_cfg_unlocked(uint32_t lc_id, const sched_interface::ue
     if (lch[lc_id].cfg.direction != sched_interface::ue_bearer_cfg_t::IDLE) {
       if (not is_equal) {
         Info("SCHED: Set bearer config lc_id=%d, direction=%d\n", lc_id, (int)lch[lc_id].cfg.direction);
-        printf("SCHED: Set bearer config lc_id=%d, direction=%d\n", lc_id, (int)lch[lc_id].cfg.direction);
       }
     } else if (not is_idle) {
       Info("SCHED: Removed bearer config lc_id=%d, direction=%d\n", lc_id, (int)lch[lc_id].cfg.direction);
-      printf("SCHED: Removed bearer config lc_id=%d, direction=%d\n", lc_id, (int)lch[lc_id].cfg.direction);
     }
   }
 }
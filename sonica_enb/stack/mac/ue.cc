@@ -25,6 +25,7 @@
 #include <iostream>
 #include <string.h>
 
+#include "sonica/common/trace.h"
 #include "sonica_enb/hdr/stack/mac/ue.h"
 #include "srslte/common/log_helper.h"
 #include "srslte/interfaces/enb_interfaces_nb.h"
@@ -161,7 +162,7 @@ void ue::deallocate_pdu(const uint32_t tti)
 
 void ue::process_pdu(uint8_t* pdu, uint32_t nof_bytes, srslte::pdu_queue::channel_t channel)
 {
-  printf("MAC UE process_pdu: length=%d, pdu=%x %x %x\n",nof_bytes, pdu[0], pdu[1], pdu[2]);
+  SONICA_TRACE(MAC_UL_PDU, SONICA_TRACE_NO_TTI, rnti, nof_bytes, sonica_trace_pack(pdu, nof_bytes, 0));
 
   // Store the DPR byte
   uint8_t dpr = 0x00;
@@ -207,10 +208,11 @@ void ue::process_pdu(uint8_t* pdu, uint32_t nof_bytes, srslte::pdu_queue::channe
                        rnti,
                        mac_msg_ul.get()->get_sdu_lcid(),
                        mac_msg_ul.get()->get_payload_size());
-      printf("Receive PDU: rnti=0x%x, lcid=%d, %d bytes\n",
-             rnti,
-             mac_msg_ul.get()->get_sdu_lcid(),
-             mac_msg_ul.get()->get_payload_size());
+      SONICA_TRACE(MAC_UL_SDU,
+                   SONICA_TRACE_NO_TTI,
+                   rnti,
+                   mac_msg_ul.get()->get_sdu_lcid(),
+                   mac_msg_ul.get()->get_payload_size());
 
       /* In some cases, an uplink transmission with only CQI has all zeros and gets routed to RRC
        * Compute the checksum if lcid=0 and avoid routing in that case
@@ -233,9 +235,8 @@ void ue::process_pdu(uint8_t* pdu, uint32_t nof_bytes, srslte::pdu_queue::channe
                        mac_msg_ul.get()->get_sdu_lcid(),
                        mac_msg_ul.get()->get_sdu_ptr(),
                        mac_msg_ul.get()->get_payload_size());
-      } else {
-        printf("MAC UE mac_msg_ul.get()->get_sdu_ptr(): pdu=%x %x %x\n", mac_msg_ul.get()->get_sdu_ptr()[0], mac_msg_ul.get()->get_sdu_ptr()[1], mac_msg_ul.get()->get_sdu_ptr()[2]);
-        printf("Sched UE: RLC is not set!\n");
+      } else if (route_pdu) {
+        SONICA_TRACE(MAC_UL_NO_RLC, SONICA_TRACE_NO_TTI, rnti, mac_msg_ul.get()->get_sdu_lcid());
       }
 
       // Indicate scheduler to update BSR counters
@@ -270,7 +271,7 @@ void ue::process_pdu(uint8_t* pdu, uint32_t nof_bytes, srslte::pdu_queue::channe
 
   // Process the DPR. The data valume is according to TS 36.321 Table 6.1.3.10-1a. Use tmp 125 bytes now.
   if(dpr != 0x00){
-    printf("MAC: ue::process_pdu: DPR=%x, lcid_most_data=%d\n", dpr, lcid_most_data);
+    SONICA_TRACE(MAC_DPR, SONICA_TRACE_NO_TTI, rnti, dpr, lcid_most_data);
     sched->ul_bsr(rnti, lcid_most_data, 125, false);
     sched->ul_wait_timer(rnti, 30, true);
   }
@@ -312,7 +313,6 @@ bool ue::process_ce(srslte::sch_subh* subh)
     case srslte::ul_sch_lcid::CRNTI:
       old_rnti = subh->get_c_rnti();
       Info("CE:    Received C-RNTI from temp_rnti=0x%x, rnti=0x%x\n", rnti, old_rnti);
-      printf("CE:    Received C-RNTI from temp_rnti=0x%x, rnti=0x%x\n", rnti, old_rnti);
       if (sched->ue_exists(old_rnti)) {
         // rrc->upd_user(rnti, old_rnti);
         rnti = old_rnti;
@@ -325,7 +325,6 @@ bool ue::process_ce(srslte::sch_subh* subh)
       idx = subh->get_bsr(buff_size);
       if (idx == -1) {
         Error("Invalid Index Passed to lc groups\n");
-        printf("Invalid Index Passed to lc groups\n");
         break;
       }
       //      for (uint32_t i = 0; i < lc_groups[idx].size(); i++) {
@@ -340,11 +339,6 @@ bool ue::process_ce(srslte::sch_subh* subh)
            rnti,
            idx,
            buff_size[idx]);
-      printf("MAC: NB-IoT: ue::process_ce: CE: Received %s BSR rnti=0x%x, lcg=%d, value=%d\n",
-             subh->ul_sch_ce_type() == srslte::ul_sch_lcid::SHORT_BSR ? "Short" : "Trunc",
-             rnti,
-             idx,
-             buff_size[idx]);
       is_bsr = true;
       break;
     case srslte::ul_sch_lcid::LONG_BSR:
@@ -380,7 +374,7 @@ int ue::read_pdu(uint32_t lcid, uint8_t* payload, uint32_t requested_bytes)
 void ue::allocate_sdu(srslte::sch_pdu* pdu, uint32_t lcid, uint32_t total_sdu_len)
 {
   int sdu_space = pdu->get_sdu_space();
-  printf("MAC allocate_sdu SDU: total_sdu_len=%d, sdu_space=%d\n", total_sdu_len, (uint32_t)sdu_space);
+  SONICA_TRACE(MAC_DL_SDU, SONICA_TRACE_NO_TTI, rnti, lcid, total_sdu_len, sdu_space);
   if (sdu_space > 0) {
     int sdu_len = SRSLTE_MIN(total_sdu_len, (uint32_t)sdu_space);
     int n       = 1;
@@ -453,6 +447,17 @@ uint8_t* ue::generate_pdu(uint32_t                        ue_cc_idx,
   return ret;
 }
 
+//! Returns the MAC PDU last generated for a HARQ process, used for the retransmissions
+uint8_t* ue::get_tx_pdu(uint32_t ue_cc_idx, uint32_t harq_pid, uint32_t tb_idx)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (ue_cc_idx < tx_payload_buffer.size() && harq_pid < SRSLTE_FDD_NOF_HARQ && tb_idx < SRSLTE_MAX_TB) {
+    return tx_payload_buffer[ue_cc_idx][harq_pid][tb_idx]->msg;
+  }
+  log_h->error("Invalid parameters calling get_tx_pdu: cc_idx=%d, harq_pid=%d, tb_idx=%d\n", ue_cc_idx, harq_pid, tb_idx);
+  return nullptr;
+}
+
 /******* METRICS interface ***************/
 void ue::metrics_rx(bool crc, uint32_t tbs)
 {
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/*
+ * Stresses the buffer pool from several threads, each allocating and freeing buffers at random while
+ * holding a few, and checks that no buffer is handed out twice and that every one comes back. Then
+ * exhausts the pool: the buffers left in the caches of threads that went idle must still be allocated,
+ * and a blocking allocation must be woken by a buffer freed from another thread.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "srslte/common/buffer_pool.h"
+
+static uint32_t nof_threads = 8;
+static uint32_t nof_iters   = 1000000;
+static uint32_t capacity    = 1024;
+static uint32_t max_held    = 16;
+
+// A blocking allocation not woken within this time fails the bench
+static const uint32_t WAKEUP_TIMEOUT_MS = 1000;
+
+typedef srslte::buffer_pool<srslte::byte_buffer_t> pool_t;
+
+static void usage(char* prog)
+{
+  printf("Usage: %s [tncm]\n", prog);
+  printf("\t-t number of threads [Default %d]\n", nof_threads);
+  printf("\t-n allocations per thread [Default %d]\n", nof_iters);
+  printf("\t-c pool capacity [Default %d]\n", capacity);
+  printf("\t-m buffers held per thread at most [Default %d]\n", max_held);
+}
+
+static void parse_args(int argc, char** argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "tncm")) != -1) {
+    switch (opt) {
+      case 't':
+        nof_threads = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'n':
+        nof_iters = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'c':
+        capacity = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'm':
+        max_held = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+}
+
+// Each held buffer carries its owner, a buffer handed out twice is found overwritten by the other thread
+static void stress_thread(pool_t* pool, uint32_t id, std::atomic<uint32_t>* nof_errors)
+{
+  std::vector<srslte::byte_buffer_t*> held;
+  uint32_t                            seed = id;
+
+  for (uint32_t i = 0; i < nof_iters; i++) {
+    bool alloc = held.empty() or (held.size() < max_held and rand_r(&seed) % 2);
+    if (alloc) {
+      srslte::byte_buffer_t* b = pool->allocate("stress");
+      if (b != nullptr) {
+        b->N_bytes = id;
+        held.push_back(b);
+      }
+    } else {
+      uint32_t               k = rand_r(&seed) % held.size();
+      srslte::byte_buffer_t* b = held[k];
+      held[k]                  = held.back();
+      held.pop_back();
+      if (b->N_bytes != id) {
+        nof_errors->fetch_add(1);
+      }
+      if (not pool->deallocate(b)) {
+        nof_errors->fetch_add(1);
+      }
+    }
+  }
+  for (srslte::byte_buffer_t* b : held) {
+    if (b->N_bytes != id or not pool->deallocate(b)) {
+      nof_errors->fetch_add(1);
+    }
+  }
+}
+
+static int run_stress()
+{
+  pool_t                   pool(capacity);
+  std::atomic<uint32_t>    nof_errors{0};
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t t = 0; t < nof_threads; t++) {
+    threads.emplace_back(stress_thread, &pool, t, &nof_errors);
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  srslte::buffer_pool_metrics_t m;
+  pool.get_metrics(m);
+  printf("Stress: %d threads x %d operations, %.1f ns per operation, %lu failed allocations\n",
+         nof_threads,
+         nof_iters,
+         us * 1000 / ((double)nof_threads * nof_iters),
+         (unsigned long)m.nof_alloc_fail);
+
+  if (nof_errors.load() > 0) {
+    fprintf(stderr, "Stress: %d buffers handed out twice or not taken back\n", nof_errors.load());
+    return SRSLTE_ERROR;
+  }
+  if (m.nof_used != 0) {
+    fprintf(stderr, "Stress: %d buffers still used after every thread freed its own\n", m.nof_used);
+    return SRSLTE_ERROR;
+  }
+  return SRSLTE_SUCCESS;
+}
+
+static int run_exhaustion()
+{
+  pool_t pool(capacity);
+
+  // Threads that fill their caches and go idle, they only exit once the pool is exhausted
+  std::atomic<uint32_t>    nof_idle{0};
+  std::atomic<bool>        release{false};
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < nof_threads; t++) {
+    threads.emplace_back([&pool, &nof_idle, &release]() {
+      std::vector<srslte::byte_buffer_t*> held;
+      for (uint32_t i = 0; i < max_held; i++) {
+        held.push_back(pool.allocate("idle"));
+      }
+      for (srslte::byte_buffer_t* b : held) {
+        pool.deallocate(b);
+      }
+      nof_idle++;
+      while (not release) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    });
+  }
+  while (nof_idle < nof_threads) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  srslte::buffer_pool_metrics_t m;
+  pool.get_metrics(m);
+
+  // Every buffer has to be allocated without blocking, the cached ones included
+  std::vector<srslte::byte_buffer_t*> held;
+  while (srslte::byte_buffer_t* b = pool.allocate("exhaust")) {
+    held.push_back(b);
+  }
+  printf("Exhaustion: %d of %d buffers allocated, %d were cached by idle threads\n",
+         (uint32_t)held.size(),
+         capacity,
+         m.nof_cached);
+  release = true;
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  if (held.size() != capacity) {
+    fprintf(stderr, "Exhaustion: %d free buffers could not be allocated\n", capacity - (uint32_t)held.size());
+    return SRSLTE_ERROR;
+  }
+
+  // A blocking allocation on the empty pool is woken by a buffer freed from another thread
+  std::atomic<bool> done{false};
+  std::thread       waiter([&pool, &done]() {
+    srslte::byte_buffer_t* b = pool.allocate("blocking", true);
+    done                     = true;
+    pool.deallocate(b);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  std::thread freer([&pool, &held]() {
+    pool.deallocate(held.back());
+  });
+  freer.join();
+  held.pop_back();
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(WAKEUP_TIMEOUT_MS);
+  while (not done and std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (not done) {
+    fprintf(stderr, "Exhaustion: blocking allocation not woken within %d ms\n", WAKEUP_TIMEOUT_MS);
+    // Let the waiter out before the pool goes away
+    pool.deallocate(held.back());
+    held.pop_back();
+    waiter.join();
+    return SRSLTE_ERROR;
+  }
+  waiter.join();
+  printf("Exhaustion: blocking allocation woken by a free from another thread\n");
+
+  for (srslte::byte_buffer_t* b : held) {
+    pool.deallocate(b);
+  }
+  return SRSLTE_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+  parse_args(argc, argv);
+
+  if (run_stress() or run_exhaustion()) {
+    return SRSLTE_ERROR;
+  }
+  return SRSLTE_SUCCESS;
+}
@@ -41,6 +41,7 @@ private:
   FILE *log_fp;
 
   uint8_t rx_tb[SRSLTE_MAX_DL_BITS_CAT_NB1]; // Byte buffer for rx'ed transport blocks
+  uint32_t ul_tb_len;
 
   bool ul_record_start;
   uint32_t ul_record_cnt;
@@ -53,6 +54,7 @@ NBULDecode::NBULDecode()
   rxport_map[1] = UL_FREQ;
 
   ul_record_start = false;
+  ul_tb_len = 0;
 
   log_fp = fopen("/tmp/nbul_decode.log", "w");
   if (log_fp == nullptr) {
@@ -141,7 +143,9 @@ void NBULDecode::subframe_handler()
           ul_record_skip = ugrant.k0 + udci_unpacked.dci_sf_rep_num + 1;
           ul_record_start = true;
           if (ugrant.nof_sc == 12 && ugrant.nof_rep == 1 && udci_unpacked.dci_sf_rep_num == 0) {
-            sonica_enb_ul_nbiot_cfg_grant(&enb_ul, &ugrant, args.rnti);
+            if (sonica_enb_ul_nbiot_cfg_grant(&enb_ul, &ugrant, args.rnti) >= 0) {
+              ul_tb_len = ugrant.mcs.tbs / 8;
+            }
           }
         }
       }
@@ -157,13 +161,13 @@ void NBULDecode::subframe_handler()
       //                    -srslte_sync_nbiot_get_cfo(&ue_sync.strack) / ue_sync.fft_size);
       // fwrite(buff_ptrs[1], sizeof(cf_t), 1920, ul_record_file);
       // ul_record_pos++;
-      if (enb_ul.has_ul_grant) {
+      if (enb_ul.nof_grants > 0) {
         n = sonica_enb_ul_nbiot_decode_npusch(&enb_ul,
                                               buff_ptrs[1],
                                               srslte_ue_sync_nbiot_get_sfidx(&ue_sync),
                                               rx_tb);
         if (n == SRSLTE_SUCCESS) {
-          log_data(rx_tb, enb_ul.npusch_cfg.grant.mcs.tbs / 8);
+          log_data(rx_tb, ul_tb_len);
         } else {
           fprintf(log_fp, "UL decode returns %d\n", n);
         }
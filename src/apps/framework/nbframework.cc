@@ -383,7 +383,7 @@ void NBFramework::run()
               srslte_nbiot_ue_dl_set_rnti(&ue_dl, args.rnti);
 
               if (nof_rf_ports > 1 && rxport_map[1] == UL_FREQ) {
-                if (sonica_enb_ul_nbiot_init(&enb_ul, buff_ptrs[1])) {
+                if (sonica_enb_ul_nbiot_init(&enb_ul, buff_ptrs[1], srslte_symbol_sz(SRSLTE_NBIOT_MAX_PRB))) {
                   fprintf(stderr, "Error initiating ENB uplink processing module\n");
                   exit(-1);
                 }
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/*
+ * Compares the NPRACH detector fed through the decimating channelizer with the full band detector,
+ * which transforms every NPRACH symbol at the input rate. The occasion is read from a recorded IQ
+ * file (complex float, starting at the first symbol group) or synthesized with a few preambles in noise.
+ * A synthesized occasion fails the bench if either detector misses a preamble or estimates its ToA
+ * more than MAX_TOA_ERROR_US off.
+ */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sonica/nbiot_phch/nprach.h"
+#include "srslte/srslte.h"
+
+#define MAX_TOA_ERROR_US 1.0f
+
+static uint32_t nof_occasions = 100;
+static uint32_t symbol_sz     = 128;
+static uint32_t nof_reps      = 1;
+static uint32_t nof_ue        = 4;
+static float    snr_db        = 0.0f;
+static char*    input_file    = NULL;
+
+static void usage(char* prog)
+{
+  printf("Usage: %s [nsruev] [-i file]\n", prog);
+  printf("\t-n number of occasions [Default %d]\n", nof_occasions);
+  printf("\t-s OFDM symbol size, sets the sample rate [Default %d]\n", symbol_sz);
+  printf("\t-r number of repetitions [Default %d]\n", nof_reps);
+  printf("\t-u number of synthesized preambles [Default %d]\n", nof_ue);
+  printf("\t-e SNR per sample of the synthesized preambles in dB [Default %.1f]\n", snr_db);
+  printf("\t-i recorded IQ file, complex float [Default synthesized]\n");
+  printf("\t-v [set srslte_verbose to debug, default none]\n");
+}
+
+static void parse_args(int argc, char** argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "nsruiev")) != -1) {
+    switch (opt) {
+      case 'n':
+        nof_occasions = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 's':
+        symbol_sz = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'r':
+        nof_reps = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'u':
+        nof_ue = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'e':
+        snr_db = strtof(argv[optind], NULL);
+        break;
+      case 'i':
+        input_file = argv[optind];
+        break;
+      case 'v':
+        srslte_verbose++;
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+}
+
+static double elapsed_us(struct timeval* t)
+{
+  get_time_interval(t);
+  return t[0].tv_sec * 1e6 + t[0].tv_usec;
+}
+
+static float gauss()
+{
+  float u = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+  float v = rand() / (RAND_MAX + 1.0f);
+  return sqrtf(-2 * logf(u)) * cosf(2 * M_PI * v);
+}
+
+// Adds a format 1 preamble on subcarrier n_init, hopping as in 36.211 10.1.6.1, delayed by delay samples
+static void
+add_preamble(const sonica_nprach_t* q, cf_t* x, uint32_t len, uint32_t n_init, uint32_t delay, float amp)
+{
+  uint32_t n     = q->in_samp_size;
+  uint32_t cp    = n;
+  uint32_t glen  = cp + SONICA_NPRACH_SYM_GROUP_SIZE * n;
+  uint32_t gap   = (uint32_t)(q->in_srate_hz * SONICA_NPRACH_GAP_MS / 1000);
+  uint32_t start = (n_init / SONICA_NPRACH_SUBCARRIERS) * SONICA_NPRACH_SUBCARRIERS;
+  uint32_t sc    = n_init % SONICA_NPRACH_SUBCARRIERS;
+
+  for (uint32_t i = 0; i < nof_reps * SONICA_NPRACH_SYM_GROUPS; i++) {
+    if (i > 0) {
+      switch (i % SONICA_NPRACH_SYM_GROUPS) {
+        case 0:
+          sc = (n_init + q->hop[i / SONICA_NPRACH_SYM_GROUPS]) % SONICA_NPRACH_SUBCARRIERS;
+          break;
+        case 2:
+          sc = sc < SONICA_NPRACH_SUBC_HALF ? sc + SONICA_NPRACH_SUBC_HALF : sc - SONICA_NPRACH_SUBC_HALF;
+          break;
+        default:
+          sc ^= 1;
+      }
+    }
+
+    float    f   = ((float)(start + sc) - SONICA_NPRACH_MAX_SUBCARRIERS / 2 + 0.5f) * SONICA_NPRACH_SCS_HZ;
+    uint32_t off = i * glen + delay + (i / (SONICA_NPRACH_GAP_REPS * SONICA_NPRACH_SYM_GROUPS)) * gap;
+    for (uint32_t m = 0; m < glen && off + m < len; m++) {
+      x[off + m] += amp * cexpf(I * 2 * M_PI * f * ((float)m - cp) / q->in_srate_hz);
+    }
+  }
+}
+
+// Every synthesized preamble has to be detected on its subcarrier with its ToA
+static int check_detections(const char*     name,
+                            const uint32_t* sc,
+                            const float*    delay_us,
+                            uint32_t        nof_ue_,
+                            const uint32_t* idx,
+                            const float*    toa,
+                            uint32_t        nof_det)
+{
+  int ret = SRSLTE_SUCCESS;
+  for (uint32_t u = 0; u < nof_ue_; u++) {
+    uint32_t i = 0;
+    while (i < nof_det && idx[i] != sc[u]) {
+      i++;
+    }
+    if (i == nof_det) {
+      ERROR("%s detector missed the preamble on subcarrier %d\n", name, sc[u]);
+      ret = SRSLTE_ERROR;
+    } else if (fabsf(toa[i] * 1e6f - delay_us[u]) > MAX_TOA_ERROR_US) {
+      ERROR("%s detector ToA error of %.2f us on subcarrier %d exceeds %.2f us\n",
+            name,
+            toa[i] * 1e6f - delay_us[u],
+            sc[u],
+            MAX_TOA_ERROR_US);
+      ret = SRSLTE_ERROR;
+    }
+  }
+  return ret;
+}
+
+// Feeds one occasion subframe by subframe, as the NPRACH worker does
+static int run_occasion(sonica_nprach_t* q, const cf_t* x, uint32_t len, uint32_t* idx, float* toa, uint32_t* nof_det)
+{
+  uint32_t sf_len = (uint32_t)(q->in_srate_hz / 1000);
+  sonica_nprach_detect_reset(q);
+  for (uint32_t off = 0; off < len; off += sf_len) {
+    uint32_t n   = SRSLTE_MIN(sf_len, len - off);
+    int      ret = sonica_nprach_detect(q, &x[off], n, NULL, idx, toa, NULL, nof_det);
+    if (ret != 0) {
+      return ret;
+    }
+  }
+  return SRSLTE_ERROR;
+}
+
+int main(int argc, char** argv)
+{
+  int             ret  = SRSLTE_ERROR;
+  cf_t*           x    = NULL;
+  sonica_nprach_t full = {}, ch = {};
+  struct timeval  t[3];
+  uint32_t        ue_sc[SONICA_NPRACH_MAX_SUBCARRIERS];
+  float           ue_delay_us[SONICA_NPRACH_MAX_SUBCARRIERS];
+
+  parse_args(argc, argv);
+
+  if (sonica_nprach_init(&full, symbol_sz) || sonica_nprach_init(&ch, symbol_sz)) {
+    ERROR("Error initiating NPRACH detector\n");
+    goto clean_exit;
+  }
+  sonica_nprach_set_channelizer(&full, false);
+
+  srslte_nbiot_cell_t cell = {};
+  cell.n_id_ncell          = 1;
+  sonica_nprach_cfg_t cfg  = {SONICA_NPRACH_FORMAT_1, 0, SONICA_NPRACH_MAX_SUBCARRIERS, nof_reps};
+  if (sonica_nprach_set_cell(&full, cell) || sonica_nprach_set_cell(&ch, cell) ||
+      sonica_nprach_set_cfg(&full, &cfg) || sonica_nprach_set_cfg(&ch, &cfg)) {
+    ERROR("Error configuring NPRACH detector\n");
+    goto clean_exit;
+  }
+
+  // The channelizer needs its look-ahead past the end of the occasion
+  uint32_t len = SRSLTE_MAX(sonica_nprach_occasion_len(&full), sonica_nprach_occasion_len(&ch));
+  x            = srslte_vec_cf_malloc(len);
+  if (!x) {
+    perror("malloc");
+    goto clean_exit;
+  }
+  srslte_vec_cf_zero(x, len);
+
+  if (input_file) {
+    srslte_filesource_t fsrc;
+    if (srslte_filesource_init(&fsrc, input_file, SRSLTE_COMPLEX_FLOAT_BIN)) {
+      ERROR("Error opening %s\n", input_file);
+      goto clean_exit;
+    }
+    int n = srslte_filesource_read(&fsrc, x, len);
+    srslte_filesource_free(&fsrc);
+    if (n < (int)sonica_nprach_occasion_len(&full)) {
+      ERROR("%s holds %d samples, an occasion needs %d\n", input_file, n, sonica_nprach_occasion_len(&full));
+      goto clean_exit;
+    }
+  } else {
+    // Delays up to 200 us, within the format 1 CP
+    float amp = sqrtf(powf(10.0f, snr_db / 10.0f));
+    nof_ue    = SRSLTE_MIN(nof_ue, SONICA_NPRACH_MAX_SUBCARRIERS);
+    for (uint32_t u = 0; u < nof_ue; u++) {
+      uint32_t n_init = (u * 13 + 5) % SONICA_NPRACH_MAX_SUBCARRIERS;
+      uint32_t delay  = (uint32_t)(rand() % 200 * 1e-6f * ch.in_srate_hz);
+      add_preamble(&ch, x, len, n_init, delay, amp);
+      ue_sc[u]       = n_init;
+      ue_delay_us[u] = delay / ch.in_srate_hz * 1e6f;
+      printf("Preamble on subcarrier %2d, ToA %.2f us\n", n_init, ue_delay_us[u]);
+    }
+    for (uint32_t i = 0; i < len; i++) {
+      x[i] += M_SQRT1_2 * (gauss() + I * gauss());
+    }
+  }
+
+  // Both detectors have to agree before timing them
+  uint32_t idx_full[SONICA_NPRACH_MAX_SUBCARRIERS], idx_ch[SONICA_NPRACH_MAX_SUBCARRIERS];
+  float    toa_full[SONICA_NPRACH_MAX_SUBCARRIERS], toa_ch[SONICA_NPRACH_MAX_SUBCARRIERS];
+  uint32_t nof_full = 0, nof_ch = 0;
+  if (run_occasion(&full, x, len, idx_full, toa_full, &nof_full) != 1 ||
+      run_occasion(&ch, x, len, idx_ch, toa_ch, &nof_ch) != 1) {
+    ERROR("Error running NPRACH detector\n");
+    goto clean_exit;
+  }
+
+  printf("Detected: full=%d, channelizer=%d\n", nof_full, nof_ch);
+  for (uint32_t i = 0; i < SRSLTE_MAX(nof_full, nof_ch); i++) {
+    if (i < nof_full) {
+      printf("  full: sc=%2d toa=%6.2f us", idx_full[i], toa_full[i] * 1e6);
+    } else {
+      printf("  %-26s", "");
+    }
+    if (i < nof_ch) {
+      printf("  channelizer: sc=%2d toa=%6.2f us", idx_ch[i], toa_ch[i] * 1e6);
+    }
+    printf("\n");
+  }
+
+  if (!input_file) {
+    int check_full = check_detections("Full band", ue_sc, ue_delay_us, nof_ue, idx_full, toa_full, nof_full);
+    int check_ch   = check_detections("Channelizer", ue_sc, ue_delay_us, nof_ue, idx_ch, toa_ch, nof_ch);
+    if (check_full || check_ch) {
+      goto clean_exit;
+    }
+    printf("All %d preambles detected, ToA error within %.2f us\n", nof_ue, MAX_TOA_ERROR_US);
+  }
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_occasions; i++) {
+    run_occasion(&full, x, len, idx_full, toa_full, &nof_full);
+  }
+  gettimeofday(&t[2], NULL);
+  double full_us = elapsed_us(t) / nof_occasions;
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_occasions; i++) {
+    run_occasion(&ch, x, len, idx_ch, toa_ch, &nof_ch);
+  }
+  gettimeofday(&t[2], NULL);
+  double ch_us = elapsed_us(t) / nof_occasions;
+
+  printf("%d occasions of %d repetitions at %.2f MHz, us per occasion:\n",
+         nof_occasions,
+         nof_reps,
+         ch.in_srate_hz / 1e6);
+  printf("  full=%.2f, channelizer=%.2f (x%.2f)\n", full_us, ch_us, full_us / ch_us);
+
+  ret = SRSLTE_SUCCESS;
+
+clean_exit:
+  sonica_nprach_free(&full);
+  sonica_nprach_free(&ch);
+  free(x);
+  return ret;
+}
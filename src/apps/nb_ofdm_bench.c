@@ -0,0 +1,213 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/*
+ * Compares the narrowband OFDM modulator/demodulator with the full srslte_ofdm transforms on the
+ * configurations used by the eNB: DL with normalization and +1/2 subcarrier shift, UL without
+ * normalization, -1/2 subcarrier shift and DFT window offset.
+ */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "sonica/nbiot_enb/ofdm_nbiot.h"
+#include "srslte/srslte.h"
+
+// Largest error of the narrowband transforms, relative to the largest magnitude of the full ones
+#define MAX_REL_ERROR 1e-3f
+
+static uint32_t nof_sf = 10000;
+
+static void usage(char* prog)
+{
+  printf("Usage: %s [nv]\n", prog);
+  printf("\t-n number of subframes [Default %d]\n", nof_sf);
+  printf("\t-v [set srslte_verbose to debug, default none]\n");
+}
+
+static void parse_args(int argc, char** argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "nv")) != -1) {
+    switch (opt) {
+      case 'n':
+        nof_sf = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 'v':
+        srslte_verbose++;
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+}
+
+static double elapsed_us(struct timeval* t)
+{
+  get_time_interval(t);
+  return t[0].tv_sec * 1e6 + t[0].tv_usec;
+}
+
+static float max_error(const cf_t* a, const cf_t* b, uint32_t len)
+{
+  float err = 0, peak = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    err  = SRSLTE_MAX(err, cabsf(a[i] - b[i]));
+    peak = SRSLTE_MAX(peak, cabsf(a[i]));
+  }
+  return peak > 0 ? err / peak : err;
+}
+
+int main(int argc, char** argv)
+{
+  int      ret     = SRSLTE_ERROR;
+  uint32_t sf_len  = SRSLTE_SF_LEN_PRB(SRSLTE_NBIOT_MAX_PRB);
+  uint32_t nof_re  = SRSLTE_SF_LEN_RE(SRSLTE_NBIOT_MAX_PRB, SRSLTE_CP_NORM);
+  cf_t*    grid    = srslte_vec_cf_malloc(nof_re);
+  cf_t*    grid_rx = srslte_vec_cf_malloc(nof_re);
+  cf_t*    grid_nb = srslte_vec_cf_malloc(nof_re);
+  cf_t*    sig     = srslte_vec_cf_malloc(sf_len);
+  cf_t*    sig_nb  = srslte_vec_cf_malloc(sf_len);
+  cf_t*    sig_rx  = srslte_vec_cf_malloc(sf_len);
+
+  srslte_ofdm_t       ofdm_tx = {}, ofdm_rx = {};
+  sonica_ofdm_nbiot_t nb_tx = {}, nb_rx = {};
+  struct timeval      t[3];
+
+  parse_args(argc, argv);
+
+  if (!grid || !grid_rx || !grid_nb || !sig || !sig_nb || !sig_rx) {
+    perror("malloc");
+    goto clean_exit;
+  }
+  for (uint32_t i = 0; i < nof_re; i++) {
+    grid[i] = (rand() % 2 ? 1.0f : -1.0f) * M_SQRT1_2 + I * (rand() % 2 ? 1.0f : -1.0f) * M_SQRT1_2;
+  }
+
+  srslte_ofdm_cfg_t tx_cfg = {};
+  tx_cfg.nof_prb           = SRSLTE_NBIOT_MAX_PRB;
+  tx_cfg.cp                = SRSLTE_CP_NORM;
+  tx_cfg.normalize         = true;
+  tx_cfg.freq_shift_f      = -SRSLTE_NBIOT_FREQ_SHIFT_FACTOR;
+  tx_cfg.in_buffer         = grid;
+  tx_cfg.out_buffer        = sig;
+  if (srslte_ofdm_tx_init_cfg(&ofdm_tx, &tx_cfg)) {
+    ERROR("Error initiating iFFT\n");
+    goto clean_exit;
+  }
+  tx_cfg.out_buffer = sig_nb;
+  if (sonica_ofdm_nbiot_tx_init(&nb_tx, &tx_cfg)) {
+    ERROR("Error initiating narrowband iFFT\n");
+    goto clean_exit;
+  }
+
+  // The full FFT shifts its input in place, so it gets its own copy of the signal
+  srslte_ofdm_cfg_t rx_cfg = {};
+  rx_cfg.nof_prb           = SRSLTE_NBIOT_MAX_PRB;
+  rx_cfg.cp                = SRSLTE_CP_NORM;
+  rx_cfg.freq_shift_f      = SRSLTE_NBIOT_FREQ_SHIFT_FACTOR;
+  rx_cfg.rx_window_offset  = 0.2f;
+  rx_cfg.in_buffer         = sig_rx;
+  rx_cfg.out_buffer        = grid_rx;
+  if (srslte_ofdm_rx_init_cfg(&ofdm_rx, &rx_cfg)) {
+    ERROR("Error initiating FFT\n");
+    goto clean_exit;
+  }
+  rx_cfg.in_buffer  = sig_nb;
+  rx_cfg.out_buffer = grid_nb;
+  if (sonica_ofdm_nbiot_rx_init(&nb_rx, &rx_cfg)) {
+    ERROR("Error initiating narrowband FFT\n");
+    goto clean_exit;
+  }
+
+  // Both transforms have to agree before timing them
+  srslte_ofdm_tx_sf(&ofdm_tx);
+  sonica_ofdm_nbiot_tx_sf(&nb_tx);
+  float tx_err = max_error(sig, sig_nb, sf_len);
+
+  srslte_vec_cf_copy(sig_rx, sig_nb, sf_len);
+  srslte_ofdm_rx_sf(&ofdm_rx);
+  sonica_ofdm_nbiot_rx_sf(&nb_rx);
+  float rx_err = max_error(grid_rx, grid_nb, nof_re);
+
+  printf("Max relative error: tx=%.2e, rx=%.2e\n", tx_err, rx_err);
+  if (!(tx_err <= MAX_REL_ERROR && rx_err <= MAX_REL_ERROR)) {
+    ERROR("Narrowband OFDM differs from the full transforms by more than %.0e\n", MAX_REL_ERROR);
+    goto clean_exit;
+  }
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_sf; i++) {
+    srslte_ofdm_tx_sf(&ofdm_tx);
+  }
+  gettimeofday(&t[2], NULL);
+  double full_tx = elapsed_us(t) / nof_sf;
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_sf; i++) {
+    sonica_ofdm_nbiot_tx_sf(&nb_tx);
+  }
+  gettimeofday(&t[2], NULL);
+  double nb_tx_us = elapsed_us(t) / nof_sf;
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_sf; i++) {
+    srslte_vec_cf_copy(sig_rx, sig_nb, sf_len);
+    srslte_ofdm_rx_sf(&ofdm_rx);
+  }
+  gettimeofday(&t[2], NULL);
+  double full_rx = elapsed_us(t) / nof_sf;
+
+  gettimeofday(&t[1], NULL);
+  for (uint32_t i = 0; i < nof_sf; i++) {
+    sonica_ofdm_nbiot_rx_sf(&nb_rx);
+  }
+  gettimeofday(&t[2], NULL);
+  double nb_rx_us = elapsed_us(t) / nof_sf;
+
+  printf("%d subframes, us per subframe:\n", nof_sf);
+  printf("  TX: full=%.2f, narrowband=%.2f (x%.2f)\n", full_tx, nb_tx_us, full_tx / nb_tx_us);
+  printf("  RX: full=%.2f (including the input copy), narrowband=%.2f (x%.2f)\n",
+         full_rx,
+         nb_rx_us,
+         full_rx / nb_rx_us);
+
+  ret = SRSLTE_SUCCESS;
+
+clean_exit:
+  srslte_ofdm_tx_free(&ofdm_tx);
+  srslte_ofdm_rx_free(&ofdm_rx);
+  sonica_ofdm_nbiot_free(&nb_tx);
+  sonica_ofdm_nbiot_free(&nb_rx);
+  free(grid);
+  free(grid_rx);
+  free(grid_nb);
+  free(sig);
+  free(sig_nb);
+  free(sig_rx);
+  return ret;
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/*
+ * Prints a binary trace of the eNB as text, one event per line in time order. The event table is read from the
+ * file, so a trace is decoded by the formats of the build which wrote it.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sonica/common/trace.h"
+
+#define MAX_MSG_LEN 512
+
+typedef struct {
+  uint8_t layer;
+  uint8_t level;
+  char*   name;
+  char*   fmt;
+  bool    fmt_valid;
+} event_info_t;
+
+static char*    input_file = NULL;
+static uint32_t max_level  = SONICA_TRACE_LEVEL_DEBUG;
+static bool     relative   = false;
+
+static const char level_chars[SONICA_TRACE_NOF_LEVELS] = {'-', 'E', 'W', 'I', 'D'};
+
+static void usage(char* prog)
+{
+  printf("Usage: %s [lt] -i file\n", prog);
+  printf("\t-i trace file\n");
+  printf("\t-l highest level printed, 1 (error) to 4 (debug) [Default %d]\n", max_level);
+  printf("\t-t print the time since the start of the trace [Default wall clock]\n");
+}
+
+static void parse_args(int argc, char** argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "ilt")) != -1) {
+    switch (opt) {
+      case 'i':
+        input_file = argv[optind];
+        break;
+      case 'l':
+        max_level = (uint32_t)strtol(argv[optind], NULL, 10);
+        break;
+      case 't':
+        relative = true;
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+  if (input_file == NULL) {
+    usage(argv[0]);
+    exit(-1);
+  }
+}
+
+static char* read_string(FILE* f)
+{
+  uint16_t len = 0;
+  if (fread(&len, sizeof(len), 1, f) != 1) {
+    return NULL;
+  }
+  char* s = calloc(len + 1, 1);
+  if (s != NULL && fread(s, 1, len, f) != len) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+// The formats are taken from the file, only int conversions are let through to snprintf
+static bool check_fmt(const char* fmt)
+{
+  uint32_t nof_args = 0;
+  for (const char* p = fmt; *p; p++) {
+    if (*p != '%') {
+      continue;
+    }
+    p++;
+    if (*p == '%') {
+      continue;
+    }
+    p += strspn(p, "-+ #0");
+    p += strspn(p, "0123456789");
+    if (*p == '.') {
+      p++;
+      p += strspn(p, "0123456789");
+    }
+    if (*p == '\0' || strchr("diuxXc", *p) == NULL || ++nof_args > SONICA_TRACE_NOF_ARGS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compare_records(const void* a, const void* b)
+{
+  const sonica_trace_record_t* ra = (const sonica_trace_record_t*)a;
+  const sonica_trace_record_t* rb = (const sonica_trace_record_t*)b;
+  if (ra->time_ns != rb->time_ns) {
+    return ra->time_ns < rb->time_ns ? -1 : 1;
+  }
+  return (int)ra->thread - (int)rb->thread;
+}
+
+static void print_time(const sonica_trace_file_header_t* h, uint64_t time_ns)
+{
+  if (relative) {
+    uint64_t t = time_ns - h->start_ns;
+    printf("%5lu.%06lu", (unsigned long)(t / 1000000000ULL), (unsigned long)(t % 1000000000ULL / 1000));
+    return;
+  }
+  uint64_t  t    = h->start_real_ns + (time_ns - h->start_ns);
+  time_t    secs = (time_t)(t / 1000000000ULL);
+  struct tm tm;
+  char      buf[16];
+  localtime_r(&secs, &tm);
+  strftime(buf, sizeof(buf), "%H:%M:%S", &tm);
+  printf("%s.%06lu", buf, (unsigned long)(t % 1000000000ULL / 1000));
+}
+
+int main(int argc, char** argv)
+{
+  parse_args(argc, argv);
+
+  FILE* f = fopen(input_file, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Error opening %s\n", input_file);
+    exit(-1);
+  }
+
+  sonica_trace_file_header_t h;
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, SONICA_TRACE_MAGIC, sizeof(h.magic)) != 0) {
+    fprintf(stderr, "%s is not a trace file\n", input_file);
+    exit(-1);
+  }
+  if (h.version != SONICA_TRACE_VERSION || h.record_size != sizeof(sonica_trace_record_t)) {
+    fprintf(stderr, "Unsupported trace version %d with records of %d bytes\n", h.version, h.record_size);
+    exit(-1);
+  }
+
+  char**        layers = calloc(h.nof_layers, sizeof(char*));
+  event_info_t* events = calloc(h.nof_events, sizeof(event_info_t));
+  if (layers == NULL || events == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(-1);
+  }
+  for (uint32_t i = 0; i < h.nof_layers; i++) {
+    if ((layers[i] = read_string(f)) == NULL) {
+      fprintf(stderr, "Truncated layer table\n");
+      exit(-1);
+    }
+  }
+  for (uint32_t i = 0; i < h.nof_events; i++) {
+    event_info_t* e = &events[i];
+    if (fread(&e->layer, 1, 1, f) != 1 || fread(&e->level, 1, 1, f) != 1 || (e->name = read_string(f)) == NULL ||
+        (e->fmt = read_string(f)) == NULL) {
+      fprintf(stderr, "Truncated event table\n");
+      exit(-1);
+    }
+    e->fmt_valid = check_fmt(e->fmt);
+  }
+
+  // The records of each thread are in order, the threads are merged by time
+  size_t                 nof_records = 0;
+  size_t                 capacity    = 1 << 16;
+  sonica_trace_record_t* records     = malloc(capacity * sizeof(sonica_trace_record_t));
+  while (records != NULL) {
+    nof_records += fread(&records[nof_records], sizeof(sonica_trace_record_t), capacity - nof_records, f);
+    if (nof_records < capacity) {
+      break;
+    }
+    capacity *= 2;
+    records = realloc(records, capacity * sizeof(sonica_trace_record_t));
+  }
+  fclose(f);
+  if (records == NULL) {
+    fprintf(stderr, "Error allocating memory\n");
+    exit(-1);
+  }
+  qsort(records, nof_records, sizeof(sonica_trace_record_t), compare_records);
+
+  uint64_t nof_dropped = 0;
+  char     msg[MAX_MSG_LEN];
+  for (size_t i = 0; i < nof_records; i++) {
+    const sonica_trace_record_t* r = &records[i];
+    nof_dropped += r->nof_dropped;
+    if (r->event >= h.nof_events) {
+      fprintf(stderr, "Unknown event %d\n", r->event);
+      continue;
+    }
+    const event_info_t* e = &events[r->event];
+    if (e->level > max_level) {
+      continue;
+    }
+
+    const int32_t* a = r->args;
+    if (e->fmt_valid) {
+      snprintf(msg, sizeof(msg), e->fmt, a[0], a[1], a[2], a[3], a[4]);
+    } else {
+      snprintf(msg, sizeof(msg), "%s %d %d %d %d %d", e->name, a[0], a[1], a[2], a[3], a[4]);
+    }
+
+    print_time(&h, r->time_ns);
+    printf(" [%-6s] [%c] ",
+           e->layer < h.nof_layers ? layers[e->layer] : "",
+           e->level < SONICA_TRACE_NOF_LEVELS ? level_chars[e->level] : '?');
+    if (r->tti != SONICA_TRACE_NO_TTI) {
+      printf("%4d.%d ", r->tti / 10, r->tti % 10);
+    } else {
+      printf("     - ");
+    }
+    if (r->rnti != 0) {
+      printf("rnti=0x%04x ", r->rnti);
+    }
+    printf("%s", msg);
+    if (r->nof_dropped > 0) {
+      printf(" (%d events of thread %d dropped before)", r->nof_dropped, r->thread);
+    }
+    printf("\n");
+  }
+
+  if (nof_dropped > 0) {
+    fprintf(stderr, "%lu events dropped by full rings\n", (unsigned long)nof_dropped);
+  }
+
+  free(records);
+  for (uint32_t i = 0; i < h.nof_events; i++) {
+    free(events[i].name);
+    free(events[i].fmt);
+  }
+  for (uint32_t i = 0; i < h.nof_layers; i++) {
+    free(layers[i]);
+  }
+  free(events);
+  free(layers);
+  exit(0);
+}
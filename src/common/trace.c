@@ -0,0 +1,347 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sonica/common/trace.h"
+
+// Period of the drain thread
+#define DRAIN_PERIOD_NS 1000000
+
+/**
+ * Ring of one thread, which only that thread writes and only the drain thread reads. head and tail count the records
+ * since the ring was created, they are on separate cache lines. A ring left by its thread is taken by the next new
+ * thread once it is drained.
+ */
+typedef struct {
+  _Atomic uint64_t       head;
+  uint8_t                head_pad[56];
+  _Atomic uint64_t       tail;
+  atomic_bool            owned;
+  uint16_t               id;
+  uint32_t               mask;
+  uint32_t               nof_dropped; // by the owner since its last record
+  sonica_trace_record_t* buf;
+} trace_ring_t;
+
+uint8_t sonica_trace_levels[SONICA_TRACE_NOF_LAYERS];
+
+// The decoder reads them as they are
+_Static_assert(sizeof(sonica_trace_record_t) == 40, "trace record layout");
+_Static_assert(sizeof(sonica_trace_file_header_t) == 32, "trace file header layout");
+
+#define EVENT_LAYER(name, layer, level, fmt) SONICA_TRACE_LAYER_##layer,
+#define EVENT_LEVEL(name, layer, level, fmt) SONICA_TRACE_LEVEL_##level,
+#define EVENT_NAME(name, layer, level, fmt) #name,
+#define EVENT_FMT(name, layer, level, fmt) fmt,
+static const uint8_t     event_layers[] = {SONICA_TRACE_EVENTS(EVENT_LAYER)};
+static const uint8_t     event_levels[] = {SONICA_TRACE_EVENTS(EVENT_LEVEL)};
+static const char* const event_names[]  = {SONICA_TRACE_EVENTS(EVENT_NAME)};
+static const char* const event_fmts[]   = {SONICA_TRACE_EVENTS(EVENT_FMT)};
+
+static const char* const layer_names[SONICA_TRACE_NOF_LAYERS] = {"PHY", "NPRACH", "MAC", "SCHED"};
+static const char* const level_names[SONICA_TRACE_NOF_LEVELS] = {"None", "Error", "Warning", "Info", "Debug"};
+
+static struct {
+  pthread_mutex_t  mutex; // taking a ring, start and stop
+  pthread_once_t   key_once;
+  pthread_key_t    key;
+  pthread_t        thread;
+  atomic_bool      running;
+  FILE*            f;
+  uint32_t         ring_size;
+  trace_ring_t*    rings[SONICA_TRACE_MAX_THREADS];
+  _Atomic uint32_t nof_rings;
+  _Atomic uint64_t nof_dropped;
+} trace = {.mutex = PTHREAD_MUTEX_INITIALIZER, .key_once = PTHREAD_ONCE_INIT};
+
+static _Thread_local trace_ring_t* thread_ring    = NULL;
+static _Thread_local bool          thread_no_ring = false;
+
+static uint64_t now_ns(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void release_ring(void* ptr)
+{
+  trace_ring_t* r = (trace_ring_t*)ptr;
+  atomic_store_explicit(&r->owned, false, memory_order_release);
+}
+
+static void create_key(void)
+{
+  pthread_key_create(&trace.key, release_ring);
+}
+
+static trace_ring_t* new_ring(uint16_t id, uint32_t size)
+{
+  uint32_t n = 1;
+  while (n < size) {
+    n <<= 1;
+  }
+  trace_ring_t* r = calloc(1, sizeof(trace_ring_t));
+  if (r == NULL) {
+    return NULL;
+  }
+  r->buf = calloc(n, sizeof(sonica_trace_record_t));
+  if (r->buf == NULL) {
+    free(r);
+    return NULL;
+  }
+  r->id   = id;
+  r->mask = n - 1;
+  return r;
+}
+
+// Slow path of the first event of a thread
+static trace_ring_t* take_ring(void)
+{
+  if (thread_no_ring) {
+    return NULL;
+  }
+  pthread_once(&trace.key_once, create_key);
+  pthread_mutex_lock(&trace.mutex);
+
+  trace_ring_t* r = NULL;
+  uint32_t      n = atomic_load_explicit(&trace.nof_rings, memory_order_relaxed);
+  for (uint32_t i = 0; i < n && r == NULL; i++) {
+    trace_ring_t* c = trace.rings[i];
+    if (!atomic_load_explicit(&c->owned, memory_order_acquire) &&
+        atomic_load_explicit(&c->head, memory_order_relaxed) ==
+            atomic_load_explicit(&c->tail, memory_order_acquire)) {
+      r = c;
+    }
+  }
+  if (r == NULL && n < SONICA_TRACE_MAX_THREADS) {
+    r = new_ring((uint16_t)n, trace.ring_size);
+    if (r != NULL) {
+      trace.rings[n] = r;
+      atomic_store_explicit(&trace.nof_rings, n + 1, memory_order_release);
+    }
+  }
+  if (r != NULL) {
+    atomic_store_explicit(&r->owned, true, memory_order_relaxed);
+    pthread_setspecific(trace.key, r);
+  }
+
+  pthread_mutex_unlock(&trace.mutex);
+
+  thread_ring    = r;
+  thread_no_ring = r == NULL;
+  return r;
+}
+
+void sonica_trace_write(uint32_t event,
+                        uint32_t tti,
+                        uint16_t rnti,
+                        int32_t  a0,
+                        int32_t  a1,
+                        int32_t  a2,
+                        int32_t  a3,
+                        int32_t  a4)
+{
+  if (event >= SONICA_TRACE_NOF_EVENTS || !atomic_load_explicit(&trace.running, memory_order_relaxed)) {
+    return;
+  }
+  trace_ring_t* r = thread_ring ? thread_ring : take_ring();
+  if (r == NULL) {
+    atomic_fetch_add_explicit(&trace.nof_dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) > r->mask) {
+    r->nof_dropped++;
+    atomic_fetch_add_explicit(&trace.nof_dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  sonica_trace_record_t* rec = &r->buf[head & r->mask];
+  rec->time_ns               = now_ns(CLOCK_MONOTONIC);
+  rec->tti                   = tti;
+  rec->event                 = (uint16_t)event;
+  rec->rnti                  = rnti;
+  rec->thread                = r->id;
+  rec->nof_dropped           = r->nof_dropped > UINT16_MAX ? UINT16_MAX : (uint16_t)r->nof_dropped;
+  rec->args[0]               = a0;
+  rec->args[1]               = a1;
+  rec->args[2]               = a2;
+  rec->args[3]               = a3;
+  rec->args[4]               = a4;
+  r->nof_dropped             = 0;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static void write_string(const char* s)
+{
+  uint16_t len = (uint16_t)strlen(s);
+  fwrite(&len, sizeof(len), 1, trace.f);
+  fwrite(s, 1, len, trace.f);
+}
+
+static void write_header(void)
+{
+  sonica_trace_file_header_t h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SONICA_TRACE_MAGIC, sizeof(h.magic));
+  h.version       = SONICA_TRACE_VERSION;
+  h.record_size   = sizeof(sonica_trace_record_t);
+  h.start_real_ns = now_ns(CLOCK_REALTIME);
+  h.start_ns      = now_ns(CLOCK_MONOTONIC);
+  h.nof_layers    = SONICA_TRACE_NOF_LAYERS;
+  h.nof_events    = SONICA_TRACE_NOF_EVENTS;
+  fwrite(&h, sizeof(h), 1, trace.f);
+
+  for (uint32_t i = 0; i < SONICA_TRACE_NOF_LAYERS; i++) {
+    write_string(layer_names[i]);
+  }
+  for (uint32_t i = 0; i < SONICA_TRACE_NOF_EVENTS; i++) {
+    fwrite(&event_layers[i], 1, 1, trace.f);
+    fwrite(&event_levels[i], 1, 1, trace.f);
+    write_string(event_names[i]);
+    write_string(event_fmts[i]);
+  }
+}
+
+// The records of each ring are written in order, the decoder merges the rings by time
+static void drain(void)
+{
+  uint32_t n = atomic_load_explicit(&trace.nof_rings, memory_order_acquire);
+  for (uint32_t i = 0; i < n; i++) {
+    trace_ring_t* r    = trace.rings[i];
+    uint64_t      tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint64_t      head = atomic_load_explicit(&r->head, memory_order_acquire);
+    while (tail != head) {
+      uint32_t idx   = tail & r->mask;
+      uint64_t count = head - tail;
+      if (count > r->mask + 1 - idx) {
+        count = r->mask + 1 - idx;
+      }
+      fwrite(&r->buf[idx], sizeof(sonica_trace_record_t), count, trace.f);
+      tail += count;
+    }
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+  }
+}
+
+static void* drain_thread(void* arg)
+{
+  const struct timespec period = {0, DRAIN_PERIOD_NS};
+  while (atomic_load_explicit(&trace.running, memory_order_acquire)) {
+    drain();
+    nanosleep(&period, NULL);
+  }
+  return NULL;
+}
+
+int sonica_trace_init(const char* filename, uint32_t ring_size)
+{
+  if (filename == NULL || ring_size == 0) {
+    return SONICA_ERROR_INVALID_INPUTS;
+  }
+
+  int ret = SONICA_ERROR;
+  pthread_mutex_lock(&trace.mutex);
+  if (atomic_load_explicit(&trace.running, memory_order_relaxed)) {
+    ret = SONICA_ERROR_ALREADY_STARTED;
+    goto clean_exit;
+  }
+
+  trace.f = fopen(filename, "wb");
+  if (trace.f == NULL) {
+    fprintf(stderr, "Error opening trace file %s\n", filename);
+    goto clean_exit;
+  }
+  write_header();
+
+  // Left over by the threads still writing when the trace was stopped
+  uint32_t n = atomic_load_explicit(&trace.nof_rings, memory_order_relaxed);
+  for (uint32_t i = 0; i < n; i++) {
+    atomic_store_explicit(
+        &trace.rings[i]->tail, atomic_load_explicit(&trace.rings[i]->head, memory_order_acquire), memory_order_release);
+  }
+
+  trace.ring_size = ring_size;
+  atomic_store_explicit(&trace.running, true, memory_order_release);
+  if (pthread_create(&trace.thread, NULL, drain_thread, NULL)) {
+    fprintf(stderr, "Error creating trace thread\n");
+    atomic_store_explicit(&trace.running, false, memory_order_relaxed);
+    fclose(trace.f);
+    trace.f = NULL;
+    goto clean_exit;
+  }
+  ret = SONICA_SUCCESS;
+
+clean_exit:
+  pthread_mutex_unlock(&trace.mutex);
+  return ret;
+}
+
+void sonica_trace_stop(void)
+{
+  pthread_mutex_lock(&trace.mutex);
+  if (atomic_load_explicit(&trace.running, memory_order_relaxed)) {
+    atomic_store_explicit(&trace.running, false, memory_order_release);
+    pthread_join(trace.thread, NULL);
+    drain();
+    fclose(trace.f);
+    trace.f = NULL;
+  }
+  pthread_mutex_unlock(&trace.mutex);
+}
+
+void sonica_trace_set_level(sonica_trace_layer_t layer, sonica_trace_level_t level)
+{
+  if (layer < SONICA_TRACE_NOF_LAYERS && level < SONICA_TRACE_NOF_LEVELS) {
+    __atomic_store_n(&sonica_trace_levels[layer], (uint8_t)level, __ATOMIC_RELAXED);
+  }
+}
+
+sonica_trace_level_t sonica_trace_get_level(sonica_trace_layer_t layer)
+{
+  if (layer >= SONICA_TRACE_NOF_LAYERS) {
+    return SONICA_TRACE_LEVEL_NONE;
+  }
+  return (sonica_trace_level_t)__atomic_load_n(&sonica_trace_levels[layer], __ATOMIC_RELAXED);
+}
+
+const char* sonica_trace_layer_name(sonica_trace_layer_t layer)
+{
+  return layer < SONICA_TRACE_NOF_LAYERS ? layer_names[layer] : "";
+}
+
+const char* sonica_trace_level_name(sonica_trace_level_t level)
+{
+  return level < SONICA_TRACE_NOF_LEVELS ? level_names[level] : "";
+}
+
+uint64_t sonica_trace_nof_dropped(void)
+{
+  return atomic_load_explicit(&trace.nof_dropped, memory_order_relaxed);
+}
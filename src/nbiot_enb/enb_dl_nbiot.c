@@ -30,35 +30,43 @@
 
 #define CURRENT_SFLEN_RE SRSLTE_SF_LEN_RE(SRSLTE_NBIOT_MAX_PRB, SRSLTE_CP_NORM)
 
-int sonica_enb_dl_nbiot_init(sonica_enb_dl_nbiot_t* q, cf_t* out_buffer[SRSLTE_MAX_PORTS])
+static void tmpl_free(sonica_enb_dl_nbiot_t* q);
+
+int sonica_enb_dl_nbiot_init(sonica_enb_dl_nbiot_t* q, cf_t* out_buffer[SRSLTE_MAX_PORTS], uint32_t symbol_sz)
 {
   int ret = SRSLTE_ERROR_INVALID_INPUTS;
 
+  // NPSS/NSSS are only mapped in frequency domain, their objects keep the LTE rate
   uint32_t sf_n_samples = 2 * SRSLTE_SLOT_LEN(srslte_symbol_sz(SRSLTE_NBIOT_MAX_PRB));
 
-  if (q != NULL) {
+  if (q != NULL && symbol_sz >= SONICA_NBIOT_MIN_SYMBOL_SZ && symbol_sz <= SONICA_NBIOT_MAX_SYMBOL_SZ) {
     ret = SRSLTE_ERROR;
 
     bzero(q, sizeof(sonica_enb_dl_nbiot_t));
 
+    q->sf_len = SRSLTE_SF_LEN(symbol_sz);
+
     for (int i = 0; i < SRSLTE_MAX_PORTS; i++) {
       q->sf_symbols[i] = srslte_vec_cf_malloc(SRSLTE_SF_LEN_RE(SRSLTE_NBIOT_MAX_PRB, SRSLTE_CP_NORM));
       if (!q->sf_symbols[i]) {
         perror("malloc");
         goto clean_exit;
       }
+      srslte_vec_cf_zero(q->sf_symbols[i], SRSLTE_SF_LEN_RE(SRSLTE_NBIOT_MAX_PRB, SRSLTE_CP_NORM));
     }
 
     srslte_ofdm_cfg_t ofdm_cfg = {};
     ofdm_cfg.nof_prb           = SRSLTE_NBIOT_MAX_PRB;
+    ofdm_cfg.symbol_sz         = symbol_sz;
     ofdm_cfg.cp                = SRSLTE_CP_NORM;
     ofdm_cfg.normalize         = true;
     ofdm_cfg.freq_shift_f      = -SRSLTE_NBIOT_FREQ_SHIFT_FACTOR;
     for (int i = 0; i < SRSLTE_MAX_PORTS; i++) {
+      q->out_buffer[i]    = out_buffer[i];
       ofdm_cfg.in_buffer  = q->sf_symbols[i];
       ofdm_cfg.out_buffer = out_buffer[i];
       ofdm_cfg.sf_type    = SRSLTE_SF_NORM;
-      if (srslte_ofdm_tx_init_cfg(&q->ifft[i], &ofdm_cfg)) {
+      if (sonica_ofdm_nbiot_tx_init(&q->ifft[i], &ofdm_cfg)) {
         ERROR("Error initiating FFT (%d)\n", i);
         goto clean_exit;
       }
@@ -111,7 +119,7 @@ void sonica_enb_dl_nbiot_free(sonica_enb_dl_nbiot_t* q)
 {
   if (q) {
     for (int i = 0; i < SRSLTE_MAX_PORTS; i++) {
-      srslte_ofdm_tx_free(&q->ifft[i]);
+      sonica_ofdm_nbiot_free(&q->ifft[i]);
     }
     srslte_npbch_free(&q->npbch);
     srslte_npdcch_free(&q->npdcch);
@@ -119,10 +127,130 @@ void sonica_enb_dl_nbiot_free(sonica_enb_dl_nbiot_t* q)
     srslte_chest_dl_nbiot_free(&q->ch_est);
     srslte_npss_synch_free(&q->npss_sync);
     srslte_nsss_synch_free(&q->nsss_sync);
+    tmpl_free(q);
     bzero(q, sizeof(sonica_enb_dl_nbiot_t));
   }
 }
 
+static void clear_sf(sonica_enb_dl_nbiot_t* q, cf_t* sf[SRSLTE_MAX_PORTS])
+{
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    srslte_vec_cf_zero(sf[i], CURRENT_SFLEN_RE);
+  }
+}
+
+static void put_npss(sonica_enb_dl_nbiot_t* q, cf_t* sf[SRSLTE_MAX_PORTS])
+{
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    srslte_npss_put_subframe(&q->npss_sync,
+                             q->npss_signal,
+                             sf[i],
+                             q->cell.base.nof_prb,
+                             q->cell.nbiot_prb);
+  }
+}
+
+static void put_nsss(sonica_enb_dl_nbiot_t* q, cf_t* sf[SRSLTE_MAX_PORTS], uint32_t sfn)
+{
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    srslte_nsss_put_subframe(&q->nsss_sync,
+                             q->nsss_signal,
+                             sf[i],
+                             sfn,
+                             q->cell.base.nof_prb,
+                             q->cell.nbiot_prb);
+  }
+}
+
+static void put_refs(sonica_enb_dl_nbiot_t* q, cf_t* sf[SRSLTE_MAX_PORTS], uint32_t sf_idx)
+{
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    srslte_refsignal_nrs_put_sf(q->cell, i, q->ch_est.nrs_signal.pilots[i][sf_idx], sf[i]);
+  }
+}
+
+static void tmpl_free(sonica_enb_dl_nbiot_t* q)
+{
+  for (int i = 0; i < SRSLTE_MAX_PORTS; i++) {
+    for (int t = 0; t < SONICA_ENB_DL_NBIOT_NOF_TMPL; t++) {
+      if (q->tmpl[t].grid[i]) {
+        free(q->tmpl[t].grid[i]);
+      }
+      if (q->tmpl[t].signal[i]) {
+        free(q->tmpl[t].signal[i]);
+      }
+    }
+    for (int f = 0; f < SRSLTE_NPBCH_NUM_FRAMES; f++) {
+      if (q->npbch_grid[f][i]) {
+        free(q->npbch_grid[f][i]);
+      }
+    }
+  }
+  bzero(q->tmpl, sizeof(q->tmpl));
+  bzero(q->npbch_grid, sizeof(q->npbch_grid));
+  q->cur_tmpl    = NULL;
+  q->npbch_valid = false;
+}
+
+/* Allocates and fills the NRS, NPSS and NSSS templates of the cell. The NPBCH grids are filled per period */
+static int tmpl_init(sonica_enb_dl_nbiot_t* q)
+{
+  tmpl_free(q);
+
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    for (int t = 0; t < SONICA_ENB_DL_NBIOT_NOF_TMPL; t++) {
+      q->tmpl[t].grid[i]   = srslte_vec_cf_malloc(CURRENT_SFLEN_RE);
+      q->tmpl[t].signal[i] = srslte_vec_cf_malloc(q->sf_len);
+      if (!q->tmpl[t].grid[i] || !q->tmpl[t].signal[i]) {
+        perror("malloc");
+        return SRSLTE_ERROR;
+      }
+    }
+    for (int f = 0; f < SRSLTE_NPBCH_NUM_FRAMES; f++) {
+      q->npbch_grid[f][i] = srslte_vec_cf_malloc(CURRENT_SFLEN_RE);
+      if (!q->npbch_grid[f][i]) {
+        perror("malloc");
+        return SRSLTE_ERROR;
+      }
+    }
+  }
+
+  for (uint32_t sf_idx = 0; sf_idx < SRSLTE_NOF_SF_X_FRAME; sf_idx++) {
+    clear_sf(q, q->tmpl[sf_idx].grid);
+    if (sf_idx == 5) {
+      // NPSS at subframe 5
+      put_npss(q, q->tmpl[sf_idx].grid);
+    } else {
+      // NRS in all other subframes (using CSR signal intentionally)
+      put_refs(q, q->tmpl[sf_idx].grid, sf_idx);
+    }
+  }
+  for (uint32_t n = 0; n < SRSLTE_NSSS_NUM_SEQ; n++) {
+    // NSSS in every even numbered frame at subframe 9, the sequence changes every 2 frames
+    clear_sf(q, q->tmpl[SRSLTE_NOF_SF_X_FRAME + n].grid);
+    put_nsss(q, q->tmpl[SRSLTE_NOF_SF_X_FRAME + n].grid, 2 * n);
+  }
+
+  return SRSLTE_SUCCESS;
+}
+
+/* Builds the NPBCH subframes of the MIB-NB period of sfn. Each of them is encoded from the start of the period,
+ * so the result does not depend on which frames this object has seen before */
+static void tmpl_build_npbch(sonica_enb_dl_nbiot_t* q, uint32_t hfn, uint32_t sfn)
+{
+  uint32_t sfn0 = sfn - (sfn % SRSLTE_NPBCH_NUM_FRAMES);
+
+  srslte_npbch_mib_pack(hfn, sfn0, q->mib_nb, q->bch_payload);
+  for (uint32_t f = 0; f < SRSLTE_NPBCH_NUM_FRAMES; f++) {
+    clear_sf(q, q->npbch_grid[f]);
+    srslte_npbch_put_subframe(&q->npbch, q->bch_payload, q->npbch_grid[f], sfn0 + f);
+    put_refs(q, q->npbch_grid[f], 0);
+  }
+
+  q->npbch_period = hfn * (1024 / SRSLTE_NPBCH_NUM_FRAMES) + sfn0 / SRSLTE_NPBCH_NUM_FRAMES;
+  q->npbch_valid  = true;
+}
+
 int sonica_enb_dl_nbiot_set_cell(sonica_enb_dl_nbiot_t* q, srslte_nbiot_cell_t cell)
 {
   int ret = SRSLTE_ERROR_INVALID_INPUTS;
@@ -158,6 +286,11 @@ int sonica_enb_dl_nbiot_set_cell(sonica_enb_dl_nbiot_t* q, srslte_nbiot_cell_t c
       q->mib_nb.sys_info_tag    = 14;
       q->mib_nb.ac_barring      = false;
       q->mib_nb.mode            = q->cell.mode;
+
+      if (tmpl_init(q)) {
+        ERROR("Error building base subframe templates\n");
+        return SRSLTE_ERROR;
+      }
     }
 
     ret = SRSLTE_SUCCESS;
@@ -168,82 +301,43 @@ int sonica_enb_dl_nbiot_set_cell(sonica_enb_dl_nbiot_t* q, srslte_nbiot_cell_t c
   return ret;
 }
 
-static void clear_sf(sonica_enb_dl_nbiot_t* q)
-{
-  for (int i = 0; i < q->cell.nof_ports; i++) {
-    srslte_vec_cf_zero(q->sf_symbols[i], CURRENT_SFLEN_RE);
-  }
-}
-
-static void put_npss(sonica_enb_dl_nbiot_t* q)
-{
-  for (int i = 0; i < q->cell.nof_ports; i++) {
-    srslte_npss_put_subframe(&q->npss_sync,
-                             q->npss_signal,
-                             q->sf_symbols[i],
-                             q->cell.base.nof_prb,
-                             q->cell.nbiot_prb);
-  }
-}
-
-static void put_nsss(sonica_enb_dl_nbiot_t* q, uint32_t sfn)
-{
-  for (int i = 0; i < q->cell.nof_ports; i++) {
-    srslte_nsss_put_subframe(&q->nsss_sync,
-                             q->nsss_signal,
-                             q->sf_symbols[i],
-                             sfn,
-                             q->cell.base.nof_prb,
-                             q->cell.nbiot_prb);
-  }
-}
-
-static void put_refs(sonica_enb_dl_nbiot_t* q, uint32_t sf_idx)
-{
-  for (int i = 0; i < q->cell.nof_ports; i++) {
-    srslte_refsignal_nrs_put_sf(q->cell, i, q->ch_est.nrs_signal.pilots[i][sf_idx], q->sf_symbols[i]);
-  }
-}
-
 void sonica_enb_dl_nbiot_put_base(sonica_enb_dl_nbiot_t* q, uint32_t hfn, uint32_t tti)
 {
   uint32_t sf_idx = tti % 10;
   uint32_t sfn = tti / 10;
 
-  clear_sf(q);
-
-  // Transmit NPBCH in subframe 0
+  // Transmit NPBCH in subframe 0, its signal is only used once per period so it is always modulated
   if (sf_idx == 0) {
-    if ((sfn % SRSLTE_NPBCH_NUM_FRAMES) == 0) {
-      srslte_npbch_mib_pack(hfn, sfn, q->mib_nb, q->bch_payload);
+    uint32_t period = hfn * (1024 / SRSLTE_NPBCH_NUM_FRAMES) + sfn / SRSLTE_NPBCH_NUM_FRAMES;
+    if (!q->npbch_valid || q->npbch_period != period) {
+      tmpl_build_npbch(q, hfn, sfn);
+    }
+    for (int i = 0; i < q->cell.nof_ports; i++) {
+      srslte_vec_cf_copy(q->sf_symbols[i], q->npbch_grid[sfn % SRSLTE_NPBCH_NUM_FRAMES][i], CURRENT_SFLEN_RE);
     }
-    srslte_npbch_put_subframe(&q->npbch, q->bch_payload, q->sf_symbols, sfn);
-    // if (SRSLTE_VERBOSE_ISDEBUG()) {
-    //   printf("MIB payload: ");
-    //   srslte_vec_fprint_hex(stdout, bch_payload, SRSLTE_MIB_NB_LEN);
-    // }
+    q->cur_tmpl = NULL;
+    return;
   }
 
-  if (sf_idx == 5) {
-    // NPSS at subframe 5
-    put_npss(q);
-  } else if ((sfn % 2 == 0) && sf_idx == 9) {
-    // NSSS in every even numbered frame at subframe 9
-    put_nsss(q, sfn);
+  if ((sfn % 2 == 0) && sf_idx == 9) {
+    q->cur_tmpl = &q->tmpl[SRSLTE_NOF_SF_X_FRAME + (sfn / 2) % SRSLTE_NSSS_NUM_SEQ];
   } else {
-    // NRS in all other subframes (using CSR signal intentionally)
-    put_refs(q, sf_idx);
+    q->cur_tmpl = &q->tmpl[sf_idx];
+  }
+  for (int i = 0; i < q->cell.nof_ports; i++) {
+    srslte_vec_cf_copy(q->sf_symbols[i], q->cur_tmpl->grid[i], CURRENT_SFLEN_RE);
   }
 }
 
 int sonica_enb_dl_nbiot_put_npdcch_dl(sonica_enb_dl_nbiot_t*    q,
                                       srslte_ra_nbiot_dl_dci_t* dci_dl,
+                                      srslte_dci_location_t     location,
                                       uint32_t                  sf_idx)
 {
-  srslte_dci_location_t location = { .L = 2, .ncce = 0 };
-  srslte_dci_msg_t      dci_msg;
+  srslte_dci_msg_t dci_msg;
   ZERO_OBJECT(dci_msg);
 
+  q->cur_tmpl = NULL;
   if (srslte_dci_msg_pack_npdsch(dci_dl, SRSLTE_DCI_FORMATN1, &dci_msg, false)) {
     ERROR("Error packing DL DCI\n");
     return SRSLTE_ERROR;
@@ -259,13 +353,13 @@ int sonica_enb_dl_nbiot_put_npdcch_dl(sonica_enb_dl_nbiot_t*    q,
 int sonica_enb_dl_nbiot_put_npdcch_ul(sonica_enb_dl_nbiot_t*    q,
                                       srslte_ra_nbiot_ul_dci_t* dci_ul,
                                       uint16_t                  rnti,
+                                      srslte_dci_location_t     location,
                                       uint32_t                  sf_idx)
 {
-  // TODO: Support 2 UL locations
-  srslte_dci_location_t location = { .L = 2, .ncce = 0 };
-  srslte_dci_msg_t      dci_msg;
+  srslte_dci_msg_t dci_msg;
   ZERO_OBJECT(dci_msg);
 
+  q->cur_tmpl = NULL;
   if (srslte_dci_msg_pack_npusch(dci_ul, &dci_msg)) {
     ERROR("Error packing UL DCI\n");
     return SRSLTE_ERROR;
@@ -283,13 +377,31 @@ int sonica_enb_dl_nbiot_put_npdsch(sonica_enb_dl_nbiot_t* q,
                                    uint8_t*               data,
                                    uint16_t               rnti)
 {
+  q->cur_tmpl = NULL;
   return srslte_npdsch_encode_rnti(&q->npdsch, cfg, NULL, data, rnti, q->sf_symbols);
 }
 
 void sonica_enb_dl_nbiot_gen_signal(sonica_enb_dl_nbiot_t* q)
 {
+  sonica_enb_dl_nbiot_tmpl_t* t = q->cur_tmpl;
+
+  // Nothing but the base signals in this subframe, the signal is the same as the last time
+  if (t != NULL && t->has_signal) {
+    for (int i = 0; i < q->cell.nof_ports; i++) {
+      srslte_vec_cf_copy(q->out_buffer[i], t->signal[i], q->sf_len);
+    }
+    return;
+  }
+
   //printf("T%d\n", q->cell.nof_ports);
   for (int i = 0; i < q->cell.nof_ports; i++) {
-    srslte_ofdm_tx_sf(&q->ifft[i]);
+    sonica_ofdm_nbiot_tx_sf(&q->ifft[i]);
+  }
+
+  if (t != NULL) {
+    for (int i = 0; i < q->cell.nof_ports; i++) {
+      srslte_vec_cf_copy(t->signal[i], q->out_buffer[i], q->sf_len);
+    }
+    t->has_signal = true;
   }
 }
\ No newline at end of file
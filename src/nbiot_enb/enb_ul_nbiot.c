@@ -31,22 +31,22 @@
 #include <math.h>
 #include <string.h>
 
-// TODO: configure them
-#define GROUP_ASSIGNMENT 0
-#define N_RU_SEQ 30
-
 static float smooth_filter[3] = {0.3333, 0.3334, 0.3333};
 
 int sonica_enb_ul_nbiot_init(sonica_enb_ul_nbiot_t* q,
-                             cf_t*                  in_buffer)
+                             cf_t*                  in_buffer,
+                             uint32_t               symbol_sz)
 {
   int ret = SRSLTE_ERROR_INVALID_INPUTS;
 
-  if (q != NULL) {
+  if (q != NULL && symbol_sz >= SONICA_NBIOT_MIN_SYMBOL_SZ && symbol_sz <= SONICA_NBIOT_MAX_SYMBOL_SZ) {
     ret = SRSLTE_ERROR;
 
     bzero(q, sizeof(sonica_enb_ul_nbiot_t));
 
+    q->symbol_sz = symbol_sz;
+    q->sf_len    = SRSLTE_SF_LEN(symbol_sz);
+
     q->nof_re = SRSLTE_SF_LEN_RE(SRSLTE_NBIOT_MAX_PRB, SRSLTE_CP_NORM);
 
     // for transmissions using only single subframe
@@ -64,36 +64,58 @@ int sonica_enb_ul_nbiot_init(sonica_enb_ul_nbiot_t* q,
     }
     srslte_vec_cf_zero(q->ce, q->nof_re);
 
-    // allocate memory for symbols and estimates for tx spanning multiple subframes
-    // TODO: only buffer softbits rather than raw samples
-    q->sf_buffer = srslte_vec_cf_malloc(q->nof_re * SONICA_NPUSCH_MAX_NOF_RU);
-    if (!q->sf_buffer) {
+    // each grant only keeps the soft bits accumulated over its subframes and repetitions
+    for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+      if (sonica_npusch_softbits_init(&q->grants[i].softbits, SONICA_NPUSCH_MAX_BITS)) {
+        perror("malloc");
+        goto clean_exit;
+      }
+    }
+
+    // 3.75 kHz front end
+    q->slot_buffer_3k75 = srslte_vec_cf_malloc(SONICA_ENB_UL_NBIOT_3K75_SLOT_LEN(symbol_sz));
+    if (!q->slot_buffer_3k75) {
+      perror("malloc");
+      goto clean_exit;
+    }
+    srslte_vec_cf_zero(q->slot_buffer_3k75, SONICA_ENB_UL_NBIOT_3K75_SLOT_LEN(symbol_sz));
+
+    q->slot_symbols_3k75 = srslte_vec_cf_malloc(SRSLTE_CP_NORM_NSYMB * SONICA_ENB_UL_NBIOT_3K75_NOF_SC);
+    if (!q->slot_symbols_3k75) {
       perror("malloc");
       goto clean_exit;
     }
-    srslte_vec_cf_zero(q->sf_buffer, q->nof_re * SONICA_NPUSCH_MAX_NOF_RU);
+    srslte_vec_cf_zero(q->slot_symbols_3k75, SRSLTE_CP_NORM_NSYMB * SONICA_ENB_UL_NBIOT_3K75_NOF_SC);
 
-    q->ce_buffer = srslte_vec_cf_malloc(q->nof_re * SONICA_NPUSCH_MAX_NOF_RU);
-    if (!q->ce_buffer) {
+    q->shift_3k75 = srslte_vec_cf_malloc(SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(symbol_sz));
+    if (!q->shift_3k75) {
       perror("malloc");
       goto clean_exit;
     }
-    srslte_vec_cf_zero(q->ce_buffer, q->nof_re * SONICA_NPUSCH_MAX_NOF_RU);
+    for (uint32_t t = 0; t < SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(symbol_sz); t++) {
+      q->shift_3k75[t] = cexpf(I * 2 * M_PI * (float)t * SRSLTE_NBIOT_FREQ_SHIFT_FACTOR /
+                               SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(symbol_sz));
+    }
+
+    if (srslte_dft_plan_c(&q->fft_3k75, SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(symbol_sz), SRSLTE_DFT_FORWARD)) {
+      fprintf(stderr, "Error initiating 3.75 kHz FFT\n");
+      goto clean_exit;
+    }
 
     // initialize memory
     srslte_ofdm_cfg_t ofdm_cfg = {};
     ofdm_cfg.nof_prb           = 1;
+    ofdm_cfg.symbol_sz         = symbol_sz;
     ofdm_cfg.in_buffer         = in_buffer;
     ofdm_cfg.out_buffer        = q->sf_symbols;
     ofdm_cfg.cp                = SRSLTE_CP_NORM;
     ofdm_cfg.freq_shift_f      = SRSLTE_NBIOT_FREQ_SHIFT_FACTOR;
     ofdm_cfg.normalize         = false;
     ofdm_cfg.rx_window_offset  = 0.2f;
-    if (srslte_ofdm_rx_init_cfg(&q->fft, &ofdm_cfg)) {
+    if (sonica_ofdm_nbiot_rx_init(&q->fft, &ofdm_cfg)) {
       fprintf(stderr, "Error initiating FFT\n");
       goto clean_exit;
     }
-    // srslte_ofdm_set_normalize(&q->fft, true);
 
     if (sonica_npusch_init_enb(&q->npusch)) {
       fprintf(stderr, "Error creating PDSCH object\n");
@@ -117,7 +139,7 @@ clean_exit:
 void sonica_enb_ul_nbiot_free(sonica_enb_ul_nbiot_t* q)
 {
   if (q) {
-    srslte_ofdm_rx_free(&q->fft);
+    sonica_ofdm_nbiot_free(&q->fft);
     sonica_npusch_free(&q->npusch);
     srslte_softbuffer_rx_free(&q->softbuffer);
     if (q->sf_symbols) {
@@ -126,11 +148,18 @@ void sonica_enb_ul_nbiot_free(sonica_enb_ul_nbiot_t* q)
     if (q->ce) {
       free(q->ce);
     }
-    if (q->sf_buffer) {
-      free(q->sf_buffer);
+    for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+      sonica_npusch_softbits_free(&q->grants[i].softbits);
+    }
+    srslte_dft_plan_free(&q->fft_3k75);
+    if (q->slot_buffer_3k75) {
+      free(q->slot_buffer_3k75);
+    }
+    if (q->slot_symbols_3k75) {
+      free(q->slot_symbols_3k75);
     }
-    if (q->ce_buffer) {
-      free(q->ce_buffer);
+    if (q->shift_3k75) {
+      free(q->shift_3k75);
     }
     bzero(q, sizeof(sonica_enb_ul_nbiot_t));
   }
@@ -149,8 +178,6 @@ int sonica_enb_ul_nbiot_set_cell(sonica_enb_ul_nbiot_t* q, srslte_nbiot_cell_t c
         fprintf(stderr, "Error creating NPUSCH object\n");
         return SRSLTE_ERROR;
       }
-
-      srslte_sequence_LTE_pr(&q->ref12_seq, 640, q->cell.n_id_ncell / N_RU_SEQ);
     }
     ret = SRSLTE_SUCCESS;
   } else {
@@ -163,21 +190,176 @@ int sonica_enb_ul_nbiot_set_cell(sonica_enb_ul_nbiot_t* q, srslte_nbiot_cell_t c
   return ret;
 }
 
+int sonica_enb_ul_nbiot_set_dmrs_cfg(sonica_enb_ul_nbiot_t* q, const sonica_npusch_dmrs_cfg_t* cfg)
+{
+  if (q == NULL || cfg == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  return sonica_npusch_set_dmrs_cfg(&q->npusch, cfg);
+}
+
+// Number of 3.75 kHz subcarriers spanned by a subcarrier of the grant
+static uint32_t grant_sc_width(srslte_ra_nbiot_ul_grant_t* grant)
+{
+  return (grant->sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) ? 1 : 4;
+}
+
+static bool grants_collide(srslte_ra_nbiot_ul_grant_t* a, srslte_ra_nbiot_ul_grant_t* b)
+{
+  // Subcarrier sets are contiguous, compare them in units of 3.75 kHz
+  uint32_t a_start = a->sc_alloc_set[0] * grant_sc_width(a);
+  uint32_t b_start = b->sc_alloc_set[0] * grant_sc_width(b);
+  uint32_t a_end   = a_start + a->nof_sc * grant_sc_width(a);
+  uint32_t b_end   = b_start + b->nof_sc * grant_sc_width(b);
+  return a_start < b_end && b_start < a_end;
+}
+
 int sonica_enb_ul_nbiot_cfg_grant(sonica_enb_ul_nbiot_t* q,
                                   srslte_ra_nbiot_ul_grant_t* grant,
                                   uint16_t rnti)
 {
+  int idx = SRSLTE_ERROR;
+
+  if (q == NULL || grant == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  // Allocations of TS 36.213 Table 16.5.1.1-1
+  if (grant->nof_sc != 1 && grant->nof_sc != 3 && grant->nof_sc != 6 && grant->nof_sc != SRSLTE_NRE) {
+    ERROR("NPUSCH of %d subcarriers for rnti=0x%x is not supported\n", grant->nof_sc, rnti);
+    return SRSLTE_ERROR;
+  }
+
+  // Only single-tone allocations exist at 3.75 kHz, TS 36.213 Table 16.5.1.1-1
+  if (grant->sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750 && grant->nof_sc != 1) {
+    ERROR("3.75 kHz NPUSCH of %d subcarriers for rnti=0x%x is not supported\n", grant->nof_sc, rnti);
+    return SRSLTE_ERROR;
+  }
+
+  if (grant->sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750 && grant->tx_tti % 2) {
+    ERROR("3.75 kHz NPUSCH for rnti=0x%x does not start at a slot boundary (tti=%d)\n", rnti, grant->tx_tti);
+    return SRSLTE_ERROR;
+  }
+
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_grant_t* g = &q->grants[i];
+    if (g->active) {
+      if (!g->complete && grants_collide(&g->npusch_cfg.grant, grant)) {
+        ERROR("NPUSCH grant for rnti=0x%x collides with active grant for rnti=0x%x\n", rnti, g->npusch_cfg.rnti);
+        return SRSLTE_ERROR;
+      }
+    } else if (idx < 0) {
+      idx = i;
+    }
+  }
+
+  if (idx < 0) {
+    ERROR("No NPUSCH receive context available for rnti=0x%x\n", rnti);
+    return SRSLTE_ERROR;
+  }
+
   // configure NPUSCH object
-  sonica_npusch_cfg(&q->npusch_cfg, grant, rnti);
-  q->has_ul_grant = true;
-  q->noise_estimate = 0.0f;
+  sonica_enb_ul_nbiot_grant_t* g = &q->grants[idx];
+  sonica_npusch_cfg(&g->npusch_cfg, grant, rnti);
+  sonica_npusch_softbits_reset(&g->softbits);
+  g->active         = true;
+  g->complete       = false;
+  g->noise_estimate = 0.0f;
+  g->signal_power   = 0.0f;
+  g->nof_meas       = 0;
+  q->nof_grants++;
+
+  return idx;
+}
+
+int sonica_enb_ul_nbiot_copy_grant(sonica_enb_ul_nbiot_t* q, sonica_enb_ul_nbiot_t* src, uint32_t idx, uint32_t num_sf)
+{
+  if (q == NULL || src == NULL || idx >= SONICA_ENB_UL_NBIOT_MAX_GRANTS || !src->grants[idx].active) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  sonica_enb_ul_nbiot_grant_t* s        = &src->grants[idx];
+  sonica_enb_ul_nbiot_grant_t* g        = &q->grants[idx];
+  uint32_t                     nof_sf   = sonica_npusch_nof_sf(&s->npusch_cfg);
+  uint32_t                     nof_bits = s->npusch_cfg.nbits.nof_bits;
+  if (num_sf >= nof_sf || nof_bits > g->softbits.max_bits) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  g->npusch_cfg = s->npusch_cfg;
+  sonica_npusch_cfg_seek(&g->npusch_cfg, num_sf);
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    srslte_vec_i16_zero(g->softbits.llr[i], nof_bits);
+    g->softbits.nof_comb[i] = 0;
+  }
+  if (!g->active) {
+    q->nof_grants++;
+  }
+  g->active         = true;
+  g->complete       = false;
+  g->noise_estimate = 0.0f;
+  g->signal_power   = 0.0f;
+  g->nof_meas       = 0;
+
+  // No other subframe is taken from src, the grant only waits for its soft bits
+  if (num_sf + 1 == nof_sf) {
+    s->complete = true;
+  }
+
+  return SRSLTE_SUCCESS;
+}
+
+int sonica_enb_ul_nbiot_merge_grant(sonica_enb_ul_nbiot_t* q, const sonica_enb_ul_nbiot_t* src, uint32_t idx)
+{
+  if (q == NULL || src == NULL || idx >= SONICA_ENB_UL_NBIOT_MAX_GRANTS) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  sonica_enb_ul_nbiot_grant_t*       g = &q->grants[idx];
+  const sonica_enb_ul_nbiot_grant_t* s = &src->grants[idx];
+  if (!g->active || g->npusch_cfg.rnti != s->npusch_cfg.rnti ||
+      g->npusch_cfg.grant.tx_tti != s->npusch_cfg.grant.tx_tti) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  if (!s->active) {
+    return SRSLTE_ERROR;
+  }
+
+  if (sonica_npusch_softbits_add(&g->softbits, &s->softbits, g->npusch_cfg.nbits.nof_bits)) {
+    return SRSLTE_ERROR;
+  }
+  uint32_t nof_meas = g->nof_meas + s->nof_meas;
+  if (nof_meas > 0) {
+    g->noise_estimate = (g->noise_estimate * g->nof_meas + s->noise_estimate * s->nof_meas) / nof_meas;
+    g->signal_power   = (g->signal_power * g->nof_meas + s->signal_power * s->nof_meas) / nof_meas;
+    g->nof_meas       = nof_meas;
+  }
+  g->npusch_cfg = s->npusch_cfg;
+
+  return s->complete ? 1 : 0;
+}
 
+int sonica_enb_ul_nbiot_set_slot_start(sonica_enb_ul_nbiot_t* q, const cf_t* input)
+{
+  if (q == NULL || input == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  srslte_vec_cf_copy(q->slot_buffer_3k75, input, q->sf_len);
   return SRSLTE_SUCCESS;
 }
 
+void sonica_enb_ul_nbiot_release_grant(sonica_enb_ul_nbiot_t* q, uint32_t idx)
+{
+  if (q != NULL && idx < SONICA_ENB_UL_NBIOT_MAX_GRANTS && q->grants[idx].active) {
+    q->grants[idx].active   = false;
+    q->grants[idx].complete = false;
+    q->nof_grants--;
+  }
+}
+
 // TODO: Put these into a separate chest module
 /* Uses the difference between the averaged and non-averaged pilot estimates */
-static float estimate_noise_pilots(cf_t* noisy, cf_t* noiseless)
+static float estimate_noise_pilots(cf_t* noisy, cf_t* noiseless, uint32_t nof_pilots)
 {
   cf_t tmp_noise[SRSLTE_NRE] = {};
   float power = 0;
@@ -186,7 +368,7 @@ static float estimate_noise_pilots(cf_t* noisy, cf_t* noiseless)
       noisy,
       noiseless,
       tmp_noise,
-      SRSLTE_NRE);
+      nof_pilots);
 
   if (true) {
     // Calibrated for filter length 3
@@ -199,8 +381,7 @@ static float estimate_noise_pilots(cf_t* noisy, cf_t* noiseless)
 }
 
 // The interpolator currently only supports same frequency allocation for each subframe
-#define cesymb(i) ce[SRSLTE_RE_IDX(1, i, 0)]
-static void interpolate_pilots(cf_t* ce, uint32_t nrefs)
+static void interpolate_pilots(cf_t* ce, uint32_t first_sc, uint32_t nrefs)
 {
   // Instead of a linear interpolation, we just copy the estimates to all symbols in that subframe
   for (int s = 0; s < 2; s++) {
@@ -210,117 +391,336 @@ static void interpolate_pilots(cf_t* ce, uint32_t nrefs)
 
       // skip the symbol with the estimates
       if (dst_symb != src_symb) {
-        memcpy(&ce[dst_symb * SRSLTE_NRE],
-               &ce[src_symb * SRSLTE_NRE],
+        memcpy(&ce[dst_symb * SRSLTE_NRE + first_sc],
+               &ce[src_symb * SRSLTE_NRE + first_sc],
                nrefs * sizeof(cf_t));
       }
     }
   }
 }
 
-int sonica_enb_ul_nbiot_decode_fft_estimate(sonica_enb_ul_nbiot_t* q, uint32_t sf_idx)
+/* Estimates the channel of a multi-tone grant on the DMRS of its own subcarriers, returns the noise estimate */
+static float estimate_grant(sonica_enb_ul_nbiot_t* q, srslte_ra_nbiot_ul_grant_t* grant, uint32_t sf_idx)
 {
-  float noise_avg = 0;
-  uint32_t ns = sf_idx * 2;
-
-  srslte_ofdm_rx_sf(&q->fft);
+  float    noise_avg = 0;
+  uint32_t ns        = sf_idx * 2;
+  uint32_t k0        = grant->sc_alloc_set[0];
+  uint32_t nof_sc    = grant->nof_sc;
 
-  for (int slot = ns; slot < ns + 2; slot++) {
-    uint32_t fgh = 0;
-    for (int i = 0; i < 8; i++) {
-      fgh += q->ref12_seq.c[slot * 8 + i] << i;
-    }
-    // TODO: configure group hopping
-    uint32_t fss = q->cell.n_id_ncell + GROUP_ASSIGNMENT; // + Hopping Group ID
-    uint32_t u = (fgh + fss) % N_RU_SEQ;
-    INFO("Slot %d: fgh=%d, fss=%d, u = %d\n", slot, fgh, fss, u);
+  for (uint32_t slot = ns; slot < ns + 2; slot++) {
+    uint32_t idx = ((slot - ns) * 7 + 3) * SRSLTE_NRE + k0;
 
-    float tmp_arg[SRSLTE_NRE];
     cf_t r_uv[SRSLTE_NRE];
-    srslte_refsignal_r_uv_arg_1prb(tmp_arg, u);
-    for (int i = 0; i < SRSLTE_NRE; i++) {
-      r_uv[i] = cexpf(I * tmp_arg[i]);
-    }
-
     cf_t estimate[SRSLTE_NRE];
     cf_t estimate_avg[SRSLTE_NRE];
-    srslte_vec_prod_conj_ccc(&q->sf_symbols[((slot - ns) * 7 + 3) * SRSLTE_NRE], r_uv, estimate, SRSLTE_NRE);
+    sonica_npusch_dmrs_multitone(&q->npusch, nof_sc, slot, r_uv);
+    srslte_vec_prod_conj_ccc(&q->sf_symbols[idx], r_uv, estimate, nof_sc);
+
+    srslte_chest_average_pilots(estimate, estimate_avg, smooth_filter, nof_sc, 1, 3);
 
-    srslte_chest_average_pilots(
-        estimate,
-        estimate_avg,
-        smooth_filter,
-        SRSLTE_NRE,
-        1,
-        3);
+    srslte_vec_cf_copy(&q->ce[idx], estimate_avg, nof_sc);
 
-    srslte_vec_cf_copy(&q->ce[((slot - ns) * 7 + 3) * SRSLTE_NRE], estimate_avg, SRSLTE_NRE);
+    noise_avg += estimate_noise_pilots(estimate, estimate_avg, nof_sc);
+  }
 
-    // for (int i = 0; i < SRSLTE_NRE; i++) {
-    //   printf("%f => %f + %fj // %f + %fj\n",
-    //          tmp_arg[i],
-    //          __real__ estimate[i], __imag__ estimate[i],
-    //          __real__ estimate_avg[i], __imag__ estimate_avg[i]);
-    // }
+  interpolate_pilots(q->ce, k0, nof_sc);
 
-    float noise_pwr = estimate_noise_pilots(estimate, estimate_avg);
-    // float snr = srslte_vec_avg_power_cf(&q->sf_symbols[((slot - ns) * 7 + 3) * SRSLTE_NRE], SRSLTE_NRE) / noise_pwr;
-    
-    // printf("Noise pwr = %f, snr = %f\n\n", noise_pwr, snr);
+  return noise_avg / 2;
+}
 
-    noise_avg += noise_pwr;
+/*
+ * Noise of the current subframe measured on the subcarriers no active grant occupies. Single-tone grants carry a
+ * single DMRS per slot, too few to tell the noise from the channel. Returns a negative value if every subcarrier is
+ * allocated.
+ */
+static float estimate_noise_unallocated(sonica_enb_ul_nbiot_t* q)
+{
+  bool used[SRSLTE_NRE] = {};
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    srslte_ra_nbiot_ul_grant_t* grant = &q->grants[i].npusch_cfg.grant;
+    if (q->grants[i].active && !q->grants[i].complete) {
+      // In units of 3.75 kHz, a 3.75 kHz tone falls into one 15 kHz subcarrier
+      uint32_t start = grant->sc_alloc_set[0] * grant_sc_width(grant);
+      uint32_t end   = start + grant->nof_sc * grant_sc_width(grant);
+      for (uint32_t k = start / 4; k < (end + 3) / 4 && k < SRSLTE_NRE; k++) {
+        used[k] = true;
+      }
+    }
   }
 
-  interpolate_pilots(q->ce, SRSLTE_NRE);
+  float    noise    = 0;
+  uint32_t nof_free = 0;
+  for (uint32_t k = 0; k < SRSLTE_NRE; k++) {
+    if (!used[k]) {
+      for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB * SRSLTE_NOF_SLOTS_PER_SF; l++) {
+        cf_t v = q->sf_symbols[l * SRSLTE_NRE + k];
+        noise += crealf(v) * crealf(v) + cimagf(v) * cimagf(v);
+      }
+      nof_free++;
+    }
+  }
+  return nof_free > 0 ? noise / (nof_free * SRSLTE_CP_NORM_NSYMB * SRSLTE_NOF_SLOTS_PER_SF) : -1.0f;
+}
 
-  q->noise_estimate += noise_avg;
+/* Demodulates the 7 symbols of the buffered 3.75 kHz slot and estimates the noise on the unallocated subcarriers */
+static void fft_3k75(sonica_enb_ul_nbiot_t* q)
+{
+  cf_t     tmp[SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(SONICA_NBIOT_MAX_SYMBOL_SZ)];
+  cf_t*    input     = q->slot_buffer_3k75;
+  cf_t*    output    = q->slot_symbols_3k75;
+  uint32_t half      = SONICA_ENB_UL_NBIOT_3K75_NOF_SC / 2;
+  uint32_t symbol_sz = SONICA_ENB_UL_NBIOT_3K75_SYMBOL_SZ(q->symbol_sz);
+
+  for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+    input += SONICA_ENB_UL_NBIOT_3K75_CP_LEN(q->symbol_sz);
+    srslte_vec_prod_ccc(input, q->shift_3k75, tmp, symbol_sz);
+    srslte_dft_run_c(&q->fft_3k75, tmp, tmp);
+
+    // FFT shift, the lower half of the subcarriers sits at the end of the spectrum
+    memcpy(output, &tmp[symbol_sz - half], half * sizeof(cf_t));
+    memcpy(&output[half], tmp, half * sizeof(cf_t));
+
+    input += symbol_sz;
+    output += SONICA_ENB_UL_NBIOT_3K75_NOF_SC;
+  }
 
-  return SRSLTE_SUCCESS;
+  // Single-tone grants carry a single DMRS per slot, so the noise is measured where nothing is allocated
+  bool used[SONICA_ENB_UL_NBIOT_3K75_NOF_SC] = {};
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    srslte_ra_nbiot_ul_grant_t* grant = &q->grants[i].npusch_cfg.grant;
+    if (q->grants[i].active && !q->grants[i].complete) {
+      uint32_t start = grant->sc_alloc_set[0] * grant_sc_width(grant);
+      uint32_t end   = start + grant->nof_sc * grant_sc_width(grant);
+      for (uint32_t k = start; k < end && k < SONICA_ENB_UL_NBIOT_3K75_NOF_SC; k++) {
+        used[k] = true;
+      }
+    }
+  }
+
+  float    noise    = 0;
+  uint32_t nof_free = 0;
+  for (uint32_t k = 0; k < SONICA_ENB_UL_NBIOT_3K75_NOF_SC; k++) {
+    if (!used[k]) {
+      for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+        cf_t v = q->slot_symbols_3k75[l * SONICA_ENB_UL_NBIOT_3K75_NOF_SC + k];
+        noise += crealf(v) * crealf(v) + cimagf(v) * cimagf(v);
+      }
+      nof_free++;
+    }
+  }
+  if (nof_free > 0) {
+    q->noise_estimate_3k75 = noise / (nof_free * SRSLTE_CP_NORM_NSYMB);
+  }
 }
 
-int sonica_enb_ul_nbiot_decode_npusch(sonica_enb_ul_nbiot_t* q,
-                                      cf_t*                  input,
-                                      uint32_t               sf_idx,
-                                      uint8_t*               data)
+/* Received power per RE on the subcarriers of the grant, without the noise */
+static float grant_signal_power(sonica_enb_ul_nbiot_t* q, sonica_enb_ul_nbiot_grant_t* g, float noise)
 {
-  int ret = SRSLTE_ERROR_INVALID_INPUTS;
+  srslte_ra_nbiot_ul_grant_t* grant  = &g->npusch_cfg.grant;
+  float                       power  = 0;
+  uint32_t                    nof_re = 0;
+
+  if (grant->sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+    // Every symbol of the slot carries the tone
+    for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+      cf_t v = q->slot_symbols_3k75[l * SONICA_ENB_UL_NBIOT_3K75_NOF_SC + grant->sc_alloc_set[0]];
+      power += crealf(v) * crealf(v) + cimagf(v) * cimagf(v);
+    }
+    power = power / SRSLTE_CP_NORM_NSYMB - noise;
+    return power > 0 ? power : 0;
+  }
+
+  if (grant->nof_sc == 1) {
+    // No channel estimate, every symbol of the subframe carries the tone
+    for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB * SRSLTE_NOF_SLOTS_PER_SF; l++) {
+      cf_t v = q->sf_symbols[l * SRSLTE_NRE + grant->sc_alloc_set[0]];
+      power += crealf(v) * crealf(v) + cimagf(v) * cimagf(v);
+    }
+    power = power / (SRSLTE_CP_NORM_NSYMB * SRSLTE_NOF_SLOTS_PER_SF) - noise;
+    return power > 0 ? power : 0;
+  }
 
-  if (q->has_ul_grant == false) {
+  // The channel estimate of the DMRS symbols is smoothed over the pilots, which leaves out most of the noise
+  for (uint32_t s = 0; s < 2; s++) {
+    for (uint32_t k = grant->sc_alloc_set[0]; k < grant->sc_alloc_set[0] + grant->nof_sc && k < SRSLTE_NRE; k++) {
+      cf_t v = q->ce[(s * 7 + 3) * SRSLTE_NRE + k];
+      power += crealf(v) * crealf(v) + cimagf(v) * cimagf(v);
+      nof_re++;
+    }
+  }
+  return nof_re > 0 ? power / nof_re : 0;
+}
+
+int sonica_enb_ul_nbiot_receive_npusch(sonica_enb_ul_nbiot_t* q,
+                                       const cf_t*            input,
+                                       uint32_t               sf_idx)
+{
+  int   nof_complete = 0;
+  bool  has_15k      = false;
+  bool  has_3k75     = false;
+  float noise[SONICA_ENB_UL_NBIOT_MAX_GRANTS];
+
+  if (q == NULL || input == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (q->nof_grants == 0) {
     DEBUG("Skipping NPUSCH processing due to lack of grant.\n");
     return SRSLTE_ERROR_INVALID_INPUTS;
   }
 
-  if ((sonica_enb_ul_nbiot_decode_fft_estimate(q, sf_idx)) < 0) {
-    return ret;
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_grant_t* g = &q->grants[i];
+    if (g->active && !g->complete) {
+      if (g->npusch_cfg.grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+        has_3k75 = true;
+      } else {
+        has_15k = true;
+      }
+    }
   }
 
-  uint32_t cfg_sf = q->npusch_cfg.grant.nof_slots / 2;
-  // TODO: support repetition
-  if (q->npusch_cfg.num_sf >= cfg_sf) {
-    ERROR("We don't handle repetition now\n");
-    return SRSLTE_ERROR_INVALID_INPUTS;
+  // Keep the raw samples of the first subframe for the 3.75 kHz slot
+  if (has_3k75) {
+    srslte_vec_cf_copy(&q->slot_buffer_3k75[(sf_idx % 2) * q->sf_len], input, q->sf_len);
   }
 
-  srslte_vec_cf_copy(&q->sf_buffer[q->npusch_cfg.sf_idx * q->nof_re], q->sf_symbols, q->nof_re);
-  srslte_vec_cf_copy(&q->ce_buffer[q->npusch_cfg.sf_idx * q->nof_re], q->ce, q->nof_re);
+  // A single FFT for all 15 kHz grants, each one is then estimated on its own subcarriers
+  if (has_15k) {
+    sonica_ofdm_nbiot_rx_sf_ng(&q->fft, input, q->sf_symbols);
+
+    float    noise_multitone = 0;
+    uint32_t nof_multitone   = 0;
+    for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+      sonica_enb_ul_nbiot_grant_t* g = &q->grants[i];
+      if (g->active && !g->complete && g->npusch_cfg.grant.nof_sc > 1) {
+        noise[i] = estimate_grant(q, &g->npusch_cfg.grant, sf_idx);
+        noise_multitone += noise[i];
+        nof_multitone++;
+      }
+    }
+
+    // Single-tone grants take the noise of the free subcarriers, or of the multi-tone pilots if there are none
+    float noise_free = estimate_noise_unallocated(q);
+    if (noise_free >= 0) {
+      q->noise_estimate = noise_free;
+    } else if (nof_multitone > 0) {
+      q->noise_estimate = noise_multitone / nof_multitone;
+    }
+  }
 
-  q->npusch_cfg.num_sf++;
-  q->npusch_cfg.sf_idx++;
-  if (q->npusch_cfg.num_sf == cfg_sf * q->npusch_cfg.grant.nof_rep) {
-    INFO("Trying to decode NPUSCH with %d RU(s), %d SF.\n", q->npusch_cfg.grant.nof_ru, cfg_sf);
-    srslte_softbuffer_rx_reset(&q->softbuffer);
-    // TODO: make sure noise estimation is correct
-    if (sonica_npusch_decode(&q->npusch, &q->npusch_cfg, &q->softbuffer, q->sf_buffer, q->ce_buffer,
-                             q->noise_estimate / 2.0f, data) != SRSLTE_SUCCESS) {
+  // The 3.75 kHz slot is complete with its second subframe
+  bool has_slot_3k75 = has_3k75 && (sf_idx % 2) == 1;
+  if (has_slot_3k75) {
+    fft_3k75(q);
+  }
+
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    sonica_enb_ul_nbiot_grant_t* g = &q->grants[i];
+    if (!g->active || g->complete) {
+      continue;
+    }
+
+    int ret = SRSLTE_SUCCESS;
+    if (g->npusch_cfg.grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+      if (!has_slot_3k75) {
+        continue;
+      }
+      noise[i] = q->noise_estimate_3k75;
+      ret      = sonica_npusch_demod_slot_st(
+          &q->npusch, &g->npusch_cfg, q->slot_symbols_3k75, SONICA_ENB_UL_NBIOT_3K75_NOF_SC, noise[i], &g->softbits);
+    } else {
+      if (g->npusch_cfg.grant.nof_sc == 1) {
+        noise[i] = q->noise_estimate;
+      }
+      ret = sonica_npusch_demod_sf(&q->npusch, &g->npusch_cfg, q->sf_symbols, q->ce, noise[i], &g->softbits);
+    }
+
+    if (ret != SRSLTE_SUCCESS) {
+      ERROR("Error demodulating NPUSCH for rnti=0x%x\n", g->npusch_cfg.rnti);
+      sonica_enb_ul_nbiot_release_grant(q, i);
+      continue;
+    }
+    g->nof_meas++;
+    g->noise_estimate += (noise[i] - g->noise_estimate) / g->nof_meas;
+    g->signal_power += (grant_signal_power(q, g, noise[i]) - g->signal_power) / g->nof_meas;
+
+    if (g->npusch_cfg.num_sf == sonica_npusch_nof_sf(&g->npusch_cfg)) {
+      g->complete = true;
+      nof_complete++;
+    }
+  }
+
+  return nof_complete;
+}
+
+float sonica_enb_ul_nbiot_grant_snr(sonica_enb_ul_nbiot_t* q, uint32_t idx)
+{
+  if (q == NULL || idx >= SONICA_ENB_UL_NBIOT_MAX_GRANTS || !q->grants[idx].active) {
+    return NAN;
+  }
+  sonica_enb_ul_nbiot_grant_t* g = &q->grants[idx];
+  if (g->noise_estimate <= 0) {
+    return NAN;
+  }
+  // Keep the logarithm finite when nothing was received
+  return srslte_convert_power_to_dB(SRSLTE_MAX(g->signal_power, 1e-6f * g->noise_estimate) / g->noise_estimate);
+}
+
+int sonica_enb_ul_nbiot_decode_grant(sonica_enb_ul_nbiot_t* q, uint32_t idx, uint8_t* data)
+{
+  int ret = SRSLTE_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && idx < SONICA_ENB_UL_NBIOT_MAX_GRANTS && q->grants[idx].complete) {
+    sonica_enb_ul_nbiot_grant_t* g = &q->grants[idx];
+
+    INFO("Trying to decode NPUSCH with %d RU(s), %d SF.\n", g->npusch_cfg.grant.nof_ru, g->npusch_cfg.num_sf);
+    if (sonica_npusch_decode_softbits(&q->npusch, &g->npusch_cfg, &g->softbits, data) != SRSLTE_SUCCESS) {
       INFO("Error decoding NPUSCH.\n");
       ret = SRSLTE_ERROR;
     } else {
       ret = SRSLTE_SUCCESS;
     }
-    q->has_ul_grant = false;
-  } else {
-    ret = SRSLTE_NBIOT_EXPECT_MORE_SF;
+    sonica_enb_ul_nbiot_release_grant(q, idx);
   }
 
   return ret;
 }
+
+int sonica_enb_ul_nbiot_decode_ack(sonica_enb_ul_nbiot_t* q, uint32_t idx, bool* ack)
+{
+  int ret = SRSLTE_ERROR_INVALID_INPUTS;
+
+  if (q != NULL && ack != NULL && idx < SONICA_ENB_UL_NBIOT_MAX_GRANTS && q->grants[idx].complete) {
+    sonica_enb_ul_nbiot_grant_t* g = &q->grants[idx];
+
+    ret = sonica_npusch_decode_ack(&q->npusch, &g->npusch_cfg, &g->softbits, ack);
+    if (ret != SRSLTE_SUCCESS) {
+      INFO("No HARQ-ACK detected for rnti=0x%x.\n", g->npusch_cfg.rnti);
+      ret = SRSLTE_ERROR;
+    }
+    sonica_enb_ul_nbiot_release_grant(q, idx);
+  }
+
+  return ret;
+}
+
+int sonica_enb_ul_nbiot_decode_npusch(sonica_enb_ul_nbiot_t* q,
+                                      const cf_t*            input,
+                                      uint32_t               sf_idx,
+                                      uint8_t*               data)
+{
+  int ret = sonica_enb_ul_nbiot_receive_npusch(q, input, sf_idx);
+
+  if (ret < 0) {
+    return ret;
+  }
+
+  for (uint32_t i = 0; i < SONICA_ENB_UL_NBIOT_MAX_GRANTS; i++) {
+    if (q->grants[i].complete) {
+      return sonica_enb_ul_nbiot_decode_grant(q, i, data);
+    }
+  }
+
+  return SRSLTE_NBIOT_EXPECT_MORE_SF;
+}
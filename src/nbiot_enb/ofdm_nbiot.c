@@ -0,0 +1,302 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+#include "sonica/nbiot_enb/ofdm_nbiot.h"
+
+#include "srslte/phy/utils/debug.h"
+#include "srslte/phy/utils/vector.h"
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * With n = P*m + r (P phases, m < 16) and subcarrier k shifted by f, a sample of the symbol is
+ *
+ *   x[P*m + r] = e^{j2pi f m/16} * sum_k (X_k e^{j2pi (k+f) r/N}) e^{j2pi k m/16}
+ *
+ * so each phase r is a 16-point IDFT of the 12 twiddled subcarriers. The receiver is the transpose
+ * of it, with the DFT window moved window_offset_n samples into the CP.
+ */
+/* Start of the useful part of a symbol in the slot, in samples. Not an integer below 1.92 MHz */
+static float symbol_start(srslte_cp_t cp, uint32_t l, uint32_t symbol_sz)
+{
+  float cp_sum = SRSLTE_CP_ISNORM(cp) ? SRSLTE_CP_NORM_0_LEN + SRSLTE_CP_NORM_LEN * l : SRSLTE_CP_EXT_LEN * (l + 1);
+  return l * symbol_sz + cp_sum * symbol_sz / 2048.0f;
+}
+
+static int ofdm_nbiot_init(sonica_ofdm_nbiot_t* q, srslte_ofdm_cfg_t* cfg, srslte_dft_dir_t dir)
+{
+  if (q == NULL || cfg == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  bzero(q, sizeof(sonica_ofdm_nbiot_t));
+
+  if (cfg->nof_prb != SRSLTE_NBIOT_MAX_PRB) {
+    ERROR("Narrowband OFDM supports %d PRB only, %d given\n", SRSLTE_NBIOT_MAX_PRB, cfg->nof_prb);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (cfg->symbol_sz == 0) {
+    int symbol_sz = srslte_symbol_sz(cfg->nof_prb);
+    if (symbol_sz <= SRSLTE_SUCCESS) {
+      ERROR("Invalid number of PRB %d\n", cfg->nof_prb);
+      return SRSLTE_ERROR;
+    }
+    cfg->symbol_sz = (uint32_t)symbol_sz;
+  }
+  if (cfg->symbol_sz % SONICA_OFDM_NBIOT_DFT_SZ || cfg->symbol_sz > SONICA_NBIOT_MAX_SYMBOL_SZ) {
+    ERROR("Invalid narrowband symbol size %d\n", cfg->symbol_sz);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  q->cfg = *cfg;
+
+  uint32_t symbol_sz = q->cfg.symbol_sz;
+  q->nof_symbols     = SRSLTE_CP_NSYMB(q->cfg.cp);
+  q->nof_phases      = symbol_sz / SONICA_OFDM_NBIOT_DFT_SZ;
+  q->slot_sz         = (uint32_t)SRSLTE_SLOT_LEN(symbol_sz);
+
+  // Without frequency shift the DC carrier is skipped, as srslte_ofdm does
+  float    f  = isnormal(q->cfg.freq_shift_f) ? q->cfg.freq_shift_f : 0.0f;
+  uint32_t dc = isnormal(q->cfg.freq_shift_f) ? 0 : 1;
+
+  if (dir == SRSLTE_DFT_FORWARD && isnormal(q->cfg.rx_window_offset)) {
+    float cp2          = symbol_start(q->cfg.cp, 1, symbol_sz) - symbol_start(q->cfg.cp, 0, symbol_sz) - symbol_sz;
+    float offset       = SRSLTE_MIN(1.0f, SRSLTE_MAX(0.0f, q->cfg.rx_window_offset));
+    q->window_offset_n = (uint32_t)roundf(cp2 * offset);
+  }
+
+  q->twiddle      = srslte_vec_cf_malloc(q->nof_phases * SRSLTE_NRE);
+  q->phase        = srslte_vec_cf_malloc(symbol_sz);
+  q->symbol_phase = srslte_vec_cf_malloc(q->nof_symbols * SRSLTE_NRE);
+  q->tmp_in       = srslte_vec_cf_malloc(q->nof_symbols * symbol_sz);
+  q->tmp_out      = srslte_vec_cf_malloc(q->nof_symbols * symbol_sz);
+  if (!q->twiddle || !q->phase || !q->symbol_phase || !q->tmp_in || !q->tmp_out) {
+    perror("malloc");
+    sonica_ofdm_nbiot_free(q);
+    return SRSLTE_ERROR;
+  }
+  srslte_vec_cf_zero(q->tmp_in, q->nof_symbols * symbol_sz);
+  srslte_vec_cf_zero(q->tmp_out, q->nof_symbols * symbol_sz);
+
+  // Symbols start at the nearest sample, delta is what is left to the exact start
+  uint32_t prev_end = 0;
+  float    delta[SRSLTE_CP_NORM_NSYMB];
+  for (uint32_t l = 0; l < q->nof_symbols; l++) {
+    float    start = symbol_start(q->cfg.cp, l, symbol_sz);
+    uint32_t n     = (uint32_t)roundf(start);
+    q->cp_len[l]   = n - prev_end;
+    delta[l]       = start - n;
+    prev_end       = n + symbol_sz;
+    if (fabsf(delta[l]) > 1e-3f) {
+      q->fractional_cp = true;
+    }
+  }
+  if (prev_end != q->slot_sz) {
+    ERROR("Symbols of %d samples do not fill a slot of %d samples\n", symbol_sz, q->slot_sz);
+    sonica_ofdm_nbiot_free(q);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  // Same level as the LTE symbol size, a reduced rate only drops samples of the same waveform
+  float norm = q->cfg.normalize ? 1.0f / sqrtf(srslte_symbol_sz(q->cfg.nof_prb)) : 1.0f;
+  for (uint32_t j = 0; j < SRSLTE_NRE; j++) {
+    // The lower half of the grid holds the negative subcarriers
+    int k     = (j < SRSLTE_NRE / 2) ? (int)j - SRSLTE_NRE / 2 : (int)(j + dc) - SRSLTE_NRE / 2;
+    q->bin[j] = (uint32_t)((k + SONICA_OFDM_NBIOT_DFT_SZ) % SONICA_OFDM_NBIOT_DFT_SZ);
+
+    for (uint32_t r = 0; r < q->nof_phases; r++) {
+      float arg = (dir == SRSLTE_DFT_BACKWARD) ? (k + f) * r : (k - f) * ((float)q->window_offset_n - r);
+      q->twiddle[r * SRSLTE_NRE + j] = norm * cexpf(I * 2 * M_PI * arg / symbol_sz);
+    }
+    for (uint32_t l = 0; l < q->nof_symbols; l++) {
+      float arg = (dir == SRSLTE_DFT_BACKWARD) ? -(k + f) * delta[l] : (k - f) * delta[l];
+      q->symbol_phase[l * SRSLTE_NRE + j] = cexpf(I * 2 * M_PI * arg / symbol_sz);
+    }
+  }
+  for (uint32_t n = 0; n < symbol_sz; n++) {
+    q->phase[n] = cexpf(I * 2 * M_PI * f * (float)(n / q->nof_phases) / SONICA_OFDM_NBIOT_DFT_SZ);
+  }
+  q->cp_phase = cexpf(-I * 2 * M_PI * f);
+
+  // All the phases of the symbols of a slot at once
+  if (srslte_dft_plan_guru_c(&q->plan,
+                             SONICA_OFDM_NBIOT_DFT_SZ,
+                             dir,
+                             q->tmp_in,
+                             q->tmp_out,
+                             1,
+                             1,
+                             q->nof_symbols * q->nof_phases,
+                             SONICA_OFDM_NBIOT_DFT_SZ,
+                             SONICA_OFDM_NBIOT_DFT_SZ)) {
+    ERROR("Creating narrowband DFT plan\n");
+    sonica_ofdm_nbiot_free(q);
+    return SRSLTE_ERROR;
+  }
+
+  DEBUG("Init narrowband %s symbol_sz=%d, nof_symbols=%d, phases=%d, shift=%.2f, window_offset=%d\n",
+        dir == SRSLTE_DFT_FORWARD ? "FFT" : "iFFT",
+        symbol_sz,
+        q->nof_symbols,
+        q->nof_phases,
+        f,
+        q->window_offset_n);
+
+  return SRSLTE_SUCCESS;
+}
+
+int sonica_ofdm_nbiot_tx_init(sonica_ofdm_nbiot_t* q, srslte_ofdm_cfg_t* cfg)
+{
+  return ofdm_nbiot_init(q, cfg, SRSLTE_DFT_BACKWARD);
+}
+
+int sonica_ofdm_nbiot_rx_init(sonica_ofdm_nbiot_t* q, srslte_ofdm_cfg_t* cfg)
+{
+  return ofdm_nbiot_init(q, cfg, SRSLTE_DFT_FORWARD);
+}
+
+void sonica_ofdm_nbiot_free(sonica_ofdm_nbiot_t* q)
+{
+  if (q) {
+    if (q->plan.init_size) {
+      srslte_dft_plan_free(&q->plan);
+    }
+    if (q->twiddle) {
+      free(q->twiddle);
+    }
+    if (q->phase) {
+      free(q->phase);
+    }
+    if (q->symbol_phase) {
+      free(q->symbol_phase);
+    }
+    if (q->tmp_in) {
+      free(q->tmp_in);
+    }
+    if (q->tmp_out) {
+      free(q->tmp_out);
+    }
+    bzero(q, sizeof(sonica_ofdm_nbiot_t));
+  }
+}
+
+static void ofdm_nbiot_tx_slot(sonica_ofdm_nbiot_t* q, uint32_t slot_in_sf)
+{
+  uint32_t symbol_sz = q->cfg.symbol_sz;
+  uint32_t P         = q->nof_phases;
+  cf_t*    input     = q->cfg.in_buffer + slot_in_sf * q->nof_symbols * SRSLTE_NRE;
+  cf_t*    output    = q->cfg.out_buffer + slot_in_sf * q->slot_sz;
+
+  for (uint32_t l = 0; l < q->nof_symbols; l++) {
+    cf_t sc[SRSLTE_NRE];
+    if (q->fractional_cp) {
+      srslte_vec_prod_ccc(input, &q->symbol_phase[l * SRSLTE_NRE], sc, SRSLTE_NRE);
+    } else {
+      srslte_vec_cf_copy(sc, input, SRSLTE_NRE);
+    }
+    for (uint32_t r = 0; r < P; r++) {
+      cf_t* tw  = &q->twiddle[r * SRSLTE_NRE];
+      cf_t* buf = &q->tmp_in[(l * P + r) * SONICA_OFDM_NBIOT_DFT_SZ];
+      for (uint32_t j = 0; j < SRSLTE_NRE; j++) {
+        buf[q->bin[j]] = sc[j] * tw[j];
+      }
+    }
+    input += SRSLTE_NRE;
+  }
+
+  srslte_dft_run_guru_c(&q->plan);
+
+  for (uint32_t l = 0; l < q->nof_symbols; l++) {
+    uint32_t cp_len = q->cp_len[l];
+    cf_t*    x      = &output[cp_len];
+
+    for (uint32_t r = 0; r < P; r++) {
+      cf_t* buf = &q->tmp_out[(l * P + r) * SONICA_OFDM_NBIOT_DFT_SZ];
+      for (uint32_t m = 0; m < SONICA_OFDM_NBIOT_DFT_SZ; m++) {
+        x[m * P + r] = buf[m] * q->phase[m * P + r];
+      }
+    }
+
+    /* add CP */
+    srslte_vec_sc_prod_ccc(&x[symbol_sz - cp_len], q->cp_phase, output, cp_len);
+    output += symbol_sz + cp_len;
+  }
+}
+
+static void
+ofdm_nbiot_rx_slot(sonica_ofdm_nbiot_t* q, const cf_t* in_buffer, cf_t* out_buffer, uint32_t slot_in_sf)
+{
+  uint32_t symbol_sz = q->cfg.symbol_sz;
+  uint32_t P         = q->nof_phases;
+  const cf_t* input  = in_buffer + slot_in_sf * q->slot_sz;
+  cf_t*       output = out_buffer + slot_in_sf * q->nof_symbols * SRSLTE_NRE;
+
+  for (uint32_t l = 0; l < q->nof_symbols; l++) {
+    input += q->cp_len[l];
+    const cf_t* x = input - q->window_offset_n;
+
+    for (uint32_t r = 0; r < P; r++) {
+      cf_t* buf = &q->tmp_in[(l * P + r) * SONICA_OFDM_NBIOT_DFT_SZ];
+      for (uint32_t m = 0; m < SONICA_OFDM_NBIOT_DFT_SZ; m++) {
+        buf[m] = x[m * P + r] * q->phase[m * P + r];
+      }
+    }
+    input += symbol_sz;
+  }
+
+  srslte_dft_run_guru_c(&q->plan);
+
+  for (uint32_t l = 0; l < q->nof_symbols; l++) {
+    for (uint32_t j = 0; j < SRSLTE_NRE; j++) {
+      cf_t acc = 0;
+      for (uint32_t r = 0; r < P; r++) {
+        acc += q->tmp_out[(l * P + r) * SONICA_OFDM_NBIOT_DFT_SZ + q->bin[j]] * q->twiddle[r * SRSLTE_NRE + j];
+      }
+      output[j] = acc;
+    }
+    if (q->fractional_cp) {
+      srslte_vec_prod_ccc(output, &q->symbol_phase[l * SRSLTE_NRE], output, SRSLTE_NRE);
+    }
+    output += SRSLTE_NRE;
+  }
+}
+
+void sonica_ofdm_nbiot_tx_sf(sonica_ofdm_nbiot_t* q)
+{
+  for (uint32_t n = 0; n < SRSLTE_NOF_SLOTS_PER_SF; n++) {
+    ofdm_nbiot_tx_slot(q, n);
+  }
+}
+
+void sonica_ofdm_nbiot_rx_sf(sonica_ofdm_nbiot_t* q)
+{
+  sonica_ofdm_nbiot_rx_sf_ng(q, q->cfg.in_buffer, q->cfg.out_buffer);
+}
+
+void sonica_ofdm_nbiot_rx_sf_ng(sonica_ofdm_nbiot_t* q, const cf_t* input, cf_t* output)
+{
+  for (uint32_t n = 0; n < SRSLTE_NOF_SLOTS_PER_SF; n++) {
+    ofdm_nbiot_rx_slot(q, input, output, n);
+  }
+}
@@ -19,10 +19,12 @@
  *
  */
 
+#include <float.h>
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "sonica/common/trace.h"
 #include "sonica/nbiot_phch/nprach.h"
 
 #include "srslte/srslte.h"
@@ -32,53 +34,208 @@
 #include "srslte/phy/utils/debug.h"
 #include "srslte/phy/utils/vector.h"
 
-#define FREQ_SHIFT_MAX_LEN SONICA_NPRACH_SAMP_SIZE * 4 * 6
+#define FREQ_SHIFT_MAX_LEN(q) ((q)->samp_size * SONICA_NPRACH_SYM_GROUP_SIZE)
+#define NOF_SYM_GROUPS(q) ((q)->nof_reps * SONICA_NPRACH_SYM_GROUPS)
+#define SYM_GROUP_LEN(q) ((q)->cp_len + SONICA_NPRACH_SYM_GROUP_SIZE * (q)->samp_size)
+#define GAP_LEN(q) ((uint32_t)((q)->srate_hz * SONICA_NPRACH_GAP_MS / 1000))
+
+// Lowest ToA kept when unwrapping the 1 subcarrier hop phase, allows for a small timing error
+#define TOA_MIN_S (-16.7e-6f)
 
 static void generate_freq_shift(sonica_nprach_t *q)
 {
-  float ts = 1.0f / 1.92e6;
-  float fshift = -1.85e3; // TODO: Really?
-  for (uint32_t i = 0; i < FREQ_SHIFT_MAX_LEN; i++) {
+  // Subcarriers sit half a subcarrier off the FFT bins, the shift runs over the whole symbol group
+  float ts     = 1.0f / q->srate_hz;
+  float fshift = -SONICA_NPRACH_SCS_HZ / 2;
+  for (uint32_t i = 0; i < FREQ_SHIFT_MAX_LEN(q); i++) {
     q->freq_shift[i] = cexpf(I * 2 * M_PI * fshift * ts * i);
   }
 }
 
-int sonica_nprach_init(sonica_nprach_t *q)
+static void front_end_free(sonica_nprach_t* q)
+{
+  free(q->fft_in);
+  free(q->fft_out);
+  free(q->freq_shift);
+  free(q->ch_coeff);
+  free(q->ch_buf);
+  free(q->dec_buf);
+  srslte_dft_plan_free(&q->fft);
+
+  q->fft_in     = NULL;
+  q->fft_out    = NULL;
+  q->freq_shift = NULL;
+  q->ch_coeff   = NULL;
+  q->ch_buf     = NULL;
+  q->dec_buf    = NULL;
+}
+
+// Hamming windowed sinc, cut at half the 240 kHz output rate and normalized to unit gain
+static void generate_ch_coeff(sonica_nprach_t* q)
+{
+  int32_t half = (int32_t)(q->ch_len - 1) / 2;
+  float   sum  = 0;
+  for (int32_t k = 0; k < (int32_t)q->ch_len; k++) {
+    float x = (float)(k - half) / q->decim;
+    float h = k == half ? 1.0f : sinf(M_PI * x) / (M_PI * x);
+    h *= 0.54f - 0.46f * cosf(2 * M_PI * k / (q->ch_len - 1));
+    q->ch_coeff[k] = h;
+    sum += h;
+  }
+  for (uint32_t k = 0; k < q->ch_len; k++) {
+    q->ch_coeff[k] /= sum;
+  }
+}
+
+// Sets the detector rate, the symbol size and the buffers from the input rate and the channelizer choice
+static int front_end_init(sonica_nprach_t* q)
+{
+  front_end_free(q);
+
+  q->decim = q->use_channelizer ? q->in_samp_size / SONICA_NPRACH_CH_SYMBOL_SZ : 1;
+  q->decim = SRSLTE_MAX(q->decim, 1);
+  q->samp_size = q->in_samp_size / q->decim;
+  q->srate_hz  = q->in_srate_hz / q->decim;
+  q->ch_len    = q->decim > 1 ? 2 * SONICA_NPRACH_CH_HALF_TAPS * q->decim + 1 : 0;
+  q->cp_len    = q->format == SONICA_NPRACH_FORMAT_0 ? q->samp_size / 4 : q->samp_size;
+
+  if (srslte_dft_plan(&q->fft, q->samp_size, SRSLTE_DFT_FORWARD, SRSLTE_DFT_COMPLEX)) {
+    ERROR("Error creating DFT plan\n");
+    return SRSLTE_ERROR;
+  }
+  srslte_dft_plan_set_mirror(&q->fft, true);
+  srslte_dft_plan_set_dc(&q->fft, false);
+
+  q->fft_in     = srslte_vec_cf_malloc(q->samp_size);
+  q->fft_out    = srslte_vec_cf_malloc(q->samp_size);
+  q->freq_shift = srslte_vec_cf_malloc(FREQ_SHIFT_MAX_LEN(q));
+  if (!q->fft_in || !q->fft_out || !q->freq_shift) {
+    ERROR("Error allocating memory\n");
+    return SRSLTE_ERROR;
+  }
+  generate_freq_shift(q);
+
+  if (q->ch_len) {
+    q->ch_coeff = srslte_vec_f_malloc(q->ch_len);
+    q->ch_buf   = srslte_vec_cf_malloc(q->ch_len + SONICA_NPRACH_CH_BLOCK);
+    q->dec_buf  = srslte_vec_cf_malloc((q->ch_len + SONICA_NPRACH_CH_BLOCK) / q->decim + 1);
+    if (!q->ch_coeff || !q->ch_buf || !q->dec_buf) {
+      ERROR("Error allocating memory\n");
+      return SRSLTE_ERROR;
+    }
+    generate_ch_coeff(q);
+  }
+
+  return SRSLTE_SUCCESS;
+}
+
+int sonica_nprach_init(sonica_nprach_t *q, uint32_t symbol_sz)
 {
   int ret = SRSLTE_ERROR;
 
   if (q != NULL) {
     bzero(q, sizeof(sonica_nprach_t));
 
-    if (srslte_dft_plan(&q->fft, SONICA_NPRACH_SAMP_SIZE, SRSLTE_DFT_FORWARD, SRSLTE_DFT_COMPLEX)) {
-      ERROR("Error creating DFT plan\n");
+    q->in_samp_size = SONICA_NPRACH_SYMBOL_SZ(symbol_sz);
+    q->in_srate_hz  = 15000.0f * symbol_sz;
+    if (q->in_samp_size < SONICA_NPRACH_CH_SYMBOL_SZ || q->in_samp_size % SONICA_NPRACH_CH_SYMBOL_SZ) {
+      ERROR("NPRACH symbol of %d samples cannot hold the 48 subcarriers\n", q->in_samp_size);
       return SRSLTE_ERROR;
     }
-    srslte_dft_plan_set_mirror(&q->fft, true);
-    srslte_dft_plan_set_dc(&q->fft, false);
 
-    q->fft_in  = srslte_vec_cf_malloc(SONICA_NPRACH_SAMP_SIZE);
-    q->fft_out = srslte_vec_cf_malloc(SONICA_NPRACH_SAMP_SIZE);
-    q->freq_shift = srslte_vec_cf_malloc(FREQ_SHIFT_MAX_LEN);
+    // Until configured, search every subcarrier for a single repetition of format 1
+    q->use_channelizer = true;
+    q->format          = SONICA_NPRACH_FORMAT_1;
+    if (front_end_init(q)) {
+      return SRSLTE_ERROR;
+    }
+    sonica_nprach_cfg_t cfg = {SONICA_NPRACH_FORMAT_1, 0, SONICA_NPRACH_MAX_SUBCARRIERS, 1};
+    if (sonica_nprach_set_cfg(q, &cfg)) {
+      return SRSLTE_ERROR;
+    }
+    q->det_threshold = SONICA_NPRACH_DET_THRESHOLD;
 
-    generate_freq_shift(q);
+    ret = SRSLTE_SUCCESS;
+  }
 
-    q->cp_len  = SONICA_NPRACH_SAMP_SIZE; // TODO: Format 266.7us only
+  return ret;
+}
 
-    q->base_subc = 36;
+int sonica_nprach_set_cfg(sonica_nprach_t* q, const sonica_nprach_cfg_t* cfg)
+{
+  if (q == NULL || cfg == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  if (cfg->nof_sc == 0 || cfg->nof_sc % SONICA_NPRACH_SUBCARRIERS ||
+      cfg->sc_offset + cfg->nof_sc > SONICA_NPRACH_MAX_SUBCARRIERS) {
+    ERROR("Invalid NPRACH subcarriers: offset %d, %d subcarriers\n", cfg->sc_offset, cfg->nof_sc);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  if (cfg->nof_reps == 0 || cfg->nof_reps > SONICA_NPRACH_MAX_REPS) {
+    ERROR("Invalid NPRACH repetitions %d\n", cfg->nof_reps);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
 
-    ret = SRSLTE_SUCCESS;
+  // 66.7 us and 266.7 us are 1/4 and 1 NPRACH symbol
+  q->format    = cfg->format;
+  q->cp_len    = cfg->format == SONICA_NPRACH_FORMAT_0 ? q->samp_size / 4 : q->samp_size;
+  q->sc_offset = cfg->sc_offset;
+  q->nof_sc    = cfg->nof_sc;
+  q->nof_reps  = cfg->nof_reps;
+
+  return sonica_nprach_detect_reset(q);
+}
+
+int sonica_nprach_set_channelizer(sonica_nprach_t* q, bool enable)
+{
+  if (q == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
   }
 
-  return ret;
+  q->use_channelizer = enable;
+  if (front_end_init(q)) {
+    return SRSLTE_ERROR;
+  }
+  return sonica_nprach_detect_reset(q);
+}
+
+uint32_t sonica_nprach_occasion_len(const sonica_nprach_t* q)
+{
+  uint32_t nof_gaps = (q->nof_reps - 1) / SONICA_NPRACH_GAP_REPS;
+  uint32_t len      = NOF_SYM_GROUPS(q) * SYM_GROUP_LEN(q) + nof_gaps * GAP_LEN(q);
+  return len * q->decim + q->ch_len / 2;
+}
+
+int sonica_nprach_set_cell(sonica_nprach_t* q, srslte_nbiot_cell_t cell)
+{
+  srslte_sequence_t seq = {};
+
+  if (q == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  // Hop between repetitions, 36.211 10.1.6.1: f(t) = (f(t-1) + (sum c(n) 2^n) mod 11 + 1) mod 12
+  if (srslte_sequence_LTE_pr(&seq, 10 * SONICA_NPRACH_MAX_REPS, cell.n_id_ncell)) {
+    ERROR("Error generating NPRACH hopping sequence\n");
+    return SRSLTE_ERROR;
+  }
+  uint32_t f = 0;
+  for (uint32_t t = 0; t < SONICA_NPRACH_MAX_REPS; t++) {
+    uint32_t sum = 0;
+    for (uint32_t n = 10 * t + 1; n < 10 * t + 10 && n < seq.cur_len; n++) {
+      sum += (uint32_t)seq.c[n] << (n - (10 * t + 1));
+    }
+    f          = (f + sum % (SONICA_NPRACH_SUBCARRIERS - 1) + 1) % SONICA_NPRACH_SUBCARRIERS;
+    q->hop[t] = f;
+  }
+  srslte_sequence_free(&seq);
+
+  return SRSLTE_SUCCESS;
 }
 
 int sonica_nprach_free(sonica_nprach_t* q)
 {
-  free(q->fft_in);
-  free(q->fft_out);
-  free(q->freq_shift);
-  srslte_dft_plan_free(&q->fft);
+  front_end_free(q);
 
   bzero(q, sizeof(sonica_nprach_t));
 
@@ -87,132 +244,257 @@ int sonica_nprach_free(sonica_nprach_t* q)
 
 int sonica_nprach_detect_reset(sonica_nprach_t *q)
 {
+  q->buf_samp = 0;
   q->nxt_sym  = 0;
   q->cur_symg = 0;
+  q->gap_samp = 0;
+  q->consumed = 0;
+  q->noise    = 0;
+
+  // The first output is centered on the first input sample, the filter starts half its length before it
+  if (q->ch_len) {
+    q->ch_buf_len = q->ch_len / 2;
+    q->ch_pos     = 0;
+    srslte_vec_cf_zero(q->ch_buf, q->ch_buf_len);
+  }
+
+  for (uint32_t n = 0; n < SONICA_NPRACH_MAX_SUBCARRIERS; n++) {
+    q->grp[n]        = 0;
+    q->grp_energy[n] = 0;
+    q->cur_sc[n]     = n % SONICA_NPRACH_SUBCARRIERS;
+    q->power[n]      = 0;
+    q->corr_1sc[n]   = 0;
+    q->corr_6sc[n]   = 0;
+  }
 
   return SRSLTE_SUCCESS;
 }
 
-static uint32_t get_subcarrier_sg(uint32_t start_sc, uint32_t sg)
+// Subcarrier of symbol group sg within the 12 subcarrier set, from the one of the previous group
+static uint32_t next_subcarrier(sonica_nprach_t* q, uint32_t start_sc, uint32_t prev_sc, uint32_t sg)
 {
-  uint32_t sc_id;
-  // TODO: extend over 4 sgs
-  switch (sg % 4) {
-  case 0:
-    sc_id = start_sc;
-    break;
-  case 1:
-    sc_id = start_sc ^ 1;
-    break;
-  case 2:
-    sc_id = (start_sc < SONICA_NPRACH_SUBC_HALF ?
-             start_sc + SONICA_NPRACH_SUBC_HALF :
-             start_sc - SONICA_NPRACH_SUBC_HALF) ^ 1;
-    break;
-  case 3:
-    sc_id = start_sc < SONICA_NPRACH_SUBC_HALF ?
-            start_sc + SONICA_NPRACH_SUBC_HALF :
-            start_sc - SONICA_NPRACH_SUBC_HALF;
-    break;
+  switch (sg % SONICA_NPRACH_SYM_GROUPS) {
+    case 0:
+      return (start_sc + q->hop[(sg / SONICA_NPRACH_SYM_GROUPS) % SONICA_NPRACH_MAX_REPS]) % SONICA_NPRACH_SUBCARRIERS;
+    case 2:
+      return prev_sc < SONICA_NPRACH_SUBC_HALF ? prev_sc + SONICA_NPRACH_SUBC_HALF
+                                               : prev_sc - SONICA_NPRACH_SUBC_HALF;
+    default:
+      return prev_sc ^ 1;
   }
+}
+
+// Accumulates one symbol of the current group on the searched subcarriers
+static void process_symbol(sonica_nprach_t* q, uint32_t sym)
+{
+  srslte_vec_prod_ccc(q->fft_in, &q->freq_shift[sym * q->samp_size], q->fft_in, q->samp_size);
+  srslte_dft_run(&q->fft, q->fft_in, q->fft_out);
 
-  return sc_id;
+  const cf_t* y = &q->fft_out[q->samp_size / 2 - SONICA_NPRACH_MAX_SUBCARRIERS / 2 + q->sc_offset];
+  for (uint32_t k = 0; k < q->nof_sc; k++) {
+    q->grp[k] += y[k];
+    q->grp_energy[k] += __real__ y[k] * __real__ y[k] + __imag__ y[k] * __imag__ y[k];
+  }
 }
 
-static void store_detect_buf(cf_t *buf_entry, cf_t *fft_output, uint32_t sg)
+static void process_group(sonica_nprach_t* q)
 {
-  for (uint32_t start_sc = 0; start_sc < SONICA_NPRACH_SUBCARRIERS; start_sc++) {
-    uint32_t sc = get_subcarrier_sg(start_sc, sg);
-    buf_entry[start_sc] = fft_output[sc];
+  uint32_t sg = q->cur_symg;
+
+  // The 5 symbols carry the same value, what spreads around their mean is noise
+  for (uint32_t k = 0; k < q->nof_sc; k++) {
+    float coh = __real__ q->grp[k] * __real__ q->grp[k] + __imag__ q->grp[k] * __imag__ q->grp[k];
+    q->noise += q->grp_energy[k] - coh / SONICA_NPRACH_SYM_GROUP_SIZE;
+  }
+
+  for (uint32_t n = 0; n < q->nof_sc; n++) {
+    uint32_t base = n - n % SONICA_NPRACH_SUBCARRIERS;
+    cf_t     y    = q->grp[base + q->cur_sc[n]];
+    q->power[n] += __real__ y * __real__ y + __imag__ y * __imag__ y;
+
+    // Hops within a repetition are known, each one rotates the phase by 2*pi*hop*scs*toa
+    if (sg % SONICA_NPRACH_SYM_GROUPS) {
+      cf_t y_prev = q->prev_grp[base + q->prev_sc[n]];
+      cf_t z      = q->cur_sc[n] > q->prev_sc[n] ? conjf(y_prev) * y : conjf(y) * y_prev;
+      if (sg % SONICA_NPRACH_SYM_GROUPS == 2) {
+        q->corr_6sc[n] += z;
+      } else {
+        q->corr_1sc[n] += z;
+      }
+    }
+  }
+
+  for (uint32_t n = 0; n < q->nof_sc; n++) {
+    q->prev_grp[n]   = q->grp[n];
+    q->grp[n]        = 0;
+    q->grp_energy[n] = 0;
+    q->prev_sc[n]    = q->cur_sc[n];
+    q->cur_sc[n]     = next_subcarrier(q, n % SONICA_NPRACH_SUBCARRIERS, q->cur_sc[n], sg + 1);
   }
 }
 
-int sonica_nprach_detect(sonica_nprach_t *q,
-                         cf_t*            signal,
-                         uint32_t         sig_len,
-                         uint32_t*        need_samples,
-                         uint32_t*        indices,
-                         uint32_t*        ind_len)
+static float estimate_toa(cf_t corr_1sc, cf_t corr_6sc)
+{
+  // The 1 subcarrier hops are unambiguous over a 3.75 kHz period
+  float period_1sc = 1.0f / SONICA_NPRACH_SCS_HZ;
+  float toa_1sc    = -cargf(corr_1sc) / (2 * M_PI) * period_1sc;
+  if (toa_1sc < TOA_MIN_S) {
+    toa_1sc += period_1sc;
+  }
+
+  // The 6 subcarrier hops are 6 times finer, take the wrap closest to the coarse estimate
+  float period_6sc = period_1sc / SONICA_NPRACH_SUBC_HALF;
+  float toa_6sc    = -cargf(corr_6sc) / (2 * M_PI) * period_6sc;
+  float toa        = toa_6sc + roundf((toa_1sc - toa_6sc) / period_6sc) * period_6sc;
+
+  return SRSLTE_MAX(toa, 0.0f);
+}
+
+// Runs the symbol groups over samples at the detector rate, returns true once the occasion is complete
+static bool detect_symbols(sonica_nprach_t* q, const cf_t* signal, uint32_t sig_len)
 {
-  uint32_t buf_offset = q->buf_samp;
   uint32_t in_offset = 0;
   uint32_t rem_input = sig_len;
-  int result = 0;
-  bool finished = false;
-
-  while (rem_input + buf_offset >= SONICA_NPRACH_SAMP_SIZE) {
-    uint32_t read_amount;
-    if (q->nxt_sym == 0) {
-      // We are still expecting CP, just swallow the samples
-      // CP length is no greater than symbol length, so can we expect reading
-      // a full CP here
-      read_amount = q->cp_len - buf_offset;
-      // printf("%d: Read %d samples as CP\n", q->cur_symg, read_amount);
-    } else {
-      read_amount = SONICA_NPRACH_SAMP_SIZE - buf_offset;
-      srslte_vec_cf_copy(&q->fft_in[buf_offset], &signal[in_offset], read_amount);
+  bool     finished  = false;
 
-      srslte_vec_prod_ccc(q->fft_in, q->freq_shift, q->fft_in, SONICA_NPRACH_SAMP_SIZE);
-      srslte_dft_run(&q->fft, q->fft_in, q->fft_out);
+  while (!finished) {
+    if (q->gap_samp > 0) {
+      uint32_t skip = SRSLTE_MIN(q->gap_samp, rem_input);
+      q->gap_samp -= skip;
+      rem_input -= skip;
+      in_offset += skip;
+      if (q->gap_samp > 0) {
+        break;
+      }
+    }
 
-      uint32_t sym_num = q->cur_symg * SONICA_NPRACH_SYM_GROUP_SIZE + q->nxt_sym - 1;
-      uint32_t subc_offset = (SONICA_NPRACH_SAMP_SIZE - 48) / 2 + q->base_subc;
-      store_detect_buf(q->det_buf[sym_num], &q->fft_out[subc_offset], q->cur_symg);
+    // CP length is no greater than the symbol length, so the buffer holds a partial CP as well
+    uint32_t len = q->nxt_sym == 0 ? q->cp_len : q->samp_size;
+    if (rem_input + q->buf_samp < len) {
+      break;
     }
 
+    uint32_t read_amount = len - q->buf_samp;
+    if (q->nxt_sym > 0) {
+      srslte_vec_cf_copy(&q->fft_in[q->buf_samp], &signal[in_offset], read_amount);
+      process_symbol(q, q->nxt_sym - 1);
+    }
     rem_input -= read_amount;
     in_offset += read_amount;
-    buf_offset = 0;
+    q->buf_samp = 0;
+
     if (q->nxt_sym == SONICA_NPRACH_SYM_GROUP_SIZE) {
+      process_group(q);
       q->nxt_sym = 0;
       q->cur_symg++;
-      if (q->cur_symg == 4) {
-        // TODO: support multiple groups of 4 SG
-        finished = true;
-        break;
+      finished = q->cur_symg == NOF_SYM_GROUPS(q);
+      if (!finished && q->cur_symg % (SONICA_NPRACH_GAP_REPS * SONICA_NPRACH_SYM_GROUPS) == 0) {
+        q->gap_samp = GAP_LEN(q);
       }
     } else {
       q->nxt_sym++;
     }
   }
 
-  if (finished) {
-    for (int sc = 0; sc < 12; sc++) {
-      int count = 0;
-      float avg = 0;
-      for (int i = 0; i < 20; i++) {
-        float absx = cabsf(q->det_buf[i][sc]);
-        if (absx > 5) {
-          count++;
-        }
-        avg += absx;
-      }
-      avg /= 20;
-      if (count > 18) {
-        printf("DET SUBC %d (avg %f)\n", sc, avg);
-        // XXX
-        if (indices != NULL) {
-          *indices = sc + 36;
-        }
-        result = 1;
-      }
+  if (!finished) {
+    if (rem_input > 0 && q->nxt_sym > 0) {
+      srslte_vec_cf_copy(&q->fft_in[q->buf_samp], &signal[in_offset], rem_input);
+    }
+    q->buf_samp += rem_input;
+  }
+
+  return finished;
+}
+
+// Filters and decimates the input block by block, feeding the detector with each block of outputs
+static bool channelize(sonica_nprach_t* q, const cf_t* signal, uint32_t sig_len)
+{
+  bool finished = false;
+
+  for (uint32_t offset = 0; offset < sig_len && !finished;) {
+    uint32_t n = SRSLTE_MIN(SONICA_NPRACH_CH_BLOCK, sig_len - offset);
+    srslte_vec_cf_copy(&q->ch_buf[q->ch_buf_len], &signal[offset], n);
+    q->ch_buf_len += n;
+    offset += n;
 
-      // printf("Subc %d\n", sc);
-      // for (int i = 0; i < 20; i++) {
-      //   printf("\t%2.4f", cabsf(q->det_buf[i][sc]));
-      //   if (i % 5 == 4) {
-      //     printf("\n");
-      //   }
-      // }
+    // Only the outputs kept by the decimation are computed
+    uint32_t nof_out = 0;
+    while (q->ch_pos + q->ch_len <= q->ch_buf_len) {
+      q->dec_buf[nof_out++] = srslte_vec_dot_prod_cfc(&q->ch_buf[q->ch_pos], q->ch_coeff, q->ch_len);
+      q->ch_pos += q->decim;
     }
-    q->buf_samp = 0;
-  } else {
-    if (rem_input > 0) {
-      srslte_vec_cf_copy(q->fft_in, &signal[in_offset], rem_input);
+
+    // Keep the history the next outputs need
+    q->ch_buf_len -= q->ch_pos;
+    memmove(q->ch_buf, &q->ch_buf[q->ch_pos], sizeof(cf_t) * q->ch_buf_len);
+    q->ch_pos = 0;
+
+    finished = detect_symbols(q, q->dec_buf, nof_out);
+  }
+
+  return finished;
+}
+
+int sonica_nprach_detect(sonica_nprach_t *q,
+                         const cf_t*      signal,
+                         uint32_t         sig_len,
+                         uint32_t*        need_samples,
+                         uint32_t*        indices,
+                         float*           t_offsets,
+                         float*           peak_to_avg,
+                         uint32_t*        ind_len)
+{
+  if (q == NULL || (signal == NULL && sig_len > 0)) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+  if (ind_len) {
+    *ind_len = 0;
+  }
+
+  bool finished = q->ch_len ? channelize(q, signal, sig_len) : detect_symbols(q, signal, sig_len);
+  if (!finished) {
+    q->consumed += sig_len;
+    if (need_samples) {
+      uint32_t len  = sonica_nprach_occasion_len(q);
+      *need_samples = len > q->consumed ? len - q->consumed : 0;
     }
-    q->buf_samp = rem_input;
-    // printf("%d.%d: Absorb %d remaining input\n", q->cur_symg, q->nxt_sym - 1, rem_input);
+    return 0;
+  }
+  if (need_samples) {
+    *need_samples = 0;
+  }
+
+  // Noise per symbol and subcarrier, 4 degrees of freedom are left in each group of 5 symbols
+  uint32_t nof_grp = NOF_SYM_GROUPS(q);
+  float    noise   = q->noise / (nof_grp * q->nof_sc * (SONICA_NPRACH_SYM_GROUP_SIZE - 1));
+  noise            = SRSLTE_MAX(noise, FLT_MIN);
+  float threshold  = 1.0f + q->det_threshold / sqrtf(nof_grp);
+
+  uint32_t nof_det = 0;
+  for (uint32_t n = 0; n < q->nof_sc; n++) {
+    float p2avg = q->power[n] / (SONICA_NPRACH_SYM_GROUP_SIZE * noise * nof_grp);
+    if (p2avg > threshold) {
+      if (indices) {
+        indices[nof_det] = q->sc_offset + n;
+      }
+      if (t_offsets) {
+        t_offsets[nof_det] = estimate_toa(q->corr_1sc[n], q->corr_6sc[n]);
+      }
+      if (peak_to_avg) {
+        peak_to_avg[nof_det] = p2avg;
+      }
+      SONICA_TRACE(NPRACH_SUBCARRIER,
+                   SONICA_TRACE_NO_TTI,
+                   0,
+                   q->sc_offset + n,
+                   p2avg * 10,
+                   estimate_toa(q->corr_1sc[n], q->corr_6sc[n]) * 1e9);
+      nof_det++;
+    }
+  }
+  if (ind_len) {
+    *ind_len = nof_det;
   }
 
-  return result;
+  return 1;
 }
@@ -44,6 +44,61 @@
 
 #define CURRENT_SFLEN_RE SRSLTE_SF_LEN_RE(q->cell.base.nof_prb, q->cell.base.cp)
 
+// Length of the group hopping sequences, 8 bits for each of the 20 slots of a radio frame
+#define DMRS_GH_SEQ_LEN (8 * SRSLTE_NOF_SLOTS_PER_SF * SRSLTE_NOF_SF_X_FRAME)
+
+// Base sequences of the 3- and 6-tone DMRS in units of pi/4, TS 36.211 Tables 10.1.4.1.2-1 and 10.1.4.1.2-2
+static const int8_t dmrs_phi_3[12][3] = {{1, -3, -3}, {1, -3, -1}, {1, -3, 3}, {1, -1, -1}, {1, -1, 1}, {1, -1, 3},
+                                         {1, 1, -3},  {1, 1, -1},  {1, 1, 3},  {1, 3, -1},  {1, 3, 1},  {1, 3, 3}};
+
+static const int8_t dmrs_phi_6[14][6] = {{1, 1, 1, 1, 3, -3},
+                                         {1, 1, 3, 1, -3, 3},
+                                         {1, -1, -1, -1, 1, -3},
+                                         {1, -1, 3, -3, -1, -1},
+                                         {1, 3, 1, -1, -1, 3},
+                                         {1, -3, -3, 1, 3, 1},
+                                         {-1, -1, 1, -3, -3, -1},
+                                         {-1, -1, -1, 3, -3, -1},
+                                         {3, -1, 1, -3, -3, 3},
+                                         {3, -1, 3, -3, -1, 1},
+                                         {3, -3, 3, -1, 3, 3},
+                                         {-3, 1, 3, 1, -3, -1},
+                                         {-3, -1, 1, -3, 1, 3},
+                                         {-3, 1, -1, -3, -1, 1}};
+
+// Cyclic shifts of the 6-tone DMRS in units of 2*pi/6, TS 36.211 Table 10.1.4.1.2-3
+static const uint32_t dmrs_cs_6[4] = {0, 1, 2, 4};
+
+/* Index of the group hopping sequence of a grant of nof_sc subcarriers in dmrs_gh_seq */
+static uint32_t dmrs_gh_idx(uint32_t nof_sc)
+{
+  switch (nof_sc) {
+    case 1:
+      return 0;
+    case 3:
+      return 1;
+    case 6:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+/* Number of DMRS base sequences, N_seq^RU of TS 36.211 Sec. 10.1.4.1.3 */
+static uint32_t dmrs_nof_seq(uint32_t nof_sc)
+{
+  switch (nof_sc) {
+    case 1:
+      return 16;
+    case 3:
+      return 12;
+    case 6:
+      return 14;
+    default:
+      return 30;
+  }
+}
+
 // TODO: This only handles Format 1, 15kHz case
 int sonica_npusch_cp(cf_t *input,
                      cf_t *output,
@@ -98,6 +153,11 @@ static int npusch_init(sonica_npusch_t* q, bool is_ue)
     bzero(q, sizeof(sonica_npusch_t));
     q->max_re = MAX_NPUSCH_RE;
 
+    // Without SIB2-NB the base sequences follow the cell ID
+    q->dmrs_cfg.three_tone_base_seq  = -1;
+    q->dmrs_cfg.six_tone_base_seq    = -1;
+    q->dmrs_cfg.twelve_tone_base_seq = -1;
+
     q->g_bits = srslte_vec_i16_malloc(q->max_re * srslte_mod_bits_x_symbol(SRSLTE_MOD_QPSK));
     if (!q->g_bits) {
       goto clean;
@@ -137,11 +197,28 @@ static int npusch_init(sonica_npusch_t* q, bool is_ue)
     if (srslte_dft_precoding_init(&q->dft_precoding, 1, is_ue)) {
       goto clean;
     }
+    if (srslte_dft_plan_c(&q->dft_plan_3, 3, is_ue ? SRSLTE_DFT_FORWARD : SRSLTE_DFT_BACKWARD)) {
+      goto clean;
+    }
+    srslte_dft_plan_set_norm(&q->dft_plan_3, true);
+    if (srslte_dft_plan_c(&q->dft_plan_6, 6, is_ue ? SRSLTE_DFT_FORWARD : SRSLTE_DFT_BACKWARD)) {
+      goto clean;
+    }
+    srslte_dft_plan_set_norm(&q->dft_plan_6, true);
 
     if (sonica_nulsch_init(&q->nulsch)) {
       goto clean;
     }
 
+    if (sonica_npusch_softbits_init(&q->softbits, SONICA_NPUSCH_MAX_BITS)) {
+      goto clean;
+    }
+
+    // The single-tone DMRS sequence is initialised with c_init = 35 at the start of every NPUSCH
+    if (srslte_sequence_LTE_pr(&q->dmrs_seq_st, SONICA_NPUSCH_MAX_NOF_SLOTS_ST, 35)) {
+      goto clean;
+    }
+
     if (srslte_sch_init(&q->nul_sch)) {
       goto clean;
     }
@@ -194,8 +271,16 @@ void sonica_npusch_free(sonica_npusch_t* q)
 
   srslte_modem_table_free(&q->mod_qpsk);
   srslte_dft_precoding_free(&q->dft_precoding);
+  srslte_dft_plan_free(&q->dft_plan_3);
+  srslte_dft_plan_free(&q->dft_plan_6);
   srslte_sch_free(&q->nul_sch);
   sonica_nulsch_free(&q->nulsch);
+  sonica_npusch_softbits_free(&q->softbits);
+  srslte_sequence_free(&q->dmrs_seq_st);
+  srslte_sequence_free(&q->dmrs_oc_seq);
+  for (uint32_t i = 0; i < 4; i++) {
+    srslte_sequence_free(&q->dmrs_gh_seq[i]);
+  }
 
   bzero(q, sizeof(sonica_npusch_t));
 }
@@ -207,6 +292,19 @@ int sonica_npusch_set_cell(sonica_npusch_t* q, srslte_nbiot_cell_t cell)
   if (q != NULL && srslte_nbiot_cell_isvalid(&cell)) {
     q->cell = cell;
 
+    // 8 bits of c(i) select the Format 2 cover of each of the 20 slots of a radio frame
+    if (srslte_sequence_LTE_pr(&q->dmrs_oc_seq, DMRS_GH_SEQ_LEN, cell.n_id_ncell)) {
+      return SRSLTE_ERROR;
+    }
+
+    // Group hopping of each allocation size, with its own number of base sequences
+    uint32_t nof_sc[4] = {1, 3, 6, SRSLTE_NRE};
+    for (uint32_t i = 0; i < 4; i++) {
+      if (srslte_sequence_LTE_pr(&q->dmrs_gh_seq[i], DMRS_GH_SEQ_LEN, cell.n_id_ncell / dmrs_nof_seq(nof_sc[i]))) {
+        return SRSLTE_ERROR;
+      }
+    }
+
     INFO("NPUSCH: Cell config n_id_ncell=%d, %d ports, %d PRBs base cell, max_symbols: %d\n",
          q->cell.n_id_ncell,
          q->cell.nof_ports,
@@ -218,6 +316,82 @@ int sonica_npusch_set_cell(sonica_npusch_t* q, srslte_nbiot_cell_t cell)
   return ret;
 }
 
+int sonica_npusch_set_dmrs_cfg(sonica_npusch_t* q, const sonica_npusch_dmrs_cfg_t* cfg)
+{
+  if (q == NULL || cfg == NULL || cfg->group_assign >= 30 || cfg->three_tone_base_seq >= 12 ||
+      cfg->three_tone_cyclic_shift >= 3 || cfg->six_tone_base_seq >= 14 || cfg->six_tone_cyclic_shift >= 4 ||
+      cfg->twelve_tone_base_seq >= 30) {
+    fprintf(stderr, "sonica_npusch_set_dmrs_cfg() called with invalid parameters.\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  q->dmrs_cfg = *cfg;
+
+  INFO("NPUSCH: DMRS group hopping %s, group assignment %d\n",
+       cfg->group_hopping_en ? "enabled" : "disabled",
+       cfg->group_assign);
+
+  return SRSLTE_SUCCESS;
+}
+
+/* Base sequence u of the DMRS in slot ns of the frame, TS 36.211 Sec. 10.1.4.1.2 and 10.1.4.1.3 */
+static uint32_t npusch_dmrs_u(sonica_npusch_t* q, uint32_t nof_sc, uint32_t ns)
+{
+  uint32_t nof_seq = dmrs_nof_seq(nof_sc);
+
+  if (q->dmrs_cfg.group_hopping_en) {
+    srslte_sequence_t* seq = &q->dmrs_gh_seq[dmrs_gh_idx(nof_sc)];
+    uint32_t           fgh = 0;
+    for (uint32_t i = 0; i < 8; i++) {
+      fgh += (uint32_t)seq->c[8 * ns + i] << i;
+    }
+    uint32_t fss = (q->cell.n_id_ncell + q->dmrs_cfg.group_assign) % nof_seq;
+    return (fgh + fss) % nof_seq;
+  }
+
+  int base_seq = -1;
+  switch (nof_sc) {
+    case 3:
+      base_seq = q->dmrs_cfg.three_tone_base_seq;
+      break;
+    case 6:
+      base_seq = q->dmrs_cfg.six_tone_base_seq;
+      break;
+    case SRSLTE_NRE:
+      base_seq = q->dmrs_cfg.twelve_tone_base_seq;
+      break;
+    default:
+      break;
+  }
+  return (base_seq >= 0) ? (uint32_t)base_seq : q->cell.n_id_ncell % nof_seq;
+}
+
+void sonica_npusch_dmrs_multitone(sonica_npusch_t* q, uint32_t nof_sc, uint32_t ns, cf_t* r)
+{
+  uint32_t u = npusch_dmrs_u(q, nof_sc, ns);
+
+  float arg[SRSLTE_NRE];
+  float alpha = 0;
+  if (nof_sc == 3) {
+    for (uint32_t i = 0; i < 3; i++) {
+      arg[i] = dmrs_phi_3[u][i] * M_PI / 4;
+    }
+    alpha = 2 * M_PI * q->dmrs_cfg.three_tone_cyclic_shift / 3;
+  } else if (nof_sc == 6) {
+    for (uint32_t i = 0; i < 6; i++) {
+      arg[i] = dmrs_phi_6[u][i] * M_PI / 4;
+    }
+    alpha = 2 * M_PI * dmrs_cs_6[q->dmrs_cfg.six_tone_cyclic_shift] / 6;
+  } else {
+    srslte_refsignal_r_uv_arg_1prb(arg, u);
+  }
+  DEBUG("Slot %d, %d tones: u=%d, alpha=%.2f\n", ns, nof_sc, u, alpha);
+
+  for (uint32_t n = 0; n < nof_sc; n++) {
+    r[n] = cexpf(I * (alpha * n + arg[n]));
+  }
+}
+
 // TODO: Pregenerate sequences?
 static srslte_sequence_t* get_user_sequence(sonica_npusch_t* q, uint16_t rnti, uint32_t nf,
                                             uint32_t nslot, uint32_t len)
@@ -280,44 +454,436 @@ int sonica_npusch_decode(sonica_npusch_t*        q,
                          float                   noise_estimate,
                          uint8_t*                data)
 {
-  uint32_t n;
-
   if (q != NULL && sf_symbols != NULL && data != NULL && cfg != NULL) {
-    uint32_t num_sf = cfg->grant.nof_slots / 2;
-    uint32_t num_re_per_sf = 6 * 2 * cfg->grant.nof_sc;
+    uint32_t nof_sf = sonica_npusch_nof_sf(cfg);
 
-    for (uint32_t i = 0; i < num_sf; i++) {
-      n = npusch_get(&sf_symbols[i * CURRENT_SFLEN_RE], &q->rx_syms[i * num_re_per_sf], &cfg->grant);
-      if (n != num_re_per_sf) {
-        fprintf(stderr, "Error expecting %d symbols but got %d\n", num_re_per_sf, n);
-        return SRSLTE_ERROR;
+    sonica_npusch_softbits_reset(&q->softbits);
+    for (uint32_t i = 0; i < nof_sf; i++) {
+      int ret = sonica_npusch_demod_sf(
+          q, cfg, &sf_symbols[i * CURRENT_SFLEN_RE], &ce[i * CURRENT_SFLEN_RE], noise_estimate, &q->softbits);
+      if (ret != SRSLTE_SUCCESS) {
+        return ret;
       }
+    }
 
-      n = npusch_get(&ce[i * CURRENT_SFLEN_RE], &q->ce[i * num_re_per_sf], &cfg->grant);
-      if (n != num_re_per_sf) {
-        fprintf(stderr, "Error expecting %d symbols but got %d\n", num_re_per_sf, n);
-        return SRSLTE_ERROR;
-      }
+    return sonica_npusch_decode_softbits(q, cfg, &q->softbits, data);
+  } else {
+    fprintf(stderr, "sonica_npusch_decode() called with invalid parameters.\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+}
+
+int sonica_npusch_softbits_init(sonica_npusch_softbits_t* sb, uint32_t max_bits)
+{
+  if (sb == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  bzero(sb, sizeof(sonica_npusch_softbits_t));
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    sb->llr[i] = srslte_vec_i16_malloc(max_bits);
+    if (!sb->llr[i]) {
+      sonica_npusch_softbits_free(sb);
+      return SRSLTE_ERROR;
     }
+  }
+  sb->max_bits = max_bits;
+  sonica_npusch_softbits_reset(sb);
+
+  return SRSLTE_SUCCESS;
+}
+
+void sonica_npusch_softbits_free(sonica_npusch_softbits_t* sb)
+{
+  if (sb == NULL) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    if (sb->llr[i]) {
+      free(sb->llr[i]);
+    }
+  }
+  bzero(sb, sizeof(sonica_npusch_softbits_t));
+}
+
+void sonica_npusch_softbits_reset(sonica_npusch_softbits_t* sb)
+{
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    if (sb->llr[i]) {
+      srslte_vec_i16_zero(sb->llr[i], sb->max_bits);
+    }
+    sb->nof_comb[i] = 0;
+  }
+}
+
+int sonica_npusch_softbits_copy(sonica_npusch_softbits_t* dst, const sonica_npusch_softbits_t* src, uint32_t nof_bits)
+{
+  if (dst == NULL || src == NULL || nof_bits > dst->max_bits || nof_bits > src->max_bits) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    memcpy(dst->llr[i], src->llr[i], nof_bits * sizeof(int16_t));
+    dst->nof_comb[i] = src->nof_comb[i];
+  }
+
+  return SRSLTE_SUCCESS;
+}
+
+/* Adds the LLRs of one repetition, saturating instead of wrapping around */
+static void npusch_llr_acc(int16_t* acc, const int16_t* llr, uint32_t len)
+{
+  for (uint32_t i = 0; i < len; i++) {
+    int32_t v = (int32_t)acc[i] + llr[i];
+    acc[i]    = (int16_t)SRSLTE_MAX(INT16_MIN, SRSLTE_MIN(INT16_MAX, v));
+  }
+}
+
+int sonica_npusch_softbits_add(sonica_npusch_softbits_t* dst, const sonica_npusch_softbits_t* src, uint32_t nof_bits)
+{
+  if (dst == NULL || src == NULL || nof_bits > dst->max_bits || nof_bits > src->max_bits) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    npusch_llr_acc(dst->llr[i], src->llr[i], nof_bits);
+    dst->nof_comb[i] += src->nof_comb[i];
+  }
+
+  return SRSLTE_SUCCESS;
+}
 
-    srslte_predecoding_single(q->rx_syms, q->ce, q->d, NULL, cfg->nbits.nof_re, 1.0f, noise_estimate);
+/* Number of consecutive transmissions of each subframe, TS 36.211 Sec. 10.1.3.6 */
+static uint32_t npusch_m_identical(srslte_ra_nbiot_ul_grant_t* grant)
+{
+  if (grant->nof_sc == 1) {
+    return 1;
+  }
+  return SRSLTE_MAX(1, SRSLTE_MIN(4, grant->nof_rep / 2));
+}
+
+uint32_t sonica_npusch_nof_sf(sonica_npusch_cfg_t* cfg)
+{
+  // A 3.75 kHz slot lasts 2 ms
+  uint32_t nof_sf = (cfg->grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) ? cfg->grant.nof_slots * 2
+                                                                              : cfg->grant.nof_slots / 2;
+  return nof_sf * SRSLTE_MAX(1, cfg->grant.nof_rep);
+}
+
+void sonica_npusch_cfg_seek(sonica_npusch_cfg_t* cfg, uint32_t num_sf)
+{
+  uint32_t nof_slots = cfg->grant.nof_slots;
+
+  // Same counters as left by the demodulation of the preceding subframes, a 3.75 kHz slot starts at an even one
+  if (cfg->grant.nof_sc == 1) {
+    bool is_3k75   = cfg->grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750;
+    cfg->num_slots = is_3k75 ? num_sf / 2 : num_sf * 2;
+    cfg->num_sf    = is_3k75 ? cfg->num_slots * 2 : cfg->num_slots / 2;
+    cfg->sf_idx    = is_3k75 ? (cfg->num_slots % nof_slots) * 2 : (cfg->num_slots % nof_slots) / 2;
+    cfg->rep_idx   = cfg->num_slots / nof_slots;
+  } else {
+    uint32_t cw_sf = nof_slots / 2;
+    uint32_t m     = npusch_m_identical(&cfg->grant);
+    cfg->num_sf    = num_sf;
+    cfg->sf_idx    = (num_sf % (cw_sf * m)) / m;
+    cfg->rep_idx   = num_sf / cw_sf;
+  }
+}
+
+int sonica_npusch_demod_sf(sonica_npusch_t*          q,
+                           sonica_npusch_cfg_t*      cfg,
+                           cf_t*                     sf_symbols,
+                           cf_t*                     ce,
+                           float                     noise_estimate,
+                           sonica_npusch_softbits_t* softbits)
+{
+  if (q == NULL || cfg == NULL || sf_symbols == NULL || ce == NULL || softbits == NULL) {
+    fprintf(stderr, "sonica_npusch_demod_sf() called with invalid parameters.\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (cfg->nbits.nof_bits > softbits->max_bits) {
+    fprintf(stderr, "Error too many NPUSCH bits (%d), maximum is %d\n", cfg->nbits.nof_bits, softbits->max_bits);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (cfg->num_sf >= sonica_npusch_nof_sf(cfg)) {
+    fprintf(stderr, "Error NPUSCH already received %d subframes\n", cfg->num_sf);
+    return SRSLTE_ERROR;
+  }
 
-    // TODO: support NRUsc other than 12
-    srslte_dft_precoding(&q->dft_precoding, q->d, q->rx_syms, 1, cfg->grant.nof_slots * 6);
+  if (cfg->grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+    fprintf(stderr, "Error 3.75 kHz NPUSCH is received per slot with sonica_npusch_demod_slot_st()\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (cfg->grant.nof_sc == 1) {
+    for (uint32_t slot = 0; slot < SRSLTE_NOF_SLOTS_PER_SF; slot++) {
+      int ret = sonica_npusch_demod_slot_st(
+          q, cfg, &sf_symbols[slot * SRSLTE_CP_NORM_NSYMB * SRSLTE_NRE], SRSLTE_NRE, noise_estimate, softbits);
+      if (ret != SRSLTE_SUCCESS) {
+        return ret;
+      }
+    }
+    return SRSLTE_SUCCESS;
+  }
 
-    srslte_demod_soft_demodulate_s(cfg->grant.mcs.mod, q->rx_syms, q->q_bits, cfg->nbits.nof_re);
+  if (cfg->grant.nof_sc != 3 && cfg->grant.nof_sc != 6 && cfg->grant.nof_sc != SRSLTE_NRE) {
+    fprintf(stderr, "Error NPUSCH of %d subcarriers is not supported\n", cfg->grant.nof_sc);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
 
-    srslte_sequence_t* seq = get_user_sequence(q, cfg->rnti, cfg->grant.tx_tti / 10,
-                                               (cfg->grant.tx_tti % 10) * 2, cfg->nbits.nof_bits);
+  uint32_t num_sf        = cfg->grant.nof_slots / 2;
+  uint32_t m_identical   = npusch_m_identical(&cfg->grant);
+  uint32_t num_re_per_sf = 6 * 2 * cfg->grant.nof_sc;
+  uint32_t num_bits_sf   = num_re_per_sf * cfg->grant.Qm;
+  int16_t* llr           = q->q_bits;
+
+  // Each subframe is sent M_identical times in a row, and every block of M_identical codewords alternates the RV
+  uint32_t block = cfg->num_sf / (num_sf * m_identical);
+  uint32_t k     = (cfg->num_sf % (num_sf * m_identical)) / m_identical;
+  uint32_t rv    = block % SONICA_NPUSCH_NOF_RV;
+
+  uint32_t n = npusch_get(sf_symbols, q->rx_syms, &cfg->grant);
+  if (n != num_re_per_sf) {
+    fprintf(stderr, "Error expecting %d symbols but got %d\n", num_re_per_sf, n);
+    return SRSLTE_ERROR;
+  }
+  npusch_get(ce, q->ce, &cfg->grant);
 
-    srslte_scrambling_s_offset(seq, q->q_bits, 0, cfg->nbits.nof_bits);
+  srslte_predecoding_single(q->rx_syms, q->ce, q->d, NULL, num_re_per_sf, 1.0f, noise_estimate);
 
-    // return srslte_nulsch_decode(&q->nul_sch, &cfg->grant, q->q_bits, q->g_bits, softbuffer, data);
-    return sonica_nulsch_decode(&q->nulsch, &cfg->grant, q->q_bits, q->g_bits, data);
+  // Each of the 12 data symbols of the subframe is spread over the nof_sc subcarriers of the grant
+  if (cfg->grant.nof_sc == SRSLTE_NRE) {
+    srslte_dft_precoding(&q->dft_precoding, q->d, q->rx_syms, 1, SRSLTE_NRE);
   } else {
-    fprintf(stderr, "sonica_npusch_decode() called with invalid parameters.\n");
+    srslte_dft_plan_t* plan = (cfg->grant.nof_sc == 3) ? &q->dft_plan_3 : &q->dft_plan_6;
+    for (uint32_t l = 0; l < 12; l++) {
+      srslte_dft_run_c(plan, &q->d[l * cfg->grant.nof_sc], &q->rx_syms[l * cfg->grant.nof_sc]);
+    }
+  }
+
+  srslte_demod_soft_demodulate_s(cfg->grant.mcs.mod, q->rx_syms, llr, num_re_per_sf);
+
+  // The scrambling is initialised at the first slot of every block, TS 36.211 Sec. 10.1.3.1
+  uint32_t block_tti = (cfg->grant.tx_tti + block * num_sf * m_identical) % 10240;
+  srslte_sequence_t* seq = get_user_sequence(q, cfg->rnti, block_tti / 10,
+                                             (block_tti % 10) * 2, cfg->nbits.nof_bits);
+
+  srslte_scrambling_s_offset(seq, llr, k * num_bits_sf, num_bits_sf);
+
+  npusch_llr_acc(&softbits->llr[rv][k * num_bits_sf], llr, num_bits_sf);
+  if (k == 0) {
+    softbits->nof_comb[rv]++;
+  }
+
+  cfg->num_sf++;
+  cfg->sf_idx  = (cfg->num_sf % (num_sf * m_identical)) / m_identical;
+  cfg->rep_idx = cfg->num_sf / num_sf;
+
+  return SRSLTE_SUCCESS;
+}
+
+/* Duration of symbol l of a single-tone slot in units of the symbol length N, i.e. (N + N_CP,l) / N */
+static double npusch_st_symb_len(bool is_3k75, uint32_t l)
+{
+  if (is_3k75) {
+    return (8192 + 256) / 8192.0;
+  }
+  return (2048 + ((l == 0) ? 160 : 144)) / 2048.0;
+}
+
+/* Orthogonal sequence w(n) of the single-tone DMRS, TS 36.211 Table 10.1.4.1.1-1 lists the rows of a 16x16
+ * Hadamard matrix */
+static float npusch_st_w(uint32_t u, uint32_t n)
+{
+  return (__builtin_popcount(u & n) & 1) ? -1.0f : 1.0f;
+}
+
+/* Slot number n_s within the frame of slot of a single-tone NPUSCH, 20 slots at 15 kHz and 5 at 3.75 kHz */
+static uint32_t npusch_st_ns(sonica_npusch_cfg_t* cfg, uint32_t slot)
+{
+  if (cfg->grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+    return ((cfg->grant.tx_tti + 2 * slot) % 10) / 2;
+  }
+  return ((cfg->grant.tx_tti + slot / 2) % 10) * 2 + slot % 2;
+}
+
+int sonica_npusch_demod_slot_st(sonica_npusch_t*          q,
+                                sonica_npusch_cfg_t*      cfg,
+                                cf_t*                     slot_symbols,
+                                uint32_t                  nof_sc,
+                                float                     noise_estimate,
+                                sonica_npusch_softbits_t* softbits)
+{
+  if (q == NULL || cfg == NULL || slot_symbols == NULL || softbits == NULL || cfg->grant.nof_sc != 1) {
+    fprintf(stderr, "sonica_npusch_demod_slot_st() called with invalid parameters.\n");
     return SRSLTE_ERROR_INVALID_INPUTS;
   }
+
+  bool     is_3k75       = cfg->grant.sc_spacing == SRSLTE_NPUSCH_SC_SPACING_3750;
+  bool     is_format2    = cfg->grant.format == SRSLTE_NPUSCH_FORMAT2;
+  uint32_t k             = cfg->grant.sc_alloc_set[0];
+  uint32_t nof_slots     = cfg->grant.nof_slots;
+  uint32_t slot          = cfg->num_slots;
+  uint32_t dmrs_start    = is_format2 ? (is_3k75 ? 0 : 2) : (is_3k75 ? 4 : 3);
+  uint32_t nof_dmrs      = is_format2 ? 3 : 1;
+  uint32_t nof_data      = SRSLTE_CP_NORM_NSYMB - nof_dmrs;
+  uint32_t num_bits_slot = nof_data * cfg->grant.Qm;
+  float    rho           = (cfg->grant.Qm == 1) ? (float)M_PI_2 : (float)M_PI_4;
+  int16_t* llr           = q->q_bits;
+
+  if (k >= nof_sc || cfg->nbits.nof_bits > softbits->max_bits) {
+    fprintf(stderr, "Error invalid single-tone NPUSCH on subcarrier %d\n", k);
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (slot >= nof_slots * SRSLTE_MAX(1, cfg->grant.nof_rep) || slot >= SONICA_NPUSCH_MAX_NOF_SLOTS_ST) {
+    fprintf(stderr, "Error NPUSCH already received %d slots\n", slot);
+    return SRSLTE_ERROR;
+  }
+
+  // Remove the phase rotation phi(l) = rho * (l mod 2) + phi_hat(l) of every symbol, including the DMRS. The symbol
+  // counter l starts with the transmission, phi_hat(l) accumulates 2*pi*(k + 1/2)*(N + N_CP) / N of each symbol.
+  double slot_len = 0;
+  for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+    slot_len += npusch_st_symb_len(is_3k75, l);
+  }
+
+  cf_t   y[SRSLTE_CP_NORM_NSYMB];
+  double t = slot * slot_len;
+  for (uint32_t l = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+    float phi = (float)(2 * M_PI * fmod((k + 0.5) * t, 1.0)) + rho * (l % 2);
+    y[l]      = slot_symbols[l * nof_sc + k] * cexpf(-I * phi);
+    t += npusch_st_symb_len(is_3k75, l);
+  }
+
+  // The DMRS of a slot is r(n) = (1 + j) / sqrt(2) * (1 - 2c(n)) * w(n mod 16). With group hopping u only changes
+  // at the first slot of each RU, 16 slots for Format 1 and 4 for Format 2.
+  uint32_t ru_len = is_format2 ? 4 : 16;
+  uint32_t u      = npusch_dmrs_u(q, 1, npusch_st_ns(cfg, slot - slot % ru_len));
+  cf_t     r = (1.0f + I) * (float)M_SQRT1_2 * (1.0f - 2.0f * q->dmrs_seq_st.c[slot]) * npusch_st_w(u, slot % 16);
+
+  // Format 2 repeats it on 3 symbols with the cover w(m) of TS 36.211 Table 5.5.2.2.1-2, selected per slot n_s by
+  // (sum_i c(8 n_s + i) 2^i) mod 3
+  cf_t     h      = 0;
+  uint32_t oc_idx = 0;
+  if (is_format2) {
+    uint32_t n_s = npusch_st_ns(cfg, slot);
+    for (uint32_t i = 0; i < 8; i++) {
+      oc_idx += (uint32_t)q->dmrs_oc_seq.c[8 * n_s + i] << i;
+    }
+    oc_idx %= 3;
+  }
+  for (uint32_t m = 0; m < nof_dmrs; m++) {
+    cf_t w = cexpf(I * (float)(2 * M_PI * oc_idx * m / 3));
+    h += y[dmrs_start + m] * conjf(w * r);
+  }
+  h /= nof_dmrs;
+
+  cf_t data[SRSLTE_CP_NORM_NSYMB - 1];
+  cf_t ce[SRSLTE_CP_NORM_NSYMB - 1];
+  for (uint32_t l = 0, j = 0; l < SRSLTE_CP_NORM_NSYMB; l++) {
+    if (l < dmrs_start || l >= dmrs_start + nof_dmrs) {
+      data[j] = y[l];
+      ce[j]   = h;
+      j++;
+    }
+  }
+
+  srslte_predecoding_single(data, ce, q->d, NULL, nof_data, 1.0f, noise_estimate);
+
+  srslte_demod_soft_demodulate_s(cfg->grant.mcs.mod, q->d, llr, nof_data);
+
+  // M_identical is 1, so every codeword repetition restarts the scrambling. Format 1 repetitions alternate the RV,
+  // the Format 2 codeword has none.
+  uint32_t block     = slot / nof_slots;
+  uint32_t s         = slot % nof_slots;
+  uint32_t rv        = is_format2 ? 0 : block % SONICA_NPUSCH_NOF_RV;
+  uint32_t cw_sf     = is_3k75 ? nof_slots * 2 : nof_slots / 2;
+  uint32_t block_tti = (cfg->grant.tx_tti + block * cw_sf) % 10240;
+  srslte_sequence_t* seq = get_user_sequence(q, cfg->rnti, block_tti / 10,
+                                             (block_tti % 10) * 2, cfg->nbits.nof_bits);
+
+  srslte_scrambling_s_offset(seq, llr, s * num_bits_slot, num_bits_slot);
+
+  npusch_llr_acc(&softbits->llr[rv][s * num_bits_slot], llr, num_bits_slot);
+  if (s == 0) {
+    softbits->nof_comb[rv]++;
+  }
+
+  cfg->num_slots++;
+  cfg->num_sf  = is_3k75 ? cfg->num_slots * 2 : cfg->num_slots / 2;
+  cfg->sf_idx  = is_3k75 ? (cfg->num_slots % nof_slots) * 2 : (cfg->num_slots % nof_slots) / 2;
+  cfg->rep_idx = cfg->num_slots / nof_slots;
+
+  return SRSLTE_SUCCESS;
+}
+
+int sonica_npusch_decode_softbits(sonica_npusch_t*          q,
+                                  sonica_npusch_cfg_t*      cfg,
+                                  sonica_npusch_softbits_t* softbits,
+                                  uint8_t*                  data)
+{
+  int16_t* cw[SONICA_NPUSCH_NOF_RV];
+  uint32_t rv_idx[SONICA_NPUSCH_NOF_RV];
+  uint32_t nof_cw = 0;
+
+  if (q == NULL || cfg == NULL || softbits == NULL || data == NULL) {
+    fprintf(stderr, "sonica_npusch_decode_softbits() called with invalid parameters.\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  // The repetitions are summed with saturation as they arrive, the sums go to the turbo decoder as they are
+  for (uint32_t i = 0; i < SONICA_NPUSCH_NOF_RV; i++) {
+    if (softbits->nof_comb[i] == 0) {
+      continue;
+    }
+
+    cw[nof_cw]     = softbits->llr[i];
+    rv_idx[nof_cw] = (cfg->grant.rv_idx + 2 * i) % 4;
+    nof_cw++;
+  }
+
+  if (nof_cw == 0) {
+    return SRSLTE_ERROR;
+  }
+
+  // return srslte_nulsch_decode(&q->nul_sch, &cfg->grant, q->q_bits, q->g_bits, softbuffer, data);
+  return sonica_nulsch_decode(&q->nulsch, &cfg->grant, cw, rv_idx, nof_cw, q->g_bits, data);
+}
+
+int sonica_npusch_decode_ack(sonica_npusch_t*          q,
+                             sonica_npusch_cfg_t*      cfg,
+                             sonica_npusch_softbits_t* softbits,
+                             bool*                     ack)
+{
+  if (q == NULL || cfg == NULL || softbits == NULL || ack == NULL || cfg->grant.format != SRSLTE_NPUSCH_FORMAT2 ||
+      cfg->nbits.nof_bits != SONICA_NPUSCH_F2_NOF_BITS) {
+    fprintf(stderr, "sonica_npusch_decode_ack() called with invalid parameters.\n");
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  if (softbits->nof_comb[0] == 0) {
+    return SRSLTE_ERROR;
+  }
+
+  // Every bit of the codeword is the HARQ-ACK bit, 1 for ACK
+  int32_t sum = 0, abs_sum = 0;
+  for (uint32_t i = 0; i < SONICA_NPUSCH_F2_NOF_BITS; i++) {
+    sum += softbits->llr[0][i];
+    abs_sum += abs(softbits->llr[0][i]);
+  }
+
+  // Noise alone agrees in sign on about 1/sqrt(16) of the magnitude
+  if (abs_sum == 0 || 2 * abs(sum) < abs_sum) {
+    DEBUG("NPUSCH Format 2 for rnti=0x%x: DTX, llr sum=%d/%d\n", cfg->rnti, sum, abs_sum);
+    return SRSLTE_ERROR;
+  }
+
+  *ack = sum > 0;
+  return SRSLTE_SUCCESS;
 }
 
 /* Configures the structure sonica_npusch_cfg_t from a DL grant.
@@ -337,6 +903,7 @@ int sonica_npusch_cfg(sonica_npusch_cfg_t*        cfg,
     cfg->sf_idx     = 0;
     cfg->rep_idx    = 0;
     cfg->num_sf     = 0;
+    cfg->num_slots  = 0;
     cfg->is_encoded = false;
     cfg->rnti       = rnti;
 
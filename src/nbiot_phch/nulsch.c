@@ -89,13 +89,19 @@ int sonica_nulsch_free(sonica_nulsch_t *q)
 
 int sonica_nulsch_decode(sonica_nulsch_t*            q,
                          srslte_ra_nbiot_ul_grant_t* grant,
-                         int16_t*                    q_bits,
+                         int16_t**                   q_bits,
+                         uint32_t*                   rv_idx,
+                         uint32_t                    nof_cw,
                          int16_t*                    g_bits,
                          uint8_t*                    data)
 {
   sonica_segm segm;
   int ret = SRSLTE_ERROR_INVALID_INPUTS;
 
+  if (nof_cw == 0) {
+    return ret;
+  }
+
   if (openair_lte_segmentation(NULL, NULL, grant->mcs.tbs + 3 * 8,
         &segm.C, &segm.Cplus, &segm.Cminus, &segm.Kplus, &segm.Kminus, &segm.F) != 0) {
     return ret;
@@ -107,19 +113,57 @@ int sonica_nulsch_decode(sonica_nulsch_t*            q,
   uint32_t offset = 0;
   uint8_t crc_type;
   uint32_t E;
-  uint32_t r_offset = 0;
-
-  // Interleaving is done per RU
-  for (uint32_t i = 0; i < grant->nof_ru; i++) {
-    ulsch_deinterleave(&q_bits[i * nb_q_ru],
-                       Qm,
-                       nb_q_ru / Qm,
-                       12 /* Symbols per RU */,
-                       &g_bits[i * nb_q_ru],
-                       q->ack_ri_bits,
-                       0,
-                       q->temp_g_bits,
-                       q->ul_interleaver);
+  uint32_t RTC[3];
+  // 6 data symbols per slot, i.e. 12 for a 12-tone RU and 96 for a single-tone RU
+  uint32_t nof_symb_ru = 6 * (grant->nof_slots / grant->nof_ru);
+
+  for (uint32_t r = 0; r < segm.C; r++) {
+    uint32_t Kr = (r < segm.Cminus) ? segm.Kminus : segm.Kplus;
+
+    memset(&q->dummy_w[r][0], 0, 3*(6144+64)*sizeof(short));
+    RTC[r] = openair_generate_dummy_w(4 + Kr, (uint8_t*)&q->dummy_w[r][0],
+                                      (r==0) ? segm.F : 0);
+  }
+
+  // Every codeword is rate dematched into the same circular buffer, the first one clears it
+  for (uint32_t cw = 0; cw < nof_cw; cw++) {
+    uint32_t r_offset = 0;
+
+    // Interleaving is done per RU
+    for (uint32_t i = 0; i < grant->nof_ru; i++) {
+      ulsch_deinterleave(&q_bits[cw][i * nb_q_ru],
+                         Qm,
+                         nb_q_ru / Qm,
+                         nof_symb_ru,
+                         &g_bits[i * nb_q_ru],
+                         q->ack_ri_bits,
+                         0,
+                         q->temp_g_bits,
+                         q->ul_interleaver);
+    }
+
+    for (uint32_t r = 0; r < segm.C; r++) {
+      if (openair_lte_rm_turbo_rx(RTC[r],
+                                  nb_q, // G
+                                  q->w[r],
+                                  (uint8_t*) &q->dummy_w[r][0],
+                                  g_bits + r_offset,
+                                  segm.C,
+                                  OPENAIR_NSOFT,
+                                  0,   //Uplink
+                                  1,
+                                  rv_idx[cw],
+                                  (cw == 0) /* clear */,
+                                  Qm /* Qm */,
+                                  1,
+                                  r,
+                                  &E)==-1) {
+        fprintf(stderr, "ulsch_decoding: Problem in rate matching\n");
+        return(-1);
+      }
+
+      r_offset += E;
+    }
   }
 
   for (uint32_t r = 0; r < segm.C; r++) {
@@ -140,31 +184,6 @@ int sonica_nulsch_decode(sonica_nulsch_t*            q,
       fprintf(stderr, "Invalid CB length\n");
     }
 
-    memset(&q->dummy_w[r][0], 0, 3*(6144+64)*sizeof(short));
-    uint32_t RTC = openair_generate_dummy_w(4 + Kr, (uint8_t*)&q->dummy_w[r][0],
-                                    (r==0) ? segm.F : 0);
-
-    if (openair_lte_rm_turbo_rx(RTC,
-                                nb_q, // G
-                                q->w[r],
-                                (uint8_t*) &q->dummy_w[r][0],
-                                g_bits + r_offset,
-                                segm.C,
-                                OPENAIR_NSOFT,
-                                0,   //Uplink
-                                1,
-                                0 /* rvidx */,
-                                1 /* clear */,
-                                Qm /* Qm */,
-                                1,
-                                r,
-                                &E)==-1) {
-      fprintf(stderr, "ulsch_decoding: Problem in rate matching\n");
-      return(-1);
-    }
-
-    r_offset += E;
-
     openair_sub_block_deinterleaving_turbo(4 + Kr, &q->d[r][96], q->w[r]);
 
     if (segm.C == 1) {
@@ -198,4 +217,4 @@ int sonica_nulsch_decode(sonica_nulsch_t*            q,
   }
 
   return SRSLTE_SUCCESS;
-}
\ No newline at end of file
+}
@@ -23,9 +23,11 @@
 #define SRSLTE_BUFFER_POOL_H
 
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <pthread.h>
-#include <stack>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -38,6 +40,20 @@
 
 namespace srslte {
 
+struct buffer_pool_metrics_t {
+  uint32_t capacity;
+  uint32_t nof_used;       ///< allocated and not deallocated yet
+  uint32_t nof_cached;     ///< free, in the caches of the threads
+  uint64_t nof_alloc_fail; ///< allocations that found the pool empty
+};
+
+namespace pool_details {
+
+//! Index of the calling thread, unique among the running threads and given to another thread once it exits
+uint32_t get_thread_slot();
+
+} // namespace pool_details
+
 /******************************************************************************
  * Buffer pool
  *
@@ -45,6 +61,20 @@ namespace srslte {
  * deallocate functions. Provides quick object creation and deletion as well
  * as object reuse.
  * Singleton class of byte_buffer_t (but other pools of different type can be created)
+ *
+ * The free buffers form an intrusive list, a lock-free stack whose head
+ * carries a tag against ABA, and deallocate finds the node of a buffer from
+ * its address. Each thread keeps a cache of free buffers, which it refills
+ * from and returns to the list in batches. An allocation that finds the list
+ * empty drains the caches of the other threads before it fails or blocks.
+ * Only blocking allocations on an empty pool take a lock.
+ *
+ * A cache is taken with a flag its owner never waits on, the owner uses the
+ * list while another thread drains its cache. A blocking allocation counts
+ * itself in nof_waiting and then looks at the list and the caches, while
+ * every allocate and deallocate updates the list or releases its cache and
+ * then reads nof_waiting. Both sides use seq_cst operations, so either the
+ * waiter finds the buffers or the other thread sees it waiting and wakes it.
  *****************************************************************************/
 
 template <class buffer_t>
@@ -54,41 +84,47 @@ public:
   // non-static methods
   buffer_pool(int capacity_ = -1)
   {
-    uint32_t nof_buffers = POOL_SIZE;
+    capacity = POOL_SIZE;
     if (capacity_ > 0) {
-      nof_buffers = (uint32_t)capacity_;
+      capacity = (uint32_t)capacity_;
     }
     pthread_mutex_init(&mutex, NULL);
     pthread_cond_init(&cv_not_empty, NULL);
-    for (uint32_t i = 0; i < nof_buffers; i++) {
-      buffer_t* b = new buffer_t;
-      available.push(b);
+    nodes.reset(new node_t[capacity]);
+    for (uint32_t i = 0; i < capacity; i++) {
+      nodes[i].next.store(i + 1 < capacity ? i + 1 : NIL, std::memory_order_relaxed);
+    }
+    head.store(pack(0, 0), std::memory_order_release);
+
+    // The caches hold at most 1/8 of the buffers, small pools go without them
+    batch = std::min(MAX_BATCH, capacity / (8 * MAX_CACHES));
+    if (batch >= 2) {
+      caches.reset(new cache_t[MAX_CACHES]);
     }
-    capacity = nof_buffers;
   }
 
   ~buffer_pool()
   {
     // this destructor assumes all buffers have been properly deallocated
-    while (available.size()) {
-      delete available.top();
-      available.pop();
-    }
-
-    for (uint32_t i = 0; i < used.size(); i++) {
-      delete used[i];
-    }
     pthread_cond_destroy(&cv_not_empty);
     pthread_mutex_destroy(&mutex);
   }
 
   void print_all_buffers()
   {
-    printf("%d buffers in queue\n", (int)used.size());
+    buffer_pool_metrics_t m;
+    get_metrics(m);
+    printf("%d buffers in queue, %d cached, %ld failed allocations\n",
+           (int)m.nof_used,
+           (int)m.nof_cached,
+           (long)m.nof_alloc_fail);
 #ifdef SRSLTE_BUFFER_POOL_LOG_ENABLED
     std::map<std::string, uint32_t> buffer_cnt;
-    for (uint32_t i = 0; i < used.size(); i++) {
-      buffer_cnt[strlen(used[i]->debug_name) ? used[i]->debug_name : "Undefined"]++;
+    for (uint32_t i = 0; i < capacity; i++) {
+      if (nodes[i].used.load(std::memory_order_relaxed)) {
+        buffer_t* b = &nodes[i].obj;
+        buffer_cnt[strlen(b->debug_name) ? b->debug_name : "Undefined"]++;
+      }
     }
     std::map<std::string, uint32_t>::iterator it;
     for (it = buffer_cnt.begin(); it != buffer_cnt.end(); it++) {
@@ -97,75 +133,256 @@ public:
 #endif
   }
 
-  uint32_t nof_available_pdus() { return available.size(); }
+  void get_metrics(buffer_pool_metrics_t& m) const
+  {
+    uint64_t nof_alloc_   = nof_alloc.load(std::memory_order_relaxed);
+    uint64_t nof_dealloc_ = nof_dealloc.load(std::memory_order_relaxed);
+    m.capacity       = capacity;
+    m.nof_cached     = 0;
+    m.nof_alloc_fail = nof_alloc_fail.load(std::memory_order_relaxed);
+    if (caches) {
+      for (uint32_t i = 0; i < MAX_CACHES; i++) {
+        nof_alloc_ += caches[i].nof_alloc.load(std::memory_order_relaxed);
+        nof_dealloc_ += caches[i].nof_dealloc.load(std::memory_order_relaxed);
+        m.nof_cached += caches[i].n.load(std::memory_order_relaxed);
+      }
+    }
+    m.nof_used = nof_alloc_ > nof_dealloc_ ? (uint32_t)(nof_alloc_ - nof_dealloc_) : 0;
+  }
+
+  uint32_t nof_available_pdus()
+  {
+    buffer_pool_metrics_t m;
+    get_metrics(m);
+    return capacity - std::min(m.nof_used, capacity);
+  }
 
-  bool is_almost_empty() { return available.size() < capacity / 20; }
+  bool is_almost_empty() { return nof_available_pdus() < capacity / 20; }
 
   buffer_t* allocate(const char* debug_name = NULL, bool blocking = false)
   {
-    pthread_mutex_lock(&mutex);
-    buffer_t* b = NULL;
+    uint32_t idx = NIL;
+    cache_t* c   = lock_cache();
 
-    if (available.size() > 0) {
-      b = available.top();
-      used.push_back(b);
-      available.pop();
-
-      if (is_almost_empty()) {
-        printf("Warning buffer pool capacity is %f %%\n", (float)100 * available.size() / capacity);
+    if (c != nullptr) {
+      uint32_t n = c->n.load(std::memory_order_relaxed);
+      if (n == 0) {
+        n = pop_list(c->idx, batch);
       }
-#ifdef SRSLTE_BUFFER_POOL_LOG_ENABLED
-      if (debug_name) {
-        strncpy(b->debug_name, debug_name, SRSLTE_BUFFER_POOL_LOG_NAME_LEN);
-        b->debug_name[SRSLTE_BUFFER_POOL_LOG_NAME_LEN - 1] = 0;
+      if (n > 0) {
+        idx = c->idx[--n];
+        c->n.store(n, std::memory_order_relaxed);
+        count(c->nof_alloc);
       }
-#endif
-    } else if (blocking) {
-      // blocking allocation
-      while (available.size() == 0) {
-        pthread_cond_wait(&cv_not_empty, &mutex);
+      unlock_cache(c);
+      // the buffers left in the cache may be what a waiting thread needs
+      wake_waiters();
+    } else if (pop_list(&idx, 1) > 0) {
+      nof_alloc.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (idx == NIL) {
+      // the free buffers may sit in the caches of other threads
+      drain_caches();
+      if (pop_list(&idx, 1) > 0) {
+        nof_alloc.fetch_add(1, std::memory_order_relaxed);
       }
+    }
 
-      // retrieve the new buffer
-      b = available.top();
-      used.push_back(b);
-      available.pop();
+    if (idx == NIL and blocking) {
+      // blocking allocation, allocate and deallocate signal once they see a waiting thread
+      nof_waiting.fetch_add(1);
+      pthread_mutex_lock(&mutex);
+      while (pop_list(&idx, 1) == 0) {
+        if (drain_caches() == 0) {
+          pthread_cond_wait(&cv_not_empty, &mutex);
+        }
+      }
+      pthread_mutex_unlock(&mutex);
+      nof_waiting.fetch_sub(1);
+      nof_alloc.fetch_add(1, std::memory_order_relaxed);
+    }
 
-      // do not print any warning
-    } else {
-      printf("Error - buffer pool is empty\n");
+    if (idx == NIL) {
+      nof_alloc_fail.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
 
+    nodes[idx].used.store(true, std::memory_order_relaxed);
+    buffer_t* b = &nodes[idx].obj;
 #ifdef SRSLTE_BUFFER_POOL_LOG_ENABLED
-      print_all_buffers();
-#endif
+    if (debug_name) {
+      strncpy(b->debug_name, debug_name, SRSLTE_BUFFER_POOL_LOG_NAME_LEN);
+      b->debug_name[SRSLTE_BUFFER_POOL_LOG_NAME_LEN - 1] = 0;
     }
-
-    pthread_mutex_unlock(&mutex);
+#endif
     return b;
   }
 
   bool deallocate(buffer_t* b)
   {
-    bool ret = false;
-    pthread_mutex_lock(&mutex);
-    typename std::vector<buffer_t*>::iterator elem = std::find(used.begin(), used.end(), b);
-    if (elem != used.end()) {
-      used.erase(elem);
-      available.push(b);
-      ret = true;
+    uint32_t idx = index_of(b);
+    if (idx == NIL or not nodes[idx].used.exchange(false)) {
+      // not a buffer of this pool, or already deallocated
+      return false;
     }
-    pthread_cond_signal(&cv_not_empty);
-    pthread_mutex_unlock(&mutex);
-    return ret;
+
+    cache_t* c = lock_cache();
+    if (c != nullptr) {
+      uint32_t n  = c->n.load(std::memory_order_relaxed);
+      c->idx[n++] = idx;
+      if (n == 2 * batch) {
+        push_list(&c->idx[batch], batch);
+        n = batch;
+      }
+      c->n.store(n, std::memory_order_relaxed);
+      count(c->nof_dealloc);
+      unlock_cache(c);
+    } else {
+      push_list(&idx, 1);
+      nof_dealloc.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    wake_waiters();
+    return true;
   }
 
 private:
-  static const int       POOL_SIZE = 4096;
-  std::stack<buffer_t*>  available;
-  std::vector<buffer_t*> used;
-  pthread_mutex_t        mutex;
-  pthread_cond_t         cv_not_empty;
-  uint32_t               capacity;
+  static const int      POOL_SIZE  = 4096;
+  static const uint32_t NIL        = UINT32_MAX;
+  static const uint32_t MAX_CACHES = 16; ///< threads beyond it use the shared list only
+  static const uint32_t MAX_BATCH  = 16;
+
+  struct node_t {
+    buffer_t              obj;
+    std::atomic<uint32_t> next{NIL};
+    std::atomic<bool>     used{false};
+  };
+
+  // Used by the thread of its slot, or by a thread draining it while it holds busy. The others only read its counters
+  struct cache_t {
+    std::atomic<bool>     busy{false};
+    uint32_t              idx[2 * MAX_BATCH];
+    std::atomic<uint32_t> n{0};
+    std::atomic<uint64_t> nof_alloc{0};
+    std::atomic<uint64_t> nof_dealloc{0};
+  };
+
+  static uint64_t pack(uint32_t idx, uint32_t tag) { return ((uint64_t)tag << 32u) | idx; }
+  static uint32_t head_idx(uint64_t h) { return (uint32_t)h; }
+  static uint32_t head_tag(uint64_t h) { return (uint32_t)(h >> 32u); }
+  // Only the owner of a cache writes its counters
+  static void count(std::atomic<uint64_t>& c) { c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+  cache_t* get_cache()
+  {
+    if (not caches) {
+      return nullptr;
+    }
+    uint32_t slot = pool_details::get_thread_slot();
+    return slot < MAX_CACHES ? &caches[slot] : nullptr;
+  }
+
+  // The cache of the calling thread, null if it has none or another thread is draining it
+  cache_t* lock_cache()
+  {
+    cache_t* c = get_cache();
+    if (c != nullptr and c->busy.exchange(true)) {
+      return nullptr;
+    }
+    return c;
+  }
+
+  static void unlock_cache(cache_t* c) { c->busy.store(false); }
+
+  // Moves the buffers of every cache not in use to the list. Returns how many were moved
+  uint32_t drain_caches()
+  {
+    uint32_t total = 0;
+    for (uint32_t i = 0; caches and i < MAX_CACHES; i++) {
+      cache_t& c = caches[i];
+      if (c.busy.exchange(true)) {
+        continue;
+      }
+      uint32_t n = c.n.load(std::memory_order_relaxed);
+      push_list(c.idx, n);
+      c.n.store(0, std::memory_order_relaxed);
+      c.busy.store(false);
+      total += n;
+    }
+    return total;
+  }
+
+  // Hands the cached buffers over to the threads waiting in a blocking allocation
+  void wake_waiters()
+  {
+    if (nof_waiting.load() == 0) {
+      return;
+    }
+    drain_caches();
+    pthread_mutex_lock(&mutex);
+    pthread_cond_broadcast(&cv_not_empty);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  uint32_t index_of(buffer_t* b) const
+  {
+    uintptr_t first = (uintptr_t)&nodes[0].obj;
+    uintptr_t addr  = (uintptr_t)b;
+    if (addr < first or (addr - first) % sizeof(node_t) != 0) {
+      return NIL;
+    }
+    uintptr_t idx = (addr - first) / sizeof(node_t);
+    return idx < capacity ? (uint32_t)idx : NIL;
+  }
+
+  // Takes up to k buffers off the head of the list. The tag changes with every update of the head, so the nodes
+  // walked are still the first ones when the CAS succeeds
+  uint32_t pop_list(uint32_t* out, uint32_t k)
+  {
+    uint64_t h = head.load();
+    while (true) {
+      uint32_t n   = 0;
+      uint32_t cur = head_idx(h);
+      while (n < k and cur != NIL) {
+        out[n++] = cur;
+        cur      = nodes[cur].next.load(std::memory_order_relaxed);
+      }
+      if (n == 0) {
+        return 0;
+      }
+      if (head.compare_exchange_weak(h, pack(cur, head_tag(h) + 1))) {
+        return n;
+      }
+    }
+  }
+
+  void push_list(const uint32_t* in, uint32_t k)
+  {
+    if (k == 0) {
+      return;
+    }
+    for (uint32_t i = 0; i + 1 < k; i++) {
+      nodes[in[i]].next.store(in[i + 1], std::memory_order_relaxed);
+    }
+    uint64_t h = head.load();
+    do {
+      nodes[in[k - 1]].next.store(head_idx(h), std::memory_order_relaxed);
+    } while (not head.compare_exchange_weak(h, pack(in[0], head_tag(h) + 1)));
+  }
+
+  std::unique_ptr<node_t[]>  nodes;
+  std::unique_ptr<cache_t[]> caches;
+  uint32_t                   capacity = 0;
+  uint32_t                   batch    = 0;
+  std::atomic<uint64_t>      head{0};
+  uint8_t                    head_pad[64]; ///< keeps the counters off the cache line of the head
+  std::atomic<uint64_t>      nof_alloc{0};
+  std::atomic<uint64_t>      nof_dealloc{0};
+  std::atomic<uint64_t>      nof_alloc_fail{0};
+  std::atomic<uint32_t>      nof_waiting{0};
+  pthread_mutex_t            mutex;
+  pthread_cond_t             cv_not_empty;
 };
 
 class byte_buffer_pool
@@ -212,6 +429,7 @@ public:
     b = NULL;
   }
   void print_all_buffers() { pool->print_all_buffers(); }
+  void get_metrics(buffer_pool_metrics_t& m) const { pool->get_metrics(m); }
 
 private:
   srslte::log*                log;
@@ -47,6 +47,8 @@ public:
   logger_file(std::string file);
   ~logger_file();
   void init(std::string file, int max_length = -1);
+  // Scheduling of the logger thread, to be set before init()
+  void set_thread_cfg(const threads_cfg_t& cfg) { thread_cfg = cfg; }
   void stop();
   // Implementation of log_out
   void log(unique_log_str_t msg);
@@ -63,6 +65,7 @@ private:
   std::string     filename;
   pthread_cond_t  not_empty;
   pthread_mutex_t mutex;
+  threads_cfg_t   thread_cfg = {};
 
   std::deque<unique_log_str_t> buffer;
 };
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2021      Metro Group @ UCLA
+ *
+ * This file is part of Sonica.
+ *
+ * Sonica is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Sonica is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * A copy of the GNU Affero General Public License can be found in
+ * the LICENSE file in the top-level directory of this distribution
+ * and at http://www.gnu.org/licenses/.
+ *
+ */
+
+/******************************************************************************
+ *  File:         mpsc_multiqueue.h
+ *  Description:  Lock-free list of bounded queues with several producers and
+ *                a single consumer, which pops from the queues by priority.
+ *****************************************************************************/
+
+#ifndef SRSLTE_MPSC_MULTIQUEUE_H
+#define SRSLTE_MPSC_MULTIQUEUE_H
+
+#include "move_callback.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <semaphore.h>
+#include <stdint.h>
+#include <thread>
+
+namespace srslte {
+
+/**
+ * Bounded queue for several producers and one consumer, without locks. The slots are allocated once. Each one holds a
+ * sequence number, equal to pos when the producer of position pos may write it, to pos + 1 once it is written and to
+ * pos + capacity once the consumer has read it.
+ */
+template <typename myobj>
+class mpsc_queue
+{
+public:
+  explicit mpsc_queue(uint32_t capacity_) : capacity(round_up_pow2(capacity_)), slots(new slot_t[capacity])
+  {
+    for (size_t i = 0; i < capacity; ++i) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  mpsc_queue(const mpsc_queue&) = delete;
+  mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+  //! Any thread. The value is only moved from when it is pushed
+  template <typename FwdRef>
+  bool try_push(FwdRef&& value)
+  {
+    size_t  pos = tail.load(std::memory_order_relaxed);
+    slot_t* s   = nullptr;
+    while (true) {
+      s              = &slots[pos & (capacity - 1)];
+      size_t    seq  = s->seq.load(std::memory_order_acquire);
+      ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The consumer has not read this slot yet
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    s->value = std::forward<FwdRef>(value);
+    s->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  //! Consumer thread only
+  bool try_pop(myobj* value)
+  {
+    slot_t& s = slots[head & (capacity - 1)];
+    if (s.seq.load(std::memory_order_acquire) != head + 1) {
+      return false;
+    }
+    *value = std::move(s.value);
+    s.seq.store(head + capacity, std::memory_order_release);
+    head++;
+    return true;
+  }
+
+  //! Consumer thread only
+  bool empty() const { return slots[head & (capacity - 1)].seq.load(std::memory_order_acquire) != head + 1; }
+
+  size_t get_capacity() const { return capacity; }
+
+private:
+  struct slot_t {
+    std::atomic<size_t> seq{0};
+    myobj               value{};
+  };
+
+  static size_t round_up_pow2(uint32_t n)
+  {
+    size_t c = 1;
+    while (c < n) {
+      c <<= 1;
+    }
+    return c;
+  }
+
+  const size_t              capacity;
+  std::unique_ptr<slot_t[]> slots;
+  std::atomic<size_t>       tail{0};
+  uint8_t                   tail_pad[64]; ///< keeps the producers and the consumer on separate cache lines
+  size_t                    head = 0;
+};
+
+/**
+ * List of mpsc_queue served by a single consumer, which pops from the non-empty queue of highest priority, in
+ * round-robin among queues of the same priority. A producer never blocks on a lock: a push only wakes the consumer
+ * when it makes the tasks of all the queues go from none to some, and a full queue makes it yield until there is room.
+ */
+template <typename myobj>
+class mpsc_multiqueue
+{
+public:
+  static const uint32_t MAX_QUEUES = 16;
+
+  class queue_handler
+  {
+  public:
+    queue_handler() = default;
+    queue_handler(mpsc_multiqueue<myobj>* parent_, int id) : parent(parent_), queue_id(id) {}
+    template <typename FwdRef>
+    void push(FwdRef&& value)
+    {
+      parent->push(queue_id, std::forward<FwdRef>(value));
+    }
+    template <typename FwdRef>
+    bool try_push(FwdRef&& value)
+    {
+      return parent->try_push(queue_id, std::forward<FwdRef>(value));
+    }
+
+  private:
+    mpsc_multiqueue<myobj>* parent   = nullptr;
+    int                     queue_id = -1;
+  };
+
+  explicit mpsc_multiqueue(uint32_t capacity_ = 8192) : capacity(capacity_) { sem_init(&sem, 0, 0); }
+  ~mpsc_multiqueue()
+  {
+    reset();
+    sem_destroy(&sem);
+  }
+  mpsc_multiqueue(const mpsc_multiqueue&) = delete;
+  mpsc_multiqueue& operator=(const mpsc_multiqueue&) = delete;
+
+  //! Unblocks the consumer, which stops popping
+  void reset()
+  {
+    running.store(false, std::memory_order_release);
+    sem_post(&sem);
+  }
+
+  //! Higher priorities are served first. Queues are not reused once erased
+  int add_queue(int priority = 0)
+  {
+    std::lock_guard<std::mutex> lock(add_mutex);
+    uint32_t                    n = nof_queues.load(std::memory_order_relaxed);
+    if (not running.load(std::memory_order_relaxed) or n >= MAX_QUEUES) {
+      return -1;
+    }
+    queues[n].reset(new queue_t(capacity, priority));
+    nof_queues.store(n + 1, std::memory_order_release);
+    return (int)n;
+  }
+
+  int nof_queues_active() const
+  {
+    uint32_t n     = nof_queues.load(std::memory_order_acquire);
+    int      count = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      count += queues[i]->active.load(std::memory_order_relaxed) ? 1 : 0;
+    }
+    return count;
+  }
+
+  template <typename FwdRef>
+  void push(int q_idx, FwdRef&& value)
+  {
+    queue_t* q = get_queue_(q_idx);
+    if (q == nullptr) {
+      return;
+    }
+    while (not q->ring.try_push(std::forward<FwdRef>(value))) {
+      if (not running.load(std::memory_order_relaxed) or not q->active.load(std::memory_order_relaxed)) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+    notify_();
+  }
+
+  template <typename FwdRef>
+  bool try_push(int q_idx, FwdRef&& value)
+  {
+    queue_t* q = get_queue_(q_idx);
+    if (q == nullptr or not q->ring.try_push(std::forward<FwdRef>(value))) {
+      return false;
+    }
+    notify_();
+    return true;
+  }
+
+  //! Consumer thread only. Returns the queue of the popped value, or -1 once reset
+  int wait_pop(myobj* value)
+  {
+    while (running.load(std::memory_order_acquire)) {
+      int q_idx = pop_(value);
+      if (q_idx >= 0) {
+        return q_idx;
+      }
+      if (nof_pending.load(std::memory_order_acquire) > 0) {
+        // A pushed value waits behind the slot of a push still in progress
+        std::this_thread::yield();
+        continue;
+      }
+      // Any push from now on finds no pending values and posts
+      while (sem_wait(&sem) != 0 and errno == EINTR) {
+      }
+    }
+    return -1;
+  }
+
+  //! Consumer thread only
+  int try_pop(myobj* value) { return running.load(std::memory_order_acquire) ? pop_(value) : -1; }
+
+  //! Consumer thread only, the values left in the queue are dropped
+  void erase_queue(int qidx)
+  {
+    queue_t* q = get_queue_(qidx);
+    if (q != nullptr) {
+      q->active.store(false, std::memory_order_relaxed);
+      drain_(*q);
+    }
+  }
+
+  bool is_queue_active(int qidx) const { return get_queue_(qidx) != nullptr; }
+
+  queue_handler get_queue_handler(int priority = 0) { return {this, add_queue(priority)}; }
+
+private:
+  struct queue_t {
+    queue_t(uint32_t capacity, int priority_) : ring(capacity), priority(priority_) {}
+    mpsc_queue<myobj> ring;
+    const int         priority;
+    std::atomic<bool> active{true};
+  };
+
+  queue_t* get_queue_(int qidx) const
+  {
+    if (qidx < 0 or (uint32_t)qidx >= nof_queues.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    queue_t* q = queues[qidx].get();
+    return running.load(std::memory_order_relaxed) and q->active.load(std::memory_order_relaxed) ? q : nullptr;
+  }
+
+  void notify_()
+  {
+    if (nof_pending.fetch_add(1, std::memory_order_acq_rel) == 0) {
+      sem_post(&sem);
+    }
+  }
+
+  void drain_(queue_t& q)
+  {
+    myobj dropped;
+    while (q.ring.try_pop(&dropped)) {
+      nof_pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  int pop_(myobj* value)
+  {
+    uint32_t n    = nof_queues.load(std::memory_order_acquire);
+    int      best = -1;
+    for (uint32_t i = 0; i < n; ++i) {
+      uint32_t idx = (spin_idx + 1 + i) % n;
+      queue_t& q   = *queues[idx];
+      if (q.ring.empty()) {
+        continue;
+      }
+      if (not q.active.load(std::memory_order_relaxed)) {
+        // Pushed while the queue was being erased
+        drain_(q);
+        continue;
+      }
+      if (best < 0 or q.priority > queues[best]->priority) {
+        best = (int)idx;
+      }
+    }
+    if (best < 0 or not queues[best]->ring.try_pop(value)) {
+      return -1;
+    }
+    nof_pending.fetch_sub(1, std::memory_order_acq_rel);
+    spin_idx = (uint32_t)best;
+    return best;
+  }
+
+  const uint32_t                                  capacity;
+  std::array<std::unique_ptr<queue_t>, MAX_QUEUES> queues;
+  std::atomic<uint32_t>                           nof_queues{0};
+  std::atomic<bool>                               running{true};
+  std::mutex                                      add_mutex; ///< between callers of add_queue, never the consumer
+  uint32_t                                        spin_idx = 0;
+  std::atomic<int32_t>                            nof_pending{0}; ///< pushed and not popped, negative while a push ends
+  sem_t                                           sem;
+};
+
+//! Specialization for tasks
+using mpsc_task_multiqueue = mpsc_multiqueue<move_task_t>;
+
+} // namespace srslte
+
+#endif // SRSLTE_MPSC_MULTIQUEUE_H
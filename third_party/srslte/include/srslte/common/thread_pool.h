@@ -52,6 +52,7 @@ public:
     worker();
     ~worker() = default;
     void     setup(uint32_t id, thread_pool* parent, uint32_t prio = 0, uint32_t mask = 255);
+    void     setup(uint32_t id, thread_pool* parent, const threads_cfg_t& cfg, uint32_t prio = 0);
     uint32_t get_id();
     void     release();
 
@@ -69,6 +70,7 @@ public:
 
   thread_pool(uint32_t nof_workers);
   void     init_worker(uint32_t id, worker*, uint32_t prio = 0, uint32_t mask = 255);
+  void     init_worker(uint32_t id, worker*, const threads_cfg_t& cfg, uint32_t prio = 0);
   void     stop();
   worker*  wait_worker_id(uint32_t id);
   worker*  wait_worker(uint32_t tti);
@@ -101,6 +103,7 @@ public:
   explicit task_thread_pool(uint32_t nof_workers);
   ~task_thread_pool();
   void start(int32_t prio = -1, uint32_t mask = 255);
+  void start(const threads_cfg_t& cfg, int32_t prio = -1);
   void stop();
 
   void     push_task(const task_t& task);
@@ -114,6 +117,7 @@ private:
     explicit worker_t(task_thread_pool* parent_, uint32_t id);
     void     stop();
     void     setup(int32_t prio, uint32_t mask);
+    void     setup(const threads_cfg_t& cfg, int32_t prio);
     bool     is_running() const { return running; }
     uint32_t id() const { return id_; }
 
@@ -23,6 +23,8 @@
 #define SRSLTE_THREADS_H
 
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/timerfd.h>
@@ -35,10 +37,22 @@
 extern "C" {
 #endif // __cplusplus
 
+// Explicit scheduling of a thread, a zeroed configuration keeps the behaviour of the priority offset
+typedef struct {
+  bool      set_policy; // Use policy and priority instead of the ones derived from the priority offset
+  int       policy;     // SCHED_FIFO, SCHED_RR or SCHED_OTHER
+  int       priority;   // Real-time priority, only used with SCHED_FIFO and SCHED_RR
+  cpu_set_t cpus;       // Cores the thread may run on, empty to inherit the affinity of the caller
+} threads_cfg_t;
 bool threads_new_rt(pthread_t* thread, void* (*start_routine)(void*), void* arg);
 bool threads_new_rt_prio(pthread_t* thread, void* (*start_routine)(void*), void* arg, int prio_offset);
 bool threads_new_rt_cpu(pthread_t* thread, void* (*start_routine)(void*), void* arg, int cpu, int prio_offset);
 bool threads_new_rt_mask(pthread_t* thread, void* (*start_routine)(void*), void* arg, int mask, int prio_offset);
+bool threads_new_rt_cfg(pthread_t* thread,
+                        void* (*start_routine)(void*),
+                        void*                arg,
+                        const threads_cfg_t* cfg,
+                        int                  prio_offset);
 void threads_print_self();
 
 #ifdef __cplusplus
@@ -78,6 +92,12 @@ public:
     return threads_new_rt_mask(&_thread, thread_function_entry, this, mask, prio);
   }
 
+  // Uses the scheduling in cfg, falling back to prio for what it leaves unset
+  bool start_cfg(const threads_cfg_t& cfg, int prio = -1)
+  {
+    return threads_new_rt_cfg(&_thread, thread_function_entry, this, &cfg, prio);
+  }
+
   void print_priority() { threads_print_self(); }
 
   void set_name(const std::string& name_)
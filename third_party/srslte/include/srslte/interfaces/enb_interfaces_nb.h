@@ -41,16 +41,19 @@ namespace sonica_enb {
 class mac_interface_phy_nb
 {
 public:
-  const static int MAX_GRANTS = 64;
+  const static int MAX_GRANTS    = 64;
+  const static int MAX_DL_GRANTS = 4; ///< Two DCIs of one NCCE and a broadcast start in the same subframe at most
 
   /**
    * DL grant structure per UE
    */
   typedef struct {
     srslte_ra_nbiot_dl_dci_t         dci;
+    sched_interface::npdcch_alloc_t npdcch;
     uint8_t*                data[SRSLTE_MAX_TB];
     bool     has_npdcch;
     bool     is_new_sib;
+    bool     needs_ack; ///< NPDSCH is acknowledged on NPUSCH Format 2 with the resource of the DCI
     // srslte_softbuffer_tx_t* softbuffer_tx[SRSLTE_MAX_TB];
   } dl_sched_grant_t;
 
@@ -58,7 +61,7 @@ public:
    * DL Scheduling result per cell/carrier
    */
   typedef struct {
-    dl_sched_grant_t npdsch; //< DL Grants
+    dl_sched_grant_t npdsch[MAX_DL_GRANTS]; //< DL Grants
     uint32_t         nof_grants;        //< Number of DL grants
     uint32_t         cfi;               //< Current CFI of the cell, it can vary across cells
   } dl_sched_t;
@@ -81,6 +84,7 @@ public:
     uint32_t                current_tx_nb;
     uint8_t*                data;
     bool                    needs_npdcch;
+    sched_interface::npdcch_alloc_t npdcch;
     srslte_softbuffer_rx_t* softbuffer_rx;
   } ul_sched_grant_t;
 
@@ -100,7 +104,7 @@ public:
   typedef std::vector<ul_sched_t> ul_sched_list_t;
 
 //  virtual int  sr_detected(uint32_t tti, uint16_t rnti) = 0;
-  virtual void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv) = 0;
+  virtual void rach_detected(uint32_t tti, uint32_t preamble_idx, uint32_t time_adv, uint32_t ce_level) = 0;
 
   /**
    * PHY callback for for giving MAC the Channel Quality information of a given RNTI, TTI and eNb cell/carrier
@@ -113,15 +117,15 @@ public:
   // virtual int cqi_info(uint32_t tti, uint16_t rnti, uint32_t cqi_value) = 0;
 
   /**
-   * PHY callback for giving MAC the SNR in dB of an UL transmission for a given RNTI at a given carrier
+   * PHY callback for giving MAC the SNR in dB of an NPUSCH Format 1 transmission for a given RNTI
    *
-   * @param tti The measurement was made
+   * @param tti The TTI the NPUSCH started
    * @param rnti The UE identifier in the eNb
-   * @param cc_idx The eNb Cell/Carrier where the UL transmission was received
-   * @param snr_db The actual SNR of the received signal
+   * @param snr_db The SNR per RE of the received signal, averaged over its subframes
+   * @param noise_db The noise power per RE the SNR was measured against
    * @return SRSLTE_SUCCESS if no error occurs, SRSLTE_ERROR* if an error occurs
    */
-  // virtual int snr_info(uint32_t tti, uint16_t rnti, float snr_db) = 0;
+  virtual int snr_info(uint32_t tti, uint16_t rnti, float snr_db, float noise_db) = 0;
 
   /**
    * PHY callback for giving MAC the Time Aligment information in microseconds of a given RNTI during a TTI processing
@@ -134,17 +138,14 @@ public:
   // virtual int ta_info(uint32_t tti, uint16_t rnti, float ta_us) = 0;
 
   /**
-   * PHY callback for giving MAC the HARQ DL ACK/NACK feedback information for a given RNTI, TTI, eNb cell/carrier and
-   * Transport block.
+   * PHY callback for giving MAC the HARQ DL ACK/NACK feedback received on NPUSCH Format 2 for a given RNTI and TTI.
    *
-   * @param tti the given TTI
+   * @param tti the TTI the NPUSCH Format 2 started
    * @param rnti the UE identifier in the eNb
-   * @param cc_idx the eNb Cell/Carrier identifier
-   * @param tb_idx the transport block index
    * @param ack true for ACK, false for NACK, do not call for DTX
    * @return SRSLTE_SUCCESS if no error occurs, SRSLTE_ERROR* if an error occurs
    */
-  // virtual int ack_info(uint32_t tti, uint16_t rnti, uint32_t cc_idx, uint32_t tb_idx, bool ack) = 0;
+  virtual int ack_info(uint32_t tti, uint16_t rnti, bool ack) = 0;
 
   /**
    * Informs MAC about a received PUSCH transmission for given RNTI, TTI and eNb Cell/carrier.
@@ -159,7 +160,8 @@ public:
 
   // TODO
    virtual int  get_dl_sched(uint32_t hfn, uint32_t tti, dl_sched_list_t& dl_sched_res)                = 0;
-   virtual int  get_ul_sched(uint32_t hfn, uint32_t tti, ul_sched_list_t& ul_sched_res)                = 0;
+   // Fills the UL result in place, the PHY hands out the grant slot of the TTI
+   virtual int  get_ul_sched(uint32_t hfn, uint32_t tti, ul_sched_t& ul_sched_res)                     = 0;
   // virtual void set_sched_dl_tti_mask(uint8_t* tti_mask, uint32_t nof_sfs)               = 0;
 
   // Radio-Link status
@@ -456,7 +458,7 @@ typedef struct {
 
 typedef struct {
   uint32_t                      nof_prb; ///< Needed to dimension MAC softbuffers for all cells
-  // sched_interface::sched_args_t sched;
+  sched_interface::sched_args_t sched;
   int                           link_failure_nof_err;
 } mac_args_t;
 
@@ -172,6 +172,8 @@ class phy_interface_radio
 public:
   virtual void radio_overflow() = 0;
   virtual void radio_failure()  = 0;
+  virtual void radio_underflow() {}
+  virtual void radio_late() {}
 };
 
 } // namespace srslte
@@ -22,6 +22,7 @@
 #include "srslte/common/common.h"
 #include "srslte/srslte.h"
 #include <array>
+#include <string>
 #include <vector>
 
 #ifndef SRSLTE_SCHED_INTERFACE_NB_H
@@ -52,14 +53,28 @@ public:
     uint32_t period_rf;
   } cell_cfg_sib_t;
 
+  /// NPDCCH search space, TS 36.213 16.6
+  struct npdcch_ss_cfg_t {
+    uint32_t r_max;        ///< Rmax, maximum number of repetitions
+    float    g;            ///< G, the period of the search space is Rmax * G subframes
+    float    alpha_offset; ///< start of the search space within the period, as a fraction of it
+  };
+
   struct sched_args_t {
-    int      pdsch_mcs            = -1;
-    int      pdsch_max_mcs        = 28;
-    int      pusch_mcs            = -1;
-    int      pusch_max_mcs        = 28;
-    uint32_t min_nof_ctrl_symbols = 1;
-    uint32_t max_nof_ctrl_symbols = 3;
-    int      max_aggr_level       = 3;
+    int         pdsch_mcs            = -1;
+    int         pdsch_max_mcs        = 28;
+    int         pusch_mcs            = -1;
+    int         pusch_max_mcs        = 28;
+    uint32_t    min_nof_ctrl_symbols = 1;
+    uint32_t    max_nof_ctrl_symbols = 3;
+    int         max_aggr_level       = 3;
+    std::string sched_policy         = "pf"; ///< UE ordering, "rr" or "pf"
+    npdcch_ss_cfg_t npdcch_uss       = {2, 4, 0};   ///< UE-specific search space, npdcch-ConfigDedicated-NB
+    npdcch_ss_cfg_t npdcch_ra_css    = {8, 2, 0};   ///< Type-2 common search space of the first CE level
+    npdcch_ss_cfg_t npdcch_paging    = {256, 0, 0}; ///< Type-1 common search space, only Rmax applies
+    std::vector<uint32_t> ce_level_rep = {8}; ///< Rmax of the Type-2 common search space of each CE level
+    float       ul_target_bler       = 0.1;  ///< BLER the UL link adaptation converges to
+    float       ul_olla_step_db      = 1.0;  ///< Outer loop SNR offset step on a CRC error
   };
 
   struct cell_cfg_t {
@@ -145,6 +160,7 @@ public:
     std::vector<cc_cfg_t>               supported_cc_list; ///< list of UE supported CCs. First index for PCell
     ant_info_ded_t                      dl_ant_info;
     bool                                use_tbs_index_alt = false;
+    uint32_t                            ce_level          = 0; ///< NPRACH coverage enhancement level
   };
 
   typedef struct {
@@ -167,8 +183,18 @@ public:
     uint32_t        current_sf_allocation_num;
   } dl_pdu_mch_t;
 
+  /// NPDCCH candidate of a DCI. It is sent from the TTI of the result on, in the valid DL subframes until end_tti
+  struct npdcch_alloc_t {
+    srslte_dci_location_t location;
+    uint32_t              r_max;   ///< Rmax of the search space, the NPDSCH scheduling delay depends on it
+    uint32_t              nof_rep; ///< R, the number of subframes of the NPDCCH
+    uint32_t              end_tti; ///< last subframe of the NPDCCH
+  };
+
   struct dl_sched_data_t {
     srslte_ra_nbiot_dl_dci_t dci;
+    npdcch_alloc_t  npdcch;
+    uint32_t        pid;
     uint32_t        tbs[SRSLTE_MAX_TB];
     bool            mac_ce_ta;
     bool            mac_ce_rnti;
@@ -180,7 +206,9 @@ public:
     bool            needs_npdcch;
     uint32_t        current_tx_nb;
     uint32_t        tbs;
+    uint32_t        tti_tx; ///< first subframe of the NPUSCH
     srslte_nbiot_dci_ul_t dci;
+    npdcch_alloc_t  npdcch;
   } ul_sched_data_t;
 
   struct dl_sched_rar_info_t {
@@ -199,6 +227,7 @@ public:
   typedef struct {
     uint32_t             tbs;
     srslte_ra_nbiot_dl_dci_t      dci;
+    npdcch_alloc_t       npdcch;
     uint32_t             nof_grants;
     dl_sched_rar_grant_t msg3_grant[MAX_RAR_LIST];
   } dl_sched_rar_t;
@@ -276,14 +305,15 @@ public:
   virtual int dl_mac_buffer_state(uint16_t rnti, uint32_t ce_code, uint32_t nof_cmds) = 0;
 
   /* DL information */
-//  virtual int dl_ack_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t tb_idx, bool ack) = 0;
+  virtual int dl_ack_info(uint32_t tti, uint16_t rnti, bool ack)                  = 0;
   virtual int dl_rach_info(dl_sched_rar_info_t rar_info)                          = 0;
 //  virtual int dl_ri_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t ri_value)          = 0;
 //  virtual int dl_pmi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t pmi_value)        = 0;
 //  virtual int dl_cqi_info(uint32_t tti, uint16_t rnti, uint32_t enb_cc_idx, uint32_t cqi_value)        = 0;
 
   /* UL information */
-//  virtual int ul_crc_info(uint32_t tti, uint16_t rnti, bool crc)                          = 0;
+  virtual int ul_crc_info(uint32_t tti, uint16_t rnti, bool crc)                                               = 0;
+  virtual int ul_snr_info(uint32_t tti, uint16_t rnti, float snr_db)                                           = 0;
 //  virtual int ul_sr_info(uint32_t tti, uint16_t rnti)                                                          = 0;
   virtual int ul_bsr(uint16_t rnti, uint32_t lcid, uint32_t bsr, bool set_value = true)                        = 0;
   virtual int ul_wait_timer(uint16_t rnti, uint32_t wait_time, bool set_value = true)                        = 0;
@@ -39,6 +39,7 @@
 #define SRSLTE_RARNTI_END_NBIOT 0x0100
 #define SRSLTE_NBIOT_NUM_NRS_SYMS 8
 #define SRSLTE_NPDCCH_MAX_RE (SRSLTE_NRE * SRSLTE_CP_NORM_SF_NSYMB - SRSLTE_NBIOT_NUM_NRS_SYMS)
+#define SRSLTE_NPDCCH_MAX_NCCE_RE (SRSLTE_NRE * SRSLTE_CP_NORM_SF_NSYMB / 2)
 
 #define SRSLTE_NBIOT_DCI_MAX_SIZE 23
 #define SRSLTE_AL_REPETITION_USS 64 // Higher layer configured parameter al-Repetition-USS
@@ -68,6 +69,10 @@ typedef struct SRSLTE_API {
   uint32_t            nof_lte_refs;   /// number of CRS symbols per OFDM symbol
   uint32_t            num_decoded_symbols;
 
+  /// Subframe RE indices of each NCCE, NCCE0 on subcarriers 0 to 5 and NCCE1 on 6 to 11, for NPDCCH of one NCCE
+  uint32_t ncce_re[2][SRSLTE_NPDCCH_MAX_NCCE_RE];
+  uint32_t ncce_nof_re;
+
   /* buffers */
   cf_t*    ce[SRSLTE_MAX_PORTS];
   cf_t*    symbols[SRSLTE_MAX_PORTS];
@@ -44,6 +44,18 @@
 #define SRSLTE_NPDSCH_MAX_TBS_ENC (3 * SRSLTE_NPDSCH_MAX_TBS_CRC)
 #define SRSLTE_NPDSCH_MAX_NOF_SF 10
 #define SRSLTE_NPDSCH_NUM_SEQ (2 * SRSLTE_NOF_SF_X_FRAME) ///< for even and odd numbered SFNs
+#define SRSLTE_NPDSCH_SEQ_CACHE_LEN 16                    ///< sequences kept for RNTIs other than the one set
+
+/* Scrambling sequence of an RNTI for NPDSCH starting at a given SFN parity and subframe, kept by the encoder
+ * so they are not generated again for every new TB. The least recently used one is replaced.
+ */
+typedef struct {
+  srslte_sequence_t seq;
+  uint16_t          rnti;
+  uint32_t          seq_pos; ///< same index as the sequences of srslte_npdsch_set_rnti()
+  uint64_t          last_used;
+  bool              valid;
+} srslte_npdsch_seq_cache_t;
 
 /* @brief Narrowband Physical Downlink shared channel (NPDSCH)
  *
@@ -75,6 +87,9 @@ typedef struct SRSLTE_API {
   srslte_viterbi_t     decoder;
   srslte_sequence_t    seq[SRSLTE_NPDSCH_NUM_SEQ];
   srslte_crc_t         crc;
+
+  srslte_npdsch_seq_cache_t seq_cache[SRSLTE_NPDSCH_SEQ_CACHE_LEN];
+  uint64_t                  seq_cache_tick;
   srslte_convcoder_t   encoder;
 } srslte_npdsch_t;
 
@@ -96,6 +111,8 @@ SRSLTE_API int srslte_npdsch_cfg(srslte_npdsch_cfg_t*        cfg,
                                  srslte_ra_nbiot_dl_grant_t* grant,
                                  uint32_t                    sf_idx);
 
+SRSLTE_API void srslte_npdsch_cfg_next_sf(srslte_npdsch_cfg_t* cfg);
+
 SRSLTE_API int srslte_npdsch_encode(srslte_npdsch_t*        q,
                                     srslte_npdsch_cfg_t*    cfg,
                                     srslte_softbuffer_tx_t* softbuffer,
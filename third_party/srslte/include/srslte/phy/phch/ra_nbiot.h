@@ -271,6 +271,8 @@ SRSLTE_API void srslte_ra_nbiot_ul_grant_fprint(FILE* f, srslte_ra_nbiot_ul_gran
 
 SRSLTE_API int srslte_ra_n_rep_from_dci(srslte_ra_nbiot_dl_dci_t* dci);
 
+SRSLTE_API int srslte_ra_k0_from_dci(srslte_ra_nbiot_dl_dci_t* dci, uint32_t r_max);
+
 SRSLTE_API int srslte_ra_n_rep_sib1_nb(srslte_mib_nb_t* mib);
 
 SRSLTE_API int srslte_ra_nbiot_get_sib1_tbs(srslte_mib_nb_t* mib);
@@ -20,12 +20,47 @@
  */
 
 #include "srslte/common/buffer_pool.h"
+#include <mutex>
 #include <pthread.h>
 #include <stdio.h>
 #include <string>
 
 namespace srslte {
 
+namespace pool_details {
+
+// Slots of the threads which exited, taken again before new ones
+static std::mutex            slot_mutex;
+static std::vector<uint32_t> free_slots;
+static uint32_t              nof_slots = 0;
+
+struct thread_slot_t {
+  thread_slot_t()
+  {
+    std::lock_guard<std::mutex> lock(slot_mutex);
+    if (free_slots.empty()) {
+      slot = nof_slots++;
+    } else {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    }
+  }
+  ~thread_slot_t()
+  {
+    std::lock_guard<std::mutex> lock(slot_mutex);
+    free_slots.push_back(slot);
+  }
+  uint32_t slot;
+};
+
+uint32_t get_thread_slot()
+{
+  static thread_local thread_slot_t thread_slot;
+  return thread_slot.slot;
+}
+
+} // namespace pool_details
+
 byte_buffer_pool* byte_buffer_pool::instance = NULL;
 pthread_mutex_t   instance_mutex             = PTHREAD_MUTEX_INITIALIZER;
 
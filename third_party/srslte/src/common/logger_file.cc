@@ -55,7 +55,7 @@ void logger_file::init(std::string file, int max_length_)
     printf("Error: could not create log file, no messages will be logged!\n");
   }
   is_running = true;
-  start(-2);
+  start_cfg(thread_cfg, -2);
   pthread_mutex_unlock(&mutex);
 }
 
@@ -47,6 +47,14 @@ void thread_pool::worker::setup(uint32_t id, thread_pool* parent, uint32_t prio,
   }
 }
 
+void thread_pool::worker::setup(uint32_t id, thread_pool* parent, const threads_cfg_t& cfg, uint32_t prio)
+{
+  my_id     = id;
+  my_parent = parent;
+
+  start_cfg(cfg, prio);
+}
+
 void thread_pool::worker::run_thread()
 {
   set_name(std::string("WORKER") + std::to_string(my_id));
@@ -88,6 +96,19 @@ void thread_pool::init_worker(uint32_t id, worker* obj, uint32_t prio, uint32_t
   }
 }
 
+void thread_pool::init_worker(uint32_t id, worker* obj, const threads_cfg_t& cfg, uint32_t prio)
+{
+  std::lock_guard<std::mutex> lock(mutex_queue);
+  if (id < max_workers) {
+    if (id >= nof_workers) {
+      nof_workers = id + 1;
+    }
+    workers[id] = obj;
+    obj->setup(id, this, cfg, prio);
+    cvar_queue.notify_all();
+  }
+}
+
 void thread_pool::stop()
 {
   mutex_queue.lock();
@@ -275,6 +296,15 @@ void task_thread_pool::start(int32_t prio, uint32_t mask)
   }
 }
 
+void task_thread_pool::start(const threads_cfg_t& cfg, int32_t prio)
+{
+  std::lock_guard<std::mutex> lock(queue_mutex);
+  running = true;
+  for (worker_t& w : workers) {
+    w.setup(cfg, prio);
+  }
+}
+
 void task_thread_pool::stop()
 {
   std::unique_lock<std::mutex> lock(queue_mutex);
@@ -343,6 +373,12 @@ void task_thread_pool::worker_t::setup(int32_t prio, uint32_t mask)
   }
 }
 
+void task_thread_pool::worker_t::setup(const threads_cfg_t& cfg, int32_t prio)
+{
+  running = true;
+  start_cfg(cfg, prio);
+}
+
 bool task_thread_pool::worker_t::wait_task(task_t* task)
 {
   std::unique_lock<std::mutex> lock(parent->queue_mutex);
@@ -172,6 +172,91 @@ bool threads_new_rt_cpu(pthread_t* thread, void* (*start_routine)(void*), void*
   return ret;
 }
 
+// Policy and priority threads_new_rt_cpu() gives to a priority offset
+static void threads_offset_sched(int prio_offset, int* policy, int* priority)
+{
+#ifdef PER_THREAD_PRIO
+  if (prio_offset >= 0) {
+    *policy   = SCHED_FIFO;
+    *priority = sched_get_priority_max(SCHED_FIFO) - prio_offset;
+    return;
+  }
+  if (prio_offset == -1) {
+    *policy   = SCHED_FIFO;
+    *priority = sched_get_priority_max(SCHED_FIFO) - DEFAULT_PRIORITY;
+    return;
+  }
+#else
+  if (prio_offset >= 0 && prio_offset < 5) {
+    *policy   = SCHED_FIFO;
+    *priority = 50 - prio_offset;
+    return;
+  }
+#endif
+  *policy   = SCHED_OTHER;
+  *priority = 0;
+}
+
+bool threads_new_rt_cfg(pthread_t*           thread,
+                        void* (*start_routine)(void*),
+                        void*                arg,
+                        const threads_cfg_t* cfg,
+                        int                  prio_offset)
+{
+  if (cfg == NULL) {
+    return threads_new_rt_prio(thread, start_routine, arg, prio_offset);
+  }
+
+  bool               ret = false;
+  pthread_attr_t     attr;
+  struct sched_param param;
+  int                policy;
+
+  if (cfg->set_policy) {
+    policy               = cfg->policy;
+    param.sched_priority = (policy == SCHED_OTHER) ? 0 : cfg->priority;
+  } else {
+    threads_offset_sched(prio_offset, &policy, &param.sched_priority);
+  }
+
+  if (pthread_attr_init(&attr)) {
+    perror("pthread_attr_init");
+    return false;
+  }
+  if (pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED)) {
+    perror("pthread_attr_setinheritsched");
+  }
+  if (pthread_attr_setschedpolicy(&attr, policy)) {
+    perror("pthread_attr_setschedpolicy");
+  }
+  if (pthread_attr_setschedparam(&attr, &param)) {
+    perror("pthread_attr_setschedparam");
+    fprintf(stderr, "Error not enough privileges to set Scheduling priority\n");
+  }
+  if (CPU_COUNT(&cfg->cpus) > 0) {
+    if (pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cfg->cpus)) {
+      perror("pthread_attr_setaffinity_np");
+    }
+  }
+
+  int err = pthread_create(thread, &attr, start_routine, arg);
+  if (err == EPERM) {
+    // Keep the affinity, which needs no privileges, when the real-time policy is refused
+    perror("Warning: Failed to create thread with real-time priority. Creating it with normal priority");
+    param.sched_priority = 0;
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    err = pthread_create(thread, &attr, start_routine, arg);
+  }
+  if (err) {
+    perror("pthread_create");
+  } else {
+    ret = true;
+  }
+  pthread_attr_destroy(&attr);
+  return ret;
+}
+
 void threads_print_self()
 {
   pthread_t          thread;
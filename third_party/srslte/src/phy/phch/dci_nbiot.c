@@ -273,6 +273,9 @@ int dci_formatN1_pack(const srslte_ra_nbiot_dl_dci_t* data, srslte_dci_msg_t* ms
     } else {
       srslte_bit_unpack(data->alloc.harq_ack, &y, 4);
     }
+
+    // DCI subframe repetition number – 2 bits
+    srslte_bit_unpack(data->alloc.dci_sf_rep_num, &y, 2);
   }
 
   // Padding with zeros until reaching final size
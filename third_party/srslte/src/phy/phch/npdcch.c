@@ -19,6 +19,7 @@
  *
  */
 
+#include <complex.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -149,6 +150,38 @@ void srslte_npdcch_free(srslte_npdcch_t* q)
   bzero(q, sizeof(srslte_npdcch_t));
 }
 
+/** Finds the REs of each NCCE by mapping the RE indices of a subframe as a Format 1 NPDCCH, TS 36.211 10.2.5.5 */
+static int npdcch_ncce_re_init(srslte_npdcch_t* q)
+{
+  uint32_t nof_sc = q->cell.base.nof_prb * SRSLTE_NRE;
+  cf_t*    grid   = srslte_vec_cf_malloc(SRSLTE_SF_LEN_RE(q->cell.base.nof_prb, SRSLTE_CP_NORM));
+  if (grid == NULL) {
+    return SRSLTE_ERROR;
+  }
+  for (uint32_t i = 0; i < SRSLTE_SF_LEN_RE(q->cell.base.nof_prb, SRSLTE_CP_NORM); i++) {
+    grid[i] = i;
+  }
+
+  int      n              = srslte_npdcch_get(q, grid, q->symbols[0], SRSLTE_NPDCCH_FORMAT1);
+  uint32_t nof_ncce_re[2] = {};
+  for (int i = 0; i < n; i++) {
+    uint32_t idx  = (uint32_t)crealf(q->symbols[0][i]);
+    uint32_t ncce = (idx % nof_sc - q->cell.nbiot_prb * SRSLTE_NRE) < SRSLTE_NRE / 2 ? 0 : 1;
+    if (nof_ncce_re[ncce] < SRSLTE_NPDCCH_MAX_NCCE_RE) {
+      q->ncce_re[ncce][nof_ncce_re[ncce]++] = idx;
+    }
+  }
+  free(grid);
+
+  // The reference signals take as many REs from both halves of the PRB
+  if (nof_ncce_re[0] != nof_ncce_re[1] || 2 * nof_ncce_re[0] != q->ncce_bits) {
+    ERROR("NPDCCH NCCEs have %d and %d REs, expected %d\n", nof_ncce_re[0], nof_ncce_re[1], q->ncce_bits / 2);
+    return SRSLTE_ERROR;
+  }
+  q->ncce_nof_re = nof_ncce_re[0];
+  return SRSLTE_SUCCESS;
+}
+
 int srslte_npdcch_set_cell(srslte_npdcch_t* q, srslte_nbiot_cell_t cell)
 {
   int ret = SRSLTE_ERROR_INVALID_INPUTS;
@@ -187,6 +220,10 @@ int srslte_npdcch_set_cell(srslte_npdcch_t* q, srslte_nbiot_cell_t cell)
           return SRSLTE_ERROR;
         }
       }
+
+      if (npdcch_ncce_re_init(q)) {
+        return SRSLTE_ERROR;
+      }
     }
     ret = SRSLTE_SUCCESS;
   }
@@ -482,7 +519,7 @@ int srslte_npdcch_encode(srslte_npdcch_t*      q,
 
   if (q != NULL && sf_symbols != NULL && nsubframe < 10 && srslte_nbiot_dci_location_isvalid(&location)) {
     ret         = SRSLTE_ERROR;
-    uint32_t e_bits      = q->nof_cce * q->ncce_bits;
+    uint32_t e_bits      = location.L * q->ncce_bits;
     uint32_t nof_symbols = e_bits / 2;
 
     if (msg->nof_bits < SRSLTE_DCI_MAX_BITS - 16) {
@@ -513,7 +550,8 @@ int srslte_npdcch_encode(srslte_npdcch_t*      q,
       }
 #endif
 
-      srslte_scrambling_b_offset(&q->seq[nsubframe], q->e, 72 * location.ncce, e_bits);
+      // The bits of an NCCE take its place in the block of the subframe
+      srslte_scrambling_b_offset(&q->seq[nsubframe], q->e, location.ncce * q->ncce_bits, e_bits);
 
 #if DUMP_SIGNALS
       if (SRSLTE_VERBOSE_ISDEBUG()) {
@@ -546,9 +584,15 @@ int srslte_npdcch_encode(srslte_npdcch_t*      q,
       }
 #endif
 
-      // mapping to resource elements
+      // mapping to resource elements, only those of its NCCE for an NPDCCH of one NCCE
       for (int i = 0; i < q->cell.nof_ports; i++) {
-        srslte_npdcch_put(q, q->symbols[i], sf_symbols[i], SRSLTE_NPDCCH_FORMAT1);
+        if (location.L == 1) {
+          for (uint32_t k = 0; k < q->ncce_nof_re; k++) {
+            sf_symbols[i][q->ncce_re[location.ncce][k]] = q->symbols[i][k];
+          }
+        } else {
+          srslte_npdcch_put(q, q->symbols[i], sf_symbols[i], SRSLTE_NPDCCH_FORMAT1);
+        }
       }
 
       ret = SRSLTE_SUCCESS;
@@ -288,6 +288,9 @@ void srslte_npdsch_free(srslte_npdsch_t* q)
   for (uint32_t i = 0; i < SRSLTE_NPDSCH_NUM_SEQ; i++) {
     srslte_sequence_free(&q->seq[i]);
   }
+  for (uint32_t i = 0; i < SRSLTE_NPDSCH_SEQ_CACHE_LEN; i++) {
+    srslte_sequence_free(&q->seq_cache[i].seq);
+  }
 
   srslte_modem_table_free(&q->mod);
   srslte_viterbi_free(&q->decoder);
@@ -301,6 +304,11 @@ int srslte_npdsch_set_cell(srslte_npdsch_t* q, srslte_nbiot_cell_t cell)
   if (q != NULL && srslte_nbiot_cell_isvalid(&cell)) {
     q->cell = cell;
 
+    // The sequences depend on the cell ID
+    for (uint32_t i = 0; i < SRSLTE_NPDSCH_SEQ_CACHE_LEN; i++) {
+      q->seq_cache[i].valid = false;
+    }
+
     INFO("NPDSCH: Cell config n_id_ncell=%d, %d ports, %d PRBs base cell, max_symbols: %d\n",
          q->cell.n_id_ncell,
          q->cell.nof_ports,
@@ -560,6 +568,47 @@ int srslte_npdsch_encode(srslte_npdsch_t*        q,
   }
 }
 
+/* Returns the scrambling sequence of an RNTI for a NPDSCH starting at start_sfn/start_sfidx. Sequences are
+ * generated for the maximum length, like srslte_npdsch_set_rnti() does, so a cached one fits any grant.
+ */
+static srslte_sequence_t*
+npdsch_seq_cache_get(srslte_npdsch_t* q, uint16_t rnti, uint32_t start_sfn, uint32_t start_sfidx)
+{
+  uint32_t                   seq_pos = ((start_sfn % 2) * SRSLTE_NOF_SF_X_FRAME) + start_sfidx;
+  srslte_npdsch_seq_cache_t* lru     = &q->seq_cache[0];
+
+  q->seq_cache_tick++;
+  for (uint32_t i = 0; i < SRSLTE_NPDSCH_SEQ_CACHE_LEN; i++) {
+    srslte_npdsch_seq_cache_t* e = &q->seq_cache[i];
+    if (e->valid && e->rnti == rnti && e->seq_pos == seq_pos) {
+      e->last_used = q->seq_cache_tick;
+      return &e->seq;
+    }
+    if (!e->valid || (lru->valid && e->last_used < lru->last_used)) {
+      lru = e;
+    }
+  }
+
+  // srslte_sequence_npdsch() resets the object, release the buffers of the evicted sequence first
+  srslte_sequence_free(&lru->seq);
+  lru->valid = false;
+  if (srslte_sequence_npdsch(&lru->seq,
+                             rnti,
+                             0,
+                             start_sfn,
+                             2 * start_sfidx,
+                             q->cell.n_id_ncell,
+                             q->max_re * srslte_mod_bits_x_symbol(SRSLTE_MOD_QPSK))) {
+    return NULL;
+  }
+  lru->rnti      = rnti;
+  lru->seq_pos   = seq_pos;
+  lru->last_used = q->seq_cache_tick;
+  lru->valid     = true;
+
+  return &lru->seq;
+}
+
 /** Converts the PDSCH data bits to symbols mapped to the slot ready for transmission
  */
 int srslte_npdsch_encode_rnti(srslte_npdsch_t*        q,
@@ -569,28 +618,32 @@ int srslte_npdsch_encode_rnti(srslte_npdsch_t*        q,
                               uint16_t                rnti,
                               cf_t*                   sf_symbols[SRSLTE_MAX_PORTS])
 {
+  if (q == NULL || cfg == NULL) {
+    return SRSLTE_ERROR_INVALID_INPUTS;
+  }
+
+  // The symbols of an encoded TB are only mapped again, the scrambling sequence is not used
+  if (cfg->is_encoded) {
+    return srslte_npdsch_encode_seq(q, cfg, softbuffer, data, NULL, sf_symbols);
+  }
+
   if (rnti != q->rnti) {
-    // TODO: skip sequence init if cfg->is_encoded==true
-    srslte_sequence_t seq;
     if (q->cell.is_r14 && rnti == SRSLTE_SIRNTI) {
+      // Depends on the SFN modulo 61, not worth caching
+      srslte_sequence_t seq;
       if (srslte_sequence_npdsch_bcch_r14(
               &seq, cfg->grant.start_sfn, q->cell.n_id_ncell, cfg->grant.nof_sf * cfg->nbits.nof_bits)) {
         return SRSLTE_ERROR;
       }
-    } else {
-      if (srslte_sequence_npdsch(&seq,
-                                 rnti,
-                                 0,
-                                 cfg->grant.start_sfn,
-                                 2 * cfg->grant.start_sfidx,
-                                 q->cell.n_id_ncell,
-                                 cfg->nbits.nof_bits * cfg->grant.nof_sf)) {
-        return SRSLTE_ERROR;
-      }
+      int r = srslte_npdsch_encode_seq(q, cfg, softbuffer, data, &seq, sf_symbols);
+      srslte_sequence_free(&seq);
+      return r;
     }
-    int r = srslte_npdsch_encode_seq(q, cfg, softbuffer, data, &seq, sf_symbols);
-    srslte_sequence_free(&seq);
-    return r;
+    srslte_sequence_t* seq = npdsch_seq_cache_get(q, rnti, cfg->grant.start_sfn, cfg->grant.start_sfidx);
+    if (seq == NULL) {
+      return SRSLTE_ERROR;
+    }
+    return srslte_npdsch_encode_seq(q, cfg, softbuffer, data, seq, sf_symbols);
   } else {
     int seq_pos = ((cfg->grant.start_sfn % 2) * SRSLTE_NOF_SF_X_FRAME) + cfg->grant.start_sfidx;
     return srslte_npdsch_encode_seq(q, cfg, softbuffer, data, &q->seq[seq_pos], sf_symbols);
@@ -730,35 +783,42 @@ int srslte_npdsch_encode_seq(srslte_npdsch_t*        q,
       for (int i = 0; i < q->cell.nof_ports; i++) {
         srslte_npdsch_put(q, &q->tx_syms[i][cfg->sf_idx * cfg->nbits.nof_re], sf_symbols[i], &cfg->grant);
       }
-      cfg->num_sf++;
-
-      // Decide whether we retransmit the same SF or the next
-      if (cfg->has_bcch) {
-        // NPDSCH with BCCH is always transmitted in sequence
-        cfg->sf_idx++;
-        if (cfg->sf_idx == cfg->grant.nof_sf) {
-          cfg->rep_idx++;
-        }
-      } else {
-        // NPDSCH without BCCH transmits up to 3 repetitions after another
-        cfg->rep_idx++;
-        int m = SRSLTE_MIN(cfg->grant.nof_rep, 4);
-        if (cfg->rep_idx % m == 0) {
-          cfg->sf_idx++;
-          // start with first SF again after all have been tx'ed m-times
-          if (cfg->sf_idx == cfg->grant.nof_sf) {
-            cfg->sf_idx = 0;
-          } else {
-            cfg->rep_idx -= m;
-          }
-        }
-      }
+      srslte_npdsch_cfg_next_sf(cfg);
     }
     ret = SRSLTE_SUCCESS;
   }
   return ret;
 }
 
+/* Moves cfg on to the next subframe of the NPDSCH, as done by the encoder once a subframe is mapped.
+ */
+void srslte_npdsch_cfg_next_sf(srslte_npdsch_cfg_t* cfg)
+{
+  cfg->num_sf++;
+
+  // Decide whether we retransmit the same SF or the next
+  if (cfg->has_bcch) {
+    // NPDSCH with BCCH is always transmitted in sequence
+    cfg->sf_idx++;
+    if (cfg->sf_idx == cfg->grant.nof_sf) {
+      cfg->rep_idx++;
+    }
+  } else {
+    // NPDSCH without BCCH transmits up to 3 repetitions after another
+    cfg->rep_idx++;
+    int m = SRSLTE_MIN(cfg->grant.nof_rep, 4);
+    if (cfg->rep_idx % m == 0) {
+      cfg->sf_idx++;
+      // start with first SF again after all have been tx'ed m-times
+      if (cfg->sf_idx == cfg->grant.nof_sf) {
+        cfg->sf_idx = 0;
+      } else {
+        cfg->rep_idx -= m;
+      }
+    }
+  }
+}
+
 /* Configures the structure srslte_npdsch_cfg_t from a DL grant.
  * If grant is NULL, the grant is assumed to be already stored in cfg->grant
  */
@@ -418,6 +418,7 @@ int srslte_ra_nbiot_ul_rar_dci_to_grant(srslte_ra_nbiot_ul_dci_t*   dci,
 }
 
 /// Fill a grant for NPUSCH without UL-SCH data but for UL control information
+/// tti is the last subframe of the NPDSCH, the NPUSCH starts k0 subframes later (TS 36.213 Sec. 16.4.2)
 void srslte_ra_nbiot_ul_get_uci_grant(srslte_ra_nbiot_ul_grant_t* grant,
                                       const uint8_t               resource_field,
                                       const uint32_t              tti)
@@ -435,7 +436,7 @@ void srslte_ra_nbiot_ul_get_uci_grant(srslte_ra_nbiot_ul_grant_t* grant,
   grant->Qm              = 1;
   grant->nof_ru          = 1;
   grant->nof_slots       = 4;
-  grant->nof_rep         = 0; // TODO: set appropiatly
+  grant->nof_rep         = 1; // ack-NACK-NumRepetitions, callers override the default
   grant->rv_idx          = 0;
 }
 
@@ -452,8 +453,15 @@ int srslte_ra_nbiot_ul_dci_to_grant(srslte_ra_nbiot_ul_dci_t*   dci,
   int      tbs   = -1;
   uint32_t i_tbs = 0;
 
-  /// calculate actual values
-  if (dci->i_sc <= 11) {
+  /// calculate actual values, 3.75 kHz only supports single-tone on any of the 48 subcarriers
+  if (spacing == SRSLTE_NPUSCH_SC_SPACING_3750) {
+    if (dci->i_sc > 47) {
+      printf("UL i_sc > 47 invalid for 3.75 kHz!\n");
+      return SRSLTE_ERROR;
+    }
+    grant->sc_alloc_set[0] = dci->i_sc;
+    grant->nof_sc          = 1;
+  } else if (dci->i_sc <= 11) {
     /// the value of i_sc
     grant->sc_alloc_set[0] = dci->i_sc;
     grant->nof_sc          = 1;
@@ -472,10 +480,6 @@ int srslte_ra_nbiot_ul_dci_to_grant(srslte_ra_nbiot_ul_dci_t*   dci,
   }
   grant->nof_ru  = n_ru_table_npusch[dci->i_ru];
   grant->nof_rep = n_rep_table_npusch[dci->i_rep];
-  if (grant->nof_rep != 1) {
-    printf("NPUSCH repetitions are currently not supported!\n");
-    return SRSLTE_ERROR;
-  }
 
   /// Compute number of slots according to Table Table 10.1.2.3-1 in 36.211
   switch (grant->format) {
@@ -515,9 +519,7 @@ int srslte_ra_nbiot_ul_dci_to_grant(srslte_ra_nbiot_ul_dci_t*   dci,
 
   /// Redundency version according to TS 36 212 Section 6.3.2
   /// And TS 36 213 Sec. 16.5.1.2
-  /// TODO: implement NPUSCH repetitions
-  /// int L = (grant->nof_sc == 1) ? 1 : min(4, grant->nof_rep/2);
-  /// int B = L * grant->nof_ru * grant->nof_slots;
+  /// This is the RV of the first block of repetitions, the following blocks alternate with rv_idx + 2
   int j         = 0;
   grant->rv_idx = 2 * ((dci->i_rv + j) % 2);
 
@@ -638,18 +638,28 @@ void radio::handle_rf_msg(srslte_rf_error_t error)
     log_h->info("Overflow\n");
 
     // inform PHY about overflow
-    phy->radio_overflow();
+    if (phy) {
+      phy->radio_overflow();
+    }
   } else if (error.type == srslte_rf_error_t::SRSLTE_RF_ERROR_UNDERFLOW) {
     rf_metrics.rf_u++;
     rf_metrics.rf_error = true;
     log_h->info("Underflow\n");
+    if (phy) {
+      phy->radio_underflow();
+    }
   } else if (error.type == srslte_rf_error_t::SRSLTE_RF_ERROR_LATE) {
     rf_metrics.rf_l++;
     rf_metrics.rf_error = true;
     log_h->info("Late (detected in %s)\n", error.opt ? "rx call" : "asynchronous thread");
+    if (phy) {
+      phy->radio_late();
+    }
   } else if (error.type == srslte_rf_error_t::SRSLTE_RF_ERROR_RX) {
     log_h->error("Fatal radio error occured.\n");
-    phy->radio_failure();
+    if (phy) {
+      phy->radio_failure();
+    }
   } else if (error.type == srslte_rf_error_t::SRSLTE_RF_ERROR_OTHER) {
     std::string str(error.msg);
     str.erase(std::remove(str.begin(), str.end(), '\n'), str.end());